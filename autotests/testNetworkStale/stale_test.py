@@ -0,0 +1,106 @@
+#!/usr/bin/python3
+
+import unittest
+import sys
+import time
+
+sys.path.append('../util')
+import iwd
+from iwd import IWD
+from iwd import IWD_NETWORK_INTERFACE
+
+from hostapd import HostapdCLI
+from hwsim import Hwsim
+
+class Test(unittest.TestCase):
+    def interfaces_added(self, path, interfaces):
+        if IWD_NETWORK_INTERFACE in interfaces:
+            self.added += 1
+
+    def interfaces_removed(self, path, interfaces):
+        if IWD_NETWORK_INTERFACE in interfaces:
+            self.removed += 1
+
+    def scan(self, device):
+        device.scan()
+
+        condition = 'obj.scanning'
+        self.wd.wait_for_object_condition(device, condition)
+        condition = 'not obj.scanning'
+        self.wd.wait_for_object_condition(device, condition)
+
+    def visible(self, device):
+        names = [n.name for n in device.get_ordered_networks(False) or []]
+
+        return 'ssidFlap' in names
+
+    def test_flapping_network(self):
+        hwsim = Hwsim()
+        hapd = HostapdCLI(config='ssidFlap.conf')
+        radio = hwsim.get_radio('rad0')
+
+        rule = hwsim.rules.create()
+        rule.source = radio.addresses[0]
+        rule.bidirectional = True
+        rule.drop = True
+        rule.enabled = False
+
+        self.added = 0
+        self.removed = 0
+
+        self.wd = IWD(True)
+        self.wd._object_manager.connect_to_signal("InterfacesAdded",
+                                                  self.interfaces_added)
+        self.wd._object_manager.connect_to_signal("InterfacesRemoved",
+                                                  self.interfaces_removed)
+
+        devices = self.wd.list_devices(1)
+        device = devices[0]
+
+        device.get_ordered_network('ssidFlap', full_scan=True)
+        IWD.wait(1)
+        self.assertEqual(self.added, 1)
+
+        # Each time the AP goes silent for longer than the BSS retention
+        # time two scans miss it, which used to remove the network object
+        for i in range(2):
+            rule.enabled = True
+            IWD.wait(31)
+
+            self.scan(device)
+            self.assertFalse(self.visible(device))
+            self.scan(device)
+
+            rule.enabled = False
+            self.scan(device)
+            self.assertTrue(self.visible(device))
+
+        IWD.wait(1)
+        print('Network objects added: %u removed: %u over 2 flaps' %
+                (self.added, self.removed))
+
+        self.assertEqual(self.added, 1)
+        self.assertEqual(self.removed, 0)
+
+        # Missing from three scans of its channel, the network goes away
+        rule.enabled = True
+        IWD.wait(31)
+
+        for i in range(3):
+            self.scan(device)
+
+        IWD.wait(1)
+        self.assertEqual(self.removed, 1)
+
+        rule.remove()
+
+    @classmethod
+    def setUpClass(cls):
+        pass
+
+    @classmethod
+    def tearDownClass(cls):
+        IWD.clear_storage()
+
+if __name__ == '__main__':
+    unittest.main(exit=True)
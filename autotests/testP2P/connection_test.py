@@ -123,6 +123,13 @@ class Test(unittest.TestCase):
         testutil.test_iface_operstate(peer.connected_interface)
         testutil.test_ifaces_connected(peer.connected_interface, peer_ifname)
 
+        if not go:
+            # The lease is short enough to be renewed here, make sure lease
+            # updates don't tear down the P2P client connection
+            time.sleep(5)
+            self.assertEqual(peer.connected, True)
+            testutil.test_ip_address_match(peer.connected_interface, '192.168.1.30')
+
         peer.disconnect()
         if not go:
             wd.wait_for_object_condition(wpas, 'len(obj.p2p_clients) == 0', max_wait=3)
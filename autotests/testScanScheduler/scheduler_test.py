@@ -0,0 +1,90 @@
+#!/usr/bin/python3
+
+import unittest
+import sys
+import time
+
+sys.path.append('../util')
+import iwd
+from iwd import IWD
+from iwd import DeviceState
+
+from hostapd import HostapdCLI
+from hwsim import Hwsim
+
+class Test(unittest.TestCase):
+    def measure_scanning(self, device, duration):
+        # Periodic scans toggle the Scanning property, sample it to estimate
+        # the share of time the radio spends scanning
+        scanning = 0.0
+        start = time.time()
+        last = start
+
+        while time.time() - start < duration:
+            IWD.wait(0.1)
+            now = time.time()
+
+            if device.scanning:
+                scanning += now - last
+
+            last = now
+
+        return scanning / (time.time() - start)
+
+    def test_reconnect_time(self):
+        hwsim = Hwsim()
+        hapd = HostapdCLI(config='ssidKnown.conf')
+        radio = hwsim.get_radio('rad0')
+
+        rule = hwsim.rules.create()
+        rule.source = radio.addresses[0]
+        rule.bidirectional = True
+        rule.drop = True
+        rule.enabled = False
+
+        wd = IWD(True)
+
+        devices = wd.list_devices(1)
+        device = devices[0]
+
+        # Connect once so that the network's frequency becomes known
+        condition = 'obj.state == DeviceState.connected'
+        wd.wait_for_object_condition(device, condition)
+
+        # Take the AP away and let the periodic scans run
+        rule.enabled = True
+        hapd.deauthenticate(device.address)
+
+        condition = 'obj.state == DeviceState.disconnected'
+        wd.wait_for_object_condition(device, condition)
+
+        airtime = self.measure_scanning(device, 40)
+        print('Share of time spent scanning: %.1f%%' % (airtime * 100))
+
+        # The scans should mostly target the known channel and back off
+        self.assertLess(airtime, 0.5)
+
+        rule.enabled = False
+        start = time.time()
+
+        condition = 'obj.state == DeviceState.connected'
+        wd.wait_for_object_condition(device, condition, max_wait=60)
+
+        time_to_connect = time.time() - start
+        print('Time to connect: %.1fs' % time_to_connect)
+
+        # Bounded by MaximumPeriodicScanInterval plus the scan itself
+        self.assertLess(time_to_connect, 30)
+
+        device.disconnect()
+
+    @classmethod
+    def setUpClass(cls):
+        IWD.copy_to_storage('ssidKnown.open')
+
+    @classmethod
+    def tearDownClass(cls):
+        IWD.clear_storage()
+
+if __name__ == '__main__':
+    unittest.main(exit=True)
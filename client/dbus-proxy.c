@@ -44,9 +44,16 @@ struct proxy_interface {
 
 static struct l_dbus *dbus;
 
-static struct l_queue *proxy_interfaces;
 static struct l_queue *proxy_interface_types;
 
+/*
+ * Proxies are indexed by (path, interface type) and kept in a list per
+ * interface type, so lookups don't scale with the number of objects the
+ * daemon exports.
+ */
+static struct l_hashmap *proxy_index;
+static struct l_hashmap *proxy_buckets;
+
 void proxy_properties_display(const struct proxy_interface *proxy,
 				const char *caption, const char *margin,
 				int name_column_width, int value_column_width)
@@ -403,47 +410,73 @@ static bool interface_match_by_type_name(const void *a, const void *b)
 	return !strcmp(type->interface, interface);
 }
 
+static struct proxy_interface_type *proxy_interface_type_find(
+							const char *interface)
+{
+	return l_queue_find(proxy_interface_types,
+				interface_match_by_type_name, interface);
+}
+
+static unsigned int proxy_index_hash(const void *p)
+{
+	const struct proxy_interface *proxy = p;
+
+	return l_str_hash(proxy->path) * 31 + L_PTR_TO_UINT(proxy->type);
+}
+
+static int proxy_index_compare(const void *a, const void *b)
+{
+	const struct proxy_interface *proxy_a = a;
+	const struct proxy_interface *proxy_b = b;
+
+	if (proxy_a->type != proxy_b->type)
+		return proxy_a->type < proxy_b->type ? -1 : 1;
+
+	return strcmp(proxy_a->path, proxy_b->path);
+}
+
+static struct l_queue *proxy_bucket_get(
+				const struct proxy_interface_type *type)
+{
+	return l_hashmap_lookup(proxy_buckets, type);
+}
+
 struct proxy_interface *proxy_interface_find(const char *interface,
 							const char *path)
 {
-	const struct l_queue_entry *entry;
+	struct proxy_interface key;
 
 	if (!interface || !path)
 		return NULL;
 
-	for (entry = l_queue_get_entries(proxy_interfaces); entry;
-							entry = entry->next) {
-		struct proxy_interface *proxy = entry->data;
-
-		if (strcmp(proxy->path, path))
-			continue;
-
-		if (strcmp(proxy->type->interface, interface))
-			continue;
+	key.type = proxy_interface_type_find(interface);
+	if (!key.type)
+		return NULL;
 
-		return proxy;
-	}
+	key.path = (char *) path;
 
-	return NULL;
+	return l_hashmap_lookup(proxy_index, &key);
 }
 
 struct l_queue *proxy_interface_find_all(const char *interface,
 					proxy_property_match_func_t function,
 					const void *value)
 {
+	const struct proxy_interface_type *type;
 	const struct l_queue_entry *entry;
 	struct l_queue *match = NULL;
 
 	if (!interface)
 		return NULL;
 
-	for (entry = l_queue_get_entries(proxy_interfaces); entry;
+	type = proxy_interface_type_find(interface);
+	if (!type)
+		return NULL;
+
+	for (entry = l_queue_get_entries(proxy_bucket_get(type)); entry;
 							entry = entry->next) {
 		struct proxy_interface *proxy = entry->data;
 
-		if (!interface_match_by_type_name(proxy->type, interface))
-			continue;
-
 		if (function && !function(proxy->data, value))
 			continue;
 
@@ -525,9 +558,7 @@ static void proxy_interfaces_update_properties(const char *path,
 
 	while (l_dbus_message_iter_next_entry(interfaces, &interface,
 								&properties)) {
-		interface_type = l_queue_find(proxy_interface_types,
-						interface_match_by_type_name,
-						interface);
+		interface_type = proxy_interface_type_find(interface);
 		if (!interface_type)
 			continue;
 
@@ -539,6 +570,33 @@ static void proxy_interfaces_update_properties(const char *path,
 	}
 }
 
+static struct proxy_interface *proxy_interface_new(
+				const struct proxy_interface_type *type,
+				const char *path)
+{
+	struct proxy_interface *proxy;
+	struct l_queue *bucket;
+
+	proxy = l_new(struct proxy_interface, 1);
+	proxy->path = l_strdup(path);
+	proxy->type = type;
+
+	l_hashmap_insert(proxy_index, proxy, proxy);
+
+	bucket = proxy_bucket_get(type);
+	if (!bucket) {
+		bucket = l_queue_new();
+		l_hashmap_insert(proxy_buckets, type, bucket);
+	}
+
+	l_queue_push_tail(bucket, proxy);
+
+	if (type->ops && type->ops->create)
+		proxy->data = type->ops->create();
+
+	return proxy;
+}
+
 static void proxy_interface_create(const char *path,
 					struct l_dbus_message_iter *interfaces)
 {
@@ -552,9 +610,7 @@ static void proxy_interface_create(const char *path,
 
 	while (l_dbus_message_iter_next_entry(interfaces, &interface,
 								&properties)) {
-		interface_type = l_queue_find(proxy_interface_types,
-						interface_match_by_type_name,
-						interface);
+		interface_type = proxy_interface_type_find(interface);
 
 		if (!interface_type) {
 			if (!is_ignorable(interface))
@@ -569,14 +625,7 @@ static void proxy_interface_create(const char *path,
 		if (proxy)
 			continue;
 
-		proxy = l_new(struct proxy_interface, 1);
-		proxy->path = l_strdup(path);
-		proxy->type = interface_type;
-
-		l_queue_push_tail(proxy_interfaces, proxy);
-
-		if (interface_type->ops && interface_type->ops->create)
-			proxy->data = interface_type->ops->create();
+		proxy_interface_new(interface_type, path);
 	}
 }
 
@@ -594,6 +643,37 @@ static void proxy_interface_destroy(void *data)
 	l_free(proxy);
 }
 
+static void proxy_interface_remove(struct proxy_interface *proxy)
+{
+	l_hashmap_remove(proxy_index, proxy);
+	l_queue_remove(proxy_bucket_get(proxy->type), proxy);
+
+	proxy_interface_destroy(proxy);
+}
+
+static void proxy_bucket_destroy(void *data)
+{
+	l_queue_destroy(data, proxy_interface_destroy);
+}
+
+static void proxy_registry_init(void)
+{
+	proxy_index = l_hashmap_new();
+	l_hashmap_set_hash_function(proxy_index, proxy_index_hash);
+	l_hashmap_set_compare_function(proxy_index, proxy_index_compare);
+
+	proxy_buckets = l_hashmap_new();
+}
+
+static void proxy_registry_clear(void)
+{
+	l_hashmap_destroy(proxy_index, NULL);
+	proxy_index = NULL;
+
+	l_hashmap_destroy(proxy_buckets, proxy_bucket_destroy);
+	proxy_buckets = NULL;
+}
+
 bool proxy_interface_method_call(const struct proxy_interface *proxy,
 					const char *name, const char *signature,
 					l_dbus_message_func_t callback, ...)
@@ -648,15 +728,17 @@ const char *proxy_interface_get_identity_str(
 
 void proxy_interface_display_list(const char *interface)
 {
+	const struct proxy_interface_type *type;
 	const struct l_queue_entry *entry;
 
-	for (entry = l_queue_get_entries(proxy_interfaces); entry;
+	type = proxy_interface_type_find(interface);
+	if (!type)
+		return;
+
+	for (entry = l_queue_get_entries(proxy_bucket_get(type)); entry;
 							entry = entry->next) {
 		const struct proxy_interface *proxy = entry->data;
 
-		if (!interface_match_by_type_name(proxy->type, interface))
-			continue;
-
 		if (!proxy->type->ops || !proxy->type->ops->display)
 			break;
 
@@ -706,9 +788,7 @@ static void interfaces_removed_callback(struct l_dbus_message *message,
 		if (!proxy)
 			continue;
 
-		l_queue_remove(proxy_interfaces, proxy);
-
-		proxy_interface_destroy(proxy);
+		proxy_interface_remove(proxy);
 	}
 }
 
@@ -797,7 +877,8 @@ static void service_disappeared_callback(struct l_dbus *dbus,
 		l_main_quit();
 	}
 
-	l_queue_clear(proxy_interfaces, proxy_interface_destroy);
+	proxy_registry_clear();
+	proxy_registry_init();
 
 	command_reset_default_entities();
 
@@ -829,6 +910,37 @@ struct l_dbus *dbus_get_bus(void)
 	return dbus;
 }
 
+void __proxy_registry_init(void)
+{
+	proxy_interface_types = l_queue_new();
+	proxy_registry_init();
+}
+
+void __proxy_registry_exit(void)
+{
+	proxy_registry_clear();
+
+	l_queue_destroy(proxy_interface_types, NULL);
+	proxy_interface_types = NULL;
+}
+
+struct proxy_interface *__proxy_interface_add(const char *interface,
+							const char *path)
+{
+	const struct proxy_interface_type *type;
+
+	type = proxy_interface_type_find(interface);
+	if (!type || proxy_interface_find(interface, path))
+		return NULL;
+
+	return proxy_interface_new(type, path);
+}
+
+void __proxy_interface_remove(struct proxy_interface *proxy)
+{
+	proxy_interface_remove(proxy);
+}
+
 extern struct interface_type_desc __start___interface[];
 extern struct interface_type_desc __stop___interface[];
 
@@ -844,7 +956,7 @@ bool dbus_proxy_init(void)
 		return false;
 
 	proxy_interface_types = l_queue_new();
-	proxy_interfaces = l_queue_new();
+	proxy_registry_init();
 
 	for (desc = __start___interface; desc < __stop___interface; desc++) {
 		if (!desc->init)
@@ -883,8 +995,7 @@ bool dbus_proxy_exit(void)
 	l_queue_destroy(proxy_interface_types, NULL);
 	proxy_interface_types = NULL;
 
-	l_queue_destroy(proxy_interfaces, proxy_interface_destroy);
-	proxy_interfaces = NULL;
+	proxy_registry_clear();
 
 	l_dbus_destroy(dbus);
 	dbus = NULL;
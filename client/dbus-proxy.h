@@ -129,3 +129,9 @@ struct interface_type_desc {
 
 bool dbus_proxy_init(void);
 bool dbus_proxy_exit(void);
+
+void __proxy_registry_init(void);
+void __proxy_registry_exit(void);
+struct proxy_interface *__proxy_interface_add(const char *interface,
+							const char *path);
+void __proxy_interface_remove(struct proxy_interface *proxy);
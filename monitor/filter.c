@@ -0,0 +1,415 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/filter.h>
+#include <ell/ell.h>
+
+#ifndef ARPHRD_NETLINK
+#define ARPHRD_NETLINK	824
+#endif
+
+#include "linux/nl80211.h"
+
+#include "ell/useful.h"
+#include "src/nl80211cmd.h"
+#include "monitor/filter.h"
+
+/*
+ * Offsets into a captured netlink message.  The nlmon device has no
+ * link layer header, so the packet starts with the nlmsghdr.
+ */
+#define NLMSG_TYPE_OFFSET	4
+#define GENL_CMD_OFFSET		NLMSG_HDRLEN
+#define GENL_ATTR_OFFSET	(NLMSG_HDRLEN + GENL_HDRLEN)
+
+struct capture_filter {
+	uint8_t cmds[32];
+	bool has_cmds;
+	uint16_t family;
+	uint32_t ifindex;
+	bool pae;
+	bool nortnl;
+};
+
+enum bpf_label {
+	LABEL_PASS,
+	LABEL_DROP,
+	LABEL_IFINDEX,
+	__LABEL_MAX,
+};
+
+struct bpf_fixup {
+	unsigned int insn;
+	enum bpf_label label;
+};
+
+struct bpf_prog {
+	struct sock_filter insns[BPF_MAXINSNS];
+	unsigned int len;
+	struct bpf_fixup fixups[BPF_MAXINSNS];
+	unsigned int num_fixups;
+	unsigned int labels[__LABEL_MAX];
+	bool overflow;
+};
+
+static void bpf_emit(struct bpf_prog *prog, uint16_t code,
+					uint8_t jt, uint8_t jf, uint32_t k)
+{
+	if (prog->len == BPF_MAXINSNS) {
+		prog->overflow = true;
+		return;
+	}
+
+	prog->insns[prog->len++] = (struct sock_filter) BPF_JUMP(code, k,
+									jt, jf);
+}
+
+static void bpf_stmt(struct bpf_prog *prog, uint16_t code, uint32_t k)
+{
+	bpf_emit(prog, code, 0, 0, k);
+}
+
+/*
+ * The 8 bit conditional jump offsets can't reach across large command
+ * sets, so every jump to a label goes through an unconditional jump
+ * with a 32 bit offset that is resolved once the program is complete.
+ */
+static void bpf_jump(struct bpf_prog *prog, enum bpf_label label)
+{
+	if (prog->num_fixups == BPF_MAXINSNS) {
+		prog->overflow = true;
+		return;
+	}
+
+	prog->fixups[prog->num_fixups].insn = prog->len;
+	prog->fixups[prog->num_fixups].label = label;
+	prog->num_fixups++;
+
+	bpf_stmt(prog, BPF_JMP | BPF_JA, 0);
+}
+
+static void bpf_jump_if(struct bpf_prog *prog, uint32_t k,
+						enum bpf_label label)
+{
+	bpf_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, k);
+	bpf_jump(prog, label);
+}
+
+static void bpf_jump_unless(struct bpf_prog *prog, uint32_t k,
+						enum bpf_label label)
+{
+	bpf_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, k);
+	bpf_jump(prog, label);
+}
+
+static void bpf_label(struct bpf_prog *prog, enum bpf_label label)
+{
+	prog->labels[label] = prog->len;
+}
+
+static bool bpf_attach(struct bpf_prog *prog, int fd)
+{
+	struct sock_fprog fprog;
+	unsigned int i;
+
+	bpf_label(prog, LABEL_PASS);
+	bpf_stmt(prog, BPF_RET | BPF_K, 0xffffffff);
+	bpf_label(prog, LABEL_DROP);
+	bpf_stmt(prog, BPF_RET | BPF_K, 0);
+
+	if (prog->overflow) {
+		fprintf(stderr, "Capture filter too large\n");
+		return false;
+	}
+
+	for (i = 0; i < prog->num_fixups; i++) {
+		const struct bpf_fixup *fixup = &prog->fixups[i];
+
+		prog->insns[fixup->insn].k =
+				prog->labels[fixup->label] - fixup->insn - 1;
+	}
+
+	fprog.len = prog->len;
+	fprog.filter = prog->insns;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
+					&fprog, sizeof(fprog)) < 0) {
+		perror("Failed to attach capture filter");
+		return false;
+	}
+
+	return true;
+}
+
+static struct bpf_prog *bpf_prog_new(void)
+{
+	return l_new(struct bpf_prog, 1);
+}
+
+/*
+ * Netlink messages are stored in host byte order, while packet loads
+ * return network byte order.
+ */
+static void bpf_load_nl_u16(struct bpf_prog *prog, uint32_t offset)
+{
+	bpf_stmt(prog, BPF_LD | BPF_H | BPF_ABS, offset);
+}
+
+bool capture_filter_attach_netlink(const struct capture_filter *filter,
+						uint16_t id, int fd)
+{
+	struct bpf_prog *prog;
+	uint16_t family = filter->family ? filter->family : id;
+	unsigned int cmd;
+	bool r;
+
+	prog = bpf_prog_new();
+
+	bpf_stmt(prog, BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_HATYPE);
+	bpf_jump_unless(prog, ARPHRD_NETLINK, LABEL_DROP);
+
+	bpf_stmt(prog, BPF_LD | BPF_H | BPF_ABS,
+					SKF_AD_OFF + SKF_AD_PROTOCOL);
+	if (!filter->nortnl && !filter->has_cmds)
+		bpf_jump_if(prog, NETLINK_ROUTE, LABEL_PASS);
+	bpf_jump_unless(prog, NETLINK_GENERIC, LABEL_DROP);
+
+	/*
+	 * Family announcements and acknowledgements are always needed to
+	 * track the family and to complete requests.
+	 */
+	bpf_load_nl_u16(prog, NLMSG_TYPE_OFFSET);
+	bpf_jump_if(prog, htons(GENL_ID_CTRL), LABEL_PASS);
+	bpf_jump_if(prog, htons(NLMSG_ERROR), LABEL_PASS);
+	bpf_jump_if(prog, htons(NLMSG_DONE), LABEL_PASS);
+
+	if (family)
+		bpf_jump_unless(prog, htons(family), LABEL_DROP);
+
+	if (filter->has_cmds) {
+		bpf_stmt(prog, BPF_LD | BPF_B | BPF_ABS, GENL_CMD_OFFSET);
+
+		for (cmd = 0; cmd < 256; cmd++) {
+			if (test_bit(filter->cmds, cmd))
+				bpf_jump_if(prog, cmd, LABEL_IFINDEX);
+		}
+
+		bpf_jump(prog, LABEL_DROP);
+	}
+
+	bpf_label(prog, LABEL_IFINDEX);
+
+	if (filter->ifindex) {
+		/* A = offset of NL80211_ATTR_IFINDEX or 0 if not present */
+		bpf_stmt(prog, BPF_LDX | BPF_W | BPF_IMM, GENL_ATTR_OFFSET);
+		bpf_stmt(prog, BPF_LD | BPF_W | BPF_IMM, NL80211_ATTR_IFINDEX);
+		bpf_stmt(prog, BPF_LD | BPF_W | BPF_ABS,
+					SKF_AD_OFF + SKF_AD_NLATTR);
+		bpf_jump_if(prog, 0, LABEL_DROP);
+		bpf_stmt(prog, BPF_MISC | BPF_TAX, 0);
+		bpf_stmt(prog, BPF_LD | BPF_W | BPF_IND, NLA_HDRLEN);
+		bpf_jump_unless(prog, htonl(filter->ifindex), LABEL_DROP);
+	}
+
+	bpf_jump(prog, LABEL_PASS);
+
+	r = bpf_attach(prog, fd);
+	l_free(prog);
+
+	return r;
+}
+
+bool capture_filter_attach_pae(const struct capture_filter *filter, int fd)
+{
+	struct bpf_prog *prog;
+	bool r;
+
+	prog = bpf_prog_new();
+
+	/* Selecting nl80211 commands without EAPoL leaves nothing to see */
+	if (filter->has_cmds && !filter->pae) {
+		bpf_jump(prog, LABEL_DROP);
+		goto done;
+	}
+
+	bpf_stmt(prog, BPF_LD | BPF_H | BPF_ABS, SKF_AD_OFF + SKF_AD_HATYPE);
+	bpf_jump_unless(prog, ARPHRD_ETHER, LABEL_DROP);
+
+	bpf_stmt(prog, BPF_LD | BPF_H | BPF_ABS,
+					SKF_AD_OFF + SKF_AD_PROTOCOL);
+	bpf_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, 2, 0, ETH_P_PAE);
+	bpf_emit(prog, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, ETH_P_PREAUTH);
+	bpf_jump(prog, LABEL_DROP);
+
+	if (filter->ifindex) {
+		bpf_stmt(prog, BPF_LD | BPF_W | BPF_ABS,
+					SKF_AD_OFF + SKF_AD_IFINDEX);
+		bpf_jump_unless(prog, filter->ifindex, LABEL_DROP);
+	}
+
+	bpf_jump(prog, LABEL_PASS);
+
+done:
+	r = bpf_attach(prog, fd);
+	l_free(prog);
+
+	return r;
+}
+
+static bool cmd_name_match(const char *name, const char *str)
+{
+	for (; *name && *str; name++, str++) {
+		char c = *str;
+
+		if (c == '-' || c == '_')
+			c = ' ';
+
+		if (tolower(*name) != tolower(c))
+			return false;
+	}
+
+	return !*name && !*str;
+}
+
+/*
+ * Commands can be given by number or by the name iwmon displays, with
+ * dashes or underscores in place of spaces.
+ */
+int capture_filter_parse_cmd(const char *str)
+{
+	char *end;
+	unsigned long cmd;
+	unsigned int i;
+
+	cmd = strtoul(str, &end, 0);
+	if (end != str && *end == '\0')
+		return cmd <= 255 ? (int) cmd : -1;
+
+	for (i = 0; i <= 255; i++) {
+		const char *name = nl80211cmd_to_string(i);
+
+		if (name && cmd_name_match(name, str))
+			return i;
+	}
+
+	return -1;
+}
+
+static bool parse_term(struct capture_filter *filter, const char *term)
+{
+	const char *value = strchr(term, '=');
+	unsigned long val;
+	char *end;
+	int cmd;
+
+	if (!value) {
+		if (!strcmp(term, "pae")) {
+			filter->pae = true;
+			filter->has_cmds = true;
+			set_bit(filter->cmds, NL80211_CMD_CONTROL_PORT_FRAME);
+			return true;
+		}
+
+		if (!strcmp(term, "nortnl")) {
+			filter->nortnl = true;
+			return true;
+		}
+
+		return false;
+	}
+
+	value++;
+
+	if (!strncmp(term, "cmd=", 4)) {
+		cmd = capture_filter_parse_cmd(value);
+		if (cmd < 0)
+			return false;
+
+		filter->has_cmds = true;
+		set_bit(filter->cmds, cmd);
+		return true;
+	}
+
+	val = strtoul(value, &end, 0);
+	if (end == value || *end != '\0' || !val)
+		return false;
+
+	if (!strncmp(term, "ifindex=", 8)) {
+		filter->ifindex = val;
+		return true;
+	}
+
+	if (!strncmp(term, "family=", 7) && val <= UINT16_MAX) {
+		filter->family = val;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * A filter expression is a comma separated list of terms:
+ *
+ *	cmd=<command>	Only nl80211 messages with one of the given commands
+ *	ifindex=<index>	Only messages for the given interface
+ *	family=<id>	Generic netlink family instead of nl80211
+ *	pae		Only EAPoL, including nl80211 control port frames
+ *	nortnl		No RTNL messages
+ */
+struct capture_filter *capture_filter_parse(const char *expr)
+{
+	struct capture_filter *filter = l_new(struct capture_filter, 1);
+	char **terms = l_strsplit(expr, ',');
+	unsigned int i;
+
+	for (i = 0; terms[i]; i++) {
+		if (!parse_term(filter, terms[i])) {
+			fprintf(stderr, "Invalid filter term: %s\n", terms[i]);
+			l_strfreev(terms);
+			l_free(filter);
+			return NULL;
+		}
+	}
+
+	l_strfreev(terms);
+
+	return filter;
+}
+
+void capture_filter_free(struct capture_filter *filter)
+{
+	l_free(filter);
+}
@@ -32,6 +32,10 @@
 #include <string.h>
 #include <getopt.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <sys/wait.h>
 #include <sys/socket.h>
 #include <linux/genetlink.h>
 #include <linux/rtnetlink.h>
@@ -46,9 +50,14 @@
 #include "monitor/nlmon.h"
 #include "monitor/pcap.h"
 #include "monitor/display.h"
+#include "monitor/filter.h"
 
 #define MAX_SNAPLEN (1024 * 16)
 
+#define DEFAULT_RING_BLOCK_SIZE (1024 * 1024)
+
+#define MIN_CHUNK_SIZE (1024 * 1024)
+
 static struct nlmon *nlmon = NULL;
 static const char *writer_path = NULL;
 static struct l_timeout *timeout = NULL;
@@ -569,6 +578,68 @@ done:
 	return exit_status;
 }
 
+static unsigned int process_packet(struct nlmon *nlmon,
+					const struct timeval *tv,
+					const uint8_t *buf, uint32_t len,
+					uint32_t real_len)
+{
+	const struct nlmsghdr *nlmsg;
+	uint32_t aligned_len;
+	unsigned int msg_count = 0;
+	uint16_t arphrd_type;
+	uint16_t proto_type;
+	uint16_t pkt_type;
+
+	if (len < 16) {
+		printf("Too short packet\n");
+		return 0;
+	}
+
+	if (len < real_len) {
+		printf("Packet truncated from %u\n", real_len);
+		return 0;
+	}
+
+	pkt_type = l_get_be16(buf);
+	arphrd_type = l_get_be16(buf + 2);
+	proto_type = l_get_be16(buf + 14);
+
+	switch (arphrd_type) {
+	case ARPHRD_ETHER:
+		switch (proto_type) {
+		case ETH_P_PAE:
+			nlmon_print_pae(nlmon, tv, pkt_type, -1,
+						buf + 16, len - 16);
+			msg_count++;
+			break;
+		}
+		break;
+	case ARPHRD_NETLINK:
+		switch (proto_type) {
+		case NETLINK_ROUTE:
+			nlmon_print_rtnl(nlmon, tv, buf + 16, len - 16);
+			break;
+		case NETLINK_GENERIC:
+			nlmon_print_genl(nlmon, tv, buf + 16, len - 16);
+			break;
+		default:
+			return 0;
+		}
+
+		aligned_len = NLMSG_ALIGN(len - 16);
+
+		for (nlmsg = (void *) buf + 16; NLMSG_OK(nlmsg, aligned_len);
+				nlmsg = NLMSG_NEXT(nlmsg, aligned_len))
+			msg_count++;
+		break;
+	default:
+		printf("Unsupported ARPHRD %u\n", arphrd_type);
+		break;
+	}
+
+	return msg_count;
+}
+
 static int process_pcap(struct pcap *pcap, uint16_t id)
 {
 	struct nlmon *nlmon = NULL;
@@ -588,57 +659,421 @@ static int process_pcap(struct pcap *pcap, uint16_t id)
 
 	nlmon = nlmon_create(id);
 
-	while (pcap_read(pcap, &tv, buf, snaplen, &len, &real_len)) {
-		uint16_t arphrd_type;
-		uint16_t proto_type;
-		uint16_t pkt_type;
+	while (pcap_read(pcap, &tv, buf, snaplen, &len, &real_len))
+		process_packet(nlmon, &tv, buf, len, real_len);
 
-		if (len < 16) {
-			printf("Too short packet\n");
+	nlmon_destroy(nlmon);
+
+	free(buf);
+
+	return EXIT_SUCCESS;
+}
+
+struct decode_job {
+	pid_t pid;
+	FILE *out;
+};
+
+/*
+ * A chunk starts at a record boundary and ends with the first record
+ * that crosses chunk_size bytes.  Both the decoding worker and the state
+ * tracking in the parent use this same rule.
+ */
+static size_t decode_chunk(struct pcap *pcap, struct nlmon *nlmon,
+					size_t offset, size_t chunk_size,
+					bool print)
+{
+	size_t end = offset + chunk_size;
+	struct timeval tv;
+	const void *data;
+	uint32_t len, real_len;
+
+	while (offset < end && pcap_read_at(pcap, &offset, &tv, &data, &len,
+								&real_len)) {
+		if (print) {
+			process_packet(nlmon, &tv, data, len, real_len);
 			continue;
 		}
 
-		if (len < real_len) {
-			printf("Packet truncated from %u\n", real_len);
-			continue;
+		if (len >= 16 && l_get_be16(data + 2) == ARPHRD_NETLINK &&
+				l_get_be16(data + 14) == NETLINK_GENERIC)
+			nlmon_track_genl(nlmon, &tv, data + 16, len - 16);
+		else
+			/* Still updates the time reference of the capture */
+			nlmon_track_genl(nlmon, &tv, NULL, 0);
+	}
+
+	return offset;
+}
+
+static bool start_job(struct decode_job *job, struct pcap *pcap,
+					struct nlmon *nlmon,
+					size_t offset, size_t chunk_size)
+{
+	job->out = tmpfile();
+	if (!job->out) {
+		perror("Failed to create chunk buffer");
+		return false;
+	}
+
+	/* Make sure buffered output is not duplicated into the worker */
+	fflush(stdout);
+
+	job->pid = fork();
+	if (job->pid < 0) {
+		perror("Failed to fork decoder");
+		fclose(job->out);
+		return false;
+	}
+
+	if (job->pid == 0) {
+		dup2(fileno(job->out), STDOUT_FILENO);
+		decode_chunk(pcap, nlmon, offset, chunk_size, true);
+		fflush(stdout);
+		_exit(EXIT_SUCCESS);
+	}
+
+	return true;
+}
+
+static bool finish_job(struct decode_job *job)
+{
+	char buf[16384];
+	size_t len;
+	int status;
+
+	while (waitpid(job->pid, &status, 0) < 0) {
+		if (errno != EINTR)
+			break;
+	}
+
+	rewind(job->out);
+
+	while ((len = fread(buf, 1, sizeof(buf), job->out)) > 0)
+		fwrite(buf, 1, len, stdout);
+
+	fclose(job->out);
+	job->out = NULL;
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/*
+ * Decode a mapped capture on a pool of worker processes.  The parent
+ * walks the records once, only tracking netlink requests, and forks a
+ * worker at each chunk boundary.  Every worker therefore starts with the
+ * request list of all preceding chunks, so responses can be matched to
+ * requests across chunk boundaries.  The per-chunk output is buffered
+ * and emitted in the original order.
+ */
+static int process_pcap_parallel(struct pcap *pcap, uint16_t id,
+							unsigned int jobs)
+{
+	struct decode_job *pool;
+	struct nlmon *nlmon;
+	size_t size, offset = 0, chunk_size;
+	unsigned int head = 0, count = 0;
+	int exit_status = EXIT_SUCCESS;
+
+	if (!pcap_map(pcap, &size))
+		return EXIT_FAILURE;
+
+	chunk_size = size / (jobs * 8);
+	if (chunk_size < MIN_CHUNK_SIZE)
+		chunk_size = MIN_CHUNK_SIZE;
+
+	/* Settle output properties before stdout is redirected */
+	use_color();
+	num_columns();
+
+	pool = l_new(struct decode_job, jobs);
+	nlmon = nlmon_create(id);
+
+	while (offset < size) {
+		struct decode_job *job;
+		size_t next;
+
+		if (count == jobs) {
+			if (!finish_job(&pool[head]))
+				exit_status = EXIT_FAILURE;
+
+			head = (head + 1) % jobs;
+			count--;
 		}
 
-		pkt_type = l_get_be16(buf);
-		arphrd_type = l_get_be16(buf + 2);
-		proto_type = l_get_be16(buf + 14);
+		job = &pool[(head + count) % jobs];
 
-		switch (arphrd_type) {
-		case ARPHRD_ETHER:
-			switch (proto_type) {
-			case ETH_P_PAE:
-				nlmon_print_pae(nlmon, &tv, pkt_type, -1,
-							buf + 16, len - 16);
-				break;
-			}
+		if (!start_job(job, pcap, nlmon, offset, chunk_size)) {
+			exit_status = EXIT_FAILURE;
 			break;
-		case ARPHRD_NETLINK:
-			switch (proto_type) {
-			case NETLINK_ROUTE:
-				nlmon_print_rtnl(nlmon, &tv,
-							buf + 16, len - 16);
-				break;
-			case NETLINK_GENERIC:
-				nlmon_print_genl(nlmon, &tv,
-							buf + 16, len - 16);
-				break;
-			}
+		}
+
+		count++;
+
+		next = decode_chunk(pcap, nlmon, offset, chunk_size, false);
+		if (next == offset)
 			break;
-		default:
-			printf("Unsupported ARPHRD %u\n", arphrd_type);
+
+		offset = next;
+	}
+
+	while (count) {
+		if (!finish_job(&pool[head]))
+			exit_status = EXIT_FAILURE;
+
+		head = (head + 1) % jobs;
+		count--;
+	}
+
+	nlmon_destroy(nlmon);
+	l_free(pool);
+
+	return exit_status;
+}
+
+struct index_filter {
+	bool since_set;
+	bool until_set;
+	struct timeval since;
+	struct timeval until;
+	int cmd;
+	uint32_t ifindex;
+	uint64_t wdev;
+	bool pae;
+};
+
+static bool index_filter_match(const struct index_filter *filter,
+					const struct pcap_index_entry *entry)
+{
+	if (filter->ifindex && entry->ifindex != filter->ifindex)
+		return false;
+
+	if (filter->wdev && entry->wdev != filter->wdev)
+		return false;
+
+	/* Command and PAE selections are combined */
+	if (filter->cmd < 0 && !filter->pae)
+		return true;
+
+	if (filter->cmd >= 0 && (entry->flags & PCAP_INDEX_FLAG_NL80211) &&
+						entry->cmd == filter->cmd)
+		return true;
+
+	if (filter->pae && (entry->flags & PCAP_INDEX_FLAG_PAE))
+		return true;
+
+	return false;
+}
+
+static bool timeval_after(const struct timeval *a, const struct timeval *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec > b->tv_sec;
+
+	return a->tv_usec > b->tv_usec;
+}
+
+/*
+ * Decode only the records selected by the filter, using the index to
+ * seek straight to them.  Other nl80211 records within the time window
+ * still update the request tracking so responses are shown correctly,
+ * and generic netlink family announcements are always replayed so the
+ * nl80211 family is known even when they were filtered or skipped.
+ */
+static int process_pcap_indexed(struct pcap *pcap, const char *pathname,
+					uint16_t id,
+					const struct index_filter *filter,
+					bool write_index)
+{
+	const struct pcap_index_entry *entry;
+	struct pcap_index *index;
+	struct nlmon *nlmon;
+	struct timeval tv, since, until;
+	char *index_path;
+	size_t pos, count;
+
+	if (!pcap_map(pcap, NULL))
+		return EXIT_FAILURE;
+
+	index_path = l_strdup_printf("%s.idx", pathname);
+
+	index = pcap_index_load(pcap, index_path);
+	if (!index) {
+		index = nlmon_build_index(pcap, id);
+
+		if (write_index)
+			pcap_index_save(index, pcap, index_path);
+	}
+
+	l_free(index_path);
+
+	count = pcap_index_get_count(index);
+	if (!count) {
+		pcap_index_free(index);
+		return EXIT_SUCCESS;
+	}
+
+	nlmon = nlmon_create(id);
+
+	/* Keep timestamps relative to the start of the whole capture */
+	entry = pcap_index_get(index, 0);
+	tv.tv_sec = entry->ts_sec;
+	tv.tv_usec = entry->ts_usec;
+	nlmon_track_genl(nlmon, &tv, NULL, 0);
+
+	since = filter->since;
+	since.tv_sec += entry->ts_sec;
+	until = filter->until;
+	until.tv_sec += entry->ts_sec;
+
+	pos = filter->since_set ? pcap_index_find(index, &since) : 0;
+
+	nlmon_replay_genl_ctrl(nlmon, pcap, index, pos);
+
+	for (; pos < count; pos++) {
+		size_t offset;
+		const uint8_t *data;
+		uint32_t len, real_len;
+
+		entry = pcap_index_get(index, pos);
+
+		tv.tv_sec = entry->ts_sec;
+		tv.tv_usec = entry->ts_usec;
+
+		if (filter->until_set && timeval_after(&tv, &until))
 			break;
-		}
+
+		if (!index_filter_match(filter, entry) &&
+				!(entry->flags & (PCAP_INDEX_FLAG_NL80211 |
+						PCAP_INDEX_FLAG_GENL_CTRL)))
+			continue;
+
+		offset = entry->offset;
+
+		if (!pcap_read_at(pcap, &offset, &tv, (const void **) &data,
+								&len, &real_len))
+			break;
+
+		if (index_filter_match(filter, entry))
+			process_packet(nlmon, &tv, data, len, real_len);
+		else if (len >= 16)
+			nlmon_track_genl(nlmon, &tv, data + 16, len - 16);
 	}
 
+	nlmon_destroy(nlmon);
+	pcap_index_free(index);
+
+	return EXIT_SUCCESS;
+}
+
+static bool parse_time(const char *str, struct timeval *tv)
+{
+	char *end;
+	double secs;
+
+	secs = strtod(str, &end);
+	if (end == str || *end != '\0' || secs < 0)
+		return false;
+
+	tv->tv_sec = (time_t) secs;
+	tv->tv_usec = (suseconds_t) ((secs - tv->tv_sec) * 1000000);
+
+	return true;
+}
+
+static int benchmark_pcap(const char *pathname, uint16_t id)
+{
+	struct nlmon *nlmon;
+	struct pcap *pcap;
+	struct timeval tv;
+	uint8_t *buf;
+	uint32_t snaplen, len, real_len;
+	uint64_t start_time, elapsed;
+	unsigned long pkt_count = 0;
+	unsigned long msg_count = 0;
+	int stdout_fd, null_fd;
+	int exit_status;
+
+	pcap = pcap_open(pathname);
+	if (!pcap)
+		return EXIT_FAILURE;
+
+	if (pcap_get_type(pcap) != PCAP_TYPE_LINUX_SLL) {
+		fprintf(stderr, "Invalid packet format\n");
+		exit_status = EXIT_FAILURE;
+		goto done;
+	}
+
+	snaplen = pcap_get_snaplen(pcap);
+	if (snaplen > MAX_SNAPLEN)
+		snaplen = MAX_SNAPLEN;
+
+	buf = malloc(snaplen);
+	if (!buf) {
+		fprintf(stderr, "Failed to allocate packet buffer\n");
+		exit_status = EXIT_FAILURE;
+		goto done;
+	}
+
+	/*
+	 * Run the regular decoders, but send their output to /dev/null so
+	 * that only the decoding cost itself is measured.
+	 */
+	null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (null_fd < 0) {
+		perror("Failed to open /dev/null");
+		free(buf);
+		exit_status = EXIT_FAILURE;
+		goto done;
+	}
+
+	fflush(stdout);
+	stdout_fd = dup(STDOUT_FILENO);
+	dup2(null_fd, STDOUT_FILENO);
+	close(null_fd);
+
+	nlmon = nlmon_create(id);
+
+	start_time = l_time_now();
+
+	while (pcap_read(pcap, &tv, buf, snaplen, &len, &real_len)) {
+		msg_count += process_packet(nlmon, &tv, buf, len, real_len);
+		pkt_count++;
+	}
+
+	fflush(stdout);
+	elapsed = l_time_diff(start_time, l_time_now());
+
 	nlmon_destroy(nlmon);
 
+	dup2(stdout_fd, STDOUT_FILENO);
+	close(stdout_fd);
+
 	free(buf);
 
-	return EXIT_SUCCESS;
+	if (!elapsed)
+		elapsed = 1;
+
+	printf("\n");
+	printf("   Benchmarked file: %s\n", pathname);
+	printf("\n");
+	printf("  Number of packets: %lu\n", pkt_count);
+	printf(" Number of messages: %lu\n", msg_count);
+	printf("        Decode time: %" PRIu64 ".%06" PRIu64 " seconds\n",
+				(uint64_t) (elapsed / L_USEC_PER_SEC),
+				(uint64_t) (elapsed % L_USEC_PER_SEC));
+	printf("        Packets/sec: %" PRIu64 "\n",
+			(uint64_t) (pkt_count * L_USEC_PER_SEC / elapsed));
+	printf("       Messages/sec: %" PRIu64 "\n",
+			(uint64_t) (msg_count * L_USEC_PER_SEC / elapsed));
+	printf("\n");
+
+	exit_status = EXIT_SUCCESS;
+
+done:
+	pcap_close(pcap);
+
+	return exit_status;
 }
 
 static void main_loop_quit(struct l_timeout *timeout, void *user_data)
@@ -667,24 +1102,88 @@ static void usage(void)
 		"\t-r, --read <file>      Read netlink PCAP trace file\n"
 		"\t-w, --write <file>     Write netlink PCAP trace file\n"
 		"\t-a, --analyze <file>   Analyze netlink PCAP trace file\n"
+		"\t-j, --jobs <num>       Decode PCAP trace file in parallel,\n"
+		"\t                       up to the number of online CPUs\n"
+		"\t-B, --benchmark <file> Measure decoding speed of PCAP file\n"
 		"\t-i, --interface <dev>  Use specified netlink monitor\n"
+		"\t-f, --filter <expr>    Capture only selected messages\n"
+		"\t-R, --ring <count>     Use capture ring of <count> blocks\n"
+		"\t-b, --ring-block-size <bytes>\n"
+		"\t                       Size of each capture ring block\n"
 		"\t-n, --nortnl           Don't show RTNL output\n"
 		"\t-y, --nowiphy          Don't show 'New Wiphy' output\n"
 		"\t-s, --noscan           Don't show scan result output\n"
 		"\t-e, --noies            Don't show IEs except SSID\n"
+		"\t--index                Write index of PCAP trace file\n"
+		"\t--since <secs>         Show records from <secs> into trace\n"
+		"\t--until <secs>         Show records up to <secs>\n"
+		"\t--cmd <cmd>            Show nl80211 command name or number\n"
+		"\t--ifindex <index>      Show records for interface index\n"
+		"\t--wdev <wdev>          Show records for wireless device\n"
+		"\t--pae                  Show EAPoL records\n"
 		"\t-h, --help             Show help options\n");
 }
 
+enum {
+	OPT_INDEX = 256,
+	OPT_SINCE,
+	OPT_UNTIL,
+	OPT_CMD,
+	OPT_IFINDEX,
+	OPT_WDEV,
+	OPT_PAE,
+};
+
+/* Accepts 1 up to the number of online CPUs */
+static bool parse_jobs(const char *str, unsigned int *out_jobs)
+{
+	long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long jobs;
+	char *endp;
+
+	if (max_jobs < 1)
+		max_jobs = 1;
+
+	if (!isdigit(str[0]))
+		return false;
+
+	errno = 0;
+	jobs = strtoul(str, &endp, 10);
+	if (errno || *endp != '\0' || jobs == 0)
+		return false;
+
+	if (jobs > (unsigned long) max_jobs) {
+		fprintf(stderr, "Number of jobs must be between 1 and %ld\n",
+				max_jobs);
+		return false;
+	}
+
+	*out_jobs = jobs;
+	return true;
+}
+
 static const struct option main_options[] = {
 	{ "read",      required_argument, NULL, 'r' },
 	{ "write",     required_argument, NULL, 'w' },
 	{ "analyze",   required_argument, NULL, 'a' },
+	{ "jobs",      required_argument, NULL, 'j' },
+	{ "benchmark", required_argument, NULL, 'B' },
 	{ "nl80211",   required_argument, NULL, 'F' },
 	{ "interface", required_argument, NULL, 'i' },
+	{ "filter",    required_argument, NULL, 'f' },
+	{ "ring",      required_argument, NULL, 'R' },
+	{ "ring-block-size", required_argument, NULL, 'b' },
 	{ "nortnl",    no_argument,       NULL, 'n' },
 	{ "nowiphy",   no_argument,       NULL, 'y' },
 	{ "noscan",    no_argument,       NULL, 's' },
 	{ "noies",     no_argument,       NULL, 'e' },
+	{ "index",     no_argument,       NULL, OPT_INDEX },
+	{ "since",     required_argument, NULL, OPT_SINCE },
+	{ "until",     required_argument, NULL, OPT_UNTIL },
+	{ "cmd",       required_argument, NULL, OPT_CMD },
+	{ "ifindex",   required_argument, NULL, OPT_IFINDEX },
+	{ "wdev",      required_argument, NULL, OPT_WDEV },
+	{ "pae",       no_argument,       NULL, OPT_PAE },
 	{ "version",   no_argument,       NULL, 'v' },
 	{ "help",      no_argument,       NULL, 'h' },
 	{ }
@@ -694,6 +1193,11 @@ int main(int argc, char *argv[])
 {
 	const char *reader_path = NULL;
 	const char *analyze_path = NULL;
+	const char *benchmark_path = NULL;
+	unsigned int jobs = 1;
+	struct index_filter filter = { .cmd = -1 };
+	bool use_index = false;
+	bool write_index = false;
 	const char *ifname = NULL;
 	uint16_t nl80211_family = 0;
 	int exit_status;
@@ -701,7 +1205,7 @@ int main(int argc, char *argv[])
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "r:w:a:F:i:nvhyse",
+		opt = getopt_long(argc, argv, "r:w:a:j:B:F:i:f:R:b:nvhyse",
 						main_options, NULL);
 		if (opt < 0)
 			break;
@@ -716,6 +1220,15 @@ int main(int argc, char *argv[])
 		case 'a':
 			analyze_path = optarg;
 			break;
+		case 'j':
+			if (!parse_jobs(optarg, &jobs)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'B':
+			benchmark_path = optarg;
+			break;
 		case 'F':
 			if (strlen(optarg) > 3) {
 				if (!strncasecmp(optarg, "0x", 2) &&
@@ -739,6 +1252,29 @@ int main(int argc, char *argv[])
 		case 'i':
 			ifname = optarg;
 			break;
+		case 'f':
+			capture_filter_free(config.filter);
+			config.filter = capture_filter_parse(optarg);
+			if (!config.filter)
+				return EXIT_FAILURE;
+			break;
+		case 'R':
+			config.ring_block_count = strtoul(optarg, NULL, 10);
+			if (config.ring_block_count == 0) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'b':
+			config.ring_block_size = strtoul(optarg, NULL, 0);
+			if (config.ring_block_size == 0 ||
+					config.ring_block_size %
+						sysconf(_SC_PAGESIZE)) {
+				fprintf(stderr, "Ring block size must be a "
+						"multiple of the page size\n");
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'n':
 			config.nortnl = true;
 			break;
@@ -751,6 +1287,54 @@ int main(int argc, char *argv[])
 		case 'e':
 			config.noies = true;
 			break;
+		case OPT_INDEX:
+			write_index = true;
+			use_index = true;
+			break;
+		case OPT_SINCE:
+			if (!parse_time(optarg, &filter.since)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			filter.since_set = true;
+			use_index = true;
+			break;
+		case OPT_UNTIL:
+			if (!parse_time(optarg, &filter.until)) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			filter.until_set = true;
+			use_index = true;
+			break;
+		case OPT_CMD:
+			filter.cmd = capture_filter_parse_cmd(optarg);
+			if (filter.cmd < 0) {
+				fprintf(stderr, "Unknown command %s\n", optarg);
+				return EXIT_FAILURE;
+			}
+			use_index = true;
+			break;
+		case OPT_IFINDEX:
+			filter.ifindex = strtoul(optarg, NULL, 10);
+			if (!filter.ifindex) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			use_index = true;
+			break;
+		case OPT_WDEV:
+			filter.wdev = strtoull(optarg, NULL, 0);
+			if (!filter.wdev) {
+				usage();
+				return EXIT_FAILURE;
+			}
+			use_index = true;
+			break;
+		case OPT_PAE:
+			filter.pae = true;
+			use_index = true;
+			break;
 		case 'v':
 			printf("%s\n", VERSION);
 			return EXIT_SUCCESS;
@@ -772,6 +1356,20 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (use_index && !reader_path) {
+		fprintf(stderr, "Index and filters require a trace file\n");
+		return EXIT_FAILURE;
+	}
+
+	if (config.ring_block_count && !config.ring_block_size)
+		config.ring_block_size = DEFAULT_RING_BLOCK_SIZE;
+
+	if (benchmark_path && (reader_path || analyze_path)) {
+		fprintf(stderr, "Benchmark can't be combined with "
+					"display or analyze\n");
+		return EXIT_FAILURE;
+	}
+
 	if (!l_main_init())
 		return EXIT_FAILURE;
 
@@ -782,6 +1380,11 @@ int main(int argc, char *argv[])
 		goto done;
 	}
 
+	if (benchmark_path) {
+		exit_status = benchmark_pcap(benchmark_path, nl80211_family);
+		goto done;
+	}
+
 	if (reader_path) {
 		struct pcap *pcap;
 
@@ -796,7 +1399,14 @@ int main(int argc, char *argv[])
 		if (pcap_get_type(pcap) != PCAP_TYPE_LINUX_SLL) {
 			fprintf(stderr, "Invalid packet format\n");
 			exit_status = EXIT_FAILURE;
-		} else
+		} else if (use_index)
+			exit_status = process_pcap_indexed(pcap, reader_path,
+							nl80211_family,
+							&filter, write_index);
+		else if (jobs > 1)
+			exit_status = process_pcap_parallel(pcap,
+							nl80211_family, jobs);
+		else
 			exit_status = process_pcap(pcap, nl80211_family);
 
 		pcap_close(pcap);
@@ -817,6 +1427,7 @@ int main(int argc, char *argv[])
 	nlmon_close(nlmon);
 
 done:
+	capture_filter_free(config.filter);
 	l_timeout_remove(timeout);
 
 	l_main_exit();
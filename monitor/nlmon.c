@@ -30,6 +30,7 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <net/ethernet.h>
@@ -59,6 +60,7 @@
 #include "monitor/pcap.h"
 #include "monitor/display.h"
 #include "monitor/nlmon.h"
+#include "monitor/filter.h"
 #include "src/anqputil.h"
 
 #define COLOR_TIMESTAMP		COLOR_YELLOW
@@ -94,10 +96,19 @@ enum msg_type {
 	MSG_EVENT,
 };
 
+struct nlmon_ring {
+	uint8_t *map;
+	size_t map_size;
+	uint32_t block_size;
+	uint32_t block_count;
+	uint32_t next_block;
+};
+
 struct nlmon {
 	uint16_t id;
 	struct l_io *io;
 	struct l_io *pae_io;
+	struct nlmon_ring *ring;
 	struct l_queue *req_list;
 	struct pcap *pcap;
 	bool nortnl;
@@ -112,6 +123,8 @@ struct nlmon_req {
 	uint16_t flags;
 	uint8_t cmd;
 	uint8_t version;
+	uint32_t ifindex;
+	uint64_t wdev;
 };
 
 typedef void (*attr_func_t) (unsigned int level, const char *label,
@@ -149,6 +162,78 @@ struct attr_entry {
 static void print_attributes(int indent, const struct attr_entry *table,
 						const void *buf, uint32_t len);
 
+/*
+ * Direct-index lookup array for an attr_entry table.  Built the first
+ * time a table is used and kept until the monitor is destroyed, so that
+ * decoding an attribute does not require a linear scan of its table.
+ */
+struct attr_index {
+	unsigned int max_attr;
+	const struct attr_entry *entries[];
+};
+
+static struct l_hashmap *attr_index_map = NULL;
+
+static const struct attr_index *attr_index_get(const struct attr_entry *table)
+{
+	struct attr_index *index;
+	unsigned int max_attr = 0;
+	int i;
+
+	if (!table)
+		return NULL;
+
+	if (!attr_index_map)
+		attr_index_map = l_hashmap_new();
+
+	index = l_hashmap_lookup(attr_index_map, table);
+	if (index)
+		return index;
+
+	for (i = 0; table[i].str; i++) {
+		if (table[i].attr > max_attr)
+			max_attr = table[i].attr;
+	}
+
+	index = l_malloc(sizeof(struct attr_index) +
+			(max_attr + 1) * sizeof(struct attr_entry *));
+	memset(index->entries, 0, (max_attr + 1) * sizeof(struct attr_entry *));
+	index->max_attr = max_attr;
+
+	/* Keep the first entry for an attribute, same as a linear scan */
+	for (i = 0; table[i].str; i++) {
+		if (!index->entries[table[i].attr])
+			index->entries[table[i].attr] = &table[i];
+	}
+
+	l_hashmap_insert(attr_index_map, table, index);
+
+	return index;
+}
+
+static inline const struct attr_entry *attr_index_lookup(
+					const struct attr_index *index,
+					uint16_t attr)
+{
+	if (!index || attr > index->max_attr)
+		return NULL;
+
+	return index->entries[attr];
+}
+
+static const struct attr_entry *attr_table_lookup(
+					const struct attr_entry *table,
+					uint16_t attr)
+{
+	return attr_index_lookup(attr_index_get(table), attr);
+}
+
+static void attr_index_map_free(void)
+{
+	l_hashmap_destroy(attr_index_map, l_free);
+	attr_index_map = NULL;
+}
+
 struct flag_names {
 	uint16_t flag;
 	const char *name;
@@ -2349,7 +2434,6 @@ static void print_ie(unsigned int level, const char *label,
 					const void *data, uint16_t size)
 {
 	struct ie_tlv_iter iter;
-	int i;
 
 	print_attr(level, "%s: len %u", label, size);
 
@@ -2357,14 +2441,8 @@ static void print_ie(unsigned int level, const char *label,
 
 	while (ie_tlv_iter_next(&iter)) {
 		uint16_t tag = ie_tlv_iter_get_tag(&iter);
-		struct attr_entry *entry = NULL;
-
-		for (i = 0; ie_entry[i].str; i++) {
-			if (ie_entry[i].attr == tag) {
-				entry = &ie_entry[i];
-				break;
-			}
-		}
+		const struct attr_entry *entry =
+				attr_table_lookup(ie_entry, tag);
 
 		if (cur_nlmon && cur_nlmon->noies && tag != IE_TYPE_SSID)
 			continue;
@@ -3052,7 +3130,6 @@ static void print_wsc_wfa_ext_attributes(unsigned int level, const char *label,
 						const void *data, uint16_t size)
 {
 	struct wsc_wfa_ext_iter iter;
-	int i;
 
 	print_attr(level, "%s: len %u", label, size);
 
@@ -3062,14 +3139,8 @@ static void print_wsc_wfa_ext_attributes(unsigned int level, const char *label,
 		uint8_t type = wsc_wfa_ext_iter_get_type(&iter);
 		uint8_t len = wsc_wfa_ext_iter_get_length(&iter);
 		const void *attr = wsc_wfa_ext_iter_get_data(&iter);
-		struct attr_entry *entry = NULL;
-
-		for (i = 0; wsc_wfa_ext_attr_entry[i].str; i++) {
-			if (wsc_wfa_ext_attr_entry[i].attr == type) {
-				entry = &wsc_wfa_ext_attr_entry[i];
-				break;
-			}
-		}
+		const struct attr_entry *entry =
+				attr_table_lookup(wsc_wfa_ext_attr_entry, type);
 
 		if (entry && entry->function)
 			entry->function(level + 1, entry->str, attr, len);
@@ -3207,7 +3278,6 @@ static void print_wsc_attributes(unsigned int level, const char *label,
 					const void *data, uint16_t size)
 {
 	struct wsc_attr_iter iter;
-	int i;
 
 	print_attr(level, "%s: len %u", label, size);
 
@@ -3217,14 +3287,8 @@ static void print_wsc_attributes(unsigned int level, const char *label,
 		uint16_t type = wsc_attr_iter_get_type(&iter);
 		uint16_t len = wsc_attr_iter_get_length(&iter);
 		const void *attr = wsc_attr_iter_get_data(&iter);
-		struct attr_entry *entry = NULL;
-
-		for (i = 0; wsc_attr_entry[i].str; i++) {
-			if (wsc_attr_entry[i].attr == type) {
-				entry = &wsc_attr_entry[i];
-				break;
-			}
-		}
+		const struct attr_entry *entry =
+				attr_table_lookup(wsc_attr_entry, type);
 
 		if (entry && entry->function)
 			entry->function(level + 1, entry->str, attr, len);
@@ -3891,7 +3955,6 @@ static void print_p2p_attributes(unsigned int level, const char *label,
 					const void *data, uint16_t size)
 {
 	struct p2p_attr_iter iter;
-	int i;
 
 	print_attr(level, "%s: len %u", label, size);
 
@@ -3901,14 +3964,8 @@ static void print_p2p_attributes(unsigned int level, const char *label,
 		uint16_t type = p2p_attr_iter_get_type(&iter);
 		uint16_t len = p2p_attr_iter_get_length(&iter);
 		const void *attr = p2p_attr_iter_get_data(&iter);
-		struct attr_entry *entry = NULL;
-
-		for (i = 0; p2p_attr_entry[i].str; i++) {
-			if (p2p_attr_entry[i].attr == type) {
-				entry = &p2p_attr_entry[i];
-				break;
-			}
-		}
+		const struct attr_entry *entry =
+				attr_table_lookup(p2p_attr_entry, type);
 
 		if (entry && entry->function)
 			entry->function(level + 1, entry->str, attr, len);
@@ -4157,7 +4214,6 @@ static void print_wfd_subelements(unsigned int level, const char *label,
 					const void *data, uint16_t size)
 {
 	struct wfd_subelem_iter iter;
-	int i;
 
 	print_attr(level, "%s: len %u", label, size);
 
@@ -4167,14 +4223,8 @@ static void print_wfd_subelements(unsigned int level, const char *label,
 		uint16_t type = wfd_subelem_iter_get_type(&iter);
 		uint16_t len = wfd_subelem_iter_get_length(&iter);
 		const void *attr = wfd_subelem_iter_get_data(&iter);
-		struct attr_entry *entry = NULL;
-
-		for (i = 0; wfd_subelem_entry[i].str; i++) {
-			if (wfd_subelem_entry[i].attr == type) {
-				entry = &wfd_subelem_entry[i];
-				break;
-			}
-		}
+		const struct attr_entry *entry =
+				attr_table_lookup(wfd_subelem_entry, type);
 
 		if (!entry)
 			continue;
@@ -6503,12 +6553,13 @@ static void print_array(int indent, enum attr_type type,
 static void print_attributes(int indent, const struct attr_entry *table,
 						const void *buf, uint32_t len)
 {
+	const struct attr_index *index = attr_index_get(table);
 	const struct nlattr *nla;
 	const char *str;
-	int i;
 
 	for (nla = buf ; NLA_OK(nla, len); nla = NLA_NEXT(nla, len)) {
 		uint16_t nla_type = nla->nla_type & NLA_TYPE_MASK;
+		const struct attr_entry *entry;
 		enum attr_type type;
 		enum attr_type array_type;
 		const struct attr_entry *nested;
@@ -6527,17 +6578,13 @@ static void print_attributes(int indent, const struct attr_entry *table,
 		array_type = ATTR_UNSPEC;
 		nested = NULL;
 
-		if (table) {
-			for (i = 0; table[i].str; i++) {
-				if (nla_type == table[i].attr) {
-					str = table[i].str;
-					type = table[i].type;
-					nested = table[i].nested;
-					array_type = table[i].array_type;
-					function = table[i].function;
-					break;
-				}
-			}
+		entry = attr_index_lookup(index, nla_type);
+		if (entry) {
+			str = entry->str;
+			type = entry->type;
+			nested = entry->nested;
+			array_type = entry->array_type;
+			function = entry->function;
 		}
 
 		switch (type) {
@@ -6872,9 +6919,33 @@ static void store_message(struct nlmon *nlmon, const struct timeval *tv,
 	store_netlink(nlmon, tv, NETLINK_GENERIC, nlmsg);
 }
 
+static void genl_get_iface(const void *data, uint32_t len,
+					uint32_t *ifindex, uint64_t *wdev)
+{
+	const struct nlattr *nla;
+
+	for (nla = data; NLA_OK(nla, len); nla = NLA_NEXT(nla, len)) {
+		switch (nla->nla_type & NLA_TYPE_MASK) {
+		case NL80211_ATTR_IFINDEX:
+			if (NLA_PAYLOAD(nla) == 4)
+				*ifindex = *((uint32_t *) NLA_DATA(nla));
+			break;
+		case NL80211_ATTR_WDEV:
+			if (NLA_PAYLOAD(nla) == 8)
+				*wdev = *((uint64_t *) NLA_DATA(nla));
+			break;
+		}
+	}
+}
+
+/*
+ * With print set to false only the request tracking is updated, which
+ * allows the state of a capture to be advanced without decoding it.
+ */
 static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 					const struct tpacket_auxdata *tp,
-					const struct nlmsghdr *nlmsg)
+					const struct nlmsghdr *nlmsg,
+					bool print)
 {
 	struct nlmon_req *req;
 
@@ -6905,17 +6976,21 @@ static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 				return;
 			}
 
-			store_message(nlmon, tv, nlmsg);
-			print_message(nlmon, tv, type, nlmsg->nlmsg_flags, status,
+			if (print) {
+				store_message(nlmon, tv, nlmsg);
+				print_message(nlmon, tv, type,
+						nlmsg->nlmsg_flags, status,
 						req->cmd, req->version,
 						NULL, sizeof(status));
+			}
+
 			nlmon_req_free(req);
 		}
 		return;
 	}
 
 	if (nlmsg->nlmsg_type != nlmon->id) {
-		if (nlmsg->nlmsg_type == GENL_ID_CTRL)
+		if (print && nlmsg->nlmsg_type == GENL_ID_CTRL)
 			store_message(nlmon, tv, nlmsg);
 		return;
 	}
@@ -6931,9 +7006,15 @@ static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 		req->flags = nlmsg->nlmsg_flags;
 		req->cmd = genlmsg->cmd;
 		req->version = genlmsg->version;
+		genl_get_iface(NLMSG_DATA(nlmsg) + GENL_HDRLEN,
+				NLMSG_PAYLOAD(nlmsg, GENL_HDRLEN),
+				&req->ifindex, &req->wdev);
 
 		l_queue_push_tail(nlmon->req_list, req);
 
+		if (!print)
+			return;
+
 		store_message(nlmon, tv, nlmsg);
 		print_message(nlmon, tv, MSG_REQUEST, flags, 0,
 					req->cmd, req->version,
@@ -6957,6 +7038,9 @@ static void nlmon_message(struct nlmon *nlmon, const struct timeval *tv,
 			type = MSG_RESULT;
 		}
 
+		if (!print)
+			return;
+
 		store_message(nlmon, tv, nlmsg);
 		print_message(nlmon, tv, type, nlmsg->nlmsg_flags, 0,
 					genlmsg->cmd, genlmsg->version,
@@ -6984,6 +7068,8 @@ void nlmon_destroy(struct nlmon *nlmon)
 
 	l_queue_destroy(nlmon->req_list, nlmon_req_free);
 
+	attr_index_map_free();
+
 	l_free(nlmon);
 }
 
@@ -7288,13 +7374,17 @@ static struct attr_entry route_entry[] = {
 static void print_rtnl_attributes(int indent, const struct attr_entry *table,
 						struct rtattr *rt_attr, int len)
 {
+	const struct attr_index *index;
 	struct rtattr *attr;
 
 	if (!table || !rt_attr)
 		return;
 
+	index = attr_index_get(table);
+
 	for (attr = rt_attr; RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
 		uint16_t rta_type = attr->rta_type;
+		const struct attr_entry *entry;
 		enum attr_type type = ATTR_UNSPEC;
 		attr_func_t function;
 		const struct attr_entry *nested;
@@ -7306,18 +7396,16 @@ static void print_rtnl_attributes(int indent, const struct attr_entry *table,
 		int32_t val_s32;
 		int64_t val_s64;
 		const char *str;
-		int i, payload;
+		int payload;
 
 		str = "Reserved";
 
-		for (i = 0; table[i].str; i++) {
-			if (rta_type == table[i].attr) {
-				str = table[i].str;
-				type = table[i].type;
-				function = table[i].function;
-				nested = table[i].nested;
-				break;
-			}
+		entry = attr_index_lookup(index, rta_type);
+		if (entry) {
+			str = entry->str;
+			type = entry->type;
+			function = entry->function;
+			nested = entry->nested;
 		}
 
 		payload = RTA_PAYLOAD(attr);
@@ -7836,14 +7924,199 @@ void nlmon_print_genl(struct nlmon *nlmon, const struct timeval *tv,
 			genl_ctrl(nlmon, NLMSG_DATA(nlmsg),
 						NLMSG_PAYLOAD(nlmsg, 0));
 		else
-			nlmon_message(nlmon, tv, NULL, nlmsg);
+			nlmon_message(nlmon, tv, NULL, nlmsg, true);
+	}
+}
+
+static void nlmon_packet(struct nlmon *nlmon, const struct timeval *tv,
+					const struct tpacket_auxdata *tp,
+					uint16_t proto_type,
+					const void *data, int len)
+{
+	const struct nlmsghdr *nlmsg;
+
+	for (nlmsg = data; NLMSG_OK(nlmsg, len);
+				nlmsg = NLMSG_NEXT(nlmsg, len)) {
+		switch (proto_type) {
+		case NETLINK_ROUTE:
+			store_netlink(nlmon, tv, proto_type, nlmsg);
+
+			if (!nlmon->nortnl)
+				nlmon_print_rtnl(nlmon, tv, nlmsg,
+							nlmsg->nlmsg_len);
+			break;
+		case NETLINK_GENERIC:
+			nlmon_message(nlmon, tv, tp, nlmsg, true);
+			break;
+		}
+	}
+}
+
+void nlmon_track_genl(struct nlmon *nlmon, const struct timeval *tv,
+					const void *data, uint32_t size)
+{
+	const struct nlmsghdr *nlmsg;
+
+	update_time_offset(tv);
+
+	for (nlmsg = data; nlmsg && NLMSG_OK(nlmsg, size);
+				nlmsg = NLMSG_NEXT(nlmsg, size)) {
+		if (nlmsg->nlmsg_type == GENL_ID_CTRL)
+			genl_ctrl(nlmon, NLMSG_DATA(nlmsg),
+						NLMSG_PAYLOAD(nlmsg, 0));
+		else
+			nlmon_message(nlmon, tv, NULL, nlmsg, false);
+	}
+}
+
+static void index_message(struct nlmon *nlmon, const struct nlmsghdr *nlmsg,
+					struct pcap_index_entry *entry)
+{
+	const struct genlmsghdr *genlmsg;
+
+	if (nlmsg->nlmsg_type < NLMSG_MIN_TYPE) {
+		struct nlmon_req_match match = {
+			.seq = nlmsg->nlmsg_seq,
+			.pid = nlmsg->nlmsg_pid
+		};
+		const struct nlmon_req *req;
+
+		/* Responses are indexed under their request */
+		req = l_queue_find(nlmon->req_list, nlmon_req_match, &match);
+		if (!req)
+			return;
+
+		entry->flags |= PCAP_INDEX_FLAG_NL80211;
+		entry->cmd = req->cmd;
+		entry->ifindex = req->ifindex;
+		entry->wdev = req->wdev;
+		return;
+	}
+
+	if (nlmsg->nlmsg_type != nlmon->id)
+		return;
+
+	genlmsg = NLMSG_DATA(nlmsg);
+
+	entry->flags |= PCAP_INDEX_FLAG_NL80211;
+	entry->cmd = genlmsg->cmd;
+	genl_get_iface(NLMSG_DATA(nlmsg) + GENL_HDRLEN,
+				NLMSG_PAYLOAD(nlmsg, GENL_HDRLEN),
+				&entry->ifindex, &entry->wdev);
+
+	if (genlmsg->cmd == NL80211_CMD_CONTROL_PORT_FRAME)
+		entry->flags |= PCAP_INDEX_FLAG_PAE;
+}
+
+/*
+ * Fill in the nl80211 details of an index entry from the first nl80211
+ * message of a packet, while tracking requests like nlmon_track_genl.
+ */
+void nlmon_index_genl(struct nlmon *nlmon, const struct timeval *tv,
+					const void *data, uint32_t size,
+					struct pcap_index_entry *entry)
+{
+	const struct nlmsghdr *nlmsg;
+
+	update_time_offset(tv);
+
+	for (nlmsg = data; NLMSG_OK(nlmsg, size);
+				nlmsg = NLMSG_NEXT(nlmsg, size)) {
+		if (nlmsg->nlmsg_type == GENL_ID_CTRL) {
+			entry->flags |= PCAP_INDEX_FLAG_GENL_CTRL;
+			genl_ctrl(nlmon, NLMSG_DATA(nlmsg),
+						NLMSG_PAYLOAD(nlmsg, 0));
+			continue;
+		}
+
+		if (!(entry->flags & PCAP_INDEX_FLAG_NL80211))
+			index_message(nlmon, nlmsg, entry);
+
+		nlmon_message(nlmon, tv, NULL, nlmsg, false);
+	}
+}
+
+struct pcap_index *nlmon_build_index(struct pcap *pcap, uint16_t id)
+{
+	struct pcap_index *index = pcap_index_new();
+	struct nlmon *nlmon = nlmon_create(id);
+	size_t offset = 0;
+	const uint8_t *data;
+	uint32_t len;
+
+	for (;;) {
+		struct pcap_index_entry entry;
+		struct timeval tv;
+
+		memset(&entry, 0, sizeof(entry));
+		entry.offset = offset;
+
+		if (!pcap_read_at(pcap, &offset, &tv, (const void **) &data,
+								&len, NULL))
+			break;
+
+		entry.ts_sec = tv.tv_sec;
+		entry.ts_usec = tv.tv_usec;
+
+		if (len >= 16) {
+			uint16_t arphrd_type = l_get_be16(data + 2);
+			uint16_t proto_type = l_get_be16(data + 14);
+
+			if (arphrd_type == ARPHRD_ETHER &&
+						proto_type == ETH_P_PAE)
+				entry.flags |= PCAP_INDEX_FLAG_PAE;
+			else if (arphrd_type == ARPHRD_NETLINK &&
+						proto_type == NETLINK_ROUTE)
+				entry.flags |= PCAP_INDEX_FLAG_RTNL;
+			else if (arphrd_type == ARPHRD_NETLINK &&
+						proto_type == NETLINK_GENERIC)
+				nlmon_index_genl(nlmon, &tv, data + 16,
+							len - 16, &entry);
+		}
+
+		pcap_index_add(index, &entry);
+	}
+
+	nlmon_destroy(nlmon);
+
+	return index;
+}
+
+/*
+ * Feed the generic netlink family announcements among the first count
+ * index entries to the decoder, so it learns the nl80211 family id when
+ * reading only a selection of records.
+ */
+void nlmon_replay_genl_ctrl(struct nlmon *nlmon, struct pcap *pcap,
+					struct pcap_index *index, size_t count)
+{
+	size_t pos;
+
+	for (pos = 0; pos < count; pos++) {
+		const struct pcap_index_entry *entry;
+		struct timeval tv;
+		const uint8_t *data;
+		uint32_t len;
+		size_t offset;
+
+		entry = pcap_index_get(index, pos);
+		if (!(entry->flags & PCAP_INDEX_FLAG_GENL_CTRL))
+			continue;
+
+		offset = entry->offset;
+
+		if (!pcap_read_at(pcap, &offset, &tv, (const void **) &data,
+								&len, NULL))
+			break;
+
+		if (len >= 16)
+			nlmon_track_genl(nlmon, &tv, data + 16, len - 16);
 	}
 }
 
 static bool nlmon_receive(struct l_io *io, void *user_data)
 {
 	struct nlmon *nlmon = user_data;
-	struct nlmsghdr *nlmsg;
 	struct msghdr msg;
 	struct sockaddr_ll sll;
 	struct iovec iov;
@@ -7852,11 +8125,9 @@ static bool nlmon_receive(struct l_io *io, void *user_data)
 	struct tpacket_auxdata copy_tp;
 	const struct timeval *tv = NULL;
 	const struct tpacket_auxdata *tp = NULL;
-	uint16_t proto_type;
 	unsigned char buf[8192];
 	unsigned char control[32];
 	ssize_t bytes_read;
-	int nlmsg_len;
 	int fd;
 
 	fd = l_io_get_fd(io);
@@ -7888,8 +8159,6 @@ static bool nlmon_receive(struct l_io *io, void *user_data)
 	if (sll.sll_hatype != ARPHRD_NETLINK)
 		return true;
 
-	proto_type = ntohs(sll.sll_protocol);
-
 	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
 				cmsg = CMSG_NXTHDR(&msg, cmsg)) {
 		if (cmsg->cmsg_level == SOL_SOCKET &&
@@ -7905,22 +8174,63 @@ static bool nlmon_receive(struct l_io *io, void *user_data)
 		}
 	}
 
-	nlmsg_len = bytes_read;
+	nlmon_packet(nlmon, tv, tp, ntohs(sll.sll_protocol), buf, bytes_read);
 
-	for (nlmsg = iov.iov_base; NLMSG_OK(nlmsg, nlmsg_len);
-				nlmsg = NLMSG_NEXT(nlmsg, nlmsg_len)) {
-		switch (proto_type) {
-		case NETLINK_ROUTE:
-			store_netlink(nlmon, tv, proto_type, nlmsg);
+	return true;
+}
 
-			if (!nlmon->nortnl)
-				nlmon_print_rtnl(nlmon, tv, nlmsg,
-							nlmsg->nlmsg_len);
-			break;
-		case NETLINK_GENERIC:
-			nlmon_message(nlmon, tv, tp, nlmsg);
-			break;
+static void nlmon_ring_block(struct nlmon *nlmon,
+					const struct tpacket_block_desc *block)
+{
+	const struct tpacket3_hdr *hdr;
+	uint32_t i;
+
+	hdr = (const void *) block + block->hdr.bh1.offset_to_first_pkt;
+
+	for (i = 0; i < block->hdr.bh1.num_pkts; i++) {
+		const struct sockaddr_ll *sll;
+		struct timeval tv;
+
+		sll = (const void *) hdr +
+				TPACKET_ALIGN(sizeof(struct tpacket3_hdr));
+
+		if (sll->sll_hatype == ARPHRD_NETLINK) {
+			tv.tv_sec = hdr->tp_sec;
+			tv.tv_usec = hdr->tp_nsec / 1000;
+
+			nlmon_packet(nlmon, &tv, NULL,
+					ntohs(sll->sll_protocol),
+					(const void *) hdr + hdr->tp_mac,
+					hdr->tp_snaplen);
 		}
+
+		hdr = (const void *) hdr + hdr->tp_next_offset;
+	}
+}
+
+static bool nlmon_ring_receive(struct l_io *io, void *user_data)
+{
+	struct nlmon *nlmon = user_data;
+	struct nlmon_ring *ring = nlmon->ring;
+
+	/*
+	 * Hand back every block the kernel has retired so far.  A block is
+	 * owned by userspace while TP_STATUS_USER is set in its status.
+	 */
+	for (;;) {
+		struct tpacket_block_desc *block = (void *) ring->map +
+				(size_t) ring->next_block * ring->block_size;
+
+		if (!(__atomic_load_n(&block->hdr.bh1.block_status,
+					__ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			break;
+
+		nlmon_ring_block(nlmon, block);
+
+		__atomic_store_n(&block->hdr.bh1.block_status,
+					TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+		ring->next_block = (ring->next_block + 1) % ring->block_count;
 	}
 
 	return true;
@@ -7943,12 +8253,71 @@ static struct sock_filter mon_filter[] = {
 
 static const struct sock_fprog mon_fprog = { .len = 7, .filter = mon_filter };
 
-static struct l_io *open_packet(const char *name)
+static struct nlmon_ring *setup_ring(int fd, uint32_t block_size,
+							uint32_t block_count)
+{
+	struct nlmon_ring *ring;
+	struct tpacket_req3 req;
+	int version = TPACKET_V3;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION,
+					&version, sizeof(version)) < 0) {
+		perror("Failed to select TPACKET_V3 ring");
+		return NULL;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = block_size;
+	req.tp_block_nr = block_count;
+	req.tp_frame_size = 2048;
+	req.tp_frame_nr = (block_size / req.tp_frame_size) * block_count;
+	req.tp_retire_blk_tov = 64;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING,
+						&req, sizeof(req)) < 0) {
+		perror("Failed to set up capture ring");
+		return NULL;
+	}
+
+	ring = l_new(struct nlmon_ring, 1);
+	ring->block_size = block_size;
+	ring->block_count = block_count;
+	ring->map_size = (size_t) block_size * block_count;
+
+	ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_LOCKED, fd, 0);
+	if (ring->map == MAP_FAILED) {
+		/* Locking may exceed RLIMIT_MEMLOCK, retry without it */
+		ring->map = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE,
+							MAP_SHARED, fd, 0);
+		if (ring->map == MAP_FAILED) {
+			perror("Failed to map capture ring");
+			l_free(ring);
+			return NULL;
+		}
+	}
+
+	return ring;
+}
+
+static void free_ring(struct nlmon_ring *ring)
+{
+	if (!ring)
+		return;
+
+	munmap(ring->map, ring->map_size);
+	l_free(ring);
+}
+
+static struct l_io *open_packet(const char *name,
+				const struct nlmon_config *config,
+				struct nlmon_ring **out_ring)
 {
 	struct l_io *io;
 	struct sockaddr_ll sll;
 	struct packet_mreq mr;
 	struct ifreq ifr;
+	struct nlmon_ring *ring = NULL;
 	int fd, opt = 1;
 
 	fd = socket(PF_PACKET, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
@@ -7965,6 +8334,15 @@ static struct l_io *open_packet(const char *name)
 		return NULL;
 	}
 
+	if (config->ring_block_count) {
+		ring = setup_ring(fd, config->ring_block_size,
+						config->ring_block_count);
+		if (!ring) {
+			close(fd);
+			return NULL;
+		}
+	}
+
 	memset(&sll, 0, sizeof(sll));
 	sll.sll_family = AF_PACKET;
 	sll.sll_protocol = htons(ETH_P_ALL);
@@ -7972,8 +8350,7 @@ static struct l_io *open_packet(const char *name)
 
 	if (bind(fd, (struct sockaddr *) &sll, sizeof(sll)) < 0) {
 		perror("Failed to bind packet socket");
-		close(fd);
-		return NULL;
+		goto failed;
 	}
 
 	memset(&mr, 0, sizeof(mr));
@@ -7983,28 +8360,53 @@ static struct l_io *open_packet(const char *name)
 	if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
 						&mr, sizeof(mr)) < 0) {
 		perror("Failed to enable all multicast");
-		close(fd);
-		return NULL;
+		goto failed;
 	}
 
 	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER,
 					&mon_fprog, sizeof(mon_fprog)) < 0) {
 		perror("Failed to enable monitor filter");
-		close(fd);
-		return NULL;
+		goto failed;
 	}
 
 	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &opt, sizeof(opt)) < 0) {
 		perror("Failed to enable monitor timestamps");
-		close(fd);
-		return NULL;
+		goto failed;
 	}
 
 	io = l_io_new(fd);
 
 	l_io_set_close_on_destroy(io, true);
 
+	*out_ring = ring;
+
 	return io;
+
+failed:
+	free_ring(ring);
+	close(fd);
+	return NULL;
+}
+
+static void print_statistics(const char *label, struct l_io *io, bool ring)
+{
+	struct tpacket_stats_v3 stats;
+	socklen_t len = ring ? sizeof(stats) : sizeof(struct tpacket_stats);
+
+	memset(&stats, 0, sizeof(stats));
+
+	/* Both structures share the layout of the first two counters */
+	if (getsockopt(l_io_get_fd(io), SOL_PACKET, PACKET_STATISTICS,
+							&stats, &len) < 0)
+		return;
+
+	printf("%s: %u packets received, %u dropped by kernel",
+				label, stats.tp_packets, stats.tp_drops);
+
+	if (ring)
+		printf(", %u ring freezes", stats.tp_freeze_q_cnt);
+
+	printf("\n");
 }
 
 void nlmon_print_pae(struct nlmon *nlmon, const struct timeval *tv,
@@ -8139,25 +8541,35 @@ struct nlmon *nlmon_open(const char *ifname, uint16_t id, const char *pathname,
 {
 	struct nlmon *nlmon;
 	struct l_io *io, *pae_io;
+	struct nlmon_ring *ring = NULL;
 	struct pcap *pcap;
 
-	io = open_packet(ifname);
+	io = open_packet(ifname, config, &ring);
 	if (!io)
 		return NULL;
 
 	pae_io = open_pae();
 	if (!pae_io) {
 		l_io_destroy(io);
+		free_ring(ring);
 		return NULL;
 	}
 
+	/* Replace the default filters so unwanted traffic never arrives */
+	if (config->filter) {
+		if (!capture_filter_attach_netlink(config->filter, id,
+							l_io_get_fd(io)))
+			goto failed;
+
+		if (!capture_filter_attach_pae(config->filter,
+							l_io_get_fd(pae_io)))
+			goto failed;
+	}
+
 	if (pathname) {
 		pcap = pcap_create(pathname);
-		if (!pcap) {
-			l_io_destroy(pae_io);
-			l_io_destroy(io);
-			return NULL;
-		}
+		if (!pcap)
+			goto failed;
 	} else
 		pcap = NULL;
 
@@ -8166,6 +8578,7 @@ struct nlmon *nlmon_open(const char *ifname, uint16_t id, const char *pathname,
 	nlmon->id = id;
 	nlmon->io = io;
 	nlmon->pae_io = pae_io;
+	nlmon->ring = ring;
 	nlmon->req_list = l_queue_new();
 	nlmon->pcap = pcap;
 	nlmon->nortnl = config->nortnl;
@@ -8173,12 +8586,22 @@ struct nlmon *nlmon_open(const char *ifname, uint16_t id, const char *pathname,
 	nlmon->noscan = config->noscan;
 	nlmon->noies = config->noies;
 
-	l_io_set_read_handler(nlmon->io, nlmon_receive, nlmon, NULL);
+	if (ring)
+		l_io_set_read_handler(nlmon->io, nlmon_ring_receive,
+								nlmon, NULL);
+	else
+		l_io_set_read_handler(nlmon->io, nlmon_receive, nlmon, NULL);
 	l_io_set_read_handler(nlmon->pae_io, pae_receive, nlmon, NULL);
 
 	wlan_iface_list = l_hashmap_new();
 
 	return nlmon;
+
+failed:
+	l_io_destroy(pae_io);
+	l_io_destroy(io);
+	free_ring(ring);
+	return NULL;
 }
 
 void nlmon_close(struct nlmon *nlmon)
@@ -8186,13 +8609,19 @@ void nlmon_close(struct nlmon *nlmon)
 	if (!nlmon)
 		return;
 
+	print_statistics("Netlink", nlmon->io, nlmon->ring);
+	print_statistics("PAE", nlmon->pae_io, false);
+
 	l_io_destroy(nlmon->io);
 	l_io_destroy(nlmon->pae_io);
+	free_ring(nlmon->ring);
 	l_queue_destroy(nlmon->req_list, nlmon_req_free);
 
 	l_hashmap_destroy(wlan_iface_list, wlan_iface_list_free);
 	wlan_iface_list = NULL;
 
+	attr_index_map_free();
+
 	if (nlmon->pcap)
 		pcap_close(nlmon->pcap);
 
@@ -21,15 +21,23 @@
  */
 
 #include <stdint.h>
+#include <stddef.h>
 #include <sys/time.h>
 
 struct nlmon;
+struct pcap;
+struct pcap_index;
+struct pcap_index_entry;
+struct capture_filter;
 
 struct nlmon_config {
 	bool nortnl;
 	bool nowiphy;
 	bool noscan;
 	bool noies;
+	uint32_t ring_block_size;
+	uint32_t ring_block_count;
+	struct capture_filter *filter;
 };
 
 struct nlmon *nlmon_open(const char *ifname, uint16_t id, const char *pathname,
@@ -42,6 +50,14 @@ void nlmon_print_rtnl(struct nlmon *nlmon, const struct timeval *tv,
 					const void *data, uint32_t size);
 void nlmon_print_genl(struct nlmon *nlmon, const struct timeval *tv,
 					const void *data, uint32_t size);
+void nlmon_track_genl(struct nlmon *nlmon, const struct timeval *tv,
+					const void *data, uint32_t size);
+void nlmon_index_genl(struct nlmon *nlmon, const struct timeval *tv,
+					const void *data, uint32_t size,
+					struct pcap_index_entry *entry);
+struct pcap_index *nlmon_build_index(struct pcap *pcap, uint16_t id);
+void nlmon_replay_genl_ctrl(struct nlmon *nlmon, struct pcap *pcap,
+					struct pcap_index *index, size_t count);
 void nlmon_print_pae(struct nlmon *nlmon, const struct timeval *tv,
 					uint8_t type, int index,
 					const void *data, uint32_t size);
@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/uio.h>
 #include <sys/types.h>
 #include <ell/ell.h>
@@ -55,11 +56,32 @@ struct pcap_pkt {
 } __attribute__ ((packed));
 #define PCAP_PKT_SIZE (sizeof(struct pcap_pkt))
 
+struct pcap_index_hdr {
+	uint32_t magic;		/* magic number */
+	uint32_t version;	/* index format version */
+	uint64_t pcap_size;	/* size of the indexed PCAP file */
+	uint64_t pcap_ino;	/* inode of the indexed PCAP file */
+	uint64_t pcap_mtime;	/* modification time in nanoseconds */
+	uint64_t count;		/* number of index entries */
+} __attribute__ ((packed));
+#define PCAP_INDEX_HDR_SIZE (sizeof(struct pcap_index_hdr))
+
+#define PCAP_INDEX_MAGIC	0x786d7769	/* "iwmx" */
+#define PCAP_INDEX_VERSION	3
+
+struct pcap_index {
+	struct pcap_index_entry *entries;
+	size_t count;
+	size_t size;
+};
+
 struct pcap {
 	int fd;
 	bool closed;
 	uint32_t type;
 	uint32_t snaplen;
+	uint8_t *map;
+	size_t map_size;
 };
 
 struct pcap *pcap_open(const char *pathname)
@@ -166,6 +188,9 @@ void pcap_close(struct pcap *pcap)
 	if (!pcap)
 		return;
 
+	if (pcap->map)
+		munmap(pcap->map, pcap->map_size);
+
 	if (pcap->fd >= 0)
 		close(pcap->fd);
 
@@ -233,8 +258,9 @@ bool pcap_read(struct pcap *pcap, struct timeval *tv,
 	if (len)
 		*len = toread;
 
+	/* Captures cut at the snapshot length keep the original length */
 	if (real_len)
-		*real_len = pkt.incl_len;
+		*real_len = L_MAX(pkt.incl_len, pkt.orig_len);
 
 	return true;
 }
@@ -281,3 +307,281 @@ bool pcap_write(struct pcap *pcap, const struct timeval *tv,
 
 	return true;
 }
+
+bool pcap_map(struct pcap *pcap, size_t *size)
+{
+	struct stat st;
+	void *map;
+
+	if (!pcap)
+		return false;
+
+	if (pcap->map)
+		goto done;
+
+	if (fstat(pcap->fd, &st) < 0) {
+		perror("Failed to get PCAP file size");
+		return false;
+	}
+
+	if ((size_t) st.st_size < PCAP_HDR_SIZE) {
+		fprintf(stderr, "Wrong PCAP file size\n");
+		return false;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, pcap->fd, 0);
+	if (map == MAP_FAILED) {
+		perror("Failed to map PCAP file");
+		return false;
+	}
+
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	pcap->map = map;
+	pcap->map_size = st.st_size;
+
+done:
+	if (size)
+		*size = pcap->map_size - PCAP_HDR_SIZE;
+
+	return true;
+}
+
+/*
+ * Read the record at *offset (relative to the first record) of a mapped
+ * file and advance *offset past it.  The packet data is not copied.
+ */
+bool pcap_read_at(struct pcap *pcap, size_t *offset, struct timeval *tv,
+			const void **data, uint32_t *len, uint32_t *real_len)
+{
+	const uint8_t *records;
+	struct pcap_pkt pkt;
+	size_t size;
+
+	if (!pcap || !pcap->map)
+		return false;
+
+	records = pcap->map + PCAP_HDR_SIZE;
+	size = pcap->map_size - PCAP_HDR_SIZE;
+
+	if (*offset + PCAP_PKT_SIZE > size)
+		return false;
+
+	memcpy(&pkt, records + *offset, PCAP_PKT_SIZE);
+
+	if (pkt.incl_len > size - *offset - PCAP_PKT_SIZE)
+		return false;
+
+	if (tv) {
+		tv->tv_sec = pkt.ts_sec;
+		tv->tv_usec = pkt.ts_usec;
+	}
+
+	if (data)
+		*data = records + *offset + PCAP_PKT_SIZE;
+
+	if (len)
+		*len = pkt.incl_len;
+
+	if (real_len)
+		*real_len = L_MAX(pkt.incl_len, pkt.orig_len);
+
+	*offset += PCAP_PKT_SIZE + pkt.incl_len;
+
+	return true;
+}
+
+struct pcap_index *pcap_index_new(void)
+{
+	return l_new(struct pcap_index, 1);
+}
+
+void pcap_index_free(struct pcap_index *index)
+{
+	if (!index)
+		return;
+
+	l_free(index->entries);
+	l_free(index);
+}
+
+void pcap_index_add(struct pcap_index *index,
+				const struct pcap_index_entry *entry)
+{
+	if (index->count == index->size) {
+		index->size = index->size ? index->size * 2 : 1024;
+		index->entries = l_realloc(index->entries, index->size *
+					sizeof(struct pcap_index_entry));
+	}
+
+	index->entries[index->count++] = *entry;
+}
+
+/*
+ * Identifies the version of the PCAP file an index was built for.  The size
+ * alone doesn't tell apart a different capture of the same size or a file
+ * rewritten in place.
+ */
+static bool pcap_get_file_id(struct pcap *pcap, struct pcap_index_hdr *hdr)
+{
+	struct stat st;
+
+	if (fstat(pcap->fd, &st) < 0)
+		return false;
+
+	hdr->pcap_size = pcap->map ? pcap->map_size : (uint64_t) st.st_size;
+	hdr->pcap_ino = st.st_ino;
+	hdr->pcap_mtime = (uint64_t) st.st_mtim.tv_sec * 1000000000ULL +
+							st.st_mtim.tv_nsec;
+	return true;
+}
+
+bool pcap_index_save(struct pcap_index *index, struct pcap *pcap,
+						const char *pathname)
+{
+	struct pcap_index_hdr hdr;
+	struct iovec iov[2];
+	ssize_t written;
+	int fd;
+
+	if (!index || !pcap)
+		return false;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	if (!pcap_get_file_id(pcap, &hdr)) {
+		perror("Failed to get PCAP file status");
+		return false;
+	}
+
+	hdr.magic = PCAP_INDEX_MAGIC;
+	hdr.version = PCAP_INDEX_VERSION;
+	hdr.count = index->count;
+
+	fd = open(pathname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0) {
+		perror("Failed to create PCAP index file");
+		return false;
+	}
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = PCAP_INDEX_HDR_SIZE;
+	iov[1].iov_base = index->entries;
+	iov[1].iov_len = index->count * sizeof(struct pcap_index_entry);
+
+	written = writev(fd, iov, 2);
+	close(fd);
+
+	if (written < (ssize_t) (iov[0].iov_len + iov[1].iov_len)) {
+		fprintf(stderr, "Failed to write PCAP index file\n");
+		unlink(pathname);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Returns NULL if there is no index for the file, or if the index was
+ * created for a different version of it.
+ */
+struct pcap_index *pcap_index_load(struct pcap *pcap, const char *pathname)
+{
+	struct pcap_index *index;
+	struct pcap_index_hdr hdr;
+	struct pcap_index_hdr id;
+	size_t len;
+	int fd;
+
+	memset(&id, 0, sizeof(id));
+
+	if (!pcap || !pcap_get_file_id(pcap, &id))
+		return NULL;
+
+	fd = open(pathname, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (read(fd, &hdr, PCAP_INDEX_HDR_SIZE) != PCAP_INDEX_HDR_SIZE)
+		goto failed;
+
+	if (hdr.magic != PCAP_INDEX_MAGIC ||
+				hdr.version != PCAP_INDEX_VERSION ||
+				hdr.pcap_size != id.pcap_size ||
+				hdr.pcap_ino != id.pcap_ino ||
+				hdr.pcap_mtime != id.pcap_mtime ||
+				hdr.count > id.pcap_size / PCAP_PKT_SIZE)
+		goto failed;
+
+	index = pcap_index_new();
+	index->count = hdr.count;
+	index->size = hdr.count;
+
+	len = hdr.count * sizeof(struct pcap_index_entry);
+	index->entries = l_malloc(len);
+
+	if (read(fd, index->entries, len) != (ssize_t) len) {
+		pcap_index_free(index);
+		goto failed;
+	}
+
+	close(fd);
+
+	return index;
+
+failed:
+	close(fd);
+	return NULL;
+}
+
+size_t pcap_index_get_count(struct pcap_index *index)
+{
+	if (!index)
+		return 0;
+
+	return index->count;
+}
+
+const struct pcap_index_entry *pcap_index_get(struct pcap_index *index,
+								size_t pos)
+{
+	if (!index || pos >= index->count)
+		return NULL;
+
+	return &index->entries[pos];
+}
+
+static bool entry_before(const struct pcap_index_entry *entry,
+						const struct timeval *tv)
+{
+	if (entry->ts_sec != tv->tv_sec)
+		return entry->ts_sec < tv->tv_sec;
+
+	return entry->ts_usec < tv->tv_usec;
+}
+
+/*
+ * Returns the position of the first entry not older than tv.  Records
+ * are written in capture order, so the entries are sorted by time.
+ */
+size_t pcap_index_find(struct pcap_index *index, const struct timeval *tv)
+{
+	size_t low = 0, high;
+
+	if (!index)
+		return 0;
+
+	high = index->count;
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+
+		if (entry_before(&index->entries[mid], tv))
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
@@ -22,6 +22,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <sys/time.h>
 
 #define PCAP_TYPE_INVALID	0
@@ -43,3 +44,38 @@ bool pcap_read(struct pcap *pcap, struct timeval *tv,
 bool pcap_write(struct pcap *pcap, const struct timeval *tv,
 					const void *phdr, uint32_t plen,
 					const void *data, uint32_t size);
+
+bool pcap_map(struct pcap *pcap, size_t *size);
+bool pcap_read_at(struct pcap *pcap, size_t *offset, struct timeval *tv,
+			const void **data, uint32_t *len, uint32_t *real_len);
+
+#define PCAP_INDEX_FLAG_NL80211	0x01
+#define PCAP_INDEX_FLAG_RTNL	0x02
+#define PCAP_INDEX_FLAG_PAE	0x04
+#define PCAP_INDEX_FLAG_GENL_CTRL	0x08
+
+struct pcap_index_entry {
+	uint64_t offset;	/* record offset after the file header */
+	uint64_t wdev;		/* nl80211 wireless device or 0 */
+	uint32_t ts_sec;	/* record timestamp seconds */
+	uint32_t ts_usec;	/* record timestamp microseconds */
+	uint32_t ifindex;	/* interface index or 0 */
+	uint8_t cmd;		/* nl80211 command */
+	uint8_t flags;		/* PCAP_INDEX_FLAG_* */
+	uint16_t reserved;
+};
+
+struct pcap_index;
+
+struct pcap_index *pcap_index_new(void);
+void pcap_index_free(struct pcap_index *index);
+void pcap_index_add(struct pcap_index *index,
+				const struct pcap_index_entry *entry);
+bool pcap_index_save(struct pcap_index *index, struct pcap *pcap,
+						const char *pathname);
+struct pcap_index *pcap_index_load(struct pcap *pcap, const char *pathname);
+
+size_t pcap_index_get_count(struct pcap_index *index);
+const struct pcap_index_entry *pcap_index_get(struct pcap_index *index,
+								size_t pos);
+size_t pcap_index_find(struct pcap_index *index, const struct timeval *tv);
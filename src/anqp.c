@@ -25,6 +25,8 @@
 #endif
 
 #include <stdint.h>
+#include <time.h>
+#include <stdio.h>
 
 #include <ell/ell.h>
 
@@ -36,34 +38,229 @@
 #include "src/iwd.h"
 #include "src/mpdu.h"
 #include "src/frame-xchg.h"
+#include "src/storage.h"
 
 #include "linux/nl80211.h"
 
 #define ANQP_GROUP	0
+/* Responses are reused for this many seconds */
+#define ANQP_CACHE_LIFETIME	3600
+#define ANQP_CACHE_SIZE		64
+/* Frame exchanges in flight at once, further queries wait their turn */
+#define ANQP_MAX_PARALLEL	2
 
-struct anqp_request {
+/*
+ * Responses are cached by HESSID when the BSS advertises one since all
+ * BSSes of a homogeneous ESS return the same ANQP data, and by BSSID
+ * otherwise.
+ */
+struct anqp_cache_entry {
+	uint8_t key[6];
+	bool hessid;
+	uint8_t *query;
+	size_t query_len;
+	uint8_t *response;
+	size_t response_len;
+	uint64_t expiry;	/* Wall clock seconds, this is persisted */
+};
+
+/* A single GAS exchange, shared by all requests for the same key */
+struct anqp_query {
+	uint32_t id;
+	bool started : 1;
 	uint64_t wdev_id;
-	anqp_response_func_t anqp_cb;
-	anqp_destroy_func_t anqp_destroy;
-	void *anqp_data;
+	uint8_t key[6];
+	bool hessid;
+	uint8_t *query;
+	size_t query_len;
 	uint8_t anqp_token;
 	uint32_t frequency;
 	uint8_t *frame;
 	size_t frame_len;
+	uint32_t xchg_id;
+	struct l_queue *requests;
+};
+
+struct anqp_request {
 	uint32_t id;
+	struct anqp_query *query;
+	struct l_idle *idle;
+	uint8_t *response;
+	size_t response_len;
+	anqp_response_func_t anqp_cb;
+	anqp_destroy_func_t anqp_destroy;
+	void *anqp_data;
 };
 
-static void anqp_destroy(void *user_data)
+static struct l_queue *anqp_cache;
+static struct l_queue *anqp_queries;
+static struct l_queue *anqp_requests;
+static uint32_t anqp_next_id;
+static uint32_t anqp_next_query_id;
+static struct l_idle *anqp_start_idle;
+static unsigned int anqp_in_flight;
+static uint32_t anqp_cache_hits;
+static uint32_t anqp_cache_misses;
+static uint32_t anqp_dedup_hits;
+
+static uint64_t anqp_get_time(void)
 {
-	struct anqp_request *request = user_data;
+	return time(NULL);
+}
+
+static anqp_get_time_func_t get_time = anqp_get_time;
+
+void __anqp_set_get_time_func(anqp_get_time_func_t func)
+{
+	get_time = func;
+}
+
+static void anqp_get_key(const struct scan_bss *bss, uint8_t *key,
+				bool *hessid)
+{
+	*hessid = !l_memeqzero(bss->hessid, 6);
+	memcpy(key, *hessid ? bss->hessid : bss->addr, 6);
+}
+
+static void anqp_cache_entry_free(void *data)
+{
+	struct anqp_cache_entry *entry = data;
+
+	l_free(entry->query);
+	l_free(entry->response);
+	l_free(entry);
+}
+
+static bool anqp_cache_entry_expired(void *data, void *user_data)
+{
+	struct anqp_cache_entry *entry = data;
+	uint64_t *now = user_data;
+
+	if (entry->expiry > *now)
+		return false;
+
+	anqp_cache_entry_free(entry);
+	return true;
+}
+
+static struct anqp_cache_entry *anqp_cache_lookup(const uint8_t *key,
+						bool hessid,
+						const uint8_t *query,
+						size_t query_len)
+{
+	const struct l_queue_entry *e;
+	uint64_t now = get_time();
+
+	l_queue_foreach_remove(anqp_cache, anqp_cache_entry_expired, &now);
+
+	for (e = l_queue_get_entries(anqp_cache); e; e = e->next) {
+		struct anqp_cache_entry *entry = e->data;
+
+		if (entry->hessid != hessid || memcmp(entry->key, key, 6))
+			continue;
+
+		if (entry->query_len != query_len ||
+				memcmp(entry->query, query, query_len))
+			continue;
+
+		return entry;
+	}
+
+	return NULL;
+}
+
+static void anqp_cache_add(const struct anqp_query *query,
+				const void *response, size_t response_len)
+{
+	struct anqp_cache_entry *entry;
+
+	entry = anqp_cache_lookup(query->key, query->hessid,
+					query->query, query->query_len);
+	if (entry) {
+		l_queue_remove(anqp_cache, entry);
+		anqp_cache_entry_free(entry);
+	}
+
+	/* Entries are appended so the head is always the oldest */
+	if (l_queue_length(anqp_cache) >= ANQP_CACHE_SIZE)
+		anqp_cache_entry_free(l_queue_pop_head(anqp_cache));
+
+	entry = l_new(struct anqp_cache_entry, 1);
+	memcpy(entry->key, query->key, 6);
+	entry->hessid = query->hessid;
+	entry->query = l_memdup(query->query, query->query_len);
+	entry->query_len = query->query_len;
+	entry->response = l_memdup(response, response_len);
+	entry->response_len = response_len;
+	entry->expiry = get_time() + ANQP_CACHE_LIFETIME;
+
+	l_queue_push_tail(anqp_cache, entry);
+}
+
+static void anqp_request_free(void *data)
+{
+	struct anqp_request *request = data;
 
 	if (request->anqp_destroy)
 		request->anqp_destroy(request->anqp_data);
 
-	l_free(request->frame);
+	l_idle_remove(request->idle);
+	l_free(request->response);
 	l_free(request);
 }
 
+static bool anqp_request_match_id(const void *a, const void *b)
+{
+	const struct anqp_request *request = a;
+
+	return request->id == L_PTR_TO_UINT(b);
+}
+
+static void anqp_query_complete(struct anqp_query *query,
+				enum anqp_result result,
+				const void *anqp, size_t len)
+{
+	struct anqp_request *request;
+
+	while ((request = l_queue_pop_head(query->requests))) {
+		l_queue_remove(anqp_requests, request);
+
+		if (request->anqp_cb)
+			request->anqp_cb(result, anqp, len,
+						request->anqp_data);
+
+		anqp_request_free(request);
+	}
+}
+
+static void anqp_query_free(struct anqp_query *query)
+{
+	struct anqp_request *request;
+
+	while ((request = l_queue_pop_head(query->requests))) {
+		l_queue_remove(anqp_requests, request);
+		anqp_request_free(request);
+	}
+
+	l_queue_destroy(query->requests, NULL);
+	l_free(query->query);
+	l_free(query->frame);
+	l_free(query);
+}
+
+static void anqp_queries_start(void);
+
+static void anqp_query_xchg_destroy(void *user_data)
+{
+	struct anqp_query *query = user_data;
+
+	l_queue_remove(anqp_queries, query);
+	anqp_in_flight--;
+	anqp_query_free(query);
+
+	anqp_queries_start();
+}
+
 /*
  * By using frame-xchg we should get called back here for any frame matching our
  * prefix until the duration expires. If frame-xchg is never signalled 'done'
@@ -74,7 +271,7 @@ static bool anqp_response_frame_event(const struct mmpdu_header *hdr,
 					const void *body, size_t body_len,
 					int rssi, void *user_data)
 {
-	struct anqp_request *request = user_data;
+	struct anqp_query *query = user_data;
 	const uint8_t *ptr = body;
 	uint16_t status_code;
 	uint16_t delay;
@@ -92,7 +289,7 @@ static bool anqp_response_frame_event(const struct mmpdu_header *hdr,
 	/* dialog token */
 	token = *ptr++;
 
-	if (request->anqp_token != token)
+	if (query->anqp_token != token)
 		return false;
 
 	status_code = l_get_le16(ptr);
@@ -147,10 +344,8 @@ static bool anqp_response_frame_event(const struct mmpdu_header *hdr,
 
 	l_debug("ANQP response received from "MAC, MAC_STR(hdr->address_2));
 
-	if (request->anqp_cb)
-		request->anqp_cb(ANQP_SUCCESS, ptr, qrlen, request->anqp_data);
-
-	anqp_destroy(request);
+	anqp_cache_add(query, ptr, qrlen);
+	anqp_query_complete(query, ANQP_SUCCESS, ptr, qrlen);
 
 	return true;
 }
@@ -164,7 +359,7 @@ static const struct frame_xchg_prefix anqp_frame_prefix = {
 
 static void anqp_frame_timeout(int error, void *user_data)
 {
-	struct anqp_request *request = user_data;
+	struct anqp_query *query = user_data;
 	enum anqp_result result = ANQP_TIMEOUT;
 
 	if (error < 0) {
@@ -173,13 +368,7 @@ static void anqp_frame_timeout(int error, void *user_data)
 			strerror(-error), -error);
 	}
 
-	if (request->anqp_cb)
-		request->anqp_cb(result, NULL, 0, request->anqp_data);
-
-	if (request->anqp_destroy)
-		request->anqp_destroy(request->anqp_data);
-
-	anqp_destroy(request);
+	anqp_query_complete(query, result, NULL, 0);
 }
 
 static uint8_t *anqp_build_frame(const uint8_t *addr, struct scan_bss *bss,
@@ -218,48 +407,406 @@ static uint8_t *anqp_build_frame(const uint8_t *addr, struct scan_bss *bss,
 	return frame;
 }
 
+static bool anqp_query_match_id(const void *a, const void *b)
+{
+	const struct anqp_query *query = a;
+
+	return query->id == L_PTR_TO_UINT(b);
+}
+
+static bool anqp_query_start(struct anqp_query *query)
+{
+	uint32_t id = query->id;
+	uint32_t xchg_id;
+	struct iovec iov[2];
+
+	iov[0].iov_base = query->frame;
+	iov[0].iov_len = query->frame_len;
+	iov[1].iov_base = NULL;
+
+	/*
+	 * The exchange can finish, and anqp_query_xchg_destroy free the
+	 * query, before frame_xchg_start returns.
+	 */
+	query->started = true;
+	anqp_in_flight++;
+
+	xchg_id = frame_xchg_start(query->wdev_id, iov,
+					query->frequency, 0, 300, 0,
+					ANQP_GROUP, anqp_frame_timeout, query,
+					anqp_query_xchg_destroy,
+					&anqp_frame_prefix,
+					anqp_response_frame_event, NULL);
+	if (!xchg_id) {
+		query->started = false;
+		anqp_in_flight--;
+		return false;
+	}
+
+	query = l_queue_find(anqp_queries, anqp_query_match_id,
+				L_UINT_TO_PTR(id));
+	if (query)
+		query->xchg_id = xchg_id;
+
+	return true;
+}
+
+static bool anqp_query_waiting(const void *a, const void *b)
+{
+	const struct anqp_query *query = a;
+
+	return !query->started;
+}
+
+static void anqp_queries_start(void)
+{
+	struct anqp_query *query;
+
+	/* Starting a query may change anqp_queries, look up each one anew */
+	while (anqp_in_flight < ANQP_MAX_PARALLEL) {
+		query = l_queue_find(anqp_queries, anqp_query_waiting, NULL);
+		if (!query)
+			break;
+
+		if (anqp_query_start(query))
+			continue;
+
+		l_queue_remove(anqp_queries, query);
+		anqp_query_complete(query, ANQP_FAILED, NULL, 0);
+		anqp_query_free(query);
+	}
+}
+
+static void anqp_start_idle_cb(void *user_data)
+{
+	l_idle_remove(anqp_start_idle);
+	anqp_start_idle = NULL;
+
+	anqp_queries_start();
+}
+
+static bool anqp_query_match(const void *a, const void *b)
+{
+	const struct anqp_query *query = a;
+	const struct anqp_query *match = b;
+
+	return query->wdev_id == match->wdev_id &&
+		query->hessid == match->hessid &&
+		!memcmp(query->key, match->key, 6) &&
+		query->query_len == match->query_len &&
+		!memcmp(query->query, match->query, match->query_len);
+}
+
+static void anqp_cache_hit_idle(void *user_data)
+{
+	struct anqp_request *request = user_data;
+
+	l_idle_remove(request->idle);
+	request->idle = NULL;
+
+	l_queue_remove(anqp_requests, request);
+
+	if (request->anqp_cb)
+		request->anqp_cb(ANQP_SUCCESS, request->response,
+					request->response_len,
+					request->anqp_data);
+
+	anqp_request_free(request);
+}
+
+static void anqp_log_stats(void)
+{
+	uint32_t total = anqp_cache_hits + anqp_cache_misses +
+							anqp_dedup_hits;
+
+	l_debug("ANQP cache: %u hits, %u joined in-flight, %u misses (%u%%)",
+			anqp_cache_hits, anqp_dedup_hits, anqp_cache_misses,
+			total ? (anqp_cache_hits + anqp_dedup_hits) * 100 /
+								total : 0);
+}
+
 uint32_t anqp_request(uint64_t wdev_id, const uint8_t *addr,
 			struct scan_bss *bss, const uint8_t *anqp,
 			size_t len, anqp_response_func_t cb,
 			void *user_data, anqp_destroy_func_t destroy)
 {
 	struct anqp_request *request;
-	struct iovec iov[2];
+	struct anqp_cache_entry *entry;
+	struct anqp_query lookup;
+	struct anqp_query *query;
 
 	request = l_new(struct anqp_request, 1);
 
-	request->wdev_id = wdev_id;
-	request->frequency = bss->frequency;
+	if (!++anqp_next_id)
+		anqp_next_id = 1;
+
+	request->id = anqp_next_id;
 	request->anqp_cb = cb;
 	request->anqp_destroy = destroy;
+	request->anqp_data = user_data;
+
+	anqp_get_key(bss, lookup.key, &lookup.hessid);
+
+	entry = anqp_cache_lookup(lookup.key, lookup.hessid, anqp, len);
+	if (entry) {
+		l_debug("Using cached ANQP response for "MAC,
+				MAC_STR(bss->addr));
+
+		anqp_cache_hits++;
+		anqp_log_stats();
+
+		request->response = l_memdup(entry->response,
+						entry->response_len);
+		request->response_len = entry->response_len;
+		request->idle = l_idle_create(anqp_cache_hit_idle, request,
+						NULL);
+		l_queue_push_tail(anqp_requests, request);
+
+		return request->id;
+	}
+
+	lookup.wdev_id = wdev_id;
+	lookup.query = (uint8_t *) anqp;
+	lookup.query_len = len;
+
+	query = l_queue_find(anqp_queries, anqp_query_match, &lookup);
+	if (query) {
+		l_debug("Joining pending ANQP query for "MAC,
+				MAC_STR(bss->addr));
+		anqp_dedup_hits++;
+		goto done;
+	}
+
+	anqp_cache_misses++;
+
+	query = l_new(struct anqp_query, 1);
+
+	if (!++anqp_next_query_id)
+		anqp_next_query_id = 1;
+
+	query->id = anqp_next_query_id;
+	query->wdev_id = wdev_id;
+	memcpy(query->key, lookup.key, 6);
+	query->hessid = lookup.hessid;
+	query->query = l_memdup(anqp, len);
+	query->query_len = len;
+	query->frequency = bss->frequency;
+	query->requests = l_queue_new();
 	/*
 	 * WPA3 Specificiation version 3, Section 9.4:
 	 * "A STA shall use a randomized dialog token for every new GAS
 	 * exchange."
 	 */
-	l_getrandom(&request->anqp_token, sizeof(request->anqp_token));
-	request->anqp_data = user_data;
+	l_getrandom(&query->anqp_token, sizeof(query->anqp_token));
 
-	request->frame = anqp_build_frame(addr, bss, request->anqp_token,
-						anqp, len,
-						&request->frame_len);
-
-	iov[0].iov_base = request->frame;
-	iov[0].iov_len = request->frame_len;
-	iov[1].iov_base = NULL;
+	query->frame = anqp_build_frame(addr, bss, query->anqp_token,
+						anqp, len, &query->frame_len);
 
 	l_debug("Sending ANQP request to "MAC, MAC_STR(bss->addr));
 
-	request->id = frame_xchg_start(request->wdev_id, iov,
-				request->frequency, 0, 300, 0,
-				ANQP_GROUP, anqp_frame_timeout, request, NULL,
-				&anqp_frame_prefix, anqp_response_frame_event,
-				NULL);
+	l_queue_push_tail(anqp_queries, query);
+
+	/*
+	 * Start from an idle so that a failure is reported through the
+	 * callback after the caller has the request id.
+	 */
+	if (!anqp_start_idle)
+		anqp_start_idle = l_idle_create(anqp_start_idle_cb, NULL,
+						NULL);
+
+done:
+	anqp_log_stats();
+
+	request->query = query;
+	l_queue_push_tail(query->requests, request);
+	l_queue_push_tail(anqp_requests, request);
 
 	return request->id;
 }
 
 void anqp_cancel(uint32_t id)
 {
-	frame_xchg_cancel(id);
+	struct anqp_request *request;
+	struct anqp_query *query;
+
+	request = l_queue_remove_if(anqp_requests, anqp_request_match_id,
+					L_UINT_TO_PTR(id));
+	if (!request)
+		return;
+
+	query = request->query;
+
+	if (query)
+		l_queue_remove(query->requests, request);
+
+	anqp_request_free(request);
+
+	if (!query || !l_queue_isempty(query->requests))
+		return;
+
+	/* Nobody is waiting for this response any more */
+	if (query->started) {
+		if (query->xchg_id)
+			frame_xchg_cancel(query->xchg_id);
+
+		return;
+	}
+
+	l_queue_remove(anqp_queries, query);
+	anqp_query_free(query);
+}
+
+void anqp_get_cache_stats(uint32_t *hits, uint32_t *misses)
+{
+	if (hits)
+		*hits = anqp_cache_hits + anqp_dedup_hits;
+
+	if (misses)
+		*misses = anqp_cache_misses;
+}
+
+static void anqp_cache_load(void)
+{
+	struct l_settings *settings = storage_anqp_cache_load();
+	char **groups;
+	unsigned int i;
+	uint64_t now = get_time();
+
+	if (!settings)
+		return;
+
+	groups = l_settings_get_groups(settings);
+
+	for (i = 0; groups[i]; i++) {
+		struct anqp_cache_entry *entry;
+		uint8_t key[6];
+		bool hessid;
+		uint64_t expiry;
+		uint8_t *query;
+		uint8_t *response;
+		size_t query_len;
+		size_t response_len;
+
+		if (!util_string_to_address(groups[i] + 1, key))
+			continue;
+
+		if (groups[i][0] != 'H' && groups[i][0] != 'B')
+			continue;
+
+		hessid = groups[i][0] == 'H';
+
+		if (!l_settings_get_uint64(settings, groups[i], "Expiry",
+						&expiry) || expiry <= now)
+			continue;
+
+		query = l_settings_get_bytes(settings, groups[i], "Query",
+						&query_len);
+		response = l_settings_get_bytes(settings, groups[i],
+						"Response", &response_len);
+		if (!query || !response) {
+			l_free(query);
+			l_free(response);
+			continue;
+		}
+
+		if (l_queue_length(anqp_cache) >= ANQP_CACHE_SIZE) {
+			l_free(query);
+			l_free(response);
+			break;
+		}
+
+		entry = l_new(struct anqp_cache_entry, 1);
+		memcpy(entry->key, key, 6);
+		entry->hessid = hessid;
+		entry->query = query;
+		entry->query_len = query_len;
+		entry->response = response;
+		entry->response_len = response_len;
+		entry->expiry = L_MIN(expiry, now + ANQP_CACHE_LIFETIME);
+
+		l_queue_push_tail(anqp_cache, entry);
+	}
+
+	l_strv_free(groups);
+	l_settings_free(settings);
+
+	l_debug("Loaded %u cached ANQP responses", l_queue_length(anqp_cache));
+}
+
+static void anqp_cache_sync(void)
+{
+	struct l_settings *settings = l_settings_new();
+	const struct l_queue_entry *e;
+	uint64_t now = get_time();
+
+	l_queue_foreach_remove(anqp_cache, anqp_cache_entry_expired, &now);
+
+	if (l_queue_isempty(anqp_cache)) {
+		storage_anqp_cache_sync(NULL);
+		l_settings_free(settings);
+		return;
+	}
+
+	for (e = l_queue_get_entries(anqp_cache); e; e = e->next) {
+		struct anqp_cache_entry *entry = e->data;
+		char group[19];
+
+		snprintf(group, sizeof(group), "%c%s",
+				entry->hessid ? 'H' : 'B',
+				util_address_to_string(entry->key));
+
+		l_settings_set_uint64(settings, group, "Expiry",
+					entry->expiry);
+		l_settings_set_bytes(settings, group, "Query", entry->query,
+					entry->query_len);
+		l_settings_set_bytes(settings, group, "Response",
+					entry->response, entry->response_len);
+	}
+
+	storage_anqp_cache_sync(settings);
+	l_settings_free(settings);
+}
+
+int anqp_init(void)
+{
+	anqp_cache = l_queue_new();
+	anqp_queries = l_queue_new();
+	anqp_requests = l_queue_new();
+
+	anqp_cache_load();
+
+	return 0;
+}
+
+void anqp_exit(void)
+{
+	struct l_queue *queries = anqp_queries;
+	struct anqp_query *query;
+
+	anqp_log_stats();
+
+	l_idle_remove(anqp_start_idle);
+	anqp_start_idle = NULL;
+
+	/* Detach the queue so that cancelling does not start queued queries */
+	anqp_queries = NULL;
+
+	while ((query = l_queue_pop_head(queries))) {
+		if (query->xchg_id)
+			frame_xchg_cancel(query->xchg_id);
+		else
+			anqp_query_free(query);
+	}
+
+	l_queue_destroy(queries, NULL);
+
+	l_queue_destroy(anqp_requests, anqp_request_free);
+	anqp_requests = NULL;
+
+	anqp_cache_sync();
+	l_queue_destroy(anqp_cache, anqp_cache_entry_free);
+	anqp_cache = NULL;
 }
+
+IWD_MODULE(anqp, anqp_init, anqp_exit)
+IWD_MODULE_DEPENDS(anqp, frame_xchg)
@@ -33,9 +33,16 @@ typedef void (*anqp_destroy_func_t)(void *user_data);
 typedef void (*anqp_response_func_t)(enum anqp_result result,
 					const void *anqp, size_t len,
 					void *user_data);
+typedef uint64_t (*anqp_get_time_func_t)(void);
 
 uint32_t anqp_request(uint64_t wdev_id, const uint8_t *addr,
 			struct scan_bss *bss, const uint8_t *anqp, size_t len,
 			anqp_response_func_t cb, void *user_data,
 			anqp_destroy_func_t destroy);
 void anqp_cancel(uint32_t id);
+void anqp_get_cache_stats(uint32_t *hits, uint32_t *misses);
+
+void __anqp_set_get_time_func(anqp_get_time_func_t func);
+
+int anqp_init(void);
+void anqp_exit(void);
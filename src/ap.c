@@ -55,9 +55,25 @@
 #include "src/ip-pool.h"
 #include "src/netconfig.h"
 #include "src/ap.h"
+#include "src/aputil.h"
 #include "src/storage.h"
 #include "src/diagnostic.h"
 
+/*
+ * Budget for Probe Responses sent from userspace, per source address and
+ * in total, so that a probe storm can't starve the rest of the event loop.
+ */
+#define AP_PROBE_SOURCE_RATE	4	/* Responses per second */
+#define AP_PROBE_SOURCE_BURST	8
+#define AP_PROBE_TOTAL_RATE	100
+#define AP_PROBE_TOTAL_BURST	64
+#define AP_PROBE_SOURCES_MAX	64
+
+struct ap_token_bucket {
+	uint64_t last;
+	uint64_t tokens;	/* In 1/1000ths of a token */
+};
+
 struct ap_state {
 	struct netdev *netdev;
 	struct l_genl_family *nl80211;
@@ -98,11 +114,21 @@ struct ap_state {
 	uint8_t netconfig_gateway4_mac[6];
 	uint8_t netconfig_dns4_mac[6];
 
+	/* Probe Response up to the per-request IEs, see ap_update_beacon */
+	struct ap_probe_resp_cache pr_cache;
+
+	struct l_queue *probe_sources;
+	struct ap_token_bucket probe_tokens;
+	uint32_t probe_req_rx;
+	uint32_t probe_resp_tx;
+	uint32_t probe_req_throttled;
+
 	bool started : 1;
 	bool gtk_set : 1;
 	bool netconfig_set_addr4 : 1;
 	bool in_event : 1;
 	bool free_pending : 1;
+	bool probe_resp_offload : 1;
 };
 
 struct sta_state {
@@ -135,6 +161,11 @@ struct ap_wsc_pbc_probe_record {
 	uint64_t timestamp;
 };
 
+struct ap_probe_source {
+	uint8_t addr[6];
+	struct ap_token_bucket bucket;
+};
+
 static char **global_addr4_strs;
 static uint32_t netdev_watch;
 static struct l_netlink *rtnl;
@@ -206,6 +237,18 @@ static void ap_reset(struct ap_state *ap)
 		ap->authorized_macs_num = 0;
 	}
 
+	ap_probe_resp_cache_clear(&ap->pr_cache);
+
+	l_debug("Probe Requests: %u received, %u answered, %u throttled",
+		ap->probe_req_rx, ap->probe_resp_tx, ap->probe_req_throttled);
+
+	l_queue_destroy(ap->probe_sources, l_free);
+	ap->probe_sources = NULL;
+	memset(&ap->probe_tokens, 0, sizeof(ap->probe_tokens));
+	ap->probe_req_rx = 0;
+	ap->probe_resp_tx = 0;
+	ap->probe_req_throttled = 0;
+
 	if (ap->mlme_watch)
 		l_genl_family_unregister(ap->nl80211, ap->mlme_watch);
 
@@ -596,6 +639,30 @@ static size_t ap_get_wsc_ie_len(struct ap_state *ap,
 	return 256;
 }
 
+/*
+ * Process the client Probe Request WSC IE, this may cause us to exit
+ * "active PBC mode".
+ */
+static void ap_process_probe_req_wsc(struct ap_state *ap,
+					const struct mmpdu_header *client_frame,
+					size_t client_frame_len)
+{
+	const struct mmpdu_probe_request *req = mmpdu_body(client_frame);
+	size_t req_ies_len = (void *) client_frame + client_frame_len -
+		(void *) req->ies;
+	ssize_t req_wsc_data_size;
+	uint8_t *wsc_data;
+
+	wsc_data = ie_tlv_extract_wsc_payload(req->ies, req_ies_len,
+						&req_wsc_data_size);
+	if (!wsc_data)
+		return;
+
+	ap_process_wsc_probe_req(ap, client_frame->address_2, wsc_data,
+					req_wsc_data_size);
+	l_free(wsc_data);
+}
+
 static size_t ap_write_wsc_ie(struct ap_state *ap,
 				enum mpdu_management_subtype type,
 				const struct mmpdu_header *client_frame,
@@ -610,27 +677,9 @@ static size_t ap_write_wsc_ie(struct ap_state *ap,
 
 	/* WSC IE */
 	if (type == MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE) {
-		const uint8_t *from = client_frame->address_2;
 		struct wsc_probe_response wsc_pr = {};
-		const struct mmpdu_probe_request *req =
-			mmpdu_body(client_frame);
-		size_t req_ies_len = (void *) client_frame + client_frame_len -
-			(void *) req->ies;
-		ssize_t req_wsc_data_size;
-
-		/*
-		 * Process the client Probe Request WSC IE first as it may
-		 * cause us to exit "active PBC mode" and that will be
-		 * immediately reflected in our Probe Response WSC IE.
-		 */
-		wsc_data = ie_tlv_extract_wsc_payload(req->ies, req_ies_len,
-							&req_wsc_data_size);
-		if (wsc_data) {
-			ap_process_wsc_probe_req(ap, from, wsc_data,
-							req_wsc_data_size);
-			l_free(wsc_data);
-		}
 
+		/* The Probe Request WSC IE was processed by ap_probe_req_cb */
 		wsc_pr.version2 = true;
 		wsc_pr.state = WSC_STATE_CONFIGURED;
 
@@ -820,6 +869,19 @@ static size_t ap_build_beacon_pr_head(struct ap_state *ap,
 	return 36 + out_len;
 }
 
+static size_t ap_build_beacon_pr_rsne(struct ap_state *ap, uint8_t *out_buf)
+{
+	struct ie_rsn_info rsn;
+
+	/* TODO: Country IE between TIM IE and RSNE */
+
+	ap_set_rsn_info(ap, &rsn);
+	if (!ie_build_rsne(&rsn, out_buf))
+		return 0;
+
+	return 2 + out_buf[1];
+}
+
 /* Beacon / Probe Response frame portion after the TIM IE */
 static size_t ap_build_beacon_pr_tail(struct ap_state *ap,
 					enum mpdu_management_subtype stype,
@@ -827,20 +889,93 @@ static size_t ap_build_beacon_pr_tail(struct ap_state *ap,
 					size_t req_len, uint8_t *out_buf)
 {
 	size_t len;
-	struct ie_rsn_info rsn;
-
-	/* TODO: Country IE between TIM IE and RSNE */
 
-	/* RSNE */
-	ap_set_rsn_info(ap, &rsn);
-	if (!ie_build_rsne(&rsn, out_buf))
+	len = ap_build_beacon_pr_rsne(ap, out_buf);
+	if (!len)
 		return 0;
-	len = 2 + out_buf[1];
 
 	len += ap_write_extra_ies(ap, stype, req, req_len, out_buf + len);
 	return len;
 }
 
+/*
+ * Everything in our Probe Responses other than the DA and the extra IEs
+ * only changes when the beacon does, so it is built once and reused.
+ */
+static bool ap_build_probe_resp_template(struct ap_state *ap)
+{
+	uint8_t buf[512];
+	size_t head_len, rsne_len;
+	static const uint8_t bcast_addr[6] = {
+		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+	};
+
+	head_len = ap_build_beacon_pr_head(ap,
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					bcast_addr, buf, sizeof(buf));
+	rsne_len = ap_build_beacon_pr_rsne(ap, buf + head_len);
+	if (L_WARN_ON(!head_len || !rsne_len))
+		return false;
+
+	ap_probe_resp_cache_set(&ap->pr_cache, buf, head_len + rsne_len);
+
+	return true;
+}
+
+/*
+ * The P2P IE in our Probe Responses depends on the contents of each Probe
+ * Request so only offload when no such IEs are used.  The WSC IE only
+ * changes together with the beacon.
+ */
+static bool ap_probe_resp_offload_supported(struct ap_state *ap)
+{
+	uint32_t flags = wiphy_get_probe_resp_offload(
+					netdev_get_wiphy(ap->netdev));
+	uint32_t needed = NL80211_PROBE_RESP_OFFLOAD_SUPPORT_WPS |
+				NL80211_PROBE_RESP_OFFLOAD_SUPPORT_WPS2;
+
+	if (ap->ops->write_extra_ies)
+		return false;
+
+	return (flags & needed) == needed;
+}
+
+/*
+ * Build the NL80211_ATTR_PROBE_RESP template for drivers that answer
+ * Probe Requests themselves: our response to a wildcard Probe Request
+ * without any IEs, the driver fills in the DA.
+ */
+static uint8_t *ap_build_probe_resp_offload(struct ap_state *ap,
+						size_t *out_len)
+{
+	struct mmpdu_header req = {};
+	size_t req_len;
+	uint8_t *buf;
+	size_t len;
+
+	if (!ap_probe_resp_cache_is_valid(&ap->pr_cache) &&
+			!ap_build_probe_resp_template(ap))
+		return NULL;
+
+	req.fc.type = MPDU_TYPE_MANAGEMENT;
+	req.fc.subtype = MPDU_MANAGEMENT_SUBTYPE_PROBE_REQUEST;
+	memset(req.address_1, 0xff, 6);
+	memset(req.address_3, 0xff, 6);
+	req_len = mmpdu_header_len(&req);
+
+	buf = l_malloc(ap->pr_cache.template_len + ap_get_extra_ies_len(ap,
+					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					&req, req_len));
+	memcpy(buf, ap->pr_cache.template, ap->pr_cache.template_len);
+	memset(((struct mmpdu_header *) buf)->address_1, 0xff, 6);
+	len = ap->pr_cache.template_len;
+	len += ap_write_extra_ies(ap, MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
+					&req, req_len, buf + len);
+
+	*out_len = len;
+	return buf;
+}
+
 static void ap_set_beacon_cb(struct l_genl_msg *msg, void *user_data)
 {
 	int error = l_genl_msg_get_error(msg);
@@ -858,11 +993,15 @@ void ap_update_beacon(struct ap_state *ap)
 						MPDU_MANAGEMENT_SUBTYPE_BEACON,
 						NULL, 0));
 	size_t head_len, tail_len;
+	L_AUTO_FREE_VAR(uint8_t *, pr) = NULL;
+	size_t pr_len;
 	uint64_t wdev_id = netdev_get_wdev_id(ap->netdev);
 	static const uint8_t bcast_addr[6] = {
 		0xff, 0xff, 0xff, 0xff, 0xff, 0xff
 	};
 
+	ap_probe_resp_cache_invalidate(&ap->pr_cache);
+
 	if (L_WARN_ON(!ap->started))
 		return;
 
@@ -882,6 +1021,13 @@ void ap_update_beacon(struct ap_state *ap)
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE_PROBE_RESP, 0, "");
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE_ASSOC_RESP, 0, "");
 
+	if (ap->probe_resp_offload) {
+		pr = ap_build_probe_resp_offload(ap, &pr_len);
+		if (pr)
+			l_genl_msg_append_attr(cmd, NL80211_ATTR_PROBE_RESP,
+						pr_len, pr);
+	}
+
 	if (l_genl_family_send(ap->nl80211, cmd, ap_set_beacon_cb, NULL, NULL))
 		return;
 
@@ -889,21 +1035,30 @@ void ap_update_beacon(struct ap_state *ap)
 	l_error("Issuing SET_BEACON failed");
 }
 
+static uint32_t ap_send_mgmt_framev(struct ap_state *ap,
+					struct iovec *iov,
+					frame_xchg_cb_t callback,
+					void *user_data)
+{
+	uint32_t ch_freq = scan_channel_to_freq(ap->channel, SCAN_BAND_2_4_GHZ);
+	uint64_t wdev_id = netdev_get_wdev_id(ap->netdev);
+
+	return frame_xchg_start(wdev_id, iov, ch_freq, 0, 0, 0, 0,
+					callback, user_data, NULL, NULL);
+}
+
 static uint32_t ap_send_mgmt_frame(struct ap_state *ap,
 					const struct mmpdu_header *frame,
 					size_t frame_len,
 					frame_xchg_cb_t callback,
 					void *user_data)
 {
-	uint32_t ch_freq = scan_channel_to_freq(ap->channel, SCAN_BAND_2_4_GHZ);
-	uint64_t wdev_id = netdev_get_wdev_id(ap->netdev);
 	struct iovec iov[2];
 
 	iov[0].iov_base = (void *) frame;
 	iov[0].iov_len = frame_len;
 	iov[1].iov_base = NULL;
-	return frame_xchg_start(wdev_id, iov, ch_freq, 0, 0, 0, 0,
-					callback, user_data, NULL, NULL);
+	return ap_send_mgmt_framev(ap, iov, callback, user_data);
 }
 
 #define IP4_FROM_STR(str)						\
@@ -1945,110 +2100,122 @@ static void ap_probe_resp_cb(int err, void *user_data)
 		l_info("AP Probe Response delivered OK");
 }
 
+static bool ap_token_bucket_take(struct ap_token_bucket *bucket,
+					uint64_t now, unsigned int rate,
+					unsigned int burst)
+{
+	/* Time is in microseconds, tokens in thousandths */
+	bucket->tokens += l_time_diff(bucket->last, now) * rate / 1000;
+	bucket->last = now;
+
+	if (bucket->tokens > burst * 1000ULL)
+		bucket->tokens = burst * 1000ULL;
+
+	if (bucket->tokens < 1000)
+		return false;
+
+	bucket->tokens -= 1000;
+	return true;
+}
+
+static bool ap_probe_source_match(const void *a, const void *b)
+{
+	const struct ap_probe_source *source = a;
+
+	return !memcmp(source->addr, b, 6);
+}
+
 /*
- * Parse Probe Request according to 802.11-2016 9.3.3.10 and act according
- * to 802.11-2016 11.1.4.3
+ * Sources are kept in least recently seen order, the oldest one is
+ * recycled once the table is full.
  */
+static bool ap_probe_resp_allowed(struct ap_state *ap, const uint8_t *addr)
+{
+	struct ap_probe_source *source;
+	uint64_t now = l_time_now();
+
+	if (!ap->probe_sources)
+		ap->probe_sources = l_queue_new();
+
+	source = l_queue_remove_if(ap->probe_sources, ap_probe_source_match,
+					addr);
+	if (!source) {
+		if (l_queue_length(ap->probe_sources) >= AP_PROBE_SOURCES_MAX)
+			source = l_queue_pop_head(ap->probe_sources);
+		else
+			source = l_new(struct ap_probe_source, 1);
+
+		memset(source, 0, sizeof(*source));
+		memcpy(source->addr, addr, 6);
+	}
+
+	l_queue_push_tail(ap->probe_sources, source);
+
+	if (!ap_token_bucket_take(&source->bucket, now, AP_PROBE_SOURCE_RATE,
+					AP_PROBE_SOURCE_BURST))
+		return false;
+
+	return ap_token_bucket_take(&ap->probe_tokens, now,
+					AP_PROBE_TOTAL_RATE,
+					AP_PROBE_TOTAL_BURST);
+}
+
+/* Act on a Probe Request according to 802.11-2016 11.1.4.3 */
 static void ap_probe_req_cb(const struct mmpdu_header *hdr, const void *body,
 				size_t body_len, int rssi, void *user_data)
 {
 	struct ap_state *ap = user_data;
-	const struct mmpdu_probe_request *req = body;
-	const char *ssid = NULL;
-	const uint8_t *ssid_list = NULL;
-	size_t ssid_len = 0, ssid_list_len = 0, len;
-	uint8_t dsss_channel = 0;
-	struct ie_tlv_iter iter;
 	const uint8_t *bssid = netdev_get_address(ap->netdev);
-	bool match = false;
-	uint32_t resp_len;
-	uint8_t *resp;
+	size_t req_len = body + body_len - (void *) hdr;
+	uint8_t *extra_ies;
+	size_t extra_len;
+	struct iovec iov[3];
 
 	l_info("AP Probe Request from %s",
 		util_address_to_string(hdr->address_2));
 
-	ie_tlv_iter_init(&iter, req->ies, body_len - sizeof(*req));
-
-	while (ie_tlv_iter_next(&iter))
-		switch (ie_tlv_iter_get_tag(&iter)) {
-		case IE_TYPE_SSID:
-			ssid = (const char *) ie_tlv_iter_get_data(&iter);
-			ssid_len = ie_tlv_iter_get_length(&iter);
-			break;
-
-		case IE_TYPE_SSID_LIST:
-			ssid_list = ie_tlv_iter_get_data(&iter);
-			ssid_list_len = ie_tlv_iter_get_length(&iter);
-			break;
-
-		case IE_TYPE_DSSS_PARAMETER_SET:
-			if (ie_tlv_iter_get_length(&iter) != 1)
-				return;
+	ap->probe_req_rx++;
 
-			dsss_channel = ie_tlv_iter_get_data(&iter)[0];
-			break;
-		}
+	if (!ap_probe_req_match(hdr, body, body_len, bssid, ap->ssid,
+					strlen(ap->ssid), ap->channel))
+		return;
 
 	/*
-	 * Check if we should reply to this Probe Request according to
-	 * 802.11-2016 section 11.1.4.3.2.
+	 * Process the client Probe Request WSC IE first as any PBC mode change
+	 * will be immediately reflected in our Probe Response WSC IE.  This is
+	 * done even if we don't reply ourselves so that the PBC session
+	 * overlap detection sees every enrollee.
 	 */
+	ap_process_probe_req_wsc(ap, hdr, req_len);
 
-	if (memcmp(hdr->address_1, bssid, 6) &&
-			!util_is_broadcast_address(hdr->address_1))
+	/* The driver answers using the NL80211_ATTR_PROBE_RESP template */
+	if (ap->probe_resp_offload)
 		return;
 
-	if (memcmp(hdr->address_3, bssid, 6) &&
-			!util_is_broadcast_address(hdr->address_3))
+	if (!ap_probe_resp_allowed(ap, hdr->address_2)) {
+		ap->probe_req_throttled++;
 		return;
-
-	if (!ssid || ssid_len == 0) /* Wildcard SSID */
-		match = true;
-	else if (ssid && ssid_len == strlen(ap->ssid) && /* One SSID */
-			!memcmp(ssid, ap->ssid, ssid_len))
-		match = true;
-	else if (ssid && ssid_len == 7 && !memcmp(ssid, "DIRECT-", 7) &&
-			!memcmp(ssid, ap->ssid, 7)) /* P2P wildcard */
-		match = true;
-	else if (ssid_list) { /* SSID List */
-		ie_tlv_iter_init(&iter, ssid_list, ssid_list_len);
-
-		while (ie_tlv_iter_next(&iter)) {
-			if (ie_tlv_iter_get_tag(&iter) != IE_TYPE_SSID)
-				return;
-
-			ssid = (const char *) ie_tlv_iter_get_data(&iter);
-			ssid_len = ie_tlv_iter_get_length(&iter);
-
-			if (ssid_len == strlen(ap->ssid) &&
-					!memcmp(ssid, ap->ssid, ssid_len)) {
-				match = true;
-				break;
-			}
-		}
 	}
 
-	if (dsss_channel != 0 && dsss_channel != ap->channel)
-		match = false;
-
-	if (!match)
+	if (!ap_probe_resp_cache_is_valid(&ap->pr_cache) &&
+			!ap_build_probe_resp_template(ap))
 		return;
 
-	resp_len = 512 + ap_get_extra_ies_len(ap,
+	extra_len = ap_get_extra_ies_len(ap,
 					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					hdr, body + body_len - (void *) hdr);
-	resp = l_new(uint8_t, resp_len);
-	len = ap_build_beacon_pr_head(ap,
+					hdr, req_len);
+	extra_ies = ap_probe_resp_cache_get_extra_ies(&ap->pr_cache,
+							extra_len);
+	extra_len = ap_write_extra_ies(ap,
 					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					hdr->address_2, resp, resp_len);
-	len += ap_build_beacon_pr_tail(ap,
-					MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE,
-					hdr, body + body_len - (void *) hdr,
-					resp + len);
+					hdr, req_len, extra_ies);
+
+	/* The template is copied when sent */
+	ap_probe_resp_cache_assemble(&ap->pr_cache, hdr->address_2,
+					extra_len, iov);
 
-	ap_send_mgmt_frame(ap, (struct mmpdu_header *) resp, len,
-				ap_probe_resp_cb, NULL);
-	l_free(resp);
+	if (ap_send_mgmt_framev(ap, iov, ap_probe_resp_cb, NULL))
+		ap->probe_resp_tx++;
 }
 
 /* 802.11-2016 9.3.3.5 (frame format), 802.11-2016 11.3.5.9 (MLME/SME) */
@@ -2306,6 +2473,8 @@ static struct l_genl_msg *ap_build_cmd_start_ap(struct ap_state *ap)
 						MPDU_MANAGEMENT_SUBTYPE_BEACON,
 						NULL, 0));
 	size_t head_len, tail_len;
+	L_AUTO_FREE_VAR(uint8_t *, pr) = NULL;
+	size_t pr_len = 0;
 
 	uint32_t dtim_period = 3;
 	uint32_t ifindex = netdev_get_ifindex(ap->netdev);
@@ -2339,8 +2508,11 @@ static struct l_genl_msg *ap_build_cmd_start_ap(struct ap_state *ap)
 	if (!head_len || !tail_len)
 		return NULL;
 
+	if (ap->probe_resp_offload)
+		pr = ap_build_probe_resp_offload(ap, &pr_len);
+
 	cmd = l_genl_msg_new_sized(NL80211_CMD_START_AP, 256 + head_len +
-					tail_len + strlen(ap->ssid));
+					tail_len + pr_len + strlen(ap->ssid));
 
 	/* SET_BEACON attrs */
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_BEACON_HEAD, head_len, head);
@@ -2349,6 +2521,10 @@ static struct l_genl_msg *ap_build_cmd_start_ap(struct ap_state *ap)
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE_PROBE_RESP, 0, "");
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_IE_ASSOC_RESP, 0, "");
 
+	if (pr)
+		l_genl_msg_append_attr(cmd, NL80211_ATTR_PROBE_RESP,
+					pr_len, pr);
+
 	/* START_AP attrs */
 	l_genl_msg_append_attr(cmd, NL80211_ATTR_BEACON_INTERVAL, 4,
 				&ap->beacon_interval);
@@ -3199,6 +3375,7 @@ struct ap_state *ap_start(struct netdev *netdev, struct l_settings *config,
 	ap->ciphers = wiphy_select_cipher(wiphy, 0xffff);
 	ap->group_cipher = wiphy_select_cipher(wiphy, 0xffff);
 	ap->beacon_interval = 100;
+	ap->probe_resp_offload = ap_probe_resp_offload_supported(ap);
 
 	wsc_uuid_from_addr(netdev_get_address(netdev), ap->wsc_uuid_r);
 
@@ -0,0 +1,181 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <sys/uio.h>
+
+#include <ell/ell.h>
+
+#include "src/util.h"
+#include "src/ie.h"
+#include "src/mpdu.h"
+#include "src/aputil.h"
+
+/*
+ * Parse Probe Request according to 802.11-2016 9.3.3.10 and check whether
+ * we should reply to it according to 802.11-2016 section 11.1.4.3.2.
+ */
+bool ap_probe_req_match(const struct mmpdu_header *hdr, const void *body,
+			size_t body_len, const uint8_t *bssid,
+			const char *ap_ssid, size_t ap_ssid_len,
+			uint8_t channel)
+{
+	const struct mmpdu_probe_request *req = body;
+	const char *ssid = NULL;
+	const uint8_t *ssid_list = NULL;
+	size_t ssid_len = 0, ssid_list_len = 0;
+	uint8_t dsss_channel = 0;
+	struct ie_tlv_iter iter;
+	bool match = false;
+
+	if (memcmp(hdr->address_1, bssid, 6) &&
+			!util_is_broadcast_address(hdr->address_1))
+		return false;
+
+	if (memcmp(hdr->address_3, bssid, 6) &&
+			!util_is_broadcast_address(hdr->address_3))
+		return false;
+
+	ie_tlv_iter_init(&iter, req->ies, body_len - sizeof(*req));
+
+	while (ie_tlv_iter_next(&iter))
+		switch (ie_tlv_iter_get_tag(&iter)) {
+		case IE_TYPE_SSID:
+			ssid = (const char *) ie_tlv_iter_get_data(&iter);
+			ssid_len = ie_tlv_iter_get_length(&iter);
+			break;
+
+		case IE_TYPE_SSID_LIST:
+			ssid_list = ie_tlv_iter_get_data(&iter);
+			ssid_list_len = ie_tlv_iter_get_length(&iter);
+			break;
+
+		case IE_TYPE_DSSS_PARAMETER_SET:
+			if (ie_tlv_iter_get_length(&iter) != 1)
+				return false;
+
+			dsss_channel = ie_tlv_iter_get_data(&iter)[0];
+			break;
+		}
+
+	if (dsss_channel != 0 && dsss_channel != channel)
+		return false;
+
+	if (!ssid || ssid_len == 0) /* Wildcard SSID */
+		match = true;
+	else if (ssid_len == ap_ssid_len && /* One SSID */
+			!memcmp(ssid, ap_ssid, ssid_len))
+		match = true;
+	else if (ssid_len == 7 && !memcmp(ssid, "DIRECT-", 7) &&
+			ap_ssid_len >= 7 &&
+			!memcmp(ssid, ap_ssid, 7)) /* P2P wildcard */
+		match = true;
+	else if (ssid_list) { /* SSID List */
+		ie_tlv_iter_init(&iter, ssid_list, ssid_list_len);
+
+		while (ie_tlv_iter_next(&iter)) {
+			if (ie_tlv_iter_get_tag(&iter) != IE_TYPE_SSID)
+				return false;
+
+			ssid = (const char *) ie_tlv_iter_get_data(&iter);
+			ssid_len = ie_tlv_iter_get_length(&iter);
+
+			if (ssid_len == ap_ssid_len &&
+					!memcmp(ssid, ap_ssid, ssid_len)) {
+				match = true;
+				break;
+			}
+		}
+	}
+
+	return match;
+}
+
+/* Takes a copy of the Probe Response head, any DA will do */
+void ap_probe_resp_cache_set(struct ap_probe_resp_cache *cache,
+				const void *frame, size_t len)
+{
+	l_free(cache->template);
+	cache->template = l_memdup(frame, len);
+	cache->template_len = len;
+}
+
+bool ap_probe_resp_cache_is_valid(const struct ap_probe_resp_cache *cache)
+{
+	return cache->template != NULL;
+}
+
+/* The beacon has changed, the extra IE buffer can still be reused */
+void ap_probe_resp_cache_invalidate(struct ap_probe_resp_cache *cache)
+{
+	l_free(cache->template);
+	cache->template = NULL;
+	cache->template_len = 0;
+}
+
+void ap_probe_resp_cache_clear(struct ap_probe_resp_cache *cache)
+{
+	ap_probe_resp_cache_invalidate(cache);
+
+	l_free(cache->extra_ies);
+	cache->extra_ies = NULL;
+	cache->extra_ies_size = 0;
+}
+
+/* Returns a buffer for at least len bytes of extra IEs */
+uint8_t *ap_probe_resp_cache_get_extra_ies(struct ap_probe_resp_cache *cache,
+						size_t len)
+{
+	if (len > cache->extra_ies_size) {
+		l_free(cache->extra_ies);
+		cache->extra_ies = l_malloc(len);
+		cache->extra_ies_size = len;
+	}
+
+	return cache->extra_ies;
+}
+
+/*
+ * Fills in the 3-element, NULL terminated, iov with the Probe Response to
+ * da, followed by the first extra_len bytes of the extra IE buffer.  The
+ * DA is patched into the template in place, so the frame has to be copied
+ * before the next call.
+ */
+void ap_probe_resp_cache_assemble(struct ap_probe_resp_cache *cache,
+					const uint8_t *da, size_t extra_len,
+					struct iovec *iov)
+{
+	struct mmpdu_header *hdr = (struct mmpdu_header *) cache->template;
+
+	memcpy(hdr->address_1, da, 6);
+
+	iov[0].iov_base = cache->template;
+	iov[0].iov_len = cache->template_len;
+	iov[1].iov_base = extra_len ? cache->extra_ies : NULL;
+	iov[1].iov_len = extra_len;
+	iov[2].iov_base = NULL;
+	iov[2].iov_len = 0;
+}
@@ -0,0 +1,55 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+struct mmpdu_header;
+struct iovec;
+
+bool ap_probe_req_match(const struct mmpdu_header *hdr, const void *body,
+			size_t body_len, const uint8_t *bssid,
+			const char *ap_ssid, size_t ap_ssid_len,
+			uint8_t channel);
+
+/*
+ * Probe Response up to the per-request extra IEs, plus a buffer for those
+ * IEs that is reused between requests.
+ */
+struct ap_probe_resp_cache {
+	uint8_t *template;
+	size_t template_len;
+	uint8_t *extra_ies;
+	size_t extra_ies_size;
+};
+
+void ap_probe_resp_cache_set(struct ap_probe_resp_cache *cache,
+				const void *frame, size_t len);
+bool ap_probe_resp_cache_is_valid(const struct ap_probe_resp_cache *cache);
+void ap_probe_resp_cache_invalidate(struct ap_probe_resp_cache *cache);
+void ap_probe_resp_cache_clear(struct ap_probe_resp_cache *cache);
+uint8_t *ap_probe_resp_cache_get_extra_ies(struct ap_probe_resp_cache *cache,
+						size_t len);
+void ap_probe_resp_cache_assemble(struct ap_probe_resp_cache *cache,
+					const uint8_t *da, size_t extra_len,
+					struct iovec *iov);
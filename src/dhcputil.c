@@ -0,0 +1,266 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <ell/ell.h>
+
+#include "src/util.h"
+#include "src/dhcputil.h"
+
+#define DHCP_LEASE_GROUP "IPv4Lease"
+
+/*
+ * Don't bother installing a remembered address that would expire before
+ * the DHCP exchange running in parallel had a realistic chance to finish.
+ */
+#define DHCP_SAVED_LEASE_MIN_REMAINING 30
+
+static bool dhcp_load_ipv4(const struct l_settings *settings, const char *key,
+				char *out)
+{
+	_auto_(l_free) char *str = l_settings_get_string(settings,
+							DHCP_LEASE_GROUP, key);
+	struct in_addr in_addr;
+
+	if (!str || inet_pton(AF_INET, str, &in_addr) != 1)
+		return false;
+
+	return inet_ntop(AF_INET, &in_addr, out, INET_ADDRSTRLEN) != NULL;
+}
+
+struct dhcp_saved_lease *dhcp_saved_lease_load(
+					const struct l_settings *settings)
+{
+	struct dhcp_saved_lease *lease;
+	_auto_(l_free) char *client_addr = NULL;
+	_auto_(l_strv_free) char **bssids = NULL;
+	unsigned int prefix_len;
+	char **i;
+
+	if (!l_settings_has_group(settings, DHCP_LEASE_GROUP))
+		return NULL;
+
+	lease = l_new(struct dhcp_saved_lease, 1);
+
+	if (!dhcp_load_ipv4(settings, "Address", lease->address) ||
+			!dhcp_load_ipv4(settings, "Server", lease->server))
+		goto invalid;
+
+	if (l_settings_has_key(settings, DHCP_LEASE_GROUP, "Gateway") &&
+			!dhcp_load_ipv4(settings, "Gateway", lease->gateway))
+		goto invalid;
+
+	if (!l_settings_get_uint(settings, DHCP_LEASE_GROUP, "PrefixLength",
+					&prefix_len) ||
+			prefix_len < 1 || prefix_len > 30)
+		goto invalid;
+
+	lease->prefix_len = prefix_len;
+
+	if (!l_settings_get_uint64(settings, DHCP_LEASE_GROUP, "Expires",
+					&lease->expires))
+		goto invalid;
+
+	client_addr = l_settings_get_string(settings, DHCP_LEASE_GROUP,
+						"ClientAddress");
+	if (!client_addr ||
+			!util_string_to_address(client_addr,
+							lease->client_addr))
+		goto invalid;
+
+	lease->dns = l_settings_get_string_list(settings, DHCP_LEASE_GROUP,
+						"DNS", ' ');
+
+	for (i = lease->dns; i && *i; i++) {
+		struct in_addr in_addr;
+
+		if (inet_pton(AF_INET, *i, &in_addr) != 1)
+			goto invalid;
+	}
+
+	if (lease->dns && !lease->dns[0])
+		l_strv_free(l_steal_ptr(lease->dns));
+
+	bssids = l_settings_get_string_list(settings, DHCP_LEASE_GROUP,
+						"BSSIDs", ' ');
+
+	for (i = bssids; i && *i; i++) {
+		uint8_t bssid[6];
+
+		if (lease->n_bssids == DHCP_SAVED_LEASE_MAX_BSSIDS ||
+				!util_string_to_address(*i, bssid))
+			goto invalid;
+
+		dhcp_saved_lease_add_bssid(lease, bssid);
+	}
+
+	/* Without a BSSID there is nothing to tie the lease to a site */
+	if (!lease->n_bssids)
+		goto invalid;
+
+	return lease;
+
+invalid:
+	l_debug("Ignoring invalid [%s] group", DHCP_LEASE_GROUP);
+	dhcp_saved_lease_free(lease);
+	return NULL;
+}
+
+void dhcp_saved_lease_save(struct l_settings *settings,
+				const struct dhcp_saved_lease *lease)
+{
+	dhcp_saved_lease_remove(settings);
+
+	l_settings_set_string(settings, DHCP_LEASE_GROUP, "Address",
+				lease->address);
+	l_settings_set_uint(settings, DHCP_LEASE_GROUP, "PrefixLength",
+				lease->prefix_len);
+	l_settings_set_string(settings, DHCP_LEASE_GROUP, "Server",
+				lease->server);
+
+	if (lease->gateway[0])
+		l_settings_set_string(settings, DHCP_LEASE_GROUP, "Gateway",
+					lease->gateway);
+
+	if (lease->dns && lease->dns[0])
+		l_settings_set_string_list(settings, DHCP_LEASE_GROUP, "DNS",
+						lease->dns, ' ');
+
+	l_settings_set_string(settings, DHCP_LEASE_GROUP, "ClientAddress",
+				util_address_to_string(lease->client_addr));
+	l_settings_set_uint64(settings, DHCP_LEASE_GROUP, "Expires",
+				lease->expires);
+
+	if (lease->n_bssids) {
+		char *bssids[DHCP_SAVED_LEASE_MAX_BSSIDS + 1];
+		uint8_t i;
+
+		for (i = 0; i < lease->n_bssids; i++)
+			bssids[i] = l_strdup(
+				util_address_to_string(lease->bssids[i]));
+
+		bssids[i] = NULL;
+
+		l_settings_set_string_list(settings, DHCP_LEASE_GROUP,
+						"BSSIDs", bssids, ' ');
+
+		for (i = 0; i < lease->n_bssids; i++)
+			l_free(bssids[i]);
+	}
+}
+
+void dhcp_saved_lease_remove(struct l_settings *settings)
+{
+	l_settings_remove_group(settings, DHCP_LEASE_GROUP);
+}
+
+static bool dhcp_saved_lease_has_bssid(const struct dhcp_saved_lease *lease,
+					const uint8_t *bssid)
+{
+	uint8_t i;
+
+	for (i = 0; i < lease->n_bssids; i++)
+		if (!memcmp(lease->bssids[i], bssid, 6))
+			return true;
+
+	return false;
+}
+
+/*
+ * A saved lease is only usable by the interface address it was handed out
+ * to, the server keys its bindings on the client hardware address, only
+ * through an AP of the ESS it was obtained on and only while enough of its
+ * lifetime remains.
+ */
+bool dhcp_saved_lease_usable(const struct dhcp_saved_lease *lease,
+				const uint8_t *client_addr,
+				const uint8_t *bssid, uint64_t now)
+{
+	if (memcmp(lease->client_addr, client_addr, 6))
+		return false;
+
+	if (!bssid || !dhcp_saved_lease_has_bssid(lease, bssid))
+		return false;
+
+	return lease->expires > now + DHCP_SAVED_LEASE_MIN_REMAINING;
+}
+
+/*
+ * Remembers a BSSID the lease was used through, forgetting the oldest one
+ * once the list is full.
+ */
+void dhcp_saved_lease_add_bssid(struct dhcp_saved_lease *lease,
+				const uint8_t *bssid)
+{
+	if (dhcp_saved_lease_has_bssid(lease, bssid))
+		return;
+
+	if (lease->n_bssids == DHCP_SAVED_LEASE_MAX_BSSIDS) {
+		memmove(lease->bssids[0], lease->bssids[1],
+				(DHCP_SAVED_LEASE_MAX_BSSIDS - 1) * 6);
+		lease->n_bssids--;
+	}
+
+	memcpy(lease->bssids[lease->n_bssids++], bssid, 6);
+}
+
+/*
+ * Compares everything but the expiry time, which changes with each renewal
+ * without making the lease any different.
+ */
+bool dhcp_saved_lease_equal(const struct dhcp_saved_lease *a,
+				const struct dhcp_saved_lease *b)
+{
+	char **dns_a = a->dns;
+	char **dns_b = b->dns;
+
+	if (strcmp(a->address, b->address) || a->prefix_len != b->prefix_len ||
+			strcmp(a->server, b->server) ||
+			strcmp(a->gateway, b->gateway) ||
+			memcmp(a->client_addr, b->client_addr, 6))
+		return false;
+
+	if (a->n_bssids != b->n_bssids ||
+			memcmp(a->bssids, b->bssids, a->n_bssids * 6))
+		return false;
+
+	for (; dns_a && *dns_a && dns_b && *dns_b; dns_a++, dns_b++)
+		if (strcmp(*dns_a, *dns_b))
+			return false;
+
+	return !(dns_a && *dns_a) && !(dns_b && *dns_b);
+}
+
+void dhcp_saved_lease_free(struct dhcp_saved_lease *lease)
+{
+	if (!lease)
+		return;
+
+	l_strv_free(lease->dns);
+	l_free(lease);
+}
@@ -0,0 +1,60 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+struct l_settings;
+
+#define DHCP_SAVED_LEASE_MAX_BSSIDS 16
+
+/*
+ * A DHCPv4 lease as remembered in the network profile so that it can be
+ * reused on the next connection to the same network.  The BSSIDs the lease
+ * was used through tell apart networks sharing an SSID at different sites.
+ */
+struct dhcp_saved_lease {
+	char address[INET_ADDRSTRLEN];
+	uint8_t prefix_len;
+	char server[INET_ADDRSTRLEN];
+	char gateway[INET_ADDRSTRLEN];	/* Empty if not provided */
+	char **dns;			/* NULL if not provided */
+	uint8_t client_addr[6];
+	uint8_t bssids[DHCP_SAVED_LEASE_MAX_BSSIDS][6];
+	uint8_t n_bssids;
+	uint64_t expires;		/* Seconds since the Epoch */
+};
+
+struct dhcp_saved_lease *dhcp_saved_lease_load(
+					const struct l_settings *settings);
+void dhcp_saved_lease_save(struct l_settings *settings,
+				const struct dhcp_saved_lease *lease);
+void dhcp_saved_lease_remove(struct l_settings *settings);
+bool dhcp_saved_lease_usable(const struct dhcp_saved_lease *lease,
+				const uint8_t *client_addr,
+				const uint8_t *bssid, uint64_t now);
+void dhcp_saved_lease_add_bssid(struct dhcp_saved_lease *lease,
+				const uint8_t *bssid);
+bool dhcp_saved_lease_equal(const struct dhcp_saved_lease *a,
+				const struct dhcp_saved_lease *b);
+void dhcp_saved_lease_free(struct dhcp_saved_lease *lease);
@@ -26,6 +26,7 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <ell/ell.h>
 
 #include "src/missing.h"
@@ -852,19 +853,154 @@ static bool is_embedded(const char *str)
 	return false;
 }
 
-static struct l_queue *eap_tls_load_ca_cert(struct l_settings *settings,
-						const char *value)
-{
+/*
+ * The CA certificates are loaded and parsed on every settings check and
+ * on every connection attempt, which is costly for large bundles such as
+ * the system-wide trust store.  Keep the most recently used lists parsed
+ * in memory, keyed on the file identity or the embedded PEM contents.
+ */
+#define EAP_TLS_CA_CACHE_SIZE 4
+
+struct eap_tls_ca_cache_entry {
+	char *path;
+	char *pem;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct l_queue *certs;
+};
+
+struct eap_tls_ca_cache_key {
+	const char *path;
 	const char *pem;
+	const struct stat *st;
+};
 
-	if (!is_embedded(value))
-		return l_pem_load_certificate_list(value);
+static struct l_queue *eap_tls_ca_cache;
 
-	pem = load_embedded_pem(settings, value);
-	if (!pem)
+static void eap_tls_ca_cache_entry_free(void *data)
+{
+	struct eap_tls_ca_cache_entry *entry = data;
+
+	l_queue_destroy(entry->certs, (l_queue_destroy_func_t) l_cert_free);
+	l_free(entry->path);
+	l_free(entry->pem);
+	l_free(entry);
+}
+
+static bool eap_tls_ca_cache_entry_match(const void *a, const void *b)
+{
+	const struct eap_tls_ca_cache_entry *entry = a;
+	const struct eap_tls_ca_cache_key *key = b;
+
+	if (key->pem)
+		return entry->pem && !strcmp(entry->pem, key->pem);
+
+	return entry->path && !strcmp(entry->path, key->path) &&
+		entry->dev == key->st->st_dev &&
+		entry->ino == key->st->st_ino &&
+		entry->size == key->st->st_size &&
+		entry->mtime.tv_sec == key->st->st_mtim.tv_sec &&
+		entry->mtime.tv_nsec == key->st->st_mtim.tv_nsec;
+}
+
+static struct l_queue *eap_tls_ca_cert_copy(struct l_queue *certs)
+{
+	const struct l_queue_entry *entry;
+	struct l_queue *copy = l_queue_new();
+
+	for (entry = l_queue_get_entries(certs); entry; entry = entry->next) {
+		const uint8_t *der;
+		size_t der_len;
+		struct l_cert *cert;
+
+		der = l_cert_get_der_data(entry->data, &der_len);
+		cert = l_cert_new_from_der(der, der_len);
+		if (!cert) {
+			l_queue_destroy(copy,
+					(l_queue_destroy_func_t) l_cert_free);
+			return NULL;
+		}
+
+		l_queue_push_tail(copy, cert);
+	}
+
+	return copy;
+}
+
+static void eap_tls_ca_cache_add(const struct eap_tls_ca_cache_key *key,
+					struct l_queue *certs)
+{
+	struct eap_tls_ca_cache_entry *entry;
+
+	if (!eap_tls_ca_cache)
+		eap_tls_ca_cache = l_queue_new();
+
+	if (l_queue_length(eap_tls_ca_cache) >= EAP_TLS_CA_CACHE_SIZE) {
+		entry = l_queue_peek_tail(eap_tls_ca_cache);
+		l_queue_remove(eap_tls_ca_cache, entry);
+		eap_tls_ca_cache_entry_free(entry);
+	}
+
+	entry = l_new(struct eap_tls_ca_cache_entry, 1);
+	entry->certs = certs;
+
+	if (key->pem)
+		entry->pem = l_strdup(key->pem);
+	else {
+		entry->path = l_strdup(key->path);
+		entry->dev = key->st->st_dev;
+		entry->ino = key->st->st_ino;
+		entry->size = key->st->st_size;
+		entry->mtime = key->st->st_mtim;
+	}
+
+	l_queue_push_head(eap_tls_ca_cache, entry);
+}
+
+/*
+ * l_tls takes ownership of the CA certificates so callers always get their
+ * own copy, the cached list is never handed out.
+ */
+struct l_queue *eap_tls_load_ca_cert(struct l_settings *settings,
+					const char *value)
+{
+	struct eap_tls_ca_cache_key key = {};
+	struct eap_tls_ca_cache_entry *entry;
+	struct l_queue *certs;
+	struct stat st;
+
+	if (!is_embedded(value)) {
+		if (stat(value, &st) < 0)
+			return NULL;
+
+		key.path = value;
+		key.st = &st;
+	} else {
+		key.pem = load_embedded_pem(settings, value);
+		if (!key.pem)
+			return NULL;
+	}
+
+	entry = l_queue_remove_if(eap_tls_ca_cache,
+					eap_tls_ca_cache_entry_match, &key);
+	if (entry) {
+		l_queue_push_head(eap_tls_ca_cache, entry);
+		return eap_tls_ca_cert_copy(entry->certs);
+	}
+
+	if (key.pem)
+		certs = l_pem_load_certificate_list_from_data(key.pem,
+							strlen(key.pem));
+	else
+		certs = l_pem_load_certificate_list(value);
+
+	if (!certs)
 		return NULL;
 
-	return l_pem_load_certificate_list_from_data(pem, strlen(pem));
+	eap_tls_ca_cache_add(&key, certs);
+	return eap_tls_ca_cert_copy(certs);
 }
 
 struct l_certchain *eap_tls_load_client_cert(struct l_settings *settings,
@@ -1077,3 +1213,11 @@ void eap_tls_common_tunnel_close(struct eap_state *eap)
 
 	l_tls_close(eap_tls->tunnel);
 }
+
+static void eap_tls_common_exit(void)
+{
+	l_queue_destroy(eap_tls_ca_cache, eap_tls_ca_cache_entry_free);
+	eap_tls_ca_cache = NULL;
+}
+
+EAP_METHOD_BUILTIN(eap_tls_common, NULL, eap_tls_common_exit)
@@ -48,6 +48,8 @@ void eap_tls_common_handle_request(struct eap_state *eap,
 void eap_tls_common_handle_retransmit(struct eap_state *eap,
 						const uint8_t *pkt, size_t len);
 
+struct l_queue *eap_tls_load_ca_cert(struct l_settings *settings,
+					const char *value);
 struct l_certchain *eap_tls_load_client_cert(struct l_settings *settings,
 						const char *value,
 						const char *passphrase,
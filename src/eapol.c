@@ -2634,6 +2634,14 @@ static void eapol_rx_packet(uint16_t proto, const uint8_t *from,
 							eapol_eap_results_cb);
 		}
 
+		/*
+		 * The first EAP packet means the authenticator is running
+		 * full EAP rather than using any PMKSA we offered
+		 */
+		if (!sm->eap_exchanged)
+			handshake_event(sm->handshake,
+					HANDSHAKE_EVENT_EAP_STARTED);
+
 		sm->eap_exchanged = true;
 		sm->last_eap_unencrypted = unencrypted;
 
@@ -2650,7 +2658,7 @@ static void eapol_rx_packet(uint16_t proto, const uint8_t *from,
 			/*
 			 * Either this is an error (EAP negotiation in
 			 * progress) or the server is giving us a chance to
-			 * use a cached PMK.  We don't yet cache PMKs so
+			 * use a cached PMK.  We have no PMKSA for this AP so
 			 * send an EAPOL-Start if we haven't sent one yet.
 			 */
 			if (sm->eapol_start_timeout) {
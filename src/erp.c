@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 
 #include <ell/ell.h>
 
@@ -100,7 +101,18 @@ struct erp_tlv_iter {
 	const unsigned char *data;
 };
 
-static struct l_queue *key_cache;
+/*
+ * Entries are hashed by identity and by SSID, the SSID map pointing to the
+ * most recently added entry for that SSID.  expiry_queue holds every valid
+ * entry ordered by expiration time so expired entries can be pruned from
+ * the head without walking the whole cache.  Entries that expire or get
+ * removed while referenced are marked invalid, dropped from all lookup
+ * structures and freed by the last erp_cache_put().
+ */
+static struct l_hashmap *id_cache;
+static struct l_hashmap *ssid_cache;
+static struct l_queue *expiry_queue;
+static erp_cache_changed_func_t cache_changed;
 
 static void erp_tlv_iter_init(struct erp_tlv_iter *iter,
 				const unsigned char *tlv, unsigned int len)
@@ -151,6 +163,7 @@ static void erp_cache_entry_destroy(void *data)
 		l_error("ERP entry still has a reference on cleanup!");
 
 	l_free(entry->id);
+	explicit_bzero(entry->emsk, entry->emsk_len);
 	l_free(entry->emsk);
 	l_free(entry->session_id);
 	l_free(entry->ssid);
@@ -158,16 +171,99 @@ static void erp_cache_entry_destroy(void *data)
 	l_free(entry);
 }
 
-void erp_cache_add(const char *id, const void *session_id,
-			size_t session_len, const void *emsk, size_t emsk_len,
-			const char *ssid)
+static int erp_cache_entry_compare(const void *a, const void *b,
+					void *user_data)
 {
-	struct erp_cache_entry *entry;
+	const struct erp_cache_entry *new = a;
+	const struct erp_cache_entry *cur = b;
+
+	return l_time_before(new->expire_time, cur->expire_time) ? -1 : 1;
+}
+
+static void erp_cache_find_ssid(const void *key, void *value,
+				void *user_data)
+{
+	struct erp_cache_entry *entry = value;
+	struct erp_cache_entry **found = user_data;
+
+	if (strcmp(entry->ssid, (*found)->ssid))
+		return;
+
+	if (*found == entry || (*found)->invalid ||
+			l_time_after(entry->expire_time, (*found)->expire_time))
+		*found = entry;
+}
+
+static void erp_cache_unlink(struct erp_cache_entry *entry)
+{
+	struct erp_cache_entry *next = entry;
+
+	l_queue_remove(expiry_queue, entry);
+
+	if (l_hashmap_lookup(id_cache, entry->id) == entry)
+		l_hashmap_remove(id_cache, entry->id);
 
-	if (!unlikely(id || session_id || emsk))
+	if (l_hashmap_lookup(ssid_cache, entry->ssid) != entry)
 		return;
 
-	entry = l_new(struct erp_cache_entry, 1);
+	l_hashmap_remove(ssid_cache, entry->ssid);
+
+	/* Fall back to another identity cached for the same SSID, if any */
+	entry->invalid = true;
+	l_hashmap_foreach(id_cache, erp_cache_find_ssid, &next);
+
+	if (next != entry)
+		l_hashmap_insert(ssid_cache, next->ssid, next);
+}
+
+static void erp_cache_entry_release(struct erp_cache_entry *entry)
+{
+	erp_cache_unlink(entry);
+
+	if (entry->ref) {
+		entry->invalid = true;
+		return;
+	}
+
+	erp_cache_entry_destroy(entry);
+}
+
+static void erp_cache_prune(void)
+{
+	uint64_t now = l_time_now();
+	struct erp_cache_entry *entry;
+
+	while ((entry = l_queue_peek_head(expiry_queue))) {
+		if (l_time_before(now, entry->expire_time))
+			break;
+
+		l_debug("ERP cache entry for %s expired", entry->id);
+		erp_cache_entry_release(entry);
+	}
+}
+
+static void erp_cache_insert(struct erp_cache_entry *entry)
+{
+	struct erp_cache_entry *old;
+
+	old = l_hashmap_lookup(id_cache, entry->id);
+	if (old)
+		erp_cache_entry_release(old);
+
+	l_hashmap_remove(ssid_cache, entry->ssid);
+
+	l_queue_insert(expiry_queue, entry, erp_cache_entry_compare, NULL);
+	l_hashmap_insert(id_cache, entry->id, entry);
+	l_hashmap_insert(ssid_cache, entry->ssid, entry);
+}
+
+static struct erp_cache_entry *erp_cache_entry_new(const char *id,
+					const void *session_id,
+					size_t session_len,
+					const void *emsk, size_t emsk_len,
+					const char *ssid, uint64_t lifetime)
+{
+	struct erp_cache_entry *entry = l_new(struct erp_cache_entry, 1);
 
 	entry->id = l_strdup(id);
 	entry->emsk = l_memdup(emsk, emsk_len);
@@ -175,67 +271,54 @@ void erp_cache_add(const char *id, const void *session_id,
 	entry->session_id = l_memdup(session_id, session_len);
 	entry->session_len = session_len;
 	entry->ssid = l_strdup(ssid);
-	entry->expire_time = l_time_offset(l_time_now(),
-					ERP_DEFAULT_KEY_LIFETIME_US);
+	entry->expire_time = l_time_offset(l_time_now(), lifetime);
 
-	l_queue_push_head(key_cache, entry);
+	return entry;
 }
 
-static struct erp_cache_entry *find_keycache(const char *id, const char *ssid)
+void erp_cache_add(const char *id, const void *session_id,
+			size_t session_len, const void *emsk, size_t emsk_len,
+			const char *ssid)
 {
-	const struct l_queue_entry *entry;
-
-	if (!id && !ssid)
-		return NULL;
-
-	for (entry = l_queue_get_entries(key_cache); entry;
-			entry = entry->next) {
-		struct erp_cache_entry *cache = entry->data;
-
-		if (cache->invalid)
-			continue;
-
-		if (l_time_after(l_time_now(), cache->expire_time)) {
-			if (!cache->ref) {
-				l_queue_remove(key_cache, cache);
-				erp_cache_entry_destroy(cache);
-			} else
-				cache->invalid = true;
+	if (unlikely(!id || !session_id || !emsk || !ssid))
+		return;
 
-			continue;
-		}
+	if (emsk_len > sizeof(((struct erp_state *) NULL)->r_rk))
+		return;
 
-		if (id && !strcmp(cache->id, id))
-			return cache;
+	erp_cache_prune();
 
-		if (ssid && !strcmp(cache->ssid, ssid))
-			return cache;
-	}
+	erp_cache_insert(erp_cache_entry_new(id, session_id, session_len,
+						emsk, emsk_len, ssid,
+						ERP_DEFAULT_KEY_LIFETIME_US));
 
-	return NULL;
+	if (cache_changed)
+		cache_changed();
 }
 
 void erp_cache_remove(const char *id)
 {
-	struct erp_cache_entry *entry = find_keycache(id, NULL);
+	struct erp_cache_entry *entry;
 
-	if (!entry)
-		return;
+	erp_cache_prune();
 
-	if (entry->ref) {
-		entry->invalid = true;
+	entry = l_hashmap_lookup(id_cache, id);
+	if (!entry)
 		return;
-	}
 
-	l_queue_remove(key_cache, entry);
+	erp_cache_entry_release(entry);
 
-	erp_cache_entry_destroy(entry);
+	if (cache_changed)
+		cache_changed();
 }
 
 struct erp_cache_entry *erp_cache_get(const char *ssid)
 {
-	struct erp_cache_entry *cache = find_keycache(NULL, ssid);
+	struct erp_cache_entry *cache;
+
+	erp_cache_prune();
 
+	cache = l_hashmap_lookup(ssid_cache, ssid);
 	if (!cache)
 		return NULL;
 
@@ -256,12 +339,264 @@ void erp_cache_put(struct erp_cache_entry *cache)
 
 	/*
 	 * Cache entry marked as invalid, either it expired or something
-	 * attempted to remove it. Either way, it can now be removed.
+	 * attempted to remove it. Either way, it can now be freed.
 	 */
-	l_queue_remove(key_cache, cache);
 	erp_cache_entry_destroy(cache);
 }
 
+/*
+ * The rRK lifetime sent by the server in EAP-Finish/Re-auth bounds how long
+ * the cached keys may still be used
+ */
+static void erp_cache_entry_set_lifetime(struct erp_cache_entry *cache,
+						uint32_t seconds)
+{
+	uint64_t expire_time = l_time_offset(l_time_now(),
+					seconds * L_USEC_PER_SEC);
+
+	if (cache->invalid || !l_time_before(expire_time, cache->expire_time))
+		return;
+
+	l_queue_remove(expiry_queue, cache);
+	cache->expire_time = expire_time;
+	l_queue_insert(expiry_queue, cache, erp_cache_entry_compare, NULL);
+
+	if (cache_changed)
+		cache_changed();
+}
+
+/*
+ * Sets a function called whenever entries are added, removed or have their
+ * lifetime shortened, e.g. to keep a persistent copy of the cache current.
+ * Entries loaded with erp_cache_import() or expiring are not reported.
+ */
+void erp_cache_set_changed_func(erp_cache_changed_func_t func)
+{
+	cache_changed = func;
+}
+
+#define ERP_CACHE_GROUP_FMT	"ERP-%u"
+#define ERP_CACHE_AD		"iwd ERP cache"
+
+struct erp_cache_export_data {
+	struct l_settings *settings;
+	unsigned int count;
+	uint64_t now;
+	time_t wall;
+};
+
+static void erp_cache_export_entry(void *data, void *user_data)
+{
+	struct erp_cache_entry *entry = data;
+	struct erp_cache_export_data *export = user_data;
+	char group[32];
+	char *hex;
+	uint64_t remaining;
+
+	/*
+	 * The monotonic expiry time does not survive a reboot, so store the
+	 * expiry as wall-clock time instead
+	 */
+	remaining = l_time_diff(export->now, entry->expire_time) /
+							L_USEC_PER_SEC;
+
+	snprintf(group, sizeof(group), ERP_CACHE_GROUP_FMT, export->count++);
+
+	l_settings_set_string(export->settings, group, "Identity", entry->id);
+	l_settings_set_string(export->settings, group, "SSID", entry->ssid);
+	l_settings_set_uint64(export->settings, group, "Expires",
+				(uint64_t) export->wall + remaining);
+
+	hex = l_util_hexstring(entry->session_id, entry->session_len);
+	l_settings_set_value(export->settings, group, "SessionId", hex);
+	l_free(hex);
+
+	hex = l_util_hexstring(entry->emsk, entry->emsk_len);
+	l_settings_set_value(export->settings, group, "EMSK", hex);
+	explicit_bzero(hex, strlen(hex));
+	l_free(hex);
+}
+
+/*
+ * Serializes all valid cache entries.  If a key is given (32 or 64 bytes)
+ * the result is protected with AES-SIV, otherwise it is plain text.
+ */
+void *erp_cache_export(const uint8_t *key, size_t key_len, size_t *out_len)
+{
+	struct erp_cache_export_data export;
+	struct iovec ad = {
+		.iov_base = (void *) ERP_CACHE_AD,
+		.iov_len = strlen(ERP_CACHE_AD),
+	};
+	char *text;
+	size_t text_len;
+	uint8_t *out;
+
+	erp_cache_prune();
+
+	export.settings = l_settings_new();
+	export.count = 0;
+	export.now = l_time_now();
+	export.wall = time(NULL);
+
+	l_queue_foreach(expiry_queue, erp_cache_export_entry, &export);
+
+	text = l_settings_to_data(export.settings, &text_len);
+	l_settings_free(export.settings);
+
+	if (!key) {
+		*out_len = text_len;
+		return text;
+	}
+
+	out = l_malloc(text_len + 16);
+
+	if (!aes_siv_encrypt(key, key_len, (const uint8_t *) text, text_len,
+				&ad, 1, out)) {
+		l_free(out);
+		out = NULL;
+	} else
+		*out_len = text_len + 16;
+
+	explicit_bzero(text, text_len);
+	l_free(text);
+
+	return out;
+}
+
+static bool erp_cache_import_entry(struct l_settings *settings,
+					const char *group, time_t wall)
+{
+	char *id = l_settings_get_string(settings, group, "Identity");
+	char *ssid = l_settings_get_string(settings, group, "SSID");
+	const char *value;
+	uint8_t *session_id = NULL;
+	size_t session_len;
+	uint8_t *emsk = NULL;
+	size_t emsk_len;
+	uint64_t expires;
+	bool r = false;
+
+	if (!id || !ssid)
+		goto done;
+
+	if (!l_settings_get_uint64(settings, group, "Expires", &expires))
+		goto done;
+
+	/* Silently drop entries that expired while we were not running */
+	if (expires <= (uint64_t) wall) {
+		r = true;
+		goto done;
+	}
+
+	value = l_settings_get_value(settings, group, "SessionId");
+	if (!value || !(session_id = l_util_from_hexstring(value,
+							&session_len)))
+		goto done;
+
+	value = l_settings_get_value(settings, group, "EMSK");
+	if (!value || !(emsk = l_util_from_hexstring(value, &emsk_len)))
+		goto done;
+
+	if (emsk_len > sizeof(((struct erp_state *) NULL)->r_rk))
+		goto done;
+
+	erp_cache_insert(erp_cache_entry_new(id, session_id, session_len,
+				emsk, emsk_len, ssid,
+				(expires - wall) * L_USEC_PER_SEC));
+	r = true;
+
+done:
+	if (emsk) {
+		explicit_bzero(emsk, emsk_len);
+		l_free(emsk);
+	}
+
+	l_free(session_id);
+	l_free(ssid);
+	l_free(id);
+
+	return r;
+}
+
+/*
+ * Loads entries previously serialized with erp_cache_export().  The same key
+ * has to be given, a blob that fails to authenticate is rejected as a whole.
+ */
+bool erp_cache_import(const void *data, size_t len, const uint8_t *key,
+			size_t key_len)
+{
+	struct iovec ad = {
+		.iov_base = (void *) ERP_CACHE_AD,
+		.iov_len = strlen(ERP_CACHE_AD),
+	};
+	struct l_settings *settings;
+	char *text = NULL;
+	char **groups;
+	time_t wall = time(NULL);
+	unsigned int i;
+	bool r = false;
+
+	if (key) {
+		if (len <= 16)
+			return false;
+
+		len -= 16;
+		text = l_malloc(len);
+
+		if (!aes_siv_decrypt(key, key_len, data, len + 16, &ad, 1,
+					(uint8_t *) text)) {
+			l_debug("ERP cache failed to authenticate");
+			goto done;
+		}
+
+		data = text;
+	}
+
+	settings = l_settings_new();
+
+	if (!l_settings_load_from_data(settings, data, len)) {
+		l_settings_free(settings);
+		goto done;
+	}
+
+	groups = l_settings_get_groups(settings);
+
+	for (i = 0; groups[i]; i++)
+		if (!erp_cache_import_entry(settings, groups[i], wall))
+			l_debug("Skipping invalid ERP cache entry %s",
+					groups[i]);
+
+	l_strv_free(groups);
+	l_settings_free(settings);
+	r = true;
+
+done:
+	if (text) {
+		explicit_bzero(text, len);
+		l_free(text);
+	}
+
+	return r;
+}
+
+/* Derives the key used by erp_cache_export/import from a stored secret */
+bool erp_cache_derive_key(const void *secret, size_t secret_len,
+				uint8_t *out_key, size_t key_len)
+{
+	uint8_t prk[32];
+	bool r;
+
+	r = hkdf_extract(L_CHECKSUM_SHA256, NULL, 0, 1, prk,
+				secret, secret_len) &&
+		hkdf_expand(L_CHECKSUM_SHA256, prk, sizeof(prk),
+				"iwd ERP cache key", out_key, key_len);
+
+	explicit_bzero(prk, sizeof(prk));
+
+	return r;
+}
+
 const char *erp_cache_entry_get_identity(struct erp_cache_entry *cache)
 {
 	return cache->id;
@@ -405,6 +740,7 @@ int erp_rx_packet(struct erp_state *erp, const uint8_t *pkt, size_t len)
 	uint8_t type;
 	uint16_t seq;
 	uint16_t length;
+	uint32_t rrk_lifetime = 0;
 	bool r;
 
 	/*
@@ -428,8 +764,8 @@ int erp_rx_packet(struct erp_state *erp, const uint8_t *pkt, size_t len)
 		goto eap_failed;
 
 	/*
-	 * TODO: Parse B and L bits. L bit indicates rRK lifetime, but our ERP
-	 * cache does not yet support this.
+	 * TODO: Parse the B bit.  The rRK lifetime indicated by the L bit is
+	 * picked up from its TV below if present.
 	 */
 
 	seq = l_get_be16(pkt + 6);
@@ -468,6 +804,9 @@ int erp_rx_packet(struct erp_state *erp, const uint8_t *pkt, size_t len)
 
 			nai = iter.data;
 			break;
+		case ERP_TV_RRK_LIFETIME:
+			rrk_lifetime = l_get_be32(iter.data);
+			break;
 		default:
 			break;
 		}
@@ -489,6 +828,9 @@ int erp_rx_packet(struct erp_state *erp, const uint8_t *pkt, size_t len)
 		goto eap_failed;
 	}
 
+	if (rrk_lifetime)
+		erp_cache_entry_set_lifetime(erp->cache, rrk_lifetime);
+
 	/*
 	 * RFC 6696 Section 4.6 - rMSK Derivation
 	 */
@@ -516,16 +858,20 @@ const void *erp_get_rmsk(struct erp_state *erp, size_t *rmsk_len)
 	return erp->rmsk;
 }
 
-static int erp_init(void)
+int erp_init(void)
 {
-	key_cache = l_queue_new();
+	id_cache = l_hashmap_string_new();
+	ssid_cache = l_hashmap_string_new();
+	expiry_queue = l_queue_new();
 
 	return 0;
 }
 
-static void erp_exit(void)
+void erp_exit(void)
 {
-	l_queue_destroy(key_cache, erp_cache_entry_destroy);
+	l_hashmap_destroy(ssid_cache, NULL);
+	l_hashmap_destroy(id_cache, NULL);
+	l_queue_destroy(expiry_queue, erp_cache_entry_destroy);
 }
 
 IWD_MODULE(erp, erp_init, erp_exit)
@@ -30,6 +30,7 @@ enum erp_result {
 
 typedef void (*erp_tx_packet_func_t)(const uint8_t *erp_data, size_t len,
 					void *user_data);
+typedef void (*erp_cache_changed_func_t)(void);
 
 struct erp_state *erp_new(struct erp_cache_entry *cache,
 				erp_tx_packet_func_t tx_packet,
@@ -51,3 +52,13 @@ struct erp_cache_entry *erp_cache_get(const char *ssid);
 void erp_cache_put(struct erp_cache_entry *cache);
 
 const char *erp_cache_entry_get_identity(struct erp_cache_entry *cache);
+void erp_cache_set_changed_func(erp_cache_changed_func_t func);
+
+void *erp_cache_export(const uint8_t *key, size_t key_len, size_t *out_len);
+bool erp_cache_import(const void *data, size_t len, const uint8_t *key,
+			size_t key_len);
+bool erp_cache_derive_key(const void *secret, size_t secret_len,
+				uint8_t *out_key, size_t key_len);
+
+int erp_init(void);
+void erp_exit(void);
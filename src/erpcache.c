@@ -0,0 +1,160 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <ell/ell.h>
+
+#include "src/missing.h"
+#include "src/iwd.h"
+#include "src/module.h"
+#include "src/storage.h"
+#include "src/erp.h"
+
+/*
+ * Key derived from the iwd-erp-cache credential, the cache is only
+ * persisted while this is set.  ERP keys are derived from the EMSK so they
+ * are never written out in plain text.
+ */
+static uint8_t erp_cache_key[32];
+static bool have_erp_cache_key;
+static struct l_idle *erp_cache_sync_idle;
+
+static bool erp_cache_get_key(uint8_t *out_key, size_t key_len)
+{
+	void *secret;
+	size_t secret_len;
+	bool r;
+
+	secret = storage_erp_cache_secret(&secret_len);
+	if (!secret)
+		return false;
+
+	r = erp_cache_derive_key(secret, secret_len, out_key, key_len);
+
+	explicit_bzero(secret, secret_len);
+	l_free(secret);
+
+	return r;
+}
+
+static void erp_cache_sync(void)
+{
+	void *data;
+	size_t len = 0;
+
+	data = erp_cache_export(erp_cache_key, sizeof(erp_cache_key), &len);
+	if (!data) {
+		l_error("Unable to save the ERP cache");
+		return;
+	}
+
+	storage_erp_cache_sync(data, len);
+
+	explicit_bzero(data, len);
+	l_free(data);
+}
+
+static void erp_cache_sync_idle_cb(void *user_data)
+{
+	l_idle_remove(erp_cache_sync_idle);
+	erp_cache_sync_idle = NULL;
+
+	erp_cache_sync();
+}
+
+/* Several changes usually come together, write them out once */
+static void erp_cache_changed(void)
+{
+	if (erp_cache_sync_idle)
+		return;
+
+	erp_cache_sync_idle = l_idle_create(erp_cache_sync_idle_cb, NULL,
+						NULL);
+}
+
+static int erp_cache_load(void)
+{
+	bool persist_erp_cache;
+	void *data;
+	size_t len;
+
+	if (!l_settings_get_bool(iwd_get_config(), "General",
+					"PersistERPCache", &persist_erp_cache))
+		persist_erp_cache = false;
+
+	if (!persist_erp_cache)
+		return 0;
+
+	have_erp_cache_key = erp_cache_get_key(erp_cache_key,
+						sizeof(erp_cache_key));
+	if (!have_erp_cache_key) {
+		l_warn("PersistERPCache requires the iwd-erp-cache "
+			"credential, not saving ERP keys");
+
+		/* Don't leave keys written by an older version behind */
+		storage_erp_cache_sync(NULL, 0);
+		return 0;
+	}
+
+	erp_cache_set_changed_func(erp_cache_changed);
+
+	data = storage_erp_cache_load(&len);
+	if (!data) {
+		l_debug("No ERP cache file found.");
+		return 0;
+	}
+
+	if (!erp_cache_import(data, len, erp_cache_key, sizeof(erp_cache_key)))
+		l_warn("Unable to load the ERP cache, ignoring");
+
+	explicit_bzero(data, len);
+	l_free(data);
+
+	return 0;
+}
+
+static void erp_cache_exit(void)
+{
+	if (!have_erp_cache_key)
+		return;
+
+	erp_cache_set_changed_func(NULL);
+
+	l_idle_remove(erp_cache_sync_idle);
+	erp_cache_sync_idle = NULL;
+
+	/* Entries may have expired since the last change */
+	erp_cache_sync();
+
+	explicit_bzero(erp_cache_key, sizeof(erp_cache_key));
+	have_erp_cache_key = false;
+}
+
+/*
+ * The ERP cache is owned by the erp module, this only handles loading it from
+ * and saving it to storage.  Must exit before erp so the entries are intact.
+ */
+IWD_MODULE(erp_cache, erp_cache_load, erp_cache_exit)
+IWD_MODULE_DEPENDS(erp_cache, erp)
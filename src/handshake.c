@@ -43,6 +43,7 @@
 #include "src/handshake.h"
 #include "src/erp.h"
 #include "src/band.h"
+#include "src/pmksa.h"
 
 static inline unsigned int n_ecc_groups()
 {
@@ -119,6 +120,9 @@ void handshake_state_free(struct handshake_state *s)
 	if (s->erp_cache)
 		erp_cache_put(s->erp_cache);
 
+	if (s->pmksa)
+		pmksa_free(s->pmksa);
+
 	l_free(s->chandef);
 
 	if (s->passphrase) {
@@ -141,9 +145,27 @@ void handshake_state_free(struct handshake_state *s)
 		destroy(s);
 }
 
+/*
+ * The PMK-R0 and any pre-derived PMK-R1s depend on the XXKey, SSID, MDID,
+ * R0KH-ID and SPA and have to be dropped whenever one of them changes
+ */
+static void handshake_state_flush_pmk_r0(struct handshake_state *s)
+{
+	if (!s->have_pmk_r0 && !s->pmk_r1_cache_len)
+		return;
+
+	explicit_bzero(s->pmk_r0, sizeof(s->pmk_r0));
+	explicit_bzero(s->pmk_r1_cache, sizeof(s->pmk_r1_cache));
+	s->pmk_r1_cache_len = 0;
+	s->have_pmk_r0 = false;
+}
+
 void handshake_state_set_supplicant_address(struct handshake_state *s,
 						const uint8_t *spa)
 {
+	if (memcmp(s->spa, spa, sizeof(s->spa)))
+		handshake_state_flush_pmk_r0(s);
+
 	memcpy(s->spa, spa, sizeof(s->spa));
 }
 
@@ -164,6 +186,17 @@ void handshake_state_set_pmk(struct handshake_state *s, const uint8_t *pmk,
 	memcpy(s->pmk, pmk, pmk_len);
 	s->pmk_len = pmk_len;
 	s->have_pmk = true;
+
+	handshake_state_flush_pmk_r0(s);
+
+	/*
+	 * A freshly derived PMK (e.g. the AP ignored our PMKID and ran EAP)
+	 * supersedes the cached PMKSA we started out with
+	 */
+	if (s->pmksa) {
+		pmksa_free(s->pmksa);
+		s->pmksa = NULL;
+	}
 }
 
 void handshake_state_set_ptk(struct handshake_state *s, const uint8_t *ptk,
@@ -235,6 +268,9 @@ valid_ie:
 	s->osen_ie = osen_ie;
 	s->wpa_ie = wpa_ie;
 
+	if (s->akm_suite != info.akm_suites)
+		handshake_state_flush_pmk_r0(s);
+
 	s->pairwise_cipher = info.pairwise_ciphers;
 	s->group_cipher = info.group_cipher;
 	s->group_management_cipher = info.group_management_cipher;
@@ -288,12 +324,19 @@ void handshake_state_set_supplicant_rsnxe(struct handshake_state *s,
 void handshake_state_set_ssid(struct handshake_state *s, const uint8_t *ssid,
 				size_t ssid_len)
 {
+	if (s->ssid_len != ssid_len || memcmp(s->ssid, ssid, ssid_len))
+		handshake_state_flush_pmk_r0(s);
+
 	memcpy(s->ssid, ssid, ssid_len);
 	s->ssid_len = ssid_len;
 }
 
 void handshake_state_set_mde(struct handshake_state *s, const uint8_t *mde)
 {
+	/* Only the MDID feeds into the key hierarchy */
+	if (!s->mde || !mde || memcmp(s->mde + 2, mde + 2, 2))
+		handshake_state_flush_pmk_r0(s);
+
 	replace_ie(&s->mde, mde);
 }
 
@@ -333,6 +376,10 @@ void handshake_state_set_kh_ids(struct handshake_state *s,
 				const uint8_t *r0khid, size_t r0khid_len,
 				const uint8_t *r1khid)
 {
+	if (s->r0khid_len != r0khid_len ||
+			memcmp(s->r0khid, r0khid, r0khid_len))
+		handshake_state_flush_pmk_r0(s);
+
 	memcpy(s->r0khid, r0khid, r0khid_len);
 	s->r0khid_len = r0khid_len;
 
@@ -362,6 +409,8 @@ void handshake_state_set_fils_ft(struct handshake_state *s,
 					const uint8_t *fils_ft,
 					size_t fils_ft_len)
 {
+	handshake_state_flush_pmk_r0(s);
+
 	memcpy(s->fils_ft, fils_ft, fils_ft_len);
 	s->fils_ft_len = fils_ft_len;
 }
@@ -488,6 +537,111 @@ static bool handshake_get_key_sizes(struct handshake_state *s, size_t *ptk_size,
 	return true;
 }
 
+static bool handshake_derive_pmk_r0(struct handshake_state *s)
+{
+	uint16_t mdid;
+	const uint8_t *xxkey = s->pmk;
+	size_t xxkey_len = 32;
+	bool sha384 = (s->akm_suite & IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384);
+
+	if (s->have_pmk_r0)
+		return true;
+
+	/*
+	 * In a Fast Transition initial mobility domain association
+	 * the PMK maps to the XXKey, except with EAP:
+	 * 802.11-2016 12.7.1.7.3:
+	 *    "If the AKM negotiated is 00-0F-AC:3, then [...] XXKey
+	 *    shall be the second 256 bits of the MSK (which is
+	 *    derived from the IEEE 802.1X authentication), i.e.,
+	 *    XXKey = L(MSK, 256, 256)."
+	 */
+	if (s->akm_suite == IE_RSN_AKM_SUITE_FT_OVER_8021X)
+		xxkey = s->pmk + 32;
+	else if (s->akm_suite & (IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA256 |
+			IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384)) {
+		xxkey = s->fils_ft;
+		xxkey_len = s->fils_ft_len;
+	}
+
+	if (ie_parse_mobility_domain_from_data(s->mde, s->mde[1] + 2,
+						&mdid, NULL, NULL) < 0)
+		return false;
+
+	if (!crypto_derive_pmk_r0(xxkey, xxkey_len, s->ssid,
+					s->ssid_len, mdid,
+					s->r0khid, s->r0khid_len,
+					s->spa, sha384,
+					s->pmk_r0, s->pmk_r0_name))
+		return false;
+
+	s->have_pmk_r0 = true;
+
+	return true;
+}
+
+static const struct handshake_pmk_r1 *handshake_find_pmk_r1(
+						struct handshake_state *s,
+						const uint8_t *r1khid)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->pmk_r1_cache_len; i++)
+		if (!memcmp(s->pmk_r1_cache[i].r1khid, r1khid, 6))
+			return &s->pmk_r1_cache[i];
+
+	return NULL;
+}
+
+/*
+ * Derives the PMK-R1 for a prospective FT target ahead of time so that it
+ * is ready once the target's FTE arrives.  The R1KH-ID is only known from
+ * that FTE, callers guess it (usually the BSSID) and a wrong guess simply
+ * means the PMK-R1 is derived the regular way later on.
+ */
+bool handshake_state_prepare_pmk_r1(struct handshake_state *s,
+					const uint8_t *r1khid)
+{
+	struct handshake_pmk_r1 *pre;
+	bool sha384 = (s->akm_suite & IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384);
+
+	if (!IE_AKM_IS_FT(s->akm_suite) || !s->mde || !s->r0khid_len)
+		return false;
+
+	if (handshake_find_pmk_r1(s, r1khid))
+		return true;
+
+	if (!(s->akm_suite & (IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA256 |
+			IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384)) &&
+			!s->have_pmk)
+		return false;
+
+	if (!handshake_derive_pmk_r0(s))
+		return false;
+
+	/* Replace the oldest entry when full */
+	if (s->pmk_r1_cache_len == L_ARRAY_SIZE(s->pmk_r1_cache)) {
+		memmove(s->pmk_r1_cache, s->pmk_r1_cache + 1,
+				sizeof(s->pmk_r1_cache) -
+				sizeof(s->pmk_r1_cache[0]));
+		s->pmk_r1_cache_len--;
+	}
+
+	pre = &s->pmk_r1_cache[s->pmk_r1_cache_len];
+
+	if (!crypto_derive_pmk_r1(s->pmk_r0, r1khid, s->spa,
+					s->pmk_r0_name, sha384,
+					pre->pmk_r1, pre->pmk_r1_name)) {
+		explicit_bzero(pre, sizeof(*pre));
+		return false;
+	}
+
+	memcpy(pre->r1khid, r1khid, 6);
+	s->pmk_r1_cache_len++;
+
+	return true;
+}
+
 bool handshake_state_derive_ptk(struct handshake_state *s)
 {
 	size_t ptk_size;
@@ -538,41 +692,20 @@ bool handshake_state_derive_ptk(struct handshake_state *s)
 				IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256 |
 				IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA256 |
 				IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384)) {
-		uint16_t mdid;
 		uint8_t ptk_name[16];
-		const uint8_t *xxkey = s->pmk;
-		size_t xxkey_len = 32;
 		bool sha384 = (s->akm_suite &
 					IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384);
+		const struct handshake_pmk_r1 *pre;
 
-		/*
-		 * In a Fast Transition initial mobility domain association
-		 * the PMK maps to the XXKey, except with EAP:
-		 * 802.11-2016 12.7.1.7.3:
-		 *    "If the AKM negotiated is 00-0F-AC:3, then [...] XXKey
-		 *    shall be the second 256 bits of the MSK (which is
-		 *    derived from the IEEE 802.1X authentication), i.e.,
-		 *    XXKey = L(MSK, 256, 256)."
-		 */
-		if (s->akm_suite == IE_RSN_AKM_SUITE_FT_OVER_8021X)
-			xxkey = s->pmk + 32;
-		else if (s->akm_suite & (IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA256 |
-				IE_RSN_AKM_SUITE_FT_OVER_FILS_SHA384)) {
-			xxkey = s->fils_ft;
-			xxkey_len = s->fils_ft_len;
-		}
-
-		ie_parse_mobility_domain_from_data(s->mde, s->mde[1] + 2,
-							&mdid, NULL, NULL);
-
-		if (!crypto_derive_pmk_r0(xxkey, xxkey_len, s->ssid,
-						s->ssid_len, mdid,
-						s->r0khid, s->r0khid_len,
-						s->spa, sha384,
-						s->pmk_r0, s->pmk_r0_name))
+		if (!handshake_derive_pmk_r0(s))
 			return false;
 
-		if (!crypto_derive_pmk_r1(s->pmk_r0, s->r1khid, s->spa,
+		pre = handshake_find_pmk_r1(s, s->r1khid);
+		if (pre) {
+			memcpy(s->pmk_r1, pre->pmk_r1, sizeof(s->pmk_r1));
+			memcpy(s->pmk_r1_name, pre->pmk_r1_name,
+						sizeof(s->pmk_r1_name));
+		} else if (!crypto_derive_pmk_r1(s->pmk_r0, s->r1khid, s->spa,
 						s->pmk_r0_name, sha384,
 						s->pmk_r1, s->pmk_r1_name))
 			return false;
@@ -728,6 +861,24 @@ void handshake_state_set_pmkid(struct handshake_state *s, const uint8_t *pmkid)
 	s->have_pmkid = true;
 }
 
+/*
+ * Takes ownership of a PMKSA cache entry and uses its PMK.  SAE PMKIDs can't
+ * be derived from the PMK so those are taken from the cache entry as well.
+ */
+void handshake_state_set_pmksa(struct handshake_state *s, struct pmksa *pmksa)
+{
+	memcpy(s->pmk, pmksa->pmk, pmksa->pmk_len);
+	s->pmk_len = pmksa->pmk_len;
+	s->have_pmk = true;
+
+	handshake_state_flush_pmk_r0(s);
+
+	if (IE_AKM_IS_SAE(pmksa->akm))
+		handshake_state_set_pmkid(s, pmksa->pmkid);
+
+	s->pmksa = pmksa;
+}
+
 bool handshake_state_get_pmkid(struct handshake_state *s, uint8_t *out_pmkid)
 {
 	bool use_sha256;
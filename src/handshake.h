@@ -28,6 +28,7 @@
 struct handshake_state;
 enum crypto_cipher;
 struct eapol_frame;
+struct pmksa;
 
 enum handshake_kde {
 	/* 802.11-2020 Table 12-9 in section 12.7.2 */
@@ -60,6 +61,16 @@ enum handshake_event {
 	HANDSHAKE_EVENT_EAP_NOTIFY,
 	HANDSHAKE_EVENT_TRANSITION_DISABLE,
 	HANDSHAKE_EVENT_P2P_IP_REQUEST,
+	HANDSHAKE_EVENT_EAP_STARTED,
+};
+
+/* Number of PMK-R1s pre-derived for Fast Transition candidates */
+#define HANDSHAKE_PMK_R1_CACHE_SIZE 4
+
+struct handshake_pmk_r1 {
+	uint8_t r1khid[6];
+	uint8_t pmk_r1[48];
+	uint8_t pmk_r1_name[16];
 };
 
 typedef void (*handshake_event_func_t)(struct handshake_state *hs,
@@ -117,6 +128,8 @@ struct handshake_state {
 	uint8_t pmk_r0_name[16];
 	uint8_t pmk_r1[48];
 	uint8_t pmk_r1_name[16];
+	struct handshake_pmk_r1 pmk_r1_cache[HANDSHAKE_PMK_R1_CACHE_SIZE];
+	unsigned int pmk_r1_cache_len;
 	uint8_t pmkid[16];
 	uint8_t fils_ft[48];
 	uint8_t fils_ft_len;
@@ -137,6 +150,7 @@ struct handshake_state {
 	bool authenticator_ocvc : 1;
 	bool supplicant_ocvc : 1;
 	bool ext_key_id_capable : 1;
+	bool have_pmk_r0 : 1;
 	uint8_t ssid[32];
 	size_t ssid_len;
 	char *passphrase;
@@ -149,6 +163,7 @@ struct handshake_state {
 	unsigned int gtk_index;
 	uint8_t active_tk_index;
 	struct erp_cache_entry *erp_cache;
+	struct pmksa *pmksa;
 	bool support_ip_allocation : 1;
 	uint32_t client_ip_addr;
 	uint32_t subnet_mask;
@@ -226,7 +241,10 @@ void handshake_state_new_anonce(struct handshake_state *s);
 void handshake_state_set_anonce(struct handshake_state *s,
 				const uint8_t *anonce);
 void handshake_state_set_pmkid(struct handshake_state *s, const uint8_t *pmkid);
+void handshake_state_set_pmksa(struct handshake_state *s, struct pmksa *pmksa);
 bool handshake_state_derive_ptk(struct handshake_state *s);
+bool handshake_state_prepare_pmk_r1(struct handshake_state *s,
+					const uint8_t *r1khid);
 size_t handshake_state_get_ptk_size(struct handshake_state *s);
 size_t handshake_state_get_kck_len(struct handshake_state *s);
 const uint8_t *handshake_state_get_kck(struct handshake_state *s);
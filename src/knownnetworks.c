@@ -31,6 +31,7 @@
 #include <unistd.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <ell/ell.h>
 
@@ -80,6 +81,11 @@ void __network_config_parse(const struct l_settings *settings,
 
 	config->always_random_addr = b;
 
+	if (!l_settings_get_bool(settings, NET_OKC, &b))
+		b = false;
+
+	config->okc = b;
+
 	value = l_settings_get_value(settings, NET_ADDRESS_OVERRIDE);
 	if (value) {
 		if (util_string_to_address(value, new_addr) &&
@@ -364,6 +370,27 @@ void network_info_set_uuid(struct network_info *info, const uint8_t *uuid)
 	info->has_uuid = true;
 }
 
+struct roam_frequency {
+	uint32_t frequency;
+	uint32_t score;
+	unsigned int mru;
+};
+
+static int roam_frequency_compare(const void *a, const void *b)
+{
+	const struct roam_frequency *fa = a;
+	const struct roam_frequency *fb = b;
+
+	if (fa->score != fb->score)
+		return fa->score > fb->score ? -1 : 1;
+
+	return fa->mru < fb->mru ? -1 : 1;
+}
+
+/*
+ * Returns up to max of the frequencies most likely to have a roam candidate,
+ * based on how often and how recently the network was seen on each one.
+ */
 struct scan_freq_set *network_info_get_roam_frequencies(
 					const struct network_info *info,
 					uint32_t current_freq,
@@ -371,21 +398,37 @@ struct scan_freq_set *network_info_get_roam_frequencies(
 {
 	struct scan_freq_set *freqs;
 	const struct l_queue_entry *entry;
+	struct roam_frequency *candidates;
+	unsigned int n = 0;
+	unsigned int i;
+	uint64_t now = time(NULL);
 
-	freqs = scan_freq_set_new();
+	candidates = l_new(struct roam_frequency,
+				l_queue_length(info->known_frequencies) + 1);
 
-	for (entry = l_queue_get_entries(info->known_frequencies); entry && max;
+	for (entry = l_queue_get_entries(info->known_frequencies); entry;
 			entry = entry->next) {
 		struct known_frequency *kn = entry->data;
+		uint32_t score = known_frequency_score(kn, now);
 
-		if (kn->frequency == current_freq)
+		if (kn->frequency == current_freq || !score)
 			continue;
 
-		scan_freq_set_add(freqs, kn->frequency);
-
-		max--;
+		candidates[n].frequency = kn->frequency;
+		candidates[n].score = score;
+		candidates[n].mru = n;
+		n++;
 	}
 
+	qsort(candidates, n, sizeof(*candidates), roam_frequency_compare);
+
+	freqs = scan_freq_set_new();
+
+	for (i = 0; i < n && i < max; i++)
+		scan_freq_set_add(freqs, candidates[i].frequency);
+
+	l_free(candidates);
+
 	if (scan_freq_set_isempty(freqs)) {
 		scan_freq_set_free(freqs);
 		return NULL;
@@ -558,11 +601,14 @@ static bool known_frequency_match(const void *a, const void *b)
 
 /*
  * Adds a frequency to the 'known' set of frequencies that this network
- * operates on.  The list is sorted according to most-recently seen
+ * operates on.  The list is sorted according to most-recently seen, each
+ * entry also keeps an aging hit count weighted by the kind of sighting.
  */
-int known_network_add_frequency(struct network_info *info, uint32_t frequency)
+int known_network_add_frequency(struct network_info *info, uint32_t frequency,
+					enum known_frequency_hit hit)
 {
 	struct known_frequency *known_freq;
+	uint64_t now = time(NULL);
 
 	if (!info->known_frequencies)
 		info->known_frequencies = l_queue_new();
@@ -574,6 +620,8 @@ int known_network_add_frequency(struct network_info *info, uint32_t frequency)
 		known_freq->frequency = frequency;
 	}
 
+	known_frequency_add_hit(known_freq, hit, now);
+
 	l_queue_push_head(info->known_frequencies, known_freq);
 
 	return 0;
@@ -876,23 +924,66 @@ error:
 	return NULL;
 }
 
-static void known_frequency_to_string(void *data, void *user_data)
+/*
+ * The hit counts and last sighting times are stored as separate lists
+ * matching the frequency list, files lacking them are still accepted.
+ */
+static void known_frequencies_set_stats(struct l_queue *known_frequencies,
+					const char *hits_str,
+					const char *seen_str)
 {
-	struct known_frequency *known_freq = data;
-	struct l_string *str = user_data;
+	const struct l_queue_entry *entry;
+	uint64_t now = time(NULL);
+	char *end;
 
-	l_string_append_printf(str, " %u", known_freq->frequency);
+	for (entry = l_queue_get_entries(known_frequencies); entry;
+			entry = entry->next) {
+		struct known_frequency *known_freq = entry->data;
+
+		known_freq->hits = KNOWN_FREQUENCY_HIT_SCAN;
+		known_freq->last_seen = now;
+
+		if (hits_str && *hits_str) {
+			known_freq->hits = L_MIN(strtoul(hits_str, &end, 10),
+						(unsigned long)
+						KNOWN_FREQ_MAX_HITS);
+			hits_str = end;
+		}
+
+		if (seen_str && *seen_str) {
+			known_freq->last_seen = strtoull(seen_str, &end, 10);
+			seen_str = end;
+		}
+	}
 }
 
-static char *known_frequencies_to_string(struct l_queue *known_frequencies)
+static bool known_frequency_expired(void *data, void *user_data)
 {
-	struct l_string *str;
+	struct known_frequency *known_freq = data;
+	const uint64_t *now = user_data;
+
+	if (known_frequency_score(known_freq, *now))
+		return false;
 
-	str = l_string_new(100);
+	l_free(known_freq);
+	return true;
+}
 
-	l_queue_foreach(known_frequencies, known_frequency_to_string, str);
+struct known_frequency_strings {
+	struct l_string *list;
+	struct l_string *hits;
+	struct l_string *seen;
+};
 
-	return l_string_unwrap(str);
+static void known_frequency_to_string(void *data, void *user_data)
+{
+	struct known_frequency *known_freq = data;
+	struct known_frequency_strings *strs = user_data;
+
+	l_string_append_printf(strs->list, " %u", known_freq->frequency);
+	l_string_append_printf(strs->hits, " %u", known_freq->hits);
+	l_string_append_printf(strs->seen, " %" PRIu64,
+					known_freq->last_seen);
 }
 
 struct hotspot_search {
@@ -945,6 +1036,7 @@ static int known_network_frequencies_load(void)
 	struct l_queue *known_frequencies;
 	uint32_t i;
 	uint8_t uuid[16];
+	uint64_t now = time(NULL);
 
 	known_freqs = storage_known_frequencies_load();
 	if (!known_freqs) {
@@ -980,6 +1072,19 @@ static int known_network_frequencies_load(void)
 		if (!known_frequencies)
 			goto invalid_entry;
 
+		known_frequencies_set_stats(known_frequencies,
+				l_settings_get_value(known_freqs, groups[i],
+							"hits"),
+				l_settings_get_value(known_freqs, groups[i],
+							"seen"));
+		l_queue_foreach_remove(known_frequencies,
+					known_frequency_expired, &now);
+
+		if (l_queue_isempty(known_frequencies)) {
+			l_queue_destroy(known_frequencies, NULL);
+			goto invalid_entry;
+		}
+
 		if (!l_uuid_from_string(groups[i], uuid)) {
 			l_queue_destroy(known_frequencies, l_free);
 			goto invalid_entry;
@@ -1004,26 +1109,45 @@ invalid_entry:
  */
 void known_network_frequency_sync(struct network_info *info)
 {
-	char *freq_list_str;
+	struct known_frequency_strings strs;
+	char *str;
 	char *file_path;
 	char group[37];
+	uint64_t now = time(NULL);
 
 	if (!info->known_frequencies)
 		return;
 
+	l_queue_foreach_remove(info->known_frequencies,
+				known_frequency_expired, &now);
+
 	if (!known_freqs)
 		known_freqs = l_settings_new();
 
-	freq_list_str = known_frequencies_to_string(info->known_frequencies);
+	strs.list = l_string_new(100);
+	strs.hits = l_string_new(100);
+	strs.seen = l_string_new(200);
+	l_queue_foreach(info->known_frequencies, known_frequency_to_string,
+				&strs);
 
 	file_path = info->ops->get_file_path(info);
 
 	l_uuid_to_string(network_info_get_uuid(info), group, sizeof(group));
 
 	l_settings_set_value(known_freqs, group, "name", file_path);
-	l_settings_set_value(known_freqs, group, "list", freq_list_str);
 	l_free(file_path);
-	l_free(freq_list_str);
+
+	str = l_string_unwrap(strs.list);
+	l_settings_set_value(known_freqs, group, "list", str);
+	l_free(str);
+
+	str = l_string_unwrap(strs.hits);
+	l_settings_set_value(known_freqs, group, "hits", str);
+	l_free(str);
+
+	str = l_string_unwrap(strs.seen);
+	l_settings_set_value(known_freqs, group, "seen", str);
+	l_free(str);
 
 	storage_known_frequencies_sync(known_freqs);
 }
@@ -27,9 +27,11 @@
 #define NET_ADDRESS_OVERRIDE SETTINGS, "AddressOverride"
 #define NET_TRANSITION_DISABLE SETTINGS, "TransitionDisable"
 #define NET_TRANSITION_DISABLE_MODES SETTINGS, "DisabledTransitionModes"
+#define NET_OKC SETTINGS, "OpportunisticKeyCaching"
 
 enum security;
 struct scan_freq_set;
+struct scan_bss;
 struct network_info;
 
 enum known_networks_event {
@@ -71,6 +73,7 @@ struct network_config {
 	uint8_t sta_addr[6];
 	bool have_transition_disable : 1;
 	uint8_t transition_disable;
+	bool okc : 1;
 };
 
 struct network_info {
@@ -93,10 +96,60 @@ typedef void (*known_networks_watch_func_t)(enum known_networks_event event,
 						void *user_data);
 typedef void (*known_networks_destroy_func_t)(void *user_data);
 
+/* How much each kind of sighting adds to a known frequency's hit count */
+enum known_frequency_hit {
+	KNOWN_FREQUENCY_HIT_SCAN = 1,
+	KNOWN_FREQUENCY_HIT_NEIGHBOR_REPORT = 2,
+	KNOWN_FREQUENCY_HIT_ROAM = 4,
+};
+
 struct known_frequency {
 	uint32_t frequency;
+	uint32_t hits;
+	uint64_t last_seen;	/* Wall clock, seconds */
 };
 
+/*
+ * Known frequency hit counts halve every week without a sighting, but a
+ * frequency is only forgotten once it hasn't been seen for a month.  Scans
+ * add at most one hit per frequency a day so that frequent scanning doesn't
+ * drown out neighbor reports and roams.
+ */
+#define KNOWN_FREQ_HALF_LIFE	(7 * 24 * 3600)
+#define KNOWN_FREQ_MAX_AGE	(30 * 24 * 3600)
+#define KNOWN_FREQ_SCAN_PERIOD	(24 * 3600)
+#define KNOWN_FREQ_MAX_HITS	0xffff
+
+static inline uint32_t known_frequency_score(const struct known_frequency *kf,
+						uint64_t now)
+{
+	uint64_t age = now > kf->last_seen ? now - kf->last_seen : 0;
+	uint32_t score;
+
+	if (age >= KNOWN_FREQ_MAX_AGE)
+		return 0;
+
+	score = kf->hits >> (age / KNOWN_FREQ_HALF_LIFE);
+
+	return score ? score : 1;
+}
+
+static inline void known_frequency_add_hit(struct known_frequency *kf,
+						enum known_frequency_hit hit,
+						uint64_t now)
+{
+	bool counted = hit == KNOWN_FREQUENCY_HIT_SCAN &&
+			kf->last_seen / KNOWN_FREQ_SCAN_PERIOD ==
+					now / KNOWN_FREQ_SCAN_PERIOD;
+
+	kf->hits = known_frequency_score(kf, now);
+
+	if (!counted)
+		kf->hits = L_MIN(kf->hits + hit, (uint32_t) KNOWN_FREQ_MAX_HITS);
+
+	kf->last_seen = now;
+}
+
 void __network_config_parse(const struct l_settings *settings,
 					const char *path,
 					struct network_config *config);
@@ -113,7 +166,8 @@ struct network_info *known_networks_find(const char *ssid,
 
 struct scan_freq_set *known_networks_get_recent_frequencies(
 						uint8_t num_networks_tosearch);
-int known_network_add_frequency(struct network_info *info, uint32_t frequency);
+int known_network_add_frequency(struct network_info *info, uint32_t frequency,
+					enum known_frequency_hit hit);
 void known_network_frequency_sync(struct network_info *info);
 
 uint32_t known_networks_watch_add(known_networks_watch_func_t func,
@@ -45,6 +45,7 @@
 #include "src/storage.h"
 #include "src/anqp.h"
 #include "src/netconfig.h"
+#include "src/pmksa.h"
 
 #include "src/backtrace.h"
 
@@ -495,6 +496,7 @@ int main(int argc, char *argv[])
 
 	__eapol_set_config(iwd_config);
 	__eap_set_config(iwd_config);
+	__pmksa_set_config(iwd_config);
 
 	exit_status = EXIT_FAILURE;
 
@@ -36,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <time.h>
 
 #include <ell/ell.h>
 
@@ -49,8 +50,10 @@
 #include "src/resolve.h"
 #include "src/util.h"
 #include "src/ie.h"
+#include "src/handshake.h"
 #include "src/netconfig.h"
 #include "src/sysfs.h"
+#include "src/dhcputil.h"
 
 struct netconfig {
 	uint32_t ifindex;
@@ -66,6 +69,9 @@ struct netconfig {
 	char **dns6_list;
 	char *mdns;
 	struct ie_fils_ip_addr_response_info *fils_override;
+	struct dhcp_saved_lease *saved_lease;
+	struct l_timeout *saved_lease_timeout;
+	struct l_acd *saved_lease_acd;
 	char *v4_gateway_str;
 	char *v6_gateway_str;
 	char *v4_domain;
@@ -75,6 +81,7 @@ struct netconfig {
 
 	netconfig_notify_func_t notify;
 	void *user_data;
+	bool connected;
 
 	struct resolve *resolve;
 
@@ -236,10 +243,13 @@ static char **netconfig_get_dns_list(struct netconfig *netconfig, int af,
 			return dns_list;
 		}
 
-		if (!(lease = l_dhcp_client_get_lease(netconfig->dhcp_client)))
-			return NULL;
+		if ((lease = l_dhcp_client_get_lease(netconfig->dhcp_client)))
+			return l_dhcp_lease_get_dns(lease);
+
+		if (netconfig->saved_lease && netconfig->saved_lease->dns)
+			return l_strv_copy(netconfig->saved_lease->dns);
 
-		return l_dhcp_lease_get_dns(lease);
+		return NULL;
 	} else {
 		const struct l_dhcp6_lease *lease;
 
@@ -500,10 +510,14 @@ static char *netconfig_ipv4_get_gateway(struct netconfig *netconfig,
 		}
 
 		lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
-		if (!lease)
-			return NULL;
+		if (lease)
+			return l_dhcp_lease_get_gateway(lease);
+
+		if (netconfig->saved_lease &&
+				netconfig->saved_lease->gateway[0])
+			return l_strdup(netconfig->saved_lease->gateway);
 
-		return l_dhcp_lease_get_gateway(lease);
+		return NULL;
 	}
 
 	return NULL;
@@ -792,6 +806,15 @@ static void netconfig_ifaddr_ipv6_cmd_cb(int error, uint16_t type,
 	netconfig_ifaddr_ipv6_notify(type, data, len, user_data);
 }
 
+static void netconfig_notify_connected(struct netconfig *netconfig)
+{
+	if (!netconfig->notify || netconfig->connected)
+		return;
+
+	netconfig->connected = true;
+	netconfig->notify(NETCONFIG_EVENT_CONNECTED, netconfig->user_data);
+}
+
 static void netconfig_route_generic_cb(int error, uint16_t type,
 					const void *data, uint32_t len,
 					void *user_data)
@@ -817,11 +840,7 @@ static void netconfig_route_add_cmd_cb(int error, uint16_t type,
 		return;
 	}
 
-	if (!netconfig->notify)
-		return;
-
-	netconfig->notify(NETCONFIG_EVENT_CONNECTED, netconfig->user_data);
-	netconfig->notify = NULL;
+	netconfig_notify_connected(netconfig);
 }
 
 static void netconfig_route6_add_cb(int error, uint16_t type,
@@ -882,12 +901,7 @@ static bool netconfig_ipv4_gateway_route_install(struct netconfig *netconfig)
 				netconfig->rtm_protocol == RTPROT_STATIC ?
 				"setting file" : "DHCPv4 lease");
 
-		if (netconfig->notify) {
-			netconfig->notify(NETCONFIG_EVENT_CONNECTED,
-						netconfig->user_data);
-			netconfig->notify = NULL;
-		}
-
+		netconfig_notify_connected(netconfig);
 		return true;
 	}
 
@@ -1011,6 +1025,91 @@ static void netconfig_ifaddr_del_cmd_cb(int error, uint16_t type,
 				"Error %d: %s", error, strerror(-error));
 }
 
+static void netconfig_remove_v4_address(struct netconfig *netconfig)
+{
+	if (!netconfig->v4_address)
+		return;
+
+	L_WARN_ON(!l_rtnl_ifaddr_delete(rtnl, netconfig->ifindex,
+					netconfig->v4_address,
+					netconfig_ifaddr_del_cmd_cb,
+					netconfig, NULL));
+	l_rtnl_address_free(netconfig->v4_address);
+	netconfig->v4_address = NULL;
+}
+
+static void netconfig_acd_destroy(void *user_data)
+{
+	l_acd_destroy(user_data);
+}
+
+static void netconfig_saved_lease_clear(struct netconfig *netconfig)
+{
+	l_timeout_remove(netconfig->saved_lease_timeout);
+	netconfig->saved_lease_timeout = NULL;
+
+	l_acd_destroy(netconfig->saved_lease_acd);
+	netconfig->saved_lease_acd = NULL;
+
+	dhcp_saved_lease_free(netconfig->saved_lease);
+	netconfig->saved_lease = NULL;
+}
+
+static void netconfig_saved_lease_drop(struct netconfig *netconfig)
+{
+	if (netconfig->addr4_add_cmd_id) {
+		l_netlink_cancel(rtnl, netconfig->addr4_add_cmd_id);
+		netconfig->addr4_add_cmd_id = 0;
+	}
+
+	if (netconfig->route4_add_gateway_cmd_id) {
+		l_netlink_cancel(rtnl, netconfig->route4_add_gateway_cmd_id);
+		netconfig->route4_add_gateway_cmd_id = 0;
+	}
+
+	netconfig_remove_v4_address(netconfig);
+	l_free(l_steal_ptr(netconfig->v4_gateway_str));
+	netconfig_saved_lease_clear(netconfig);
+}
+
+static void netconfig_saved_lease_expired(struct l_timeout *timeout,
+						void *user_data)
+{
+	struct netconfig *netconfig = user_data;
+
+	l_debug("Saved DHCPv4 lease expired before the server confirmed it");
+	netconfig_saved_lease_drop(netconfig);
+}
+
+/*
+ * Check whether the lease just obtained from the server is the one we have
+ * optimistically installed, in which case the address and the routes are
+ * already in place.
+ */
+static bool netconfig_saved_lease_matches(struct netconfig *netconfig)
+{
+	const struct l_dhcp_lease *lease =
+			l_dhcp_client_get_lease(netconfig->dhcp_client);
+	const struct dhcp_saved_lease *saved = netconfig->saved_lease;
+	_auto_(l_free) char *address = l_dhcp_lease_get_address(lease);
+	_auto_(l_free) char *gateway = l_dhcp_lease_get_gateway(lease);
+	uint32_t prefix_len = l_dhcp_lease_get_prefix_length(lease);
+
+	if (!prefix_len)
+		prefix_len = 24;
+
+	return l_streq0(address, saved->address) &&
+		prefix_len == saved->prefix_len &&
+		!strcmp(gateway ?: "", saved->gateway);
+}
+
+static void netconfig_notify_lease(struct netconfig *netconfig)
+{
+	if (netconfig->notify)
+		netconfig->notify(NETCONFIG_EVENT_LEASE_UPDATED,
+					netconfig->user_data);
+}
+
 static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 						enum l_dhcp_client_event event,
 						void *userdata)
@@ -1031,6 +1130,39 @@ static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 		char *gateway_str;
 		struct l_rtnl_address *address;
 
+		/* Still probing the saved address, nothing installed yet */
+		if (netconfig->saved_lease && !netconfig->v4_address) {
+			l_debug("DHCPv4 lease obtained before saved lease ACD "
+				"completed");
+			netconfig_saved_lease_clear(netconfig);
+		}
+
+		if (netconfig->saved_lease) {
+			bool confirmed =
+				netconfig_saved_lease_matches(netconfig);
+
+			l_debug("Saved DHCPv4 lease %s by the server",
+				confirmed ? "confirmed" : "superseded");
+
+			if (!confirmed) {
+				netconfig_saved_lease_drop(netconfig);
+				goto install;
+			}
+
+			netconfig_saved_lease_clear(netconfig);
+
+			if (netconfig_dns_list_update(netconfig, AF_INET))
+				netconfig_set_dns(netconfig);
+
+			if (netconfig_domains_update(netconfig, AF_INET))
+				netconfig_set_domains(netconfig);
+
+			netconfig_gateway_to_arp(netconfig);
+			netconfig_notify_lease(netconfig);
+			break;
+		}
+
+install:
 		gateway_str = netconfig_ipv4_get_gateway(netconfig, NULL);
 		if (l_streq0(netconfig->v4_gateway_str, gateway_str))
 			l_free(gateway_str);
@@ -1057,9 +1189,11 @@ static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 					netconfig->v4_address,
 					netconfig_ipv4_ifaddr_add_cmd_cb,
 					netconfig, NULL)));
+		netconfig_notify_lease(netconfig);
 		break;
 	}
 	case L_DHCP_CLIENT_EVENT_LEASE_RENEWED:
+		netconfig_notify_lease(netconfig);
 		break;
 	case L_DHCP_CLIENT_EVENT_LEASE_EXPIRED:
 		L_WARN_ON(!l_rtnl_ifaddr_delete(rtnl, netconfig->ifindex,
@@ -1072,6 +1206,9 @@ static void netconfig_ipv4_dhcp_event_handler(struct l_dhcp_client *client,
 
 		/* Fall through. */
 	case L_DHCP_CLIENT_EVENT_NO_LEASE:
+		if (netconfig->saved_lease)
+			netconfig_saved_lease_drop(netconfig);
+
 		/*
 		 * The requested address is no longer available, try to restart
 		 * the client.
@@ -1146,19 +1283,6 @@ static void netconfig_dhcp6_event_handler(struct l_dhcp6_client *client,
 	}
 }
 
-static void netconfig_remove_v4_address(struct netconfig *netconfig)
-{
-	if (!netconfig->v4_address)
-		return;
-
-	L_WARN_ON(!l_rtnl_ifaddr_delete(rtnl, netconfig->ifindex,
-					netconfig->v4_address,
-					netconfig_ifaddr_del_cmd_cb,
-					netconfig, NULL));
-	l_rtnl_address_free(netconfig->v4_address);
-	netconfig->v4_address = NULL;
-}
-
 static void netconfig_reset_v4(struct netconfig *netconfig)
 {
 	if (netconfig->rtm_protocol) {
@@ -1170,6 +1294,8 @@ static void netconfig_reset_v4(struct netconfig *netconfig)
 		l_dhcp_client_stop(netconfig->dhcp_client);
 		netconfig->rtm_protocol = 0;
 
+		netconfig_saved_lease_clear(netconfig);
+
 		l_acd_destroy(netconfig->acd);
 		netconfig->acd = NULL;
 
@@ -1212,6 +1338,93 @@ static void netconfig_ipv4_acd_event(enum l_acd_event event, void *user_data)
 	}
 }
 
+static void netconfig_saved_lease_acd_event(enum l_acd_event event,
+						void *user_data)
+{
+	struct netconfig *netconfig = user_data;
+	const struct dhcp_saved_lease *lease = netconfig->saved_lease;
+
+	switch (event) {
+	case L_ACD_EVENT_AVAILABLE:
+		netconfig->v4_address = l_rtnl_address_new(lease->address,
+							lease->prefix_len);
+		if (L_WARN_ON(!netconfig->v4_address))
+			break;
+
+		l_debug("Installing saved DHCPv4 lease address %s/%u",
+				lease->address, lease->prefix_len);
+
+		l_rtnl_address_set_noprefixroute(netconfig->v4_address, true);
+
+		if (lease->gateway[0])
+			netconfig->v4_gateway_str = l_strdup(lease->gateway);
+
+		netconfig_dns_list_update(netconfig, AF_INET);
+		netconfig_domains_update(netconfig, AF_INET);
+
+		L_WARN_ON(!(netconfig->addr4_add_cmd_id =
+				l_rtnl_ifaddr_add(rtnl, netconfig->ifindex,
+					netconfig->v4_address,
+					netconfig_ipv4_ifaddr_add_cmd_cb,
+					netconfig, NULL)));
+		return;
+	case L_ACD_EVENT_CONFLICT:
+		l_debug("Saved DHCPv4 lease address %s in use",
+				lease->address);
+		break;
+	case L_ACD_EVENT_LOST:
+		l_debug("Saved DHCPv4 lease address %s lost", lease->address);
+		break;
+	}
+
+	/* Leave the rest to the DHCP exchange, the ACD can't be freed here */
+	l_acd_set_event_handler(netconfig->saved_lease_acd, NULL, NULL, NULL);
+	l_idle_oneshot(netconfig_acd_destroy,
+			l_steal_ptr(netconfig->saved_lease_acd), NULL);
+	netconfig_saved_lease_drop(netconfig);
+}
+
+/*
+ * Install the address remembered from a previous connection to this ESS
+ * instead of waiting for the DHCP exchange, which still runs in parallel
+ * and either confirms or replaces it.  A lease is only reused through an
+ * AP it was used through before, so that a network with the same SSID at
+ * another site doesn't get a foreign address, and only once ACD has found
+ * the address unused.
+ */
+static void netconfig_ipv4_install_saved_lease(struct netconfig *netconfig)
+{
+	struct netdev *netdev = netdev_find(netconfig->ifindex);
+	struct handshake_state *hs = netdev_get_handshake(netdev);
+	const struct dhcp_saved_lease *lease = netconfig->saved_lease;
+	uint64_t now = time(NULL);
+
+	if (!dhcp_saved_lease_usable(lease, netdev_get_address(netdev),
+					hs ? hs->aa : NULL, now)) {
+		l_debug("Saved DHCPv4 lease not usable");
+		netconfig_saved_lease_clear(netconfig);
+		return;
+	}
+
+	netconfig->saved_lease_acd = l_acd_new(netconfig->ifindex);
+	l_acd_set_event_handler(netconfig->saved_lease_acd,
+				netconfig_saved_lease_acd_event, netconfig,
+				NULL);
+	if (getenv("IWD_ACD_DEBUG"))
+		l_acd_set_debug(netconfig->saved_lease_acd, do_debug,
+				"[ACD] ", NULL);
+
+	if (!l_acd_start(netconfig->saved_lease_acd, lease->address)) {
+		l_debug("Failed to start ACD for the saved DHCPv4 lease");
+		netconfig_saved_lease_clear(netconfig);
+		return;
+	}
+
+	netconfig->saved_lease_timeout = l_timeout_create(lease->expires - now,
+						netconfig_saved_lease_expired,
+						netconfig, NULL);
+}
+
 static bool netconfig_ipv4_select_and_install(struct netconfig *netconfig)
 {
 	struct netdev *netdev = netdev_find(netconfig->ifindex);
@@ -1232,6 +1445,7 @@ static bool netconfig_ipv4_select_and_install(struct netconfig *netconfig)
 
 		l_rtnl_address_set_noprefixroute(netconfig->v4_address, true);
 		set_address = true;
+		netconfig_saved_lease_clear(netconfig);
 
 		/*
 		 * TODO: If netconfig->fils_override->ipv4_lifetime is set,
@@ -1276,6 +1490,9 @@ static bool netconfig_ipv4_select_and_install(struct netconfig *netconfig)
 		return true;
 	}
 
+	if (netconfig->saved_lease)
+		netconfig_ipv4_install_saved_lease(netconfig);
+
 	l_dhcp_client_set_address(netconfig->dhcp_client, ARPHRD_ETHER,
 					netdev_get_address(netdev), ETH_ALEN);
 
@@ -1379,6 +1596,7 @@ bool netconfig_load_settings(struct netconfig *netconfig,
 	_auto_(l_strv_free) char **dns6_overrides = NULL;
 	_auto_(l_rtnl_address_free) struct l_rtnl_address *v4_address = NULL;
 	_auto_(l_rtnl_address_free) struct l_rtnl_address *v6_address = NULL;
+	struct dhcp_saved_lease *saved_lease = NULL;
 
 	dns4_overrides = l_settings_get_string_list(active_settings,
 							"IPv4", "DNS", ' ');
@@ -1469,6 +1687,11 @@ bool netconfig_load_settings(struct netconfig *netconfig,
 
 	if (netconfig->rtm_protocol == RTPROT_STATIC)
 		netconfig->v4_address = l_steal_ptr(v4_address);
+	else
+		saved_lease = dhcp_saved_lease_load(active_settings);
+
+	netconfig_saved_lease_clear(netconfig);
+	netconfig->saved_lease = saved_lease;
 
 	if (netconfig->rtm_v6_protocol == RTPROT_STATIC)
 		netconfig->v6_address = l_steal_ptr(v6_address);
@@ -1485,6 +1708,7 @@ bool netconfig_configure(struct netconfig *netconfig,
 {
 	netconfig->notify = notify;
 	netconfig->user_data = user_data;
+	netconfig->connected = false;
 
 	if (unlikely(!netconfig_ipv4_select_and_install(netconfig)))
 		return false;
@@ -1586,6 +1810,74 @@ char *netconfig_get_dhcp_server_ipv4(struct netconfig *netconfig)
 	return l_dhcp_lease_get_server_id(lease);
 }
 
+/*
+ * Updates the lease saved in settings and returns whether it changed.  Lease
+ * renewals that only extend the expiry time are not saved so that the
+ * profile isn't rewritten each time, the saved expiry is then earlier than
+ * the real one which only makes reusing the lease more conservative.
+ */
+bool netconfig_save_dhcp_lease(struct netconfig *netconfig,
+				struct l_settings *settings)
+{
+	struct netdev *netdev = netdev_find(netconfig->ifindex);
+	struct handshake_state *hs = netdev_get_handshake(netdev);
+	const struct l_dhcp_lease *lease;
+	struct dhcp_saved_lease saved = {};
+	struct dhcp_saved_lease *old;
+	bool changed;
+	_auto_(l_free) char *address = NULL;
+	_auto_(l_free) char *server = NULL;
+	_auto_(l_free) char *gateway = NULL;
+	_auto_(l_strv_free) char **dns = NULL;
+
+	if (netconfig->rtm_protocol != RTPROT_DHCP)
+		return false;
+
+	lease = l_dhcp_client_get_lease(netconfig->dhcp_client);
+	if (!lease)
+		return false;
+
+	address = l_dhcp_lease_get_address(lease);
+	server = l_dhcp_lease_get_server_id(lease);
+	if (!address || !server)
+		return false;
+
+	gateway = l_dhcp_lease_get_gateway(lease);
+	dns = l_dhcp_lease_get_dns(lease);
+
+	l_strlcpy(saved.address, address, sizeof(saved.address));
+	l_strlcpy(saved.server, server, sizeof(saved.server));
+
+	if (gateway)
+		l_strlcpy(saved.gateway, gateway, sizeof(saved.gateway));
+
+	saved.prefix_len = l_dhcp_lease_get_prefix_length(lease) ?: 24;
+	saved.dns = dns;
+	memcpy(saved.client_addr, netdev_get_address(netdev), ETH_ALEN);
+	saved.expires = (uint64_t) time(NULL) +
+				l_dhcp_lease_get_lifetime(lease);
+
+	old = dhcp_saved_lease_load(settings);
+
+	/* Keep the APs of the ESS the same address was used through */
+	if (old && !strcmp(old->address, saved.address)) {
+		memcpy(saved.bssids, old->bssids, sizeof(saved.bssids));
+		saved.n_bssids = old->n_bssids;
+	}
+
+	if (hs)
+		dhcp_saved_lease_add_bssid(&saved, hs->aa);
+
+	changed = !old || !dhcp_saved_lease_equal(old, &saved);
+	dhcp_saved_lease_free(old);
+
+	if (!changed)
+		return false;
+
+	dhcp_saved_lease_save(settings, &saved);
+	return true;
+}
+
 bool netconfig_get_fils_ip_req(struct netconfig *netconfig,
 				struct ie_fils_ip_addr_request_info *info)
 {
@@ -26,6 +26,7 @@ struct ie_fils_ip_addr_response_info;
 
 enum netconfig_event {
 	NETCONFIG_EVENT_CONNECTED,
+	NETCONFIG_EVENT_LEASE_UPDATED,
 };
 
 typedef void (*netconfig_notify_func_t)(enum netconfig_event event,
@@ -39,6 +40,8 @@ bool netconfig_configure(struct netconfig *netconfig,
 bool netconfig_reconfigure(struct netconfig *netconfig, bool set_arp_gw);
 bool netconfig_reset(struct netconfig *netconfig);
 char *netconfig_get_dhcp_server_ipv4(struct netconfig *netconfig);
+bool netconfig_save_dhcp_lease(struct netconfig *netconfig,
+				struct l_settings *settings);
 bool netconfig_get_fils_ip_req(struct netconfig *netconfig,
 				struct ie_fils_ip_addr_request_info *info);
 void netconfig_handle_fils_ip_resp(struct netconfig *netconfig,
@@ -70,6 +70,17 @@
 #define ENOTSUPP 524
 #endif
 
+/* Link sample intervals in seconds, see netdev_link_sample_interval() */
+#define LINK_SAMPLE_INTERVAL_FAST	2
+#define LINK_SAMPLE_INTERVAL_DEFAULT	6
+#define LINK_SAMPLE_INTERVAL_STABLE	12
+/* RSSI spread in dB across the sample ring */
+#define LINK_SAMPLE_STABLE_SPREAD	2
+#define LINK_SAMPLE_VOLATILE_SPREAD	8
+/* Links due within this many ms are sampled in the same tick */
+#define LINK_SAMPLE_SLACK		500
+#define LINK_SAMPLES_MAX		8
+
 enum connection_type {
 	CONNECTION_TYPE_SOFTMAC,
 	CONNECTION_TYPE_FULLMAC,
@@ -99,10 +110,19 @@ struct netdev_handshake_state {
 struct netdev_ft_over_ds_info {
 	struct ft_ds_info super;
 	struct netdev *netdev;
+	uint32_t cmd_id;
 
 	bool parsed : 1;
 };
 
+struct netdev_link_sample {
+	uint64_t time;
+	int8_t rssi;
+	uint32_t tx_bitrate;
+	uint32_t tx_retries;
+	uint32_t tx_failed;
+};
+
 struct netdev_ext_key_info {
 	uint16_t proto;
 	bool noencrypt;
@@ -150,8 +170,14 @@ struct netdev {
 	uint8_t rssi_levels_num;
 	uint8_t cur_rssi_level_idx;
 	int8_t cur_rssi;
-	struct l_timeout *rssi_poll_timeout;
-	uint32_t rssi_poll_cmd_id;
+	struct netdev_link_sample link_samples[LINK_SAMPLES_MAX];
+	uint8_t link_samples_num;
+	uint8_t link_samples_idx;
+	struct diagnostic_station_info link_info;
+	uint64_t link_info_time;
+	uint64_t link_sample_next;
+	uint32_t link_sample_cmd_id;
+	uint8_t link_watchers;
 	uint8_t set_mac_once[6];
 
 	struct scan_bss *fw_roam_bss;
@@ -169,6 +195,7 @@ struct netdev {
 	struct l_idle *disconnect_idle;
 
 	struct watchlist station_watches;
+	struct watchlist link_watches;
 
 	struct l_io *pae_io;  /* for drivers without EAPoL over NL80211 */
 
@@ -195,6 +222,7 @@ struct netdev {
 	bool retry_auth : 1;
 	bool in_reassoc : 1;
 	bool privacy : 1;
+	bool link_sampling : 1;
 };
 
 struct netdev_preauth_state {
@@ -213,6 +241,7 @@ static struct l_netlink *rtnl = NULL;
 static struct l_genl_family *nl80211;
 static struct l_queue *netdev_list;
 static struct watchlist netdev_watches;
+static struct l_timeout *link_sample_timeout;
 static bool mac_per_ssid;
 
 static unsigned int iov_ie_append(struct iovec *iov,
@@ -624,6 +653,24 @@ static bool netdev_parse_sta_info(struct l_genl_attr *attr,
 			info->expected_throughput = l_get_u32(data);
 			info->have_expected_throughput = true;
 
+			break;
+
+		case NL80211_STA_INFO_TX_RETRIES:
+			if (len != 4)
+				return false;
+
+			info->tx_retries = l_get_u32(data);
+			info->have_tx_retries = true;
+
+			break;
+
+		case NL80211_STA_INFO_TX_FAILED:
+			if (len != 4)
+				return false;
+
+			info->tx_failed = l_get_u32(data);
+			info->have_tx_failed = true;
+
 			break;
 		}
 	}
@@ -642,61 +689,210 @@ static void netdev_set_rssi_level_idx(struct netdev *netdev)
 	netdev->cur_rssi_level_idx = new_level;
 }
 
-static void netdev_rssi_poll_cb(struct l_genl_msg *msg, void *user_data)
+static bool netdev_parse_get_station(struct l_genl_msg *msg,
+					struct diagnostic_station_info *info)
 {
-	struct netdev *netdev = user_data;
 	struct l_genl_attr attr, nested;
 	uint16_t type, len;
 	const void *data;
-	bool found;
-	struct diagnostic_station_info info;
-	uint8_t prev_rssi_level_idx = netdev->cur_rssi_level_idx;
-
-	netdev->rssi_poll_cmd_id = 0;
 
 	if (!l_genl_attr_init(&attr, msg))
-		goto done;
+		return false;
+
+	memset(info, 0, sizeof(*info));
 
-	found = false;
 	while (l_genl_attr_next(&attr, &type, &len, &data)) {
-		if (type != NL80211_ATTR_STA_INFO)
-			continue;
+		switch (type) {
+		case NL80211_ATTR_STA_INFO:
+			if (!l_genl_attr_recurse(&attr, &nested))
+				return false;
 
-		if (!l_genl_attr_recurse(&attr, &nested))
-			goto done;
+			if (!netdev_parse_sta_info(&nested, info))
+				return false;
 
-		if (!netdev_parse_sta_info(&nested, &info))
-			goto done;
+			break;
 
-		found = true;
-		break;
+		case NL80211_ATTR_MAC:
+			if (len != 6)
+				return false;
+
+			memcpy(info->addr, data, 6);
+
+			break;
+		}
 	}
 
-	if (!found || !info.have_cur_rssi)
-		goto done;
+	return true;
+}
 
-	netdev->cur_rssi = info.cur_rssi;
+static bool netdev_link_sampling_needed(struct netdev *netdev)
+{
+	if (!netdev->operational || !netdev->handshake)
+		return false;
+
+	if (netdev->link_watchers)
+		return true;
 
 	/*
-	 * Note we don't have to handle LOW_SIGNAL_THRESHOLD here.  The
-	 * CQM single threshold RSSI monitoring should work even if the
-	 * kernel driver doesn't support multiple thresholds.  So the
-	 * polling only handles the client-supplied threshold list.
+	 * Note we don't have to poll for LOW_SIGNAL_THRESHOLD.  The CQM
+	 * single threshold RSSI monitoring should work even if the kernel
+	 * driver doesn't support multiple thresholds.  So the polling only
+	 * handles the client-supplied threshold list.
 	 */
-	netdev_set_rssi_level_idx(netdev);
-	if (netdev->cur_rssi_level_idx != prev_rssi_level_idx)
-		netdev->event_filter(netdev, NETDEV_EVENT_RSSI_LEVEL_NOTIFY,
+	return netdev->rssi_levels_num > 0 &&
+		!wiphy_has_ext_feature(netdev->wiphy,
+					NL80211_EXT_FEATURE_CQM_RSSI_LIST);
+}
+
+static void netdev_link_samples_reset(struct netdev *netdev)
+{
+	netdev->link_samples_num = 0;
+	netdev->link_samples_idx = 0;
+	netdev->link_info_time = 0;
+}
+
+/*
+ * Sample quickly while a roam is pending or the signal swings, back off
+ * once the whole ring agrees on the RSSI.
+ */
+static unsigned int netdev_link_sample_interval(struct netdev *netdev)
+{
+	const struct netdev_link_sample *last;
+	const struct netdev_link_sample *prev;
+	int min = INT8_MAX;
+	int max = INT8_MIN;
+	unsigned int i;
+
+	if (netdev->cur_rssi_low)
+		return LINK_SAMPLE_INTERVAL_FAST;
+
+	if (netdev->link_samples_num < 2)
+		return LINK_SAMPLE_INTERVAL_DEFAULT;
+
+	for (i = 0; i < netdev->link_samples_num; i++) {
+		min = L_MIN(min, netdev->link_samples[i].rssi);
+		max = L_MAX(max, netdev->link_samples[i].rssi);
+	}
+
+	i = netdev->link_samples_idx + LINK_SAMPLES_MAX;
+	last = &netdev->link_samples[(i - 1) % LINK_SAMPLES_MAX];
+	prev = &netdev->link_samples[(i - 2) % LINK_SAMPLES_MAX];
+
+	/* Frames the driver gave up on are an early sign of a fading link */
+	if (max - min >= LINK_SAMPLE_VOLATILE_SPREAD ||
+			last->tx_failed > prev->tx_failed)
+		return LINK_SAMPLE_INTERVAL_FAST;
+
+	if (netdev->link_samples_num == LINK_SAMPLES_MAX &&
+			max - min <= LINK_SAMPLE_STABLE_SPREAD)
+		return LINK_SAMPLE_INTERVAL_STABLE;
+
+	return LINK_SAMPLE_INTERVAL_DEFAULT;
+}
+
+static void netdev_link_info_update(struct netdev *netdev,
+				const struct diagnostic_station_info *info)
+{
+	struct netdev_link_sample *sample;
+	uint8_t prev_rssi_level_idx = netdev->cur_rssi_level_idx;
+
+	/* Samples taken on the previous BSS say nothing about this one */
+	if (memcmp(netdev->link_info.addr, info->addr, 6))
+		netdev_link_samples_reset(netdev);
+
+	memcpy(&netdev->link_info, info, sizeof(*info));
+	netdev->link_info_time = l_time_now();
+
+	if (info->have_cur_rssi) {
+		sample = &netdev->link_samples[netdev->link_samples_idx];
+		sample->time = netdev->link_info_time;
+		sample->rssi = info->cur_rssi;
+		sample->tx_bitrate = info->have_tx_bitrate ?
+							info->tx_bitrate : 0;
+		sample->tx_retries = info->tx_retries;
+		sample->tx_failed = info->tx_failed;
+
+		netdev->link_samples_idx = (netdev->link_samples_idx + 1) %
+							LINK_SAMPLES_MAX;
+		if (netdev->link_samples_num < LINK_SAMPLES_MAX)
+			netdev->link_samples_num++;
+
+		netdev->cur_rssi = info->cur_rssi;
+	}
+
+	if (info->have_cur_rssi && netdev->rssi_levels_num &&
+			netdev->event_filter &&
+			!wiphy_has_ext_feature(netdev->wiphy,
+					NL80211_EXT_FEATURE_CQM_RSSI_LIST)) {
+		netdev_set_rssi_level_idx(netdev);
+		if (netdev->cur_rssi_level_idx != prev_rssi_level_idx)
+			netdev->event_filter(netdev,
+					NETDEV_EVENT_RSSI_LEVEL_NOTIFY,
 					&netdev->cur_rssi_level_idx,
 					netdev->user_data);
+	}
 
-done:
-	/* Rearm timer */
-	l_timeout_modify(netdev->rssi_poll_timeout, 6);
+	WATCHLIST_NOTIFY(&netdev->link_watches, netdev_link_watch_func_t,
+				netdev, &netdev->link_info);
+}
+
+static void netdev_link_sample_tick(struct l_timeout *timeout,
+							void *user_data);
+
+static void netdev_link_sampler_rearm(void)
+{
+	const struct l_queue_entry *entry;
+	uint64_t next = 0;
+	uint64_t now;
+	uint64_t ms = 1;
+
+	for (entry = l_queue_get_entries(netdev_list); entry;
+						entry = entry->next) {
+		struct netdev *netdev = entry->data;
+
+		if (!netdev->link_sampling || netdev->link_sample_cmd_id)
+			continue;
+
+		if (!next || l_time_before(netdev->link_sample_next, next))
+			next = netdev->link_sample_next;
+	}
+
+	if (!next) {
+		l_timeout_remove(link_sample_timeout);
+		link_sample_timeout = NULL;
+		return;
+	}
+
+	now = l_time_now();
+	if (l_time_after(next, now))
+		ms = L_MAX(l_time_diff(now, next) / L_USEC_PER_MSEC, 1ULL);
+
+	if (link_sample_timeout)
+		l_timeout_modify_ms(link_sample_timeout, ms);
+	else
+		link_sample_timeout = l_timeout_create_ms(ms,
+						netdev_link_sample_tick,
+						NULL, NULL);
 }
 
-static void netdev_rssi_poll(struct l_timeout *timeout, void *user_data)
+static void netdev_link_sample_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct netdev *netdev = user_data;
+	struct diagnostic_station_info info;
+
+	netdev->link_sample_cmd_id = 0;
+
+	if (netdev_parse_get_station(msg, &info))
+		netdev_link_info_update(netdev, &info);
+
+	netdev->link_sample_next = l_time_offset(l_time_now(),
+				netdev_link_sample_interval(netdev) *
+				L_USEC_PER_SEC);
+	netdev_link_sampler_rearm();
+}
+
+static void netdev_link_sample(struct netdev *netdev)
+{
 	struct l_genl_msg *msg;
 
 	msg = l_genl_msg_new_sized(NL80211_CMD_GET_STATION, 64);
@@ -704,36 +900,67 @@ static void netdev_rssi_poll(struct l_timeout *timeout, void *user_data)
 	l_genl_msg_append_attr(msg, NL80211_ATTR_MAC, ETH_ALEN,
 							netdev->handshake->aa);
 
-	netdev->rssi_poll_cmd_id = l_genl_family_send(nl80211, msg,
-							netdev_rssi_poll_cb,
+	netdev->link_sample_cmd_id = l_genl_family_send(nl80211, msg,
+							netdev_link_sample_cb,
 							netdev, NULL);
+	if (netdev->link_sample_cmd_id)
+		return;
+
+	l_genl_msg_unref(msg);
+	netdev->link_sample_next = l_time_offset(l_time_now(),
+			LINK_SAMPLE_INTERVAL_DEFAULT * L_USEC_PER_SEC);
 }
 
-/* To be called whenever operational or rssi_levels_num are updated */
-static void netdev_rssi_polling_update(struct netdev *netdev)
+/*
+ * A single timer serves all links so that the GET_STATION requests of
+ * several connected netdevs go out together instead of each waking the
+ * system up on its own schedule.
+ */
+static void netdev_link_sample_tick(struct l_timeout *timeout,
+							void *user_data)
 {
-	if (wiphy_has_ext_feature(netdev->wiphy,
-					NL80211_EXT_FEATURE_CQM_RSSI_LIST))
-		return;
+	const struct l_queue_entry *entry;
+	uint64_t due = l_time_offset(l_time_now(),
+					LINK_SAMPLE_SLACK * L_USEC_PER_MSEC);
 
-	if (netdev->operational && netdev->rssi_levels_num > 0) {
-		if (netdev->rssi_poll_timeout)
-			return;
+	for (entry = l_queue_get_entries(netdev_list); entry;
+						entry = entry->next) {
+		struct netdev *netdev = entry->data;
 
-		netdev->rssi_poll_timeout =
-			l_timeout_create(1, netdev_rssi_poll, netdev, NULL);
-	} else {
-		if (!netdev->rssi_poll_timeout)
-			return;
+		if (!netdev->link_sampling || netdev->link_sample_cmd_id)
+			continue;
 
-		l_timeout_remove(netdev->rssi_poll_timeout);
-		netdev->rssi_poll_timeout = NULL;
+		if (l_time_after(netdev->link_sample_next, due))
+			continue;
 
-		if (netdev->rssi_poll_cmd_id) {
-			l_genl_family_cancel(nl80211, netdev->rssi_poll_cmd_id);
-			netdev->rssi_poll_cmd_id = 0;
-		}
+		netdev_link_sample(netdev);
+	}
+
+	netdev_link_sampler_rearm();
+}
+
+/* To be called whenever operational, rssi_levels_num or the watches change */
+static void netdev_link_sampling_update(struct netdev *netdev)
+{
+	bool needed = netdev_link_sampling_needed(netdev);
+
+	if (!netdev->operational)
+		netdev_link_samples_reset(netdev);
+
+	if (needed == netdev->link_sampling)
+		return;
+
+	netdev->link_sampling = needed;
+
+	if (needed)
+		netdev->link_sample_next = l_time_offset(l_time_now(),
+							L_USEC_PER_SEC);
+	else if (netdev->link_sample_cmd_id) {
+		l_genl_family_cancel(nl80211, netdev->link_sample_cmd_id);
+		netdev->link_sample_cmd_id = 0;
 	}
+
+	netdev_link_sampler_rearm();
 }
 
 static void netdev_preauth_destroy(void *data)
@@ -828,7 +1055,7 @@ static void netdev_connect_free(struct netdev *netdev)
 		netdev->connect_cmd = NULL;
 	}
 
-	netdev_rssi_polling_update(netdev);
+	netdev_link_sampling_update(netdev);
 
 	if (netdev->connect_cmd_id) {
 		l_genl_family_cancel(nl80211, netdev->connect_cmd_id);
@@ -895,6 +1122,14 @@ static void netdev_free(void *data)
 		l_timeout_remove(netdev->neighbor_report_timeout);
 	}
 
+	/* netdev_list may be mid-teardown, don't let the sampler walk it */
+	netdev->link_sampling = false;
+
+	if (netdev->link_sample_cmd_id) {
+		l_genl_family_cancel(nl80211, netdev->link_sample_cmd_id);
+		netdev->link_sample_cmd_id = 0;
+	}
+
 	if (netdev->connected || netdev->connect_cmd_id || netdev->work.id)
 		netdev_connect_free(netdev);
 
@@ -965,6 +1200,7 @@ static void netdev_free(void *data)
 	scan_wdev_remove(netdev->wdev_id);
 
 	watchlist_destroy(&netdev->station_watches);
+	watchlist_destroy(&netdev->link_watches);
 
 	l_io_destroy(netdev->pae_io);
 
@@ -1026,12 +1262,18 @@ static void netdev_rssi_level_init(struct netdev *netdev)
 		netdev_set_rssi_level_idx(netdev);
 }
 
+/* The RoamThreshold / RoamThreshold5G settings for a frequency */
+int netdev_get_low_signal_threshold(uint32_t frequency)
+{
+	return frequency > 4000 ? LOW_SIGNAL_THRESHOLD_5GHZ :
+					LOW_SIGNAL_THRESHOLD;
+}
+
 static void netdev_cqm_event_rssi_value(struct netdev *netdev, int rssi_val)
 {
 	bool new_rssi_low;
 	uint8_t prev_rssi_level_idx = netdev->cur_rssi_level_idx;
-	int threshold = netdev->frequency > 4000 ? LOW_SIGNAL_THRESHOLD_5GHZ :
-						LOW_SIGNAL_THRESHOLD;
+	int threshold = netdev_get_low_signal_threshold(netdev->frequency);
 
 	if (!netdev->connected)
 		return;
@@ -1401,7 +1643,7 @@ static void netdev_connect_ok(struct netdev *netdev)
 		netdev->connect_cb = NULL;
 	}
 
-	netdev_rssi_polling_update(netdev);
+	netdev_link_sampling_update(netdev);
 
 	if (netdev->work.id)
 		wiphy_radio_work_done(netdev->wiphy, netdev->work.id);
@@ -2525,7 +2767,7 @@ static struct l_genl_msg *netdev_build_cmd_connect(struct netdev *netdev,
 {
 	struct netdev_handshake_state *nhs =
 		l_container_of(hs, struct netdev_handshake_state, super);
-	uint32_t auth_type = IE_AKM_IS_SAE(hs->akm_suite) ?
+	uint32_t auth_type = IE_AKM_IS_SAE(hs->akm_suite) && !hs->pmksa ?
 					NL80211_AUTHTYPE_SAE :
 					NL80211_AUTHTYPE_OPEN_SYSTEM;
 	enum mpdu_management_subtype subtype = prev_bssid ?
@@ -3708,8 +3950,7 @@ static struct l_genl_msg *netdev_build_cmd_cqm_rssi_update(
 	uint32_t hyst = 5;
 	int thold_count;
 	int32_t thold_list[levels_num + 2];
-	int threshold = netdev->frequency > 4000 ? LOW_SIGNAL_THRESHOLD_5GHZ :
-						LOW_SIGNAL_THRESHOLD;
+	int threshold = netdev_get_low_signal_threshold(netdev->frequency);
 
 	if (levels_num == 0) {
 		thold_list[0] = threshold;
@@ -3957,6 +4198,13 @@ static void netdev_connect_common(struct netdev *netdev,
 	switch (hs->akm_suite) {
 	case IE_RSN_AKM_SUITE_SAE_SHA256:
 	case IE_RSN_AKM_SUITE_FT_OVER_SAE_SHA256:
+		/*
+		 * With a cached PMKSA use Open System authentication and go
+		 * straight to the 4-Way Handshake
+		 */
+		if (hs->pmksa)
+			goto build_cmd_connect;
+
 		netdev->ap = sae_sm_new(hs, netdev_sae_tx_authenticate,
 						netdev_sae_tx_associate,
 						netdev);
@@ -4152,7 +4400,7 @@ int netdev_reassociate(struct netdev *netdev, struct scan_bss *target_bss,
 	if (netdev->ap)
 		memcpy(netdev->ap->prev_bssid, orig_bss->addr, ETH_ALEN);
 
-	netdev_rssi_polling_update(netdev);
+	netdev_link_sampling_update(netdev);
 
 	if (old_sm)
 		eapol_sm_free(old_sm);
@@ -4448,7 +4696,7 @@ static void prepare_ft(struct netdev *netdev, const struct scan_bss *target_bss)
 		netdev->rekey_offload_cmd_id = 0;
 	}
 
-	netdev_rssi_polling_update(netdev);
+	netdev_link_sampling_update(netdev);
 	netdev_cqm_rssi_update(netdev);
 
 	if (netdev->sm) {
@@ -4467,6 +4715,8 @@ static void netdev_ft_over_ds_auth_failed(struct netdev_ft_over_ds_info *info,
 struct ft_ds_finder {
 	const uint8_t *spa;
 	const uint8_t *aa;
+	bool parsed;
+	const struct netdev_ft_over_ds_info *skip;
 };
 
 static bool match_ft_ds_info(const void *a, const void *b)
@@ -4474,6 +4724,10 @@ static bool match_ft_ds_info(const void *a, const void *b)
 	const struct netdev_ft_over_ds_info *info = a;
 	const struct ft_ds_finder *finder = b;
 
+	if (info == finder->skip)
+		return false;
+	if (finder->parsed && !info->parsed)
+		return false;
 	if (memcmp(info->super.spa, finder->spa, 6))
 		return false;
 	if (memcmp(info->super.aa, finder->aa, 6))
@@ -4482,6 +4736,27 @@ static bool match_ft_ds_info(const void *a, const void *b)
 	return true;
 }
 
+static bool netdev_ft_ds_info_remove_if(void *data, void *user_data)
+{
+	struct netdev_ft_over_ds_info *info = data;
+
+	if (!match_ft_ds_info(info, user_data))
+		return false;
+
+	ft_ds_info_free(&info->super);
+	return true;
+}
+
+static bool netdev_ft_ds_info_remove_pending(void *data, void *user_data)
+{
+	struct netdev_ft_over_ds_info *info = data;
+
+	if (info->parsed)
+		return false;
+
+	return netdev_ft_ds_info_remove_if(data, user_data);
+}
+
 static void netdev_ft_response_frame_event(const struct mmpdu_header *hdr,
 					const void *body, size_t body_len,
 					int rssi, void *user_data)
@@ -4503,6 +4778,8 @@ static void netdev_ft_response_frame_event(const struct mmpdu_header *hdr,
 
 	finder.spa = spa;
 	finder.aa = aa;
+	finder.parsed = false;
+	finder.skip = NULL;
 
 	info = l_queue_find(netdev->ft_ds_list, match_ft_ds_info, &finder);
 	if (!info)
@@ -4520,6 +4797,11 @@ static void netdev_ft_response_frame_event(const struct mmpdu_header *hdr,
 
 	info->parsed = true;
 
+	/* A refreshed response supersedes any older one for this target */
+	finder.skip = info;
+	l_queue_foreach_remove(netdev->ft_ds_list,
+				netdev_ft_ds_info_remove_if, &finder);
+
 	return;
 
 ft_error:
@@ -4620,10 +4902,12 @@ int netdev_fast_transition_over_ds(struct netdev *netdev,
 
 	finder.spa = netdev->addr;
 	finder.aa = target_bss->addr;
+	finder.parsed = true;
+	finder.skip = NULL;
 
+	/* Skip over a refresh still in progress for this target */
 	info = l_queue_find(netdev->ft_ds_list, match_ft_ds_info, &finder);
-
-	if (!info || !info->parsed)
+	if (!info)
 		return -ENOENT;
 
 	prepare_ft(netdev, target_bss);
@@ -4647,6 +4931,8 @@ static void netdev_ft_request_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct netdev_ft_over_ds_info *info = user_data;
 
+	info->cmd_id = 0;
+
 	if (l_genl_msg_get_error(msg) < 0) {
 		l_error("Could not send CMD_FRAME for FT-over-DS");
 		netdev_ft_over_ds_auth_failed(info,
@@ -4659,6 +4945,9 @@ static void netdev_ft_ds_info_free(struct ft_ds_info *ft)
 	struct netdev_ft_over_ds_info *info = l_container_of(ft,
 					struct netdev_ft_over_ds_info, super);
 
+	if (info->cmd_id)
+		l_genl_family_cancel(nl80211, info->cmd_id);
+
 	l_free(info);
 }
 
@@ -4671,6 +4960,7 @@ int netdev_fast_transition_over_ds_action(struct netdev *netdev,
 	struct iovec iovs[5];
 	uint8_t buf[512];
 	size_t len;
+	struct ft_ds_finder finder;
 
 	if (!netdev->operational)
 		return -ENOTCONN;
@@ -4682,6 +4972,18 @@ int netdev_fast_transition_over_ds_action(struct netdev *netdev,
 
 	l_debug("");
 
+	/*
+	 * Drop any request to this target still awaiting a response, a
+	 * previously parsed response is kept until the new one arrives
+	 */
+	finder.spa = hs->spa;
+	finder.aa = target_bss->addr;
+	finder.parsed = false;
+	finder.skip = NULL;
+
+	l_queue_foreach_remove(netdev->ft_ds_list,
+				netdev_ft_ds_info_remove_pending, &finder);
+
 	info = l_new(struct netdev_ft_over_ds_info, 1);
 	info->netdev = netdev;
 
@@ -4718,7 +5020,8 @@ int netdev_fast_transition_over_ds_action(struct netdev *netdev,
 
 	l_queue_push_head(netdev->ft_ds_list, info);
 
-	netdev_send_action_framev(netdev, netdev->handshake->aa, iovs, 2,
+	info->cmd_id = netdev_send_action_framev(netdev,
+					netdev->handshake->aa, iovs, 2,
 					netdev->frequency,
 					netdev_ft_request_cb,
 					info);
@@ -5618,7 +5921,7 @@ done:
 	netdev->rssi_levels_num = levels_num;
 	netdev_rssi_level_init(netdev);
 
-	netdev_rssi_polling_update(netdev);
+	netdev_link_sampling_update(netdev);
 
 	return 0;
 }
@@ -5626,47 +5929,24 @@ done:
 static void netdev_get_station_cb(struct l_genl_msg *msg, void *user_data)
 {
 	struct netdev *netdev = user_data;
-	struct l_genl_attr attr, nested;
-	uint16_t type, len;
-	const void *data;
 	struct diagnostic_station_info info;
 
 	netdev->get_station_cmd_id = 0;
 
-	if (!l_genl_attr_init(&attr, msg))
-		goto parse_error;
-
-	memset(&info, 0, sizeof(info));
+	if (!netdev_parse_get_station(msg, &info)) {
+		if (netdev->get_station_cb)
+			netdev->get_station_cb(NULL, netdev->get_station_data);
 
-	while (l_genl_attr_next(&attr, &type, &len, &data)) {
-		switch (type) {
-		case NL80211_ATTR_STA_INFO:
-			if (!l_genl_attr_recurse(&attr, &nested))
-				goto parse_error;
-
-			if (!netdev_parse_sta_info(&nested, &info))
-				goto parse_error;
-
-			break;
-
-		case NL80211_ATTR_MAC:
-			if (len != 6)
-				goto parse_error;
-
-			memcpy(info.addr, data, 6);
-
-			break;
-		}
+		return;
 	}
 
-	if (netdev->get_station_cb)
-		netdev->get_station_cb(&info, netdev->get_station_data);
-
-	return;
+	/* Let everyone else reading the link share this sample */
+	if (netdev->operational && netdev->handshake &&
+			!memcmp(info.addr, netdev->handshake->aa, 6))
+		netdev_link_info_update(netdev, &info);
 
-parse_error:
 	if (netdev->get_station_cb)
-		netdev->get_station_cb(NULL, netdev->get_station_data);
+		netdev->get_station_cb(&info, netdev->get_station_data);
 }
 
 static void netdev_get_station_destroy(void *user_data)
@@ -6446,6 +6726,7 @@ struct netdev *netdev_create_from_genl(struct l_genl_msg *msg,
 	}
 
 	watchlist_init(&netdev->station_watches, NULL);
+	watchlist_init(&netdev->link_watches, NULL);
 
 	l_queue_push_tail(netdev_list, netdev);
 
@@ -6513,6 +6794,54 @@ bool netdev_station_watch_remove(struct netdev *netdev, uint32_t id)
 	return watchlist_remove(&netdev->station_watches, id);
 }
 
+/*
+ * Watches are notified of every GET_STATION sample of the current link
+ * and keep the shared sampler running while connected.
+ */
+uint32_t netdev_link_watch_add(struct netdev *netdev,
+				netdev_link_watch_func_t func, void *user_data)
+{
+	uint32_t id = watchlist_add(&netdev->link_watches, func,
+					user_data, NULL);
+
+	netdev->link_watchers++;
+	netdev_link_sampling_update(netdev);
+
+	return id;
+}
+
+bool netdev_link_watch_remove(struct netdev *netdev, uint32_t id)
+{
+	if (!watchlist_remove(&netdev->link_watches, id))
+		return false;
+
+	netdev->link_watchers--;
+	netdev_link_sampling_update(netdev);
+
+	return true;
+}
+
+/*
+ * Returns the latest sample of the current link if it is at most max_age
+ * microseconds old, so callers can skip their own GET_STATION request.
+ */
+const struct diagnostic_station_info *netdev_get_link_info(
+						struct netdev *netdev,
+						uint64_t max_age)
+{
+	if (!netdev->operational || !netdev->handshake ||
+			!netdev->link_info_time)
+		return NULL;
+
+	if (memcmp(netdev->link_info.addr, netdev->handshake->aa, 6))
+		return NULL;
+
+	if (l_time_diff(netdev->link_info_time, l_time_now()) > max_age)
+		return NULL;
+
+	return &netdev->link_info;
+}
+
 uint32_t netdev_watch_add(netdev_watch_func_t func,
 				void *user_data, netdev_destroy_func_t destroy)
 {
@@ -6607,6 +6936,9 @@ static void netdev_exit(void)
 
 	l_genl_remove_unicast_watch(genl, unicast_watch);
 
+	l_timeout_remove(link_sample_timeout);
+	link_sample_timeout = NULL;
+
 	watchlist_destroy(&netdev_watches);
 	l_queue_destroy(netdev_list, netdev_free);
 	netdev_list = NULL;
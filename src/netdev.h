@@ -123,6 +123,9 @@ typedef void (*netdev_station_watch_func_t)(struct netdev *netdev,
 typedef void (*netdev_get_station_cb_t)(
 				const struct diagnostic_station_info *info,
 				void *user_data);
+typedef void (*netdev_link_watch_func_t)(struct netdev *netdev,
+				const struct diagnostic_station_info *info,
+				void *user_data);
 
 const char *netdev_iftype_to_string(uint32_t iftype);
 
@@ -217,6 +220,14 @@ uint32_t netdev_station_watch_add(struct netdev *netdev,
 
 bool netdev_station_watch_remove(struct netdev *netdev, uint32_t id);
 
+uint32_t netdev_link_watch_add(struct netdev *netdev,
+		netdev_link_watch_func_t func, void *user_data);
+bool netdev_link_watch_remove(struct netdev *netdev, uint32_t id);
+const struct diagnostic_station_info *netdev_get_link_info(
+						struct netdev *netdev,
+						uint64_t max_age);
+int netdev_get_low_signal_threshold(uint32_t frequency);
+
 struct netdev *netdev_create_from_genl(struct l_genl_msg *msg,
 					const uint8_t *set_mac);
 bool netdev_destroy(struct netdev *netdev);
@@ -0,0 +1,256 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <ell/ell.h>
+
+#include "src/netorder.h"
+
+/*
+ * Tracks the ordered network list as a series of generations so that
+ * clients can fetch what changed since the generation they last saw
+ * instead of the whole list.
+ */
+
+struct netorder_entry {
+	char *after;
+	int16_t signal;
+	uint64_t generation;
+	uint32_t pass;
+};
+
+struct netorder_removal {
+	char *path;
+	uint64_t generation;
+};
+
+struct netorder {
+	struct l_hashmap *entries;
+	struct l_queue *removed;
+	unsigned int max_removed;
+	int signal_delta;
+	uint64_t generation;
+	uint64_t floor;
+	uint32_t pass;
+	const char *after;
+	bool changed;
+};
+
+struct netorder_foreach_data {
+	uint64_t since;
+	netorder_changed_func_t func;
+	void *user_data;
+};
+
+static void netorder_entry_free(void *data)
+{
+	struct netorder_entry *entry = data;
+
+	l_free(entry->after);
+	l_free(entry);
+}
+
+static void netorder_removal_free(void *data)
+{
+	struct netorder_removal *removal = data;
+
+	l_free(removal->path);
+	l_free(removal);
+}
+
+static bool netorder_removal_match(const void *a, const void *b)
+{
+	const struct netorder_removal *removal = a;
+
+	return !strcmp(removal->path, b);
+}
+
+struct netorder *netorder_new(unsigned int max_removed, int signal_delta)
+{
+	struct netorder *order = l_new(struct netorder, 1);
+
+	order->entries = l_hashmap_string_new();
+	order->removed = l_queue_new();
+	order->max_removed = max_removed;
+	order->signal_delta = signal_delta;
+
+	return order;
+}
+
+void netorder_free(struct netorder *order)
+{
+	if (!order)
+		return;
+
+	l_hashmap_destroy(order->entries, netorder_entry_free);
+	l_queue_destroy(order->removed, netorder_removal_free);
+	l_free(order);
+}
+
+/* Starts a pass over the current list, networks are then added in order */
+void netorder_begin(struct netorder *order)
+{
+	order->pass++;
+	order->after = "/";
+	order->changed = false;
+}
+
+/*
+ * Records that path follows the previously added network.  The network
+ * becomes part of the next generation if it is new, moved or its signal
+ * changed by signal_delta or more.  path must stay valid until commit.
+ */
+void netorder_add(struct netorder *order, const char *path, int16_t signal)
+{
+	struct netorder_entry *entry = l_hashmap_lookup(order->entries, path);
+
+	if (!entry) {
+		entry = l_new(struct netorder_entry, 1);
+		l_hashmap_insert(order->entries, path, entry);
+	} else if (!strcmp(entry->after, order->after) &&
+			abs(entry->signal - signal) < order->signal_delta)
+		goto done;
+
+	l_free(entry->after);
+	entry->after = l_strdup(order->after);
+	entry->signal = signal;
+	entry->generation = order->generation + 1;
+	order->changed = true;
+
+done:
+	entry->pass = order->pass;
+	order->after = path;
+}
+
+static bool netorder_prune(const void *key, void *data, void *user_data)
+{
+	struct netorder_entry *entry = data;
+	struct netorder *order = user_data;
+	struct netorder_removal *removal;
+
+	if (entry->pass == order->pass)
+		return false;
+
+	l_queue_remove_if(order->removed, netorder_removal_match, key);
+
+	/*
+	 * Clients that haven't seen the generation of the dropped removal
+	 * can no longer be given a delta.
+	 */
+	if (l_queue_length(order->removed) >= order->max_removed) {
+		removal = l_queue_pop_head(order->removed);
+		order->floor = removal->generation;
+		netorder_removal_free(removal);
+	}
+
+	removal = l_new(struct netorder_removal, 1);
+	removal->path = l_strdup(key);
+	removal->generation = order->generation + 1;
+	l_queue_push_tail(order->removed, removal);
+
+	netorder_entry_free(entry);
+
+	return true;
+}
+
+/*
+ * Ends the pass, dropping networks that weren't added.  Returns true if
+ * anything changed, in which case a new generation was started.
+ */
+bool netorder_commit(struct netorder *order)
+{
+	unsigned int removed;
+
+	order->after = NULL;
+
+	removed = l_hashmap_foreach_remove(order->entries, netorder_prune,
+						order);
+	if (!order->changed && !removed)
+		return false;
+
+	order->generation++;
+	return true;
+}
+
+uint64_t netorder_get_generation(const struct netorder *order)
+{
+	return order->generation;
+}
+
+/*
+ * Generation 0 asks for a snapshot.  Unknown generations and those older
+ * than the removals still remembered get one too.
+ */
+bool netorder_is_full(const struct netorder *order, uint64_t since)
+{
+	return !since || since > order->generation || since < order->floor;
+}
+
+static void netorder_foreach_entry(const void *key, void *data,
+							void *user_data)
+{
+	const struct netorder_entry *entry = data;
+	struct netorder_foreach_data *foreach_data = user_data;
+
+	if (entry->generation <= foreach_data->since)
+		return;
+
+	foreach_data->func(key, entry->signal, entry->after,
+						foreach_data->user_data);
+}
+
+/*
+ * Calls func for networks added or changed after generation since.  Each
+ * names the network it follows, "/" for the first one, so a network moving
+ * up or down the list only touches itself and its old and new neighbours.
+ */
+void netorder_foreach_changed(const struct netorder *order, uint64_t since,
+				netorder_changed_func_t func, void *user_data)
+{
+	struct netorder_foreach_data foreach_data = { since, func, user_data };
+
+	if (since >= order->generation)
+		return;
+
+	l_hashmap_foreach(order->entries, netorder_foreach_entry,
+							&foreach_data);
+}
+
+/* Calls func for networks removed after generation since */
+void netorder_foreach_removed(const struct netorder *order, uint64_t since,
+				netorder_removed_func_t func, void *user_data)
+{
+	const struct l_queue_entry *entry;
+
+	for (entry = l_queue_get_entries(order->removed); entry;
+							entry = entry->next) {
+		const struct netorder_removal *removal = entry->data;
+
+		if (removal->generation > since)
+			func(removal->path, user_data);
+	}
+}
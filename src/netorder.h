@@ -0,0 +1,41 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct netorder;
+
+typedef void (*netorder_changed_func_t)(const char *path, int16_t signal,
+					const char *after, void *user_data);
+typedef void (*netorder_removed_func_t)(const char *path, void *user_data);
+
+struct netorder *netorder_new(unsigned int max_removed, int signal_delta);
+void netorder_free(struct netorder *order);
+
+void netorder_begin(struct netorder *order);
+void netorder_add(struct netorder *order, const char *path, int16_t signal);
+bool netorder_commit(struct netorder *order);
+
+uint64_t netorder_get_generation(const struct netorder *order);
+bool netorder_is_full(const struct netorder *order, uint64_t since);
+void netorder_foreach_changed(const struct netorder *order, uint64_t since,
+				netorder_changed_func_t func, void *user_data);
+void netorder_foreach_removed(const struct netorder *order, uint64_t since,
+				netorder_removed_func_t func, void *user_data);
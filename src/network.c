@@ -55,6 +55,7 @@
 #include "src/util.h"
 #include "src/erp.h"
 #include "src/handshake.h"
+#include "src/netconfig.h"
 
 #define SAE_PT_SETTING "SAE-PT-Group%u"
 
@@ -87,6 +88,10 @@ struct network {
 	uint8_t transition_disable; /* Temporary cache until info is set */
 	bool have_transition_disable:1;
 	int rank;
+	/* Last channel seen on and how long the network has been missing */
+	uint32_t last_frequency;
+	uint64_t missing_since;
+	unsigned int missed_scans;
 	/* Holds DBus Connect() message if it comes in before ANQP finishes */
 	struct l_dbus_message *connect_after_anqp;
 	struct l_dbus_message *connect_after_owe_hidden;
@@ -717,6 +722,31 @@ void network_sync_settings(struct network *network)
 				network->settings);
 }
 
+/*
+ * Remember the DHCPv4 lease in the network profile so that the address can
+ * be reused right away on the next connection.
+ */
+void network_save_dhcp_lease(struct network *network,
+				struct netconfig *netconfig)
+{
+	struct network_info *info = network->info;
+	struct l_settings *fs_settings;
+
+	if (!network->settings)
+		return;
+
+	if (!netconfig_save_dhcp_lease(netconfig, network->settings) || !info)
+		return;
+
+	fs_settings = info->ops->open(info);
+	if (L_WARN_ON(!fs_settings))
+		return;
+
+	netconfig_save_dhcp_lease(netconfig, fs_settings);
+	info->ops->sync(info, fs_settings);
+	l_settings_free(fs_settings);
+}
+
 const struct network_info *network_get_info(const struct network *network)
 {
 	return network->info;
@@ -727,7 +757,8 @@ static void add_known_frequency(void *data, void *user_data)
 	struct scan_bss *bss = data;
 	struct network_info *info = user_data;
 
-	known_network_add_frequency(info, bss->frequency);
+	known_network_add_frequency(info, bss->frequency,
+					KNOWN_FREQUENCY_HIT_SCAN);
 }
 
 void network_set_info(struct network *network, struct network_info *info)
@@ -959,6 +990,8 @@ static bool hotspot_info_matches(struct network *network,
 		return false;
 
 	bss = network_bss_select(network, true);
+	if (!bss)
+		return false;
 
 	if (network_info_match_hessid(info, bss->hessid))
 		return true;
@@ -990,8 +1023,19 @@ bool network_bss_add(struct network *network, struct scan_bss *bss)
 									NULL))
 		return false;
 
+	network->last_frequency = bss->frequency;
+	network->missed_scans = 0;
+
+	if (network->missing_since) {
+		network->missing_since = 0;
+		l_dbus_property_changed(dbus_get_bus(),
+					network_get_path(network),
+					IWD_NETWORK_INTERFACE, "Stale");
+	}
+
 	if (network->info)
-		known_network_add_frequency(network->info, bss->frequency);
+		known_network_add_frequency(network->info, bss->frequency,
+						KNOWN_FREQUENCY_HIT_SCAN);
 
 	/* Done if BSS is not HS20 or we already have network_info set */
 	if (!bss->hs20_capable)
@@ -1028,13 +1072,31 @@ bool network_bss_update(struct network *network, struct scan_bss *bss)
 
 	/* Sync frequency for already known networks */
 	if (network->info) {
-		known_network_add_frequency(network->info, bss->frequency);
+		known_network_add_frequency(network->info, bss->frequency,
+						KNOWN_FREQUENCY_HIT_SCAN);
 		known_network_frequency_sync(network->info);
 	}
 
 	return true;
 }
 
+/*
+ * Records a sighting of this network on a frequency from a source other
+ * than a scan, e.g. a neighbor report or a successful roam.
+ */
+void network_add_known_frequency(struct network *network, uint32_t frequency,
+					enum known_frequency_hit hit,
+					bool sync)
+{
+	if (!network->info)
+		return;
+
+	known_network_add_frequency(network->info, frequency, hit);
+
+	if (sync)
+		known_network_frequency_sync(network->info);
+}
+
 bool network_bss_list_isempty(struct network *network)
 {
 	return l_queue_isempty(network->bss_list);
@@ -1046,6 +1108,39 @@ void network_bss_list_clear(struct network *network)
 	network->bss_list = l_queue_new();
 }
 
+/*
+ * Records that a scan covering freqs found none of the network's BSSes and
+ * returns true once the network has been missing for max_scans scans of
+ * its last channel or for max_age microseconds.
+ */
+bool network_update_missing(struct network *network,
+				const struct scan_freq_set *freqs,
+				unsigned int max_scans, uint64_t max_age)
+{
+	uint64_t now = l_time_now();
+
+	if (!network->missing_since) {
+		network->missing_since = now;
+		l_dbus_property_changed(dbus_get_bus(),
+					network_get_path(network),
+					IWD_NETWORK_INTERFACE, "Stale");
+	}
+
+	if (scan_freq_set_contains(freqs, network->last_frequency))
+		network->missed_scans++;
+
+	if (network->missed_scans >= max_scans)
+		return true;
+
+	return l_time_diff(network->missing_since, now) >= max_age;
+}
+
+/* Returns when the network went stale, or 0 if it isn't stale */
+uint64_t network_get_missing_since(const struct network *network)
+{
+	return network->missing_since;
+}
+
 struct scan_bss *network_bss_list_pop(struct network *network)
 {
 	return l_queue_pop_head(network->bss_list);
@@ -1582,6 +1677,10 @@ static struct l_dbus_message *network_connect(struct l_dbus *dbus,
 	if (network->agent_request)
 		return dbus_error_busy(message);
 
+	/* Kept around after dropping out of the scan results */
+	if (network_bss_list_isempty(network))
+		return dbus_error_not_available(message);
+
 	/*
 	 * Select the best BSS to use at this time.  If we have to query the
 	 * agent this may not be the final choice because BSS visibility can
@@ -1619,6 +1718,10 @@ struct l_dbus_message *network_connect_new_hidden_network(
 	 * as hidden and trigger an update to the hidden networks count.
 	 */
 
+	/* Kept around after dropping out of the scan results */
+	if (network_bss_list_isempty(network))
+		return dbus_error_not_available(message);
+
 	bss = network_bss_select(network, true);
 	/* This should never happened for the hidden networks. */
 	if (!bss)
@@ -1717,6 +1820,18 @@ static bool network_property_get_known_network(struct l_dbus *dbus,
 	return true;
 }
 
+static bool network_property_get_stale(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct network *network = user_data;
+	bool stale = network->missing_since != 0;
+
+	l_dbus_message_builder_append_basic(builder, 'b', &stale);
+	return true;
+}
+
 bool network_register(struct network *network, const char *path)
 {
 	if (!l_dbus_object_add_interface(dbus_get_bus(), path,
@@ -1939,6 +2054,7 @@ static void event_watch_changed(enum station_event state,
 				struct network *network, void *user_data)
 {
 	struct l_dbus_message *reply;
+	struct scan_bss *bss;
 
 	switch (state) {
 	case STATION_EVENT_ANQP_STARTED:
@@ -1959,8 +2075,17 @@ static void event_watch_changed(enum station_event state,
 			return;
 		}
 
-		reply = network_connect_8021x(network,
-					network_bss_select(network, true),
+		bss = network_bss_select(network, true);
+
+		/* The network went stale while ANQP was running */
+		if (!bss) {
+			reply = dbus_error_not_available(
+						network->connect_after_anqp);
+			dbus_pending_reply(&network->connect_after_anqp, reply);
+			return;
+		}
+
+		reply = network_connect_8021x(network, bss,
 					network->connect_after_anqp);
 
 		if (reply)
@@ -1979,8 +2104,17 @@ static void event_watch_changed(enum station_event state,
 		if (!network->connect_after_owe_hidden)
 			return;
 
-		station_connect_network(network->station, network,
-					network_bss_select(network, true),
+		bss = network_bss_select(network, true);
+
+		if (!bss) {
+			reply = dbus_error_not_available(
+					network->connect_after_owe_hidden);
+			dbus_pending_reply(&network->connect_after_owe_hidden,
+						reply);
+			return;
+		}
+
+		station_connect_network(network->station, network, bss,
 					network->connect_after_owe_hidden);
 
 		l_dbus_message_unref(network->connect_after_owe_hidden);
@@ -2011,6 +2145,9 @@ static void setup_network_interface(struct l_dbus_interface *interface)
 
 	l_dbus_interface_property(interface, "KnownNetwork", 0, "o",
 				network_property_get_known_network, NULL);
+
+	l_dbus_interface_property(interface, "Stale", 0, "b",
+					network_property_get_stale, NULL);
 }
 
 static int network_init(void)
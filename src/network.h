@@ -24,12 +24,15 @@
 #include <time.h>
 
 enum security;
+enum known_frequency_hit;
 struct device;
 struct station;
 struct network;
 struct scan_bss;
+struct scan_freq_set;
 struct handshake_state;
 struct erp_cache_entry;
+struct netconfig;
 
 void network_connected(struct network *network);
 void network_disconnected(struct network *network);
@@ -55,6 +58,8 @@ int network_handshake_setup(struct network *network, struct scan_bss *bss,
 						struct handshake_state *hs);
 
 void network_sync_settings(struct network *network);
+void network_save_dhcp_lease(struct network *network,
+				struct netconfig *netconfig);
 
 const struct network_info *network_get_info(const struct network *network);
 void network_set_info(struct network *network, struct network_info *info);
@@ -65,8 +70,15 @@ int network_autoconnect(struct network *network, struct scan_bss *bss);
 void network_connect_failed(struct network *network, bool in_handshake);
 bool network_bss_add(struct network *network, struct scan_bss *bss);
 bool network_bss_update(struct network *network, struct scan_bss *bss);
+void network_add_known_frequency(struct network *network, uint32_t frequency,
+					enum known_frequency_hit hit,
+					bool sync);
 bool network_bss_list_isempty(struct network *network);
 void network_bss_list_clear(struct network *network);
+bool network_update_missing(struct network *network,
+				const struct scan_freq_set *freqs,
+				unsigned int max_scans, uint64_t max_age);
+uint64_t network_get_missing_since(const struct network *network);
 struct scan_bss *network_bss_list_pop(struct network *network);
 struct scan_bss *network_bss_find_by_addr(struct network *network,
 							const uint8_t *addr);
@@ -87,6 +87,7 @@ struct p2p_device {
 	unsigned int listen_duration;
 	struct l_queue *discovery_users;
 	struct l_queue *peer_list;
+	struct l_hashmap *peer_index;	/* peer_list keyed by bss->addr */
 	unsigned int next_tie_breaker;
 
 	struct p2p_peer *conn_peer;
@@ -238,12 +239,28 @@ static inline bool p2p_peer_operational(struct p2p_peer *peer)
 		 (peer->dev->is_go && peer->dev->conn_peer_added));
 }
 
-static bool p2p_peer_match(const void *a, const void *b)
+static unsigned int p2p_peer_addr_hash(const void *p)
 {
-	const struct p2p_peer *peer = a;
-	const uint8_t *addr = b;
+	const uint8_t *addr = p;
 
-	return !memcmp(peer->bss->addr, addr, 6);
+	/* The first three octets are mostly the same OUIs */
+	return l_get_le32(addr + 2) ^ (addr[0] << 8) ^ addr[1];
+}
+
+static int p2p_peer_addr_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, 6);
+}
+
+static void *p2p_peer_addr_copy(const void *p)
+{
+	return l_memdup(p, 6);
+}
+
+static struct p2p_peer *p2p_peer_find(struct p2p_device *dev,
+					const uint8_t *addr)
+{
+	return l_hashmap_lookup(dev->peer_index, addr);
 }
 
 static const char *p2p_peer_get_path(const struct p2p_peer *peer)
@@ -281,6 +298,14 @@ static void p2p_peer_put(void *user_data)
 	p2p_peer_free(peer);
 }
 
+static void p2p_device_peers_clear(struct p2p_device *dev)
+{
+	l_hashmap_destroy(dev->peer_index, NULL);
+	dev->peer_index = NULL;
+	l_queue_destroy(dev->peer_list, p2p_peer_put);
+	dev->peer_list = NULL;
+}
+
 static void p2p_device_discovery_start(struct p2p_device *dev);
 static void p2p_device_discovery_stop(struct p2p_device *dev);
 
@@ -726,8 +751,7 @@ static void p2p_connection_reset(struct p2p_device *dev)
 		 * have been removed except this one.  Now it's safe to
 		 * drop this peer from the scan results too.
 		 */
-		l_queue_destroy(dev->peer_list, p2p_peer_put);
-		dev->peer_list = NULL;
+		p2p_device_peers_clear(dev);
 	}
 
 	if (dev->conn_own_wfd) {
@@ -1306,6 +1330,9 @@ static void p2p_netconfig_event_handler(enum netconfig_event event,
 
 		p2p_peer_connect_done(dev);
 		break;
+	case NETCONFIG_EVENT_LEASE_UPDATED:
+		/* Leases are only remembered for station networks */
+		break;
 	default:
 		l_error("station: Unsupported netconfig event: %d.", event);
 		p2p_connect_failed(dev);
@@ -2306,7 +2333,7 @@ static void p2p_device_go_negotiation_req_cb(const struct mmpdu_header *mpdu,
 			 !l_memeqzero(mpdu->address_3, 6)))
 		return;
 
-	peer = l_queue_find(dev->peer_list, p2p_peer_match, mpdu->address_2);
+	peer = p2p_peer_find(dev, mpdu->address_2);
 	if (!peer)
 		return;
 
@@ -3606,39 +3633,51 @@ static bool p2p_device_peer_add(struct p2p_device *dev, struct p2p_peer *peer)
 			wfd.available)
 		p2p_peer_update_wfd(peer, &wfd);
 
+	if (!dev->peer_list) {
+		dev->peer_list = l_queue_new();
+		dev->peer_index = l_hashmap_new();
+		l_hashmap_set_hash_function(dev->peer_index,
+						p2p_peer_addr_hash);
+		l_hashmap_set_compare_function(dev->peer_index,
+						p2p_peer_addr_compare);
+		l_hashmap_set_key_copy_function(dev->peer_index,
+						p2p_peer_addr_copy);
+		l_hashmap_set_key_free_function(dev->peer_index, l_free);
+	}
+
 	l_queue_push_tail(dev->peer_list, peer);
+	l_hashmap_insert(dev->peer_index, peer->bss->addr, peer);
 
 	return true;
 }
 
-struct p2p_peer_move_data {
-	struct l_queue *new_list;
+struct p2p_peer_age_data {
 	struct p2p_peer *conn_peer;
 	uint64_t now;
 };
 
-static bool p2p_peer_move_recent(void *data, void *user_data)
+static bool p2p_peer_remove_old(void *data, void *user_data)
 {
 	struct p2p_peer *peer = data;
-	struct p2p_peer_move_data *move_data = user_data;
+	struct p2p_peer_age_data *age_data = user_data;
 
-	if (move_data->now > peer->bss->time_stamp + 30 * L_USEC_PER_SEC &&
-			peer != move_data->conn_peer)
-		return false;	/* Old, keep on the list */
+	/* Keep peers seen in the last 30 secs and the connected peer */
+	if (age_data->now <= peer->bss->time_stamp + 30 * L_USEC_PER_SEC ||
+			peer == age_data->conn_peer)
+		return false;
 
-	/* Recently seen or currently connected, move to the new list */
-	l_queue_push_tail(move_data->new_list, peer);
+	l_hashmap_remove(peer->dev->peer_index, peer->bss->addr);
+	p2p_peer_put(peer);
 	return true;
 }
 
-static bool p2p_peer_update_existing(struct scan_bss *bss,
-					struct l_queue *old_list,
-					struct l_queue *new_list)
+static bool p2p_peer_update_existing(struct p2p_device *dev,
+					struct scan_bss *bss)
 {
 	struct p2p_peer *peer;
 	struct p2p_wfd_properties wfd;
 
-	peer = l_queue_remove_if(old_list, p2p_peer_match, bss->addr);
+	peer = p2p_peer_find(dev, bss->addr);
 	if (!peer)
 		return false;
 
@@ -3668,7 +3707,6 @@ static bool p2p_peer_update_existing(struct scan_bss *bss,
 	else if (peer->wfd)
 		p2p_peer_update_wfd(peer, NULL);
 
-	l_queue_push_tail(new_list, peer);
 	return true;
 }
 
@@ -3678,16 +3716,13 @@ static bool p2p_scan_notify(int err, struct l_queue *bss_list,
 {
 	struct p2p_device *dev = user_data;
 	const struct l_queue_entry *entry;
-	struct l_queue *old_peer_list = dev->peer_list;
-	struct p2p_peer_move_data move_data;
+	struct p2p_peer_age_data age_data;
 
 	if (err) {
 		l_debug("P2P scan failed: %s (%i)", strerror(-err), -err);
 		goto schedule;
 	}
 
-	dev->peer_list = l_queue_new();
-
 	for (entry = l_queue_get_entries(bss_list); entry;
 			entry = entry->next) {
 		struct scan_bss *bss = entry->data;
@@ -3699,8 +3734,7 @@ static bool p2p_scan_notify(int err, struct l_queue *bss_list,
 			continue;
 		}
 
-		if (p2p_peer_update_existing(bss, old_peer_list,
-						dev->peer_list))
+		if (p2p_peer_update_existing(dev, bss))
 			continue;
 
 		peer = l_new(struct p2p_peer, 1);
@@ -3726,15 +3760,13 @@ static bool p2p_scan_notify(int err, struct l_queue *bss_list,
 	}
 
 	/*
-	 * old_peer_list now only contains peers not present in the new
-	 * results.  Move any peers seen in the last 30 secs to the new
-	 * dev->peer_list and unref only the remaining peers.
+	 * Peers present in the new results have had their scan_bss and
+	 * its timestamp updated in place.  Drop those not seen in the last
+	 * 30 secs in one pass over the list.
 	 */
-	move_data.new_list = dev->peer_list;
-	move_data.conn_peer = dev->conn_peer;
-	move_data.now = l_time_now();
-	l_queue_foreach_remove(old_peer_list, p2p_peer_move_recent, &move_data);
-	l_queue_destroy(old_peer_list, p2p_peer_put);
+	age_data.conn_peer = dev->conn_peer;
+	age_data.now = l_time_now();
+	l_queue_foreach_remove(dev->peer_list, p2p_peer_remove_old, &age_data);
 	l_queue_destroy(bss_list, NULL);
 
 schedule:
@@ -4095,7 +4127,7 @@ static void p2p_device_probe_cb(const struct mmpdu_header *mpdu,
 
 	bss->time_stamp = l_time_now();
 
-	if (p2p_peer_update_existing(bss, dev->peer_list, dev->peer_list))
+	if (p2p_peer_update_existing(dev, bss))
 		goto p2p_free;
 
 	peer = l_new(struct p2p_peer, 1);
@@ -4112,9 +4144,6 @@ static void p2p_device_probe_cb(const struct mmpdu_header *mpdu,
 	 */
 	peer->device_addr = bss->addr;
 
-	if (!dev->peer_list)
-		dev->peer_list = l_queue_new();
-
 	if (!p2p_device_peer_add(dev, peer))
 		p2p_peer_free(peer);
 
@@ -4210,11 +4239,14 @@ static void p2p_device_enable_destroy(void *user_data)
 	dev->start_stop_cmd_id = 0;
 }
 
-static bool p2p_peer_remove_disconnected(void *peer, void *conn_peer)
+static bool p2p_peer_remove_disconnected(void *data, void *conn_peer)
 {
+	struct p2p_peer *peer = data;
+
 	if (peer == conn_peer)
 		return false;
 
+	l_hashmap_remove(peer->dev->peer_index, peer->bss->addr);
 	p2p_peer_put(peer);
 	return true;
 }
@@ -4260,10 +4292,9 @@ static void p2p_device_start_stop(struct p2p_device *dev,
 		if (dev->conn_peer && !dev->conn_netdev && !dev->conn_wsc_bss)
 			p2p_connect_failed(dev);
 
-		if (!dev->conn_peer) {
-			l_queue_destroy(dev->peer_list, p2p_peer_put);
-			dev->peer_list = NULL;
-		} else
+		if (!dev->conn_peer)
+			p2p_device_peers_clear(dev);
+		else
 			/*
 			 * If the connection already depends on its own
 			 * netdev only, we can let it continue until the user
@@ -4446,7 +4477,7 @@ static void p2p_device_free(void *user_data)
 	p2p_device_discovery_stop(dev);
 	p2p_connection_reset(dev);
 	l_dbus_unregister_object(dbus_get_bus(), p2p_device_get_path(dev));
-	l_queue_destroy(dev->peer_list, p2p_peer_put);
+	p2p_device_peers_clear(dev);
 	l_queue_destroy(dev->discovery_users, p2p_discovery_user_free);
 	l_genl_family_free(dev->nl80211); /* Cancels dev->start_stop_cmd_id */
 	scan_wdev_remove(dev->wdev_id);
@@ -0,0 +1,280 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <ell/ell.h>
+
+#include "src/missing.h"
+#include "src/module.h"
+#include "src/util.h"
+#include "src/ie.h"
+#include "src/crypto.h"
+#include "src/pmksa.h"
+
+/* dot11RSNAConfigPMKLifetime default, in seconds */
+#define PMKSA_DEFAULT_LIFETIME	43200
+
+/* Upper bound on the number of cached entries */
+#define PMKSA_DEFAULT_CACHE_SIZE	64
+
+static uint64_t pmksa_default_lifetime =
+				PMKSA_DEFAULT_LIFETIME * L_USEC_PER_SEC;
+static unsigned int pmksa_cache_size = PMKSA_DEFAULT_CACHE_SIZE;
+
+/* Sorted by expiration time, earliest first */
+static struct l_queue *cache;
+
+struct pmksa_match_data {
+	const uint8_t *spa;
+	const uint8_t *aa;
+	const uint8_t *ssid;
+	size_t ssid_len;
+	uint32_t akm;
+};
+
+static bool pmksa_match(const void *a, const void *b)
+{
+	const struct pmksa *pmksa = a;
+	const struct pmksa_match_data *match = b;
+
+	if (memcmp(pmksa->spa, match->spa, 6))
+		return false;
+
+	if (memcmp(pmksa->aa, match->aa, 6))
+		return false;
+
+	if (pmksa->ssid_len != match->ssid_len ||
+			memcmp(pmksa->ssid, match->ssid, match->ssid_len))
+		return false;
+
+	return (pmksa->akm & match->akm) != 0;
+}
+
+static bool pmksa_match_ssid(void *data, void *user_data)
+{
+	struct pmksa *pmksa = data;
+	const struct pmksa_match_data *match = user_data;
+
+	if (pmksa->ssid_len != match->ssid_len ||
+			memcmp(pmksa->ssid, match->ssid, match->ssid_len))
+		return false;
+
+	pmksa_free(pmksa);
+	return true;
+}
+
+static int pmksa_compare_expiration(const void *a, const void *b,
+					void *user_data)
+{
+	const struct pmksa *new = a;
+	const struct pmksa *cur = b;
+
+	if (l_time_before(new->expiration, cur->expiration))
+		return -1;
+
+	return 1;
+}
+
+void pmksa_free(struct pmksa *pmksa)
+{
+	explicit_bzero(pmksa->pmk, sizeof(pmksa->pmk));
+	l_free(pmksa);
+}
+
+static void pmksa_cache_prune(void)
+{
+	uint64_t now = l_time_now();
+	struct pmksa *pmksa;
+
+	while ((pmksa = l_queue_peek_head(cache))) {
+		if (l_time_before(now, pmksa->expiration))
+			break;
+
+		l_debug("Expiring PMKSA for "MAC, MAC_STR(pmksa->aa));
+		l_queue_pop_head(cache);
+		pmksa_free(pmksa);
+	}
+}
+
+/*
+ * Removes the matching entry from the cache and hands it to the caller.  The
+ * entry should be given back with pmksa_cache_put() once the association
+ * using it has succeeded, otherwise it is simply freed.
+ */
+struct pmksa *pmksa_cache_get(const uint8_t spa[static 6],
+				const uint8_t aa[static 6],
+				const uint8_t *ssid, size_t ssid_len,
+				uint32_t akm)
+{
+	struct pmksa_match_data match = {
+		.spa = spa,
+		.aa = aa,
+		.ssid = ssid,
+		.ssid_len = ssid_len,
+		.akm = akm,
+	};
+
+	pmksa_cache_prune();
+
+	return l_queue_remove_if(cache, pmksa_match, &match);
+}
+
+/*
+ * Opportunistic Key Caching: reuse a PMK established with any AP of the same
+ * ESS and derive the PMKID the target AP should have obtained from the
+ * controller.  Only valid for 802.1X AKMs since the PMK is tied to the EAP
+ * session rather than to a specific AP.  The cache keeps its copy of the
+ * PMKSA, the caller gets a new entry bound to the target AP.
+ */
+struct pmksa *pmksa_cache_get_okc(const uint8_t spa[static 6],
+					const uint8_t aa[static 6],
+					const uint8_t *ssid, size_t ssid_len,
+					uint32_t akm)
+{
+	const struct l_queue_entry *entry;
+	const struct pmksa *found = NULL;
+	struct pmksa *pmksa;
+
+	if (!(akm & (IE_RSN_AKM_SUITE_8021X | IE_RSN_AKM_SUITE_8021X_SHA256)))
+		return NULL;
+
+	pmksa_cache_prune();
+
+	/* Prefer the most recently established PMKSA, i.e. the last one */
+	for (entry = l_queue_get_entries(cache); entry; entry = entry->next) {
+		const struct pmksa *cur = entry->data;
+
+		if (memcmp(cur->spa, spa, 6) || !(cur->akm & akm))
+			continue;
+
+		if (cur->ssid_len != ssid_len ||
+				memcmp(cur->ssid, ssid, ssid_len))
+			continue;
+
+		found = cur;
+	}
+
+	if (!found)
+		return NULL;
+
+	pmksa = l_memdup(found, sizeof(*found));
+	memcpy(pmksa->aa, aa, 6);
+	pmksa->akm = akm;
+
+	if (!crypto_derive_pmkid(pmksa->pmk, spa, aa, pmksa->pmkid,
+				akm == IE_RSN_AKM_SUITE_8021X_SHA256)) {
+		pmksa_free(pmksa);
+		return NULL;
+	}
+
+	return pmksa;
+}
+
+int pmksa_cache_put(struct pmksa *pmksa)
+{
+	struct pmksa_match_data match = {
+		.spa = pmksa->spa,
+		.aa = pmksa->aa,
+		.ssid = pmksa->ssid,
+		.ssid_len = pmksa->ssid_len,
+		.akm = pmksa->akm,
+	};
+	struct pmksa *old;
+
+	pmksa_cache_prune();
+
+	/* A new PMKSA with the same peer replaces the old one */
+	old = l_queue_remove_if(cache, pmksa_match, &match);
+	if (old)
+		pmksa_free(old);
+
+	if (l_queue_length(cache) >= pmksa_cache_size) {
+		old = l_queue_pop_head(cache);
+		pmksa_free(old);
+	}
+
+	l_debug("Caching PMKSA for "MAC, MAC_STR(pmksa->aa));
+
+	if (!l_queue_insert(cache, pmksa, pmksa_compare_expiration, NULL)) {
+		pmksa_free(pmksa);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void pmksa_cache_flush_ssid(const uint8_t *ssid, size_t ssid_len)
+{
+	struct pmksa_match_data match = {
+		.ssid = ssid,
+		.ssid_len = ssid_len,
+	};
+
+	l_queue_foreach_remove(cache, pmksa_match_ssid, &match);
+}
+
+uint64_t pmksa_lifetime(void)
+{
+	return pmksa_default_lifetime;
+}
+
+static void pmksa_destroy(void *data)
+{
+	pmksa_free(data);
+}
+
+void __pmksa_set_config(const struct l_settings *config)
+{
+	if (!l_settings_get_uint64(config, "General", "PmksaLifetime",
+					&pmksa_default_lifetime))
+		pmksa_default_lifetime = PMKSA_DEFAULT_LIFETIME;
+
+	/* For easier user configuration the lifetime is in seconds */
+	pmksa_default_lifetime *= L_USEC_PER_SEC;
+
+	if (!l_settings_get_uint(config, "General", "PmksaCacheSize",
+					&pmksa_cache_size) ||
+			!pmksa_cache_size)
+		pmksa_cache_size = PMKSA_DEFAULT_CACHE_SIZE;
+}
+
+int pmksa_init(void)
+{
+	cache = l_queue_new();
+
+	return 0;
+}
+
+void pmksa_exit(void)
+{
+	l_queue_destroy(cache, pmksa_destroy);
+	cache = NULL;
+}
+
+IWD_MODULE(pmksa, pmksa_init, pmksa_exit)
@@ -25,8 +25,12 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <stdio.h>
 #include <unistd.h>
 
@@ -372,109 +376,299 @@ static const struct resolve_method_ops resolve_method_systemd_ops = {
 };
 
 char *resolvconf_path;
+static struct l_signal *resolvconf_sigchld_watch;
+static struct l_queue *resolvconf_children;
 
-static bool resolvconf_invoke(const char *ifname, const char *type,
-						const char *content)
+/*
+ * DNS and domain changes usually come in bursts, e.g. both are set when a
+ * DHCP lease is obtained, renewed or after a roam, so collect all changes
+ * made within this window and apply them with a single resolvconf run.
+ */
+#define RESOLVCONF_UPDATE_DELAY_MS	100
+
+struct resolvconf {
+	struct resolve super;
+	bool have_record : 1;
+	bool update_pending : 1;
+	char *ifname;
+	char *dns;
+	char *domains;
+	struct l_timeout *update_timeout;
+	pid_t pid;
+};
+
+struct resolvconf_child {
+	pid_t pid;
+	struct resolvconf *rc;
+	/* Update of a destroyed resolvconf, run once this child exits */
+	bool deferred : 1;
+	char *ifname;
+	char *content;
+};
+
+static void resolvconf_child_free(void *data)
 {
-	FILE *resolvconf;
-	L_AUTO_FREE_VAR(char *, cmd) = NULL;
-	int error;
+	struct resolvconf_child *child = data;
 
-	if (content) {
-		cmd = l_strdup_printf("%s -a %s.%s", resolvconf_path,
-						ifname, type);
-		resolvconf = popen(cmd, "w");
-	} else {
-		cmd = l_strdup_printf("%s -d %s.%s", resolvconf_path,
-						ifname, type);
-		resolvconf = popen(cmd, "r");
+	l_free(child->ifname);
+	l_free(child->content);
+	l_free(child);
+}
+
+/*
+ * Run resolvconf without waiting for it.  The record content is small
+ * enough to fit into the pipe buffer so it is written right away and the
+ * child is reaped from the SIGCHLD handler.
+ */
+static pid_t resolvconf_spawn(const char *ifname, const char *content)
+{
+	L_AUTO_FREE_VAR(char *, record) = l_strdup_printf("%s.iwd", ifname);
+	int fds[2];
+	pid_t pid;
+	sigset_t mask;
+	ssize_t len;
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		l_error("resolve: Failed to create pipe (%s).",
+							strerror(errno));
+		return -1;
 	}
 
-	if (!resolvconf) {
+	pid = fork();
+	if (pid < 0) {
 		l_error("resolve: Failed to start %s (%s).", resolvconf_path,
 							strerror(errno));
-		return false;
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
 	}
 
-	if (content && fprintf(resolvconf, "%s", content) < 0)
-		l_error("resolve: Failed to print into %s stdin.",
+	if (pid == 0) {
+		/* Signals handled through signalfd are blocked, undo that */
+		sigemptyset(&mask);
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+
+		if (dup2(fds[0], STDIN_FILENO) < 0)
+			_exit(EXIT_FAILURE);
+
+		execl(resolvconf_path, resolvconf_path, content ? "-a" : "-d",
+			record, NULL);
+		_exit(EXIT_FAILURE);
+	}
+
+	close(fds[0]);
+
+	if (content) {
+		fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+		len = write(fds[1], content, strlen(content));
+		if (len < 0 || (size_t) len != strlen(content))
+			l_error("resolve: Failed to write into %s stdin.",
 							resolvconf_path);
+	}
 
-	error = pclose(resolvconf);
-	if (error < 0)
-		l_error("resolve: Failed to close pipe to %s (%s).",
-					resolvconf_path, strerror(errno));
-	else if (error > 0)
-		l_info("resolve: %s exited with status (%d).", resolvconf_path,
-									error);
+	close(fds[1]);
 
-	return !error;
+	l_debug("%s %s %s (pid %d)", resolvconf_path, content ? "-a" : "-d",
+			record, pid);
+	return pid;
 }
 
-struct resolvconf {
-	struct resolve super;
-	bool have_domain : 1;
-	bool have_dns : 1;
-	char *ifname;
-};
+static pid_t resolvconf_child_start(const char *ifname, const char *content,
+						struct resolvconf *rc)
+{
+	struct resolvconf_child *child;
+	pid_t pid;
 
-static void resolve_resolvconf_set_dns(struct resolve *resolve, char **dns_list)
+	pid = resolvconf_spawn(ifname, content);
+	if (pid < 0)
+		return pid;
+
+	child = l_new(struct resolvconf_child, 1);
+	child->pid = pid;
+	child->rc = rc;
+	l_queue_push_tail(resolvconf_children, child);
+
+	return pid;
+}
+
+/*
+ * Returns false if there is nothing to do, otherwise the new record
+ * content or NULL if the record is to be deleted.
+ */
+static bool resolvconf_get_content(struct resolvconf *rc, char **out_content)
 {
-	struct resolvconf *rc =
-			l_container_of(resolve, struct resolvconf, super);
-	struct l_string *content;
-	L_AUTO_FREE_VAR(char *, str) = NULL;
+	*out_content = NULL;
 
-	if (L_WARN_ON(!resolvconf_path))
-		return;
+	if (rc->dns || rc->domains) {
+		*out_content = l_strdup_printf("%s%s", rc->dns ?: "",
+						rc->domains ?: "");
+		return true;
+	}
+
+	return rc->have_record;
+}
+
+static void resolvconf_run(struct resolvconf *rc)
+{
+	L_AUTO_FREE_VAR(char *, content) = NULL;
+	pid_t pid;
 
-	if (!dns_list || !dns_list[0]) {
-		if (rc->have_dns)
-			resolvconf_invoke(rc->ifname, "dns", NULL);
+	rc->update_pending = false;
 
-		rc->have_dns = false;
+	if (!resolvconf_get_content(rc, &content))
 		return;
-	}
 
-	content = l_string_new(0);
+	pid = resolvconf_child_start(rc->ifname, content, rc);
+	if (pid < 0)
+		return;
 
-	for (; *dns_list; dns_list++)
-		l_string_append_printf(content, "nameserver %s\n", *dns_list);
+	rc->have_record = content != NULL;
+	rc->pid = pid;
+}
 
-	str = l_string_unwrap(content);
+static bool resolvconf_child_match_pid(const void *a, const void *b)
+{
+	const struct resolvconf_child *child = a;
 
-	if (resolvconf_invoke(rc->ifname, "dns", str))
-		rc->have_dns = true;
+	return child->pid == L_PTR_TO_INT(b);
 }
 
-static void resolve_resolvconf_set_domains(struct resolve *resolve,
-							char **domain_list)
+/*
+ * The resolvconf is going away while its previous run is still in flight.
+ * Hand the final update over to that child so it runs after it, keeping
+ * the updates to the interface ordered.
+ */
+static void resolvconf_defer(struct resolvconf *rc)
 {
-	struct resolvconf *rc =
-			l_container_of(resolve, struct resolvconf, super);
-	struct l_string *content;
-	L_AUTO_FREE_VAR(char *, str) = NULL;
+	struct resolvconf_child *child;
+	char *content;
 
-	if (L_WARN_ON(!resolvconf_path))
+	rc->update_pending = false;
+
+	if (!resolvconf_get_content(rc, &content))
 		return;
 
-	if (!domain_list || !domain_list[0]) {
-		if (rc->have_domain)
-			resolvconf_invoke(rc->ifname, "domain", NULL);
+	child = l_queue_find(resolvconf_children, resolvconf_child_match_pid,
+						L_INT_TO_PTR(rc->pid));
+	if (L_WARN_ON(!child)) {
+		l_free(content);
+		return;
+	}
+
+	child->deferred = true;
+	child->ifname = l_strdup(rc->ifname);
+	child->content = content;
+}
 
-		rc->have_domain = false;
+static void resolvconf_update(struct resolvconf *rc)
+{
+	/* Keep updates to a given interface ordered */
+	if (rc->pid) {
+		rc->update_pending = true;
 		return;
 	}
 
+	resolvconf_run(rc);
+}
+
+static void resolvconf_update_timeout(struct l_timeout *timeout,
+							void *user_data)
+{
+	struct resolvconf *rc = user_data;
+
+	l_timeout_remove(rc->update_timeout);
+	rc->update_timeout = NULL;
+
+	resolvconf_update(rc);
+}
+
+static void resolvconf_schedule_update(struct resolvconf *rc)
+{
+	if (rc->update_timeout)
+		return;
+
+	rc->update_timeout = l_timeout_create_ms(RESOLVCONF_UPDATE_DELAY_MS,
+						resolvconf_update_timeout,
+						rc, NULL);
+}
+
+static bool resolvconf_child_reap(void *data, void *user_data)
+{
+	struct resolvconf_child *child = data;
+	struct resolvconf *rc = child->rc;
+	int status;
+	pid_t r;
+
+	r = waitpid(child->pid, &status, WNOHANG);
+	if (r == 0)
+		return false;
+
+	if (r < 0)
+		l_error("resolve: Failed to wait for %s (%s).",
+					resolvconf_path, strerror(errno));
+	else if (!WIFEXITED(status) || WEXITSTATUS(status))
+		l_info("resolve: %s exited with status (%d).",
+					resolvconf_path, status);
+
+	if (rc) {
+		rc->pid = 0;
+
+		if (rc->update_pending)
+			resolvconf_run(rc);
+	} else if (child->deferred)
+		resolvconf_child_start(child->ifname, child->content, NULL);
+
+	resolvconf_child_free(child);
+	return true;
+}
+
+static void resolvconf_sigchld(void *user_data)
+{
+	l_queue_foreach_remove(resolvconf_children, resolvconf_child_reap,
+				NULL);
+}
+
+static char *resolvconf_build(char **list, const char *keyword)
+{
+	struct l_string *content;
+
+	if (!list || !list[0])
+		return NULL;
+
 	content = l_string_new(0);
 
-	for (; *domain_list; domain_list++)
-		l_string_append_printf(content, "search %s\n", *domain_list);
+	for (; *list; list++)
+		l_string_append_printf(content, "%s %s\n", keyword, *list);
 
-	str = l_string_unwrap(content);
+	return l_string_unwrap(content);
+}
 
-	if (resolvconf_invoke(rc->ifname, "domain", str))
-		rc->have_domain = true;
+static void resolve_resolvconf_set_dns(struct resolve *resolve, char **dns_list)
+{
+	struct resolvconf *rc =
+			l_container_of(resolve, struct resolvconf, super);
+
+	if (L_WARN_ON(!resolvconf_path))
+		return;
+
+	l_free(rc->dns);
+	rc->dns = resolvconf_build(dns_list, "nameserver");
+	resolvconf_schedule_update(rc);
+}
+
+static void resolve_resolvconf_set_domains(struct resolve *resolve,
+							char **domain_list)
+{
+	struct resolvconf *rc =
+			l_container_of(resolve, struct resolvconf, super);
+
+	if (L_WARN_ON(!resolvconf_path))
+		return;
+
+	l_free(rc->domains);
+	rc->domains = resolvconf_build(domain_list, "search");
+	resolvconf_schedule_update(rc);
 }
 
 static void resolve_resolvconf_revert(struct resolve *resolve)
@@ -482,14 +676,17 @@ static void resolve_resolvconf_revert(struct resolve *resolve)
 	struct resolvconf *rc =
 			l_container_of(resolve, struct resolvconf, super);
 
-	if (rc->have_dns)
-		resolvconf_invoke(rc->ifname, "dns", NULL);
+	l_free(l_steal_ptr(rc->dns));
+	l_free(l_steal_ptr(rc->domains));
+	resolvconf_schedule_update(rc);
+}
 
-	if (rc->have_domain)
-		resolvconf_invoke(rc->ifname, "domain", NULL);
+static void resolvconf_child_detach(void *data, void *user_data)
+{
+	struct resolvconf_child *child = data;
 
-	rc->have_dns = false;
-	rc->have_domain = false;
+	if (child->rc == user_data)
+		child->rc = NULL;
 }
 
 static void resolve_resolvconf_destroy(struct resolve *resolve)
@@ -497,6 +694,20 @@ static void resolve_resolvconf_destroy(struct resolve *resolve)
 	struct resolvconf *rc =
 			l_container_of(resolve, struct resolvconf, super);
 
+	/* Flush any change still waiting, such as the one from revert */
+	if (rc->update_timeout || rc->update_pending) {
+		l_timeout_remove(rc->update_timeout);
+
+		if (rc->pid)
+			resolvconf_defer(rc);
+		else
+			resolvconf_run(rc);
+	}
+
+	l_queue_foreach(resolvconf_children, resolvconf_child_detach, rc);
+
+	l_free(rc->dns);
+	l_free(rc->domains);
 	l_free(rc->ifname);
 	l_free(rc);
 }
@@ -530,11 +741,36 @@ static int resolve_resolvconf_init(void)
 	}
 
 	l_debug("resolvconf found as: %s", resolvconf_path);
+
+	resolvconf_children = l_queue_new();
+	resolvconf_sigchld_watch = l_signal_create(SIGCHLD,
+							resolvconf_sigchld,
+							NULL, NULL);
 	return 0;
 }
 
+static void resolvconf_child_flush(void *data, void *user_data)
+{
+	struct resolvconf_child *child = data;
+
+	if (!child->deferred)
+		return;
+
+	/* Don't lose the final update, e.g. a record removal, on exit */
+	waitpid(child->pid, NULL, 0);
+	resolvconf_spawn(child->ifname, child->content);
+}
+
 static void resolve_resolvconf_exit(void)
 {
+	l_signal_remove(resolvconf_sigchld_watch);
+	resolvconf_sigchld_watch = NULL;
+
+	/* Any other children still running are left to be reaped by init */
+	l_queue_foreach(resolvconf_children, resolvconf_child_flush, NULL);
+	l_queue_destroy(resolvconf_children, resolvconf_child_free);
+	resolvconf_children = NULL;
+
 	l_free(resolvconf_path);
 	resolvconf_path = NULL;
 }
@@ -49,6 +49,11 @@
 /* Microseconds between requests */
 #define MIN_MICROS_BETWEEN_REQUESTS	(1000000 / MAX_REQUESTS_PER_SEC)
 
+/* Measurements older than this are not reported */
+#define RRM_CACHE_MAX_AGE	(60 * L_USEC_PER_SEC)
+/* A channel scanned this recently satisfies passive and active requests */
+#define RRM_CACHE_FRESH_TIME	(2 * L_USEC_PER_SEC)
+
 /* 802.11-2016 Table 9-90 */
 #define REPORT_DETAIL_NO_FIELDS_OR_ELEMS		0
 #define REPORT_DETAIL_ALL_FIELDS_AND_ANY_REQUEST_ELEMS	1
@@ -114,6 +119,28 @@ struct rrm_beacon_req_info {
 	uint64_t scan_start_time;
 };
 
+struct rrm_measurement_key {
+	uint8_t band;
+	uint8_t channel;
+	uint8_t bssid[6];
+} __attribute__ ((packed));
+
+/* A beacon measurement taken from the results of any scan */
+struct rrm_measurement {
+	struct rrm_measurement_key key;
+	uint8_t ssid[32];
+	uint8_t phy_type;
+	uint8_t rcpi;
+	uint8_t rsni;
+	uint32_t parent_tsf;
+	uint64_t time;
+};
+
+struct rrm_channel_scan {
+	uint32_t freq;
+	uint64_t time;
+};
+
 /* Per-netdev state */
 struct rrm_state {
 	struct station *station;
@@ -123,6 +150,9 @@ struct rrm_state {
 	struct rrm_request_info *pending;
 
 	uint64_t last_request;
+
+	struct l_hashmap *measurements;
+	struct l_queue *channel_scans;
 };
 
 /* 802.11, Section 9.4.2.22.7 */
@@ -143,6 +173,7 @@ struct rrm_beacon_report {
 static struct l_queue *states;
 static struct l_genl_family *nl80211;
 static uint32_t netdev_watch;
+static uint32_t scan_results_watch;
 
 static void rrm_info_destroy(void *data)
 {
@@ -155,7 +186,7 @@ static void rrm_info_destroy(void *data)
 	l_free(beacon);
 }
 
-static uint8_t rrm_phy_type(struct scan_bss *bss)
+static uint8_t rrm_phy_type(const struct scan_bss *bss)
 {
 	if (bss->vht_capable)
 		return RRM_PHY_TYPE_VHT;
@@ -254,6 +285,82 @@ static uint8_t mdb_to_rcpi(int32_t mdb)
 		return 220;
 }
 
+static unsigned int rrm_measurement_key_hash(const void *p)
+{
+	const struct rrm_measurement_key *key = p;
+
+	return l_get_le32(key->bssid + 2) ^ (key->band << 16) ^
+		(key->channel << 8) ^ key->bssid[1];
+}
+
+static int rrm_measurement_key_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, sizeof(struct rrm_measurement_key));
+}
+
+static void rrm_measurement_from_bss(struct rrm_measurement *m,
+					const struct scan_bss *bss)
+{
+	enum scan_band band;
+
+	memset(m, 0, sizeof(*m));
+	m->key.channel = scan_freq_to_channel(bss->frequency, &band);
+	m->key.band = band;
+	memcpy(m->key.bssid, bss->addr, 6);
+	memcpy(m->ssid, bss->ssid, sizeof(m->ssid));
+	m->phy_type = rrm_phy_type(bss);
+	m->rcpi = mdb_to_rcpi(bss->signal_strength);
+	/* RSNI not available (could get this from GET_SURVEY) */
+	m->rsni = 255;
+	/*
+	 * 802.11 9.4.2.22.7 Beacon report
+	 *
+	 * "The Parent TSF field contains the lower 4 octets of the measuring
+	 *  STA's TSF timer value"
+	 */
+	m->parent_tsf = bss->parent_tsf;
+	m->time = bss->time_stamp;
+}
+
+struct rrm_beacon_report_data {
+	struct rrm_beacon_req_info *beacon;
+	enum scan_band band;
+	bool wildcard;
+	uint64_t scan_start_time;
+	uint16_t duration;
+	uint64_t min_time;
+	uint8_t frame[512];
+	size_t len;
+};
+
+static void rrm_beacon_report_init(struct rrm_beacon_report_data *data,
+					struct rrm_beacon_req_info *beacon)
+{
+	data->beacon = beacon;
+	data->band = scan_oper_class_to_band(NULL, beacon->oper_class);
+	data->wildcard = util_is_broadcast_address(beacon->bssid);
+	data->scan_start_time = 0;
+	data->duration = 0;
+	data->min_time = 0;
+
+	data->frame[0] = 0x05; /* Category: Radio Measurement */
+	data->frame[1] = 0x01; /* Action: Radio Measurement Report */
+	data->frame[2] = beacon->info.dialog_token;
+	data->len = 3;
+}
+
+static bool measurement_in_request_range(struct rrm_beacon_report_data *data,
+					const struct rrm_measurement *m)
+{
+	struct rrm_beacon_req_info *beacon = data->beacon;
+
+	/* Must be a table measurement */
+	if (beacon->channel == 0 || beacon->channel == 255)
+		return true;
+
+	return m->key.channel == beacon->channel && m->key.band == data->band;
+}
+
 /*
  * 802.11-2016 11.11.9.1 Beacon report
  *
@@ -271,32 +378,49 @@ static uint8_t mdb_to_rcpi(int32_t mdb)
  * Since accurate timing is unreliable we are setting start/duration/TSF time to
  * zero for all cases (table, passive, active).
  */
-static size_t build_report_for_bss(struct rrm_beacon_req_info *beacon,
-					struct scan_bss *bss,
-					uint8_t *to)
+static void rrm_beacon_report_add(struct rrm_beacon_report_data *data,
+					const struct rrm_measurement *m)
 {
-	struct rrm_beacon_report *report = (struct rrm_beacon_report *) to;
+	struct rrm_beacon_req_info *beacon = data->beacon;
+	struct rrm_beacon_report report;
 
-	report->oper_class = beacon->oper_class;
-	report->channel = scan_freq_to_channel(bss->frequency, NULL);
-	report->scan_start_time = L_CPU_TO_LE64(beacon->scan_start_time);
-	report->duration = L_CPU_TO_LE16(beacon->duration);
-	report->frame_info = rrm_phy_type(bss);
-	report->rcpi = mdb_to_rcpi(bss->signal_strength);
+	/* If request included a specific BSSID match only this BSS */
+	if (!data->wildcard && memcmp(m->key.bssid, beacon->bssid, 6) != 0)
+		return;
 
-	/* RSNI not available (could get this from GET_SURVEY) */
-	report->rsni = 255;
-	memcpy(report->bssid, bss->addr, 6);
-	/* Antenna identifier unknown */
-	report->antenna_id = 0;
+	/* If request was for a certain SSID, match only this SSID */
+	if (beacon->has_ssid && strncmp(beacon->ssid, (const char *) m->ssid,
+						sizeof(m->ssid)) != 0)
+		return;
 
 	/*
-	 * 802.11 9.4.2.22.7 Beacon report
-	 *
-	 * "The Parent TSF field contains the lower 4 octets of the measuring
-	 *  STA's TSF timer value"
+	 * The kernel may have returned a cached scan, so we have to
+	 * sort out any non-matching frequencies before building the
+	 * report
 	 */
-	report->parent_tsf = L_CPU_TO_LE32(bss->parent_tsf);
+	if (!measurement_in_request_range(data, m))
+		return;
+
+	if (m->time < data->min_time)
+		return;
+
+	if (data->len + 5 + sizeof(report) > sizeof(data->frame)) {
+		l_debug("Beacon report full, skipping " MAC,
+			MAC_STR(m->key.bssid));
+		return;
+	}
+
+	report.oper_class = beacon->oper_class;
+	report.channel = m->key.channel;
+	report.scan_start_time = L_CPU_TO_LE64(data->scan_start_time);
+	report.duration = L_CPU_TO_LE16(data->duration);
+	report.frame_info = m->phy_type;
+	report.rcpi = m->rcpi;
+	report.rsni = m->rsni;
+	memcpy(report.bssid, m->key.bssid, 6);
+	/* Antenna identifier unknown */
+	report.antenna_id = 0;
+	report.parent_tsf = L_CPU_TO_LE32(m->parent_tsf);
 
 	/*
 	 * TODO: Support optional subelements
@@ -304,22 +428,18 @@ static size_t build_report_for_bss(struct rrm_beacon_req_info *beacon,
 	 * (see "TODO: Support Reported Frame Body..." below)
 	 */
 
-	return sizeof(struct rrm_beacon_report);
+	rrm_build_measurement_report(&beacon->info, &report, sizeof(report),
+					data->frame + data->len);
+	data->len += 5 + sizeof(report);
 }
 
-static bool bss_in_request_range(struct rrm_beacon_req_info *beacon,
-					struct scan_bss *bss)
+static bool rrm_beacon_report_send(struct rrm_state *rrm,
+					struct rrm_beacon_report_data *data)
 {
-	uint8_t channel = scan_freq_to_channel(bss->frequency, NULL);
-
-	/* Must be a table measurement */
-	if (beacon->channel == 0 || beacon->channel == 255)
-		return true;
-
-	if (beacon->channel == channel)
-		return true;
+	rrm_info_destroy(&data->beacon->info);
+	rrm->pending = NULL;
 
-	return false;
+	return rrm_send_response(rrm, data->frame, data->len);
 }
 
 static bool rrm_report_beacon_results(struct rrm_state *rrm,
@@ -328,68 +448,87 @@ static bool rrm_report_beacon_results(struct rrm_state *rrm,
 	struct rrm_beacon_req_info *beacon = l_container_of(rrm->pending,
 						struct rrm_beacon_req_info,
 						info);
-	bool wildcard = util_is_broadcast_address(beacon->bssid);
+	struct rrm_beacon_report_data data;
 	const struct l_queue_entry *entry;
-	uint8_t frame[512];
-	uint8_t *ptr = frame;
 
-	*ptr++ = 0x05; /* Category: Radio Measurement */
-	*ptr++ = 0x01; /* Action: Radio Measurement Report */
-	*ptr++ = beacon->info.dialog_token;
+	rrm_beacon_report_init(&data, beacon);
+	data.scan_start_time = beacon->scan_start_time;
+	data.duration = beacon->duration;
 
 	for (entry = l_queue_get_entries(bss_list); entry;
 							entry = entry->next) {
-		struct scan_bss *bss = entry->data;
-		uint8_t report[257];
-		size_t report_len;
-
-		/* If request included a specific BSSID match only this BSS */
-		if (!wildcard && memcmp(bss->addr, beacon->bssid, 6) != 0)
-			continue;
-
-		/* If request was for a certain SSID, match only this SSID */
-		if (beacon->has_ssid && strncmp(beacon->ssid,
-							(const char *)bss->ssid,
-							sizeof(bss->ssid)) != 0)
-			continue;
+		struct rrm_measurement m;
 
-		/*
-		 * The kernel may have returned a cached scan, so we have to
-		 * sort out any non-matching frequencies before building the
-		 * report
-		 */
-		if (!bss_in_request_range(beacon, bss))
-			continue;
-
-		report_len = build_report_for_bss(beacon, bss, report);
-
-		rrm_build_measurement_report(&beacon->info, report,
-						report_len, ptr);
-
-		ptr += report_len + 5;
+		rrm_measurement_from_bss(&m, entry->data);
+		rrm_beacon_report_add(&data, &m);
 	}
 
-	rrm_info_destroy(&beacon->info);
-	rrm->pending = NULL;
+	return rrm_beacon_report_send(rrm, &data);
+}
 
-	return rrm_send_response(rrm, frame, ptr - frame);
+static void rrm_report_cached_measurement(const void *key, void *value,
+						void *user_data)
+{
+	rrm_beacon_report_add(user_data, value);
 }
 
+/*
+ * Table requests, and passive or active requests for a channel that was
+ * scanned very recently, are answered from the measurements collected
+ * from all scans on this wdev.
+ */
 static void rrm_handle_beacon_table(struct rrm_state *rrm,
 					struct rrm_beacon_req_info *beacon)
 {
-	struct l_queue *bss_list;
+	struct rrm_beacon_report_data data;
+	uint64_t now = l_time_now();
 
-	bss_list = station_get_bss_list(rrm->station);
-	if (!bss_list) {
+	if (l_hashmap_isempty(rrm->measurements)) {
 		rrm_reject_measurement_request(rrm, REPORT_REJECT_INCAPABLE);
 		return;
 	}
 
-	if (!rrm_report_beacon_results(rrm, bss_list))
+	rrm_beacon_report_init(&data, beacon);
+
+	if (now > RRM_CACHE_MAX_AGE)
+		data.min_time = now - RRM_CACHE_MAX_AGE;
+
+	l_hashmap_foreach(rrm->measurements, rrm_report_cached_measurement,
+				&data);
+
+	if (!rrm_beacon_report_send(rrm, &data))
 		l_error("Error reporting beacon table results");
 }
 
+static bool rrm_channel_scan_match(const void *a, const void *b)
+{
+	const struct rrm_channel_scan *scan = a;
+
+	return scan->freq == L_PTR_TO_UINT(b);
+}
+
+static bool rrm_cache_is_fresh(struct rrm_state *rrm,
+				struct rrm_beacon_req_info *beacon,
+				bool passive)
+{
+	enum scan_band band = scan_oper_class_to_band(NULL, beacon->oper_class);
+	uint32_t freq = scan_channel_to_freq(beacon->channel, band);
+	const struct rrm_channel_scan *scan;
+
+	/* Only a new scan can honor a mandatory duration */
+	if (test_bit(&beacon->info.mode, 4))
+		return false;
+
+	/* Hidden networks may only answer a directed Probe Request */
+	if (!passive && beacon->has_ssid)
+		return false;
+
+	scan = l_queue_find(rrm->channel_scans, rrm_channel_scan_match,
+				L_UINT_TO_PTR(freq));
+
+	return scan && l_time_now() - scan->time <= RRM_CACHE_FRESH_TIME;
+}
+
 static bool rrm_scan_results(int err, struct l_queue *bss_list,
 				const struct scan_freq_set *freqs,
 				void *userdata)
@@ -627,10 +766,18 @@ static void rrm_handle_beacon_request(struct rrm_state *rrm,
 	/* Mode */
 	switch (request[6]) {
 	case RRM_BEACON_REQ_MODE_PASSIVE:
-		rrm_handle_beacon_scan(rrm, beacon, true);
+		if (rrm_cache_is_fresh(rrm, beacon, true))
+			rrm_handle_beacon_table(rrm, beacon);
+		else
+			rrm_handle_beacon_scan(rrm, beacon, true);
+
 		return;
 	case RRM_BEACON_REQ_MODE_ACTIVE:
-		rrm_handle_beacon_scan(rrm, beacon, false);
+		if (rrm_cache_is_fresh(rrm, beacon, false))
+			rrm_handle_beacon_table(rrm, beacon);
+		else
+			rrm_handle_beacon_scan(rrm, beacon, false);
+
 		return;
 	case RRM_BEACON_REQ_MODE_TABLE:
 		rrm_handle_beacon_table(rrm, beacon);
@@ -776,13 +923,114 @@ static void rrm_frame_watch_cb(const struct mmpdu_header *mpdu,
 	}
 }
 
+static bool rrm_measurement_expired(const void *key, void *value,
+					void *user_data)
+{
+	struct rrm_measurement *m = value;
+	uint64_t *now = user_data;
+
+	if (m->time + RRM_CACHE_MAX_AGE >= *now)
+		return false;
+
+	l_free(m);
+	return true;
+}
+
+static bool rrm_channel_scan_expired(void *data, void *user_data)
+{
+	struct rrm_channel_scan *scan = data;
+	uint64_t *now = user_data;
+
+	if (scan->time + RRM_CACHE_MAX_AGE >= *now)
+		return false;
+
+	l_free(scan);
+	return true;
+}
+
+struct rrm_channel_scan_data {
+	struct rrm_state *rrm;
+	uint64_t now;
+};
+
+static void rrm_channel_scan_update(uint32_t freq, void *user_data)
+{
+	struct rrm_channel_scan_data *data = user_data;
+	struct rrm_channel_scan *scan;
+
+	scan = l_queue_find(data->rrm->channel_scans, rrm_channel_scan_match,
+				L_UINT_TO_PTR(freq));
+	if (!scan) {
+		scan = l_new(struct rrm_channel_scan, 1);
+		scan->freq = freq;
+		l_queue_push_tail(data->rrm->channel_scans, scan);
+	}
+
+	scan->time = data->now;
+}
+
+static bool match_wdev_id(const void *a, const void *b)
+{
+	const struct rrm_state *rrm = a;
+	const uint64_t *wdev_id = b;
+
+	return rrm->wdev_id == *wdev_id;
+}
+
+static void rrm_scan_results_watch(uint64_t wdev_id,
+					struct l_queue *bss_list,
+					const struct scan_freq_set *freqs,
+					void *user_data)
+{
+	struct rrm_state *rrm = l_queue_find(states, match_wdev_id, &wdev_id);
+	struct rrm_channel_scan_data data;
+	const struct l_queue_entry *entry;
+
+	if (!rrm)
+		return;
+
+	data.rrm = rrm;
+	data.now = l_time_now();
+
+	if (freqs)
+		scan_freq_set_foreach(freqs, rrm_channel_scan_update, &data);
+
+	for (entry = l_queue_get_entries(bss_list); entry;
+							entry = entry->next) {
+		struct rrm_measurement m;
+		struct rrm_measurement *cached;
+
+		rrm_measurement_from_bss(&m, entry->data);
+
+		cached = l_hashmap_lookup(rrm->measurements, &m.key);
+		if (!cached) {
+			cached = l_memdup(&m, sizeof(m));
+			l_hashmap_insert(rrm->measurements, &cached->key,
+						cached);
+		} else if (cached->time <= m.time)
+			memcpy(cached, &m, sizeof(m));
+	}
+
+	l_hashmap_foreach_remove(rrm->measurements, rrm_measurement_expired,
+					&data.now);
+	l_queue_foreach_remove(rrm->channel_scans, rrm_channel_scan_expired,
+					&data.now);
+}
+
+static void rrm_state_free(struct rrm_state *rrm)
+{
+	l_hashmap_destroy(rrm->measurements, l_free);
+	l_queue_destroy(rrm->channel_scans, l_free);
+	l_free(rrm);
+}
+
 static void rrm_state_destroy(void *data)
 {
 	struct rrm_state *rrm = data;
 
 	l_warn("RRM states still exist on exit!");
 
-	l_free(rrm);
+	rrm_state_free(rrm);
 }
 
 static void rrm_add_frame_watches(struct rrm_state *rrm)
@@ -806,6 +1054,13 @@ static struct rrm_state *rrm_new_state(struct netdev *netdev)
 	rrm->ifindex = netdev_get_ifindex(netdev);
 	rrm->wdev_id = netdev_get_wdev_id(netdev);
 
+	rrm->measurements = l_hashmap_new();
+	l_hashmap_set_hash_function(rrm->measurements,
+					rrm_measurement_key_hash);
+	l_hashmap_set_compare_function(rrm->measurements,
+					rrm_measurement_key_compare);
+	rrm->channel_scans = l_queue_new();
+
 	l_queue_push_head(states, rrm);
 
 	return rrm;
@@ -847,7 +1102,7 @@ static void rrm_netdev_watch(struct netdev *netdev,
 				station_remove_state_watch(rrm->station,
 								rrm->watch_id);
 
-			l_free(rrm);
+			rrm_state_free(rrm);
 		}
 
 		break;
@@ -873,6 +1128,8 @@ static int rrm_init(void)
 	nl80211 = l_genl_family_new(genl, NL80211_GENL_NAME);
 
 	netdev_watch = netdev_watch_add(rrm_netdev_watch, NULL, NULL);
+	scan_results_watch = scan_results_watch_add(rrm_scan_results_watch,
+							NULL, NULL);
 
 	return 0;
 }
@@ -883,9 +1140,11 @@ static void rrm_exit(void)
 	nl80211 = NULL;
 
 	netdev_watch_remove(netdev_watch);
+	scan_results_watch_remove(scan_results_watch);
 
 	l_queue_destroy(states, rrm_state_destroy);
 }
 
 IWD_MODULE(rrm, rrm_init, rrm_exit);
 IWD_MODULE_DEPENDS(rrm, netdev);
+IWD_MODULE_DEPENDS(rrm, scan);
@@ -50,6 +50,7 @@
 #include "src/p2putil.h"
 #include "src/mpdu.h"
 #include "src/band.h"
+#include "src/watchlist.h"
 #include "src/scan.h"
 
 /* User configurable options */
@@ -58,6 +59,16 @@ static uint32_t SCAN_MAX_INTERVAL;
 static uint32_t SCAN_INIT_INTERVAL;
 
 static struct l_queue *scan_contexts;
+static struct watchlist scan_results_watches;
+
+/* Targeted periodic scans in a row without a known network before a full */
+#define SCAN_PERIODIC_TARGETED_LIMIT	2
+/* Most recently used known networks whose channels are targeted */
+#define SCAN_PERIODIC_RECENT_NETWORKS	5
+/* Periodic scans finding a known network that still isn't connected to */
+#define SCAN_PERIODIC_PRODUCTIVE_LIMIT	3
+/* Seconds of timer lateness taken as a sign of a suspend / resume cycle */
+#define SCAN_PERIODIC_RESUME_SLACK	30
 
 static struct l_genl_family *nl80211;
 
@@ -72,6 +83,13 @@ struct scan_periodic {
 	bool retry:1;
 	uint32_t id;
 	bool needs_active_scan:1;
+	bool targeted:1;
+	uint8_t unproductive;
+	uint8_t productive;
+	uint64_t armed_time;
+	uint64_t trigger_time;
+	uint64_t airtime;
+	uint32_t count;
 };
 
 struct scan_request {
@@ -389,6 +407,10 @@ static struct l_genl_msg *scan_build_cmd(struct scan_context *sc,
 					NL80211_EXT_FEATURE_SCAN_RANDOM_SN))
 		flags |= NL80211_SCAN_FLAG_RANDOM_SN;
 
+	if (params->low_priority && wiphy_has_feature(sc->wiphy,
+					NL80211_FEATURE_LOW_PRIORITY_SCAN))
+		flags |= NL80211_SCAN_FLAG_LOW_PRIORITY;
+
 	if (flags)
 		l_genl_msg_append_attr(msg, NL80211_ATTR_SCAN_FLAGS, 4, &flags);
 
@@ -860,16 +882,85 @@ static void scan_periodic_triggered(int err, void *user_data)
 
 	l_debug("Periodic scan triggered for wdev %" PRIx64, sc->wdev_id);
 
+	sc->sp.trigger_time = l_time_now();
+
 	if (sc->sp.trigger)
 		sc->sp.trigger(0, sc->sp.userdata);
 }
 
+static bool scan_bss_match_known_ssid(const struct network_info *info,
+					void *user_data)
+{
+	const struct scan_bss *bss = user_data;
+
+	/* Returning false stops the iteration */
+	return strlen(info->ssid) != bss->ssid_len ||
+			memcmp(info->ssid, bss->ssid, bss->ssid_len);
+}
+
+static bool scan_bss_is_known(const void *data, const void *user_data)
+{
+	struct scan_bss *bss = (struct scan_bss *) data;
+
+	return !known_networks_foreach(scan_bss_match_known_ssid, bss);
+}
+
+/*
+ * Pick the next periodic scan interval based on what the last one found.
+ * A known network in range keeps the interval as is, as does a targeted
+ * scan that found nothing since a full scan is due next.  An unproductive
+ * full scan backs off, and so do further scans finding known networks
+ * once a few of them did not lead to a connection, since periodic scans
+ * stop as soon as a connection is made.
+ */
+static void scan_periodic_update_policy(struct scan_context *sc,
+					struct l_queue *bss_list)
+{
+	bool productive = bss_list &&
+				l_queue_find(bss_list, scan_bss_is_known, NULL);
+
+	if (sc->sp.trigger_time) {
+		sc->sp.airtime += l_time_diff(sc->sp.trigger_time,
+							l_time_now());
+		sc->sp.trigger_time = 0;
+		sc->sp.count++;
+	}
+
+	l_debug("%s scan %s, %u scans using %ums so far",
+			sc->sp.targeted ? "Targeted" : "Full",
+			productive ? "found known networks" : "found nothing",
+			sc->sp.count,
+			(uint32_t) (sc->sp.airtime / L_USEC_PER_MSEC));
+
+	if (productive) {
+		sc->sp.unproductive = 0;
+
+		if (sc->sp.productive < SCAN_PERIODIC_PRODUCTIVE_LIMIT) {
+			sc->sp.productive++;
+			return;
+		}
+
+		sc->sp.interval = L_MIN(sc->sp.interval * 2U,
+						SCAN_MAX_INTERVAL);
+		return;
+	}
+
+	if (sc->sp.targeted) {
+		sc->sp.unproductive++;
+		return;
+	}
+
+	sc->sp.unproductive = 0;
+	sc->sp.interval = L_MIN(sc->sp.interval * 2U, SCAN_MAX_INTERVAL);
+}
+
 static bool scan_periodic_notify(int err, struct l_queue *bss_list,
 					const struct scan_freq_set *freqs,
 					void *user_data)
 {
 	struct scan_context *sc = user_data;
 
+	scan_periodic_update_policy(sc, err ? NULL : bss_list);
 	scan_periodic_rearm(sc);
 
 	if (sc->sp.callback)
@@ -880,25 +971,47 @@ static bool scan_periodic_notify(int err, struct l_queue *bss_list,
 
 static bool scan_periodic_queue(struct scan_context *sc)
 {
+	struct scan_freq_set *freqs = NULL;
+
 	if (!l_queue_isempty(sc->requests)) {
 		sc->sp.retry = true;
 		return false;
 	}
 
+	/*
+	 * Prefer the channels where known networks were recently seen and
+	 * escalate to all channels when that keeps finding nothing.
+	 */
+	if (sc->sp.unproductive < SCAN_PERIODIC_TARGETED_LIMIT)
+		freqs = known_networks_get_recent_frequencies(
+					SCAN_PERIODIC_RECENT_NETWORKS);
+
+	if (freqs && !wiphy_constrain_freq_set(sc->wiphy, freqs)) {
+		scan_freq_set_free(freqs);
+		freqs = NULL;
+	}
+
 	if (sc->sp.needs_active_scan && known_networks_has_hidden()) {
 		struct scan_parameters params = {
 			.randomize_mac_addr_hint = true
 		};
 
 		sc->sp.needs_active_scan = false;
+		sc->sp.targeted = false;
 
 		sc->sp.id = scan_active_full(sc->wdev_id, &params,
 						scan_periodic_triggered,
 						scan_periodic_notify, sc, NULL);
-	} else
-		sc->sp.id = scan_passive(sc->wdev_id, NULL,
+	} else {
+		sc->sp.targeted = freqs != NULL;
+
+		sc->sp.id = scan_passive(sc->wdev_id, freqs,
 						scan_periodic_triggered,
 						scan_periodic_notify, sc, NULL);
+	}
+
+	if (freqs)
+		scan_freq_set_free(freqs);
 
 	return sc->sp.id != 0;
 }
@@ -936,6 +1049,10 @@ void scan_periodic_start(uint64_t wdev_id, scan_trigger_func_t trigger,
 	l_debug("Starting periodic scan for wdev %" PRIx64, wdev_id);
 
 	sc->sp.interval = SCAN_INIT_INTERVAL;
+	sc->sp.unproductive = 0;
+	sc->sp.productive = 0;
+	sc->sp.airtime = 0;
+	sc->sp.count = 0;
 	sc->sp.trigger = trigger;
 	sc->sp.callback = func;
 	sc->sp.userdata = userdata;
@@ -972,6 +1089,7 @@ bool scan_periodic_stop(uint64_t wdev_id)
 	sc->sp.userdata = NULL;
 	sc->sp.retry = false;
 	sc->sp.needs_active_scan = false;
+	sc->sp.trigger_time = 0;
 
 	return true;
 }
@@ -1001,9 +1119,20 @@ static void scan_periodic_timeout(struct l_timeout *timeout, void *user_data)
 
 	l_debug("scan_periodic_timeout: %" PRIx64, sc->wdev_id);
 
-	sc->sp.interval *= 2;
-	if (sc->sp.interval > SCAN_MAX_INTERVAL)
-		sc->sp.interval = SCAN_MAX_INTERVAL;
+	/*
+	 * The timer does not advance while the system is suspended but
+	 * l_time_now() does.  After a resume the surroundings have likely
+	 * changed, so start over with short intervals.
+	 */
+	if (l_time_diff(sc->sp.armed_time, l_time_now()) >
+			(uint64_t) (sc->sp.interval +
+					SCAN_PERIODIC_RESUME_SLACK) *
+					L_USEC_PER_SEC) {
+		l_debug("Resumed from suspend, resetting periodic scan");
+		sc->sp.interval = SCAN_INIT_INTERVAL;
+		sc->sp.unproductive = 0;
+		sc->sp.productive = 0;
+	}
 
 	scan_periodic_queue(sc);
 }
@@ -1019,6 +1148,8 @@ static void scan_periodic_rearm(struct scan_context *sc)
 {
 	l_debug("Arming periodic scan timer: %u", sc->sp.interval);
 
+	sc->sp.armed_time = l_time_now();
+
 	if (sc->sp.timeout)
 		l_timeout_modify(sc->sp.timeout, sc->sp.interval);
 	else
@@ -1692,6 +1823,12 @@ static void scan_finished(struct scan_context *sc,
 	if (bss_list)
 		discover_hidden_network_bsses(sc, bss_list);
 
+	/* Let observers see the results before the requester owns them */
+	if (!err && bss_list)
+		WATCHLIST_NOTIFY(&scan_results_watches,
+					scan_results_watch_func_t,
+					sc->wdev_id, bss_list, freqs);
+
 	if  (sr) {
 		l_queue_remove(sc->requests, sr);
 		sc->started = false;
@@ -2367,6 +2504,21 @@ void scan_freq_set_constrain(struct scan_freq_set *set,
 	set->channels_2ghz &= constraint->channels_2ghz;
 }
 
+/*
+ * Watch the results of every scan, triggered by us or externally, on all
+ * wdevs.  The BSS list must not be modified or kept.
+ */
+uint32_t scan_results_watch_add(scan_results_watch_func_t func,
+				void *userdata, scan_destroy_func_t destroy)
+{
+	return watchlist_add(&scan_results_watches, func, userdata, destroy);
+}
+
+bool scan_results_watch_remove(uint32_t id)
+{
+	return watchlist_remove(&scan_results_watches, id);
+}
+
 bool scan_wdev_add(uint64_t wdev_id)
 {
 	struct scan_context *sc;
@@ -2415,6 +2567,7 @@ static int scan_init(void)
 	const struct l_settings *config = iwd_get_config();
 
 	scan_contexts = l_queue_new();
+	watchlist_init(&scan_results_watches, NULL);
 
 	if (!l_settings_get_double(config, "Rank", "BandModifier5Ghz",
 					&RANK_5G_FACTOR))
@@ -2442,6 +2595,7 @@ static void scan_exit()
 	l_queue_destroy(scan_contexts,
 				(l_queue_destroy_func_t) scan_context_free);
 	scan_contexts = NULL;
+	watchlist_destroy(&scan_results_watches);
 	l_genl_family_free(nl80211);
 	nl80211 = NULL;
 }
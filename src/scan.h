@@ -101,6 +101,7 @@ struct scan_parameters {
 	bool randomize_mac_addr_hint : 1;
 	bool no_cck_rates : 1;
 	bool duration_mandatory : 1;
+	bool low_priority : 1;
 	const uint8_t *ssid;	/* Used for direct probe request */
 	size_t ssid_len;
 	const uint8_t *source_mac;
@@ -113,6 +114,10 @@ typedef bool (*scan_notify_func_t)(int err, struct l_queue *bss_list,
 					void *userdata);
 typedef void (*scan_destroy_func_t)(void *userdata);
 typedef void (*scan_freq_set_func_t)(uint32_t freq, void *userdata);
+typedef void (*scan_results_watch_func_t)(uint64_t wdev_id,
+					struct l_queue *bss_list,
+					const struct scan_freq_set *freqs,
+					void *userdata);
 
 static inline int scan_bss_addr_cmp(const struct scan_bss *a1,
 					const struct scan_bss *a2)
@@ -159,6 +164,10 @@ bool scan_periodic_stop(uint64_t wdev_id);
 
 uint64_t scan_get_triggered_time(uint64_t wdev_id, uint32_t id);
 
+uint32_t scan_results_watch_add(scan_results_watch_func_t func,
+				void *userdata, scan_destroy_func_t destroy);
+bool scan_results_watch_remove(uint32_t id);
+
 bool scan_get_firmware_scan(uint64_t wdev_id, scan_notify_func_t notify,
 				void *userdata, scan_destroy_func_t destroy);
 
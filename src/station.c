@@ -26,6 +26,7 @@
 
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <time.h>
 #include <sys/time.h>
@@ -52,22 +53,56 @@
 #include "src/blacklist.h"
 #include "src/mpdu.h"
 #include "src/erp.h"
+#include "src/pmksa.h"
 #include "src/netconfig.h"
 #include "src/anqp.h"
 #include "src/anqputil.h"
 #include "src/diagnostic.h"
 #include "src/frame-xchg.h"
 #include "src/sysfs.h"
+#include "src/netorder.h"
 
 static struct l_queue *station_list;
 static uint32_t netdev_watch;
 static uint32_t mfp_setting;
 static uint32_t roam_retry_interval;
+static bool predictive_roaming;
+static uint32_t bg_scan_duty_cycle;
+static uint32_t stale_network_scans;
+static uint32_t stale_network_timeout;
 static bool anqp_disabled;
 static bool supports_arp_evict_nocarrier;
 static bool supports_ndisc_evict_nocarrier;
 static struct watchlist event_watches;
 
+/* FT targets whose keys are prepared ahead of a roam */
+#define FT_PREPARE_CANDIDATES	3
+/* Seconds between FT-over-DS Action frame refreshes */
+#define FT_DS_REFRESH_INTERVAL	60
+/* Signal change in 100 * dBm that is reported as an ordered list change */
+#define ORDERED_NETWORKS_SIGNAL_DELTA	500
+/* Removed networks remembered for GetOrderedNetworkChanges */
+#define ORDERED_NETWORKS_REMOVED_MAX	128
+/* Link samples up to this many us old are good enough for diagnostics */
+#define DIAGNOSTICS_MAX_AGE	(1 * L_USEC_PER_SEC)
+/* Seconds ahead the predictor extrapolates the RSSI trend */
+#define ROAM_PREDICT_HORIZON	10
+/* Percent by which a candidate must beat the current link rate */
+#define ROAM_PREDICT_MARGIN	20
+/* Minimum seconds between predictor property change signals */
+#define ROAM_PREDICT_EMIT_INTERVAL	10
+/* Channels per background scan request and their dwell time in TUs */
+#define BG_SCAN_GROUP_SIZE	3
+#define BG_SCAN_DWELL		20
+/* Shortest gap in ms between two background scan requests */
+#define BG_SCAN_MIN_INTERVAL	1000
+/* Seconds a completed background pass is trusted for roaming */
+#define BG_SCAN_FRESH_TIME	120
+/* Candidates whose channels are rescanned before using background results */
+#define BG_SCAN_CONFIRM_CANDIDATES	3
+/* Background scans remembered for the off-channel time report */
+#define BG_SCAN_LOG_SIZE	64
+
 struct station {
 	enum station_state state;
 	struct watchlist state_watches;
@@ -80,6 +115,7 @@ struct station {
 	struct l_queue *hidden_bss_list_sorted;
 	struct l_hashmap *networks;
 	struct l_queue *networks_sorted;
+	struct netorder *ordered;
 	struct l_dbus_message *connect_pending;
 	struct l_dbus_message *hidden_pending;
 	struct l_dbus_message *disconnect_pending;
@@ -94,7 +130,31 @@ struct station {
 	/* Roaming related members */
 	struct timespec roam_min_time;
 	struct l_timeout *roam_trigger_timeout;
+	struct l_timeout *ft_ds_refresh;
+	struct l_timeout *stale_timeout;
 	uint32_t roam_scan_id;
+
+	/* Roaming predictor, RSSI values are in 1/100 dBm */
+	uint32_t predict_watch;
+	uint64_t predict_last_sample;
+	uint64_t predict_holdoff;
+	uint64_t predict_last_emit;
+	int32_t rssi_ewma;
+	int32_t rssi_slope;
+	uint64_t link_rate;
+
+	/* Background scanning of a few channels at a time while connected */
+	struct l_timeout *bg_scan_timeout;
+	uint32_t bg_scan_id;
+	unsigned int bg_scan_subset_idx;
+	unsigned int bg_scan_offset;
+	uint64_t bg_scan_start;
+	uint64_t bg_scan_pass_done;
+	struct {
+		uint64_t end;
+		uint32_t ms;
+	} bg_scan_log[BG_SCAN_LOG_SIZE];
+	unsigned int bg_scan_log_idx;
 	uint8_t preauth_bssid[6];
 
 	struct wiphy *wiphy;
@@ -118,6 +178,12 @@ struct station {
 	bool scanning : 1;
 	bool autoconnect : 1;
 	bool autoconnect_can_start : 1;
+	bool pmksa_attempted : 1;
+	bool okc_attempted : 1;
+	bool predictive_roam : 1;
+
+	uint32_t okc_hits;
+	uint32_t okc_misses;
 };
 
 struct anqp_entry {
@@ -190,11 +256,17 @@ static void station_property_set_scanning(struct station *station,
 
 static void station_enter_state(struct station *station,
 						enum station_state state);
+static void station_predict_start(struct station *station);
+static void station_bg_scan_start(struct station *station);
 
 static void network_add_foreach(struct network *network, void *user_data)
 {
 	struct station *station = user_data;
 
+	/* Stale network, nothing to connect to */
+	if (network_bss_list_isempty(network))
+		return;
+
 	l_queue_insert(station->autoconnect_list, network,
 				network_rank_compare, NULL);
 }
@@ -283,10 +355,16 @@ static void network_free(void *data)
 	network_remove(network, -ESHUTDOWN);
 }
 
+struct process_network_data {
+	struct station *station;
+	const struct scan_freq_set *freqs;
+};
+
 static bool process_network(const void *key, void *data, void *user_data)
 {
 	struct network *network = data;
-	struct station *station = user_data;
+	struct process_network_data *process_data = user_data;
+	struct station *station = process_data->station;
 
 	if (!network_bss_list_isempty(network)) {
 		bool connected = network == station->connected_network;
@@ -300,6 +378,16 @@ static bool process_network(const void *key, void *data, void *user_data)
 		return false;
 	}
 
+	/*
+	 * Keep the object registered while the network is stale so that a
+	 * network flapping at the edge of coverage doesn't churn D-Bus
+	 * objects and agent requests.  It is left out of the ordered list.
+	 */
+	if (!network_update_missing(network, process_data->freqs,
+					stale_network_scans,
+					stale_network_timeout * L_USEC_PER_SEC))
+		return false;
+
 	/* Drop networks that have no more BSSs in range */
 	l_debug("No remaining BSSs for SSID: %s -- Removing network",
 			network_get_ssid(network));
@@ -308,6 +396,84 @@ static bool process_network(const void *key, void *data, void *user_data)
 	return true;
 }
 
+static bool stale_network_expired(const void *key, void *data,
+							void *user_data)
+{
+	struct network *network = data;
+	struct station *station = user_data;
+	uint64_t missing_since = network_get_missing_since(network);
+
+	if (!missing_since || network == station->connected_network)
+		return false;
+
+	if (l_time_diff(missing_since, l_time_now()) <
+				stale_network_timeout * L_USEC_PER_SEC)
+		return false;
+
+	l_debug("Stale network %s timed out -- Removing network",
+			network_get_ssid(network));
+	network_remove(network, -ERANGE);
+
+	return true;
+}
+
+static void stale_network_earliest(const void *key, void *data,
+							void *user_data)
+{
+	struct network *network = data;
+	uint64_t *earliest = user_data;
+	uint64_t missing_since = network_get_missing_since(network);
+
+	if (missing_since && (!*earliest || missing_since < *earliest))
+		*earliest = missing_since;
+}
+
+static void station_ordered_networks_update(struct station *station);
+static void station_stale_timeout(struct l_timeout *timeout, void *user_data);
+
+/*
+ * Stale networks are otherwise only expired while processing scan results,
+ * which may not happen for a long time when connected.  Keep a single timer
+ * armed for the network that goes stale first.
+ */
+static void station_stale_timeout_rearm(struct station *station)
+{
+	uint64_t earliest = 0;
+	uint64_t now = l_time_now();
+	uint64_t elapsed;
+	uint64_t remaining_ms;
+
+	l_hashmap_foreach(station->networks, stale_network_earliest, &earliest);
+
+	if (!earliest) {
+		l_timeout_remove(station->stale_timeout);
+		station->stale_timeout = NULL;
+		return;
+	}
+
+	elapsed = l_time_diff(earliest, now);
+	remaining_ms = elapsed < stale_network_timeout * L_USEC_PER_SEC ?
+		(stale_network_timeout * L_USEC_PER_SEC - elapsed + 999) /
+				1000 : 0;
+
+	if (station->stale_timeout)
+		l_timeout_modify_ms(station->stale_timeout, remaining_ms);
+	else
+		station->stale_timeout = l_timeout_create_ms(remaining_ms,
+						station_stale_timeout,
+						station, NULL);
+}
+
+static void station_stale_timeout(struct l_timeout *timeout, void *user_data)
+{
+	struct station *station = user_data;
+
+	l_hashmap_foreach_remove(station->networks, stale_network_expired,
+					station);
+	station_ordered_networks_update(station);
+	station_stale_timeout_rearm(station);
+}
+
 static const char *iwd_network_get_path(struct station *station,
 					const char *ssid,
 					enum security security)
@@ -872,10 +1038,98 @@ static bool bss_free_if_ssid_not_utf8(void *data, void *user_data)
 	return true;
 }
 
+static void ordered_networks_append_changed(const char *path, int16_t signal,
+						const char *after,
+						void *user_data)
+{
+	struct l_dbus_message_builder *builder = user_data;
+
+	l_dbus_message_builder_enter_struct(builder, "ono");
+	l_dbus_message_builder_append_basic(builder, 'o', path);
+	l_dbus_message_builder_append_basic(builder, 'n', &signal);
+	l_dbus_message_builder_append_basic(builder, 'o', after);
+	l_dbus_message_builder_leave_struct(builder);
+}
+
+static void ordered_networks_append_removed(const char *path,
+							void *user_data)
+{
+	struct l_dbus_message_builder *builder = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'o', path);
+}
+
+/*
+ * Appends the a(ono)ao changes made after generation since.  A full
+ * snapshot lists every network as changed and nothing as removed.
+ */
+static void station_append_ordered_changes(struct station *station,
+					struct l_dbus_message_builder *builder,
+					uint64_t since, bool full)
+{
+	l_dbus_message_builder_enter_array(builder, "(ono)");
+	netorder_foreach_changed(station->ordered, full ? 0 : since,
+					ordered_networks_append_changed,
+					builder);
+	l_dbus_message_builder_leave_array(builder);
+
+	l_dbus_message_builder_enter_array(builder, "o");
+
+	if (!full)
+		netorder_foreach_removed(station->ordered, since,
+					ordered_networks_append_removed,
+					builder);
+
+	l_dbus_message_builder_leave_array(builder);
+}
+
+/*
+ * Compares networks_sorted against what was last reported and starts a
+ * new generation if a network was added, removed, moved or its signal
+ * changed by ORDERED_NETWORKS_SIGNAL_DELTA or more.
+ */
+static void station_ordered_networks_update(struct station *station)
+{
+	const struct l_queue_entry *entry;
+	uint64_t generation;
+	struct l_dbus_message *signal;
+	struct l_dbus_message_builder *builder;
+
+	netorder_begin(station->ordered);
+
+	for (entry = l_queue_get_entries(station->networks_sorted); entry;
+						entry = entry->next) {
+		const struct network *network = entry->data;
+
+		netorder_add(station->ordered, network_get_path(network),
+				network_get_signal_strength(network));
+	}
+
+	if (!netorder_commit(station->ordered))
+		return;
+
+	generation = netorder_get_generation(station->ordered);
+
+	signal = l_dbus_message_new_signal(dbus_get_bus(),
+					netdev_get_path(station->netdev),
+					IWD_STATION_INTERFACE,
+					"OrderedNetworksChanged");
+	builder = l_dbus_message_builder_new(signal);
+	l_dbus_message_builder_append_basic(builder, 't', &generation);
+	station_append_ordered_changes(station, builder, generation - 1,
+								false);
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	l_dbus_send(dbus_get_bus(), signal);
+}
+
 /*
  * Used when scan results were obtained; either from scan running
  * inside station module or scans running in other state machines, e.g. wsc
  */
+static void station_ft_prepare(struct station *station);
+
 void station_set_scan_results(struct station *station,
 					struct l_queue *new_bss_list,
 					const struct scan_freq_set *freqs,
@@ -883,6 +1137,7 @@ void station_set_scan_results(struct station *station,
 {
 	const struct l_queue_entry *bss_entry;
 	struct network *network;
+	struct process_network_data process_data = { station, freqs };
 
 	l_queue_foreach_remove(new_bss_list, bss_free_if_ssid_not_utf8, NULL);
 
@@ -938,14 +1193,86 @@ void station_set_scan_results(struct station *station,
 
 	station->bss_list = new_bss_list;
 
-	l_hashmap_foreach_remove(station->networks, process_network, station);
+	l_hashmap_foreach_remove(station->networks, process_network,
+					&process_data);
+	station_ordered_networks_update(station);
+	station_stale_timeout_rearm(station);
 
 	station->autoconnect_can_start = trigger_autoconnect;
 	station_autoconnect_start(station);
+
+	/*
+	 * Candidates may have changed.  Background scans only refresh them
+	 * once a full pass over all channels completes.
+	 */
+	if (station->state == STATION_STATE_CONNECTED && !station->bg_scan_id)
+		station_ft_prepare(station);
 }
 
 static void station_reconnect(struct station *station);
 
+/* AKMs for which PMKSA caching is supported */
+#define PMKSA_AKMS (IE_RSN_AKM_SUITE_8021X |		\
+			IE_RSN_AKM_SUITE_8021X_SHA256 |		\
+			IE_RSN_AKM_SUITE_SAE_SHA256)
+
+static void station_okc_result(struct station *station, bool hit)
+{
+	if (!station->okc_attempted)
+		return;
+
+	station->okc_attempted = false;
+
+	if (hit)
+		station->okc_hits++;
+	else
+		station->okc_misses++;
+
+	l_debug("OKC %s, hits: %u misses: %u", hit ? "hit" : "miss",
+			station->okc_hits, station->okc_misses);
+
+	if (iwd_is_developer_mode())
+		l_dbus_property_changed(dbus_get_bus(),
+				netdev_get_path(station->netdev),
+				IWD_STATION_DEBUG_INTERFACE,
+				hit ? "OKCHits" : "OKCMisses");
+}
+
+static void station_cache_pmksa(struct handshake_state *hs)
+{
+	struct pmksa *pmksa;
+
+	if (!(hs->akm_suite & PMKSA_AKMS) || hs->wpa_ie || hs->osen_ie ||
+			!hs->have_pmk)
+		return;
+
+	/* Keep the original lifetime of a PMKSA that was reused */
+	if (hs->pmksa) {
+		pmksa = hs->pmksa;
+		hs->pmksa = NULL;
+		pmksa_cache_put(pmksa);
+		return;
+	}
+
+	pmksa = l_new(struct pmksa, 1);
+
+	if (!handshake_state_get_pmkid(hs, pmksa->pmkid)) {
+		pmksa_free(pmksa);
+		return;
+	}
+
+	pmksa->expiration = l_time_offset(l_time_now(), pmksa_lifetime());
+	memcpy(pmksa->spa, hs->spa, 6);
+	memcpy(pmksa->aa, hs->aa, 6);
+	memcpy(pmksa->ssid, hs->ssid, hs->ssid_len);
+	pmksa->ssid_len = hs->ssid_len;
+	pmksa->akm = hs->akm_suite;
+	memcpy(pmksa->pmk, hs->pmk, hs->pmk_len);
+	pmksa->pmk_len = hs->pmk_len;
+
+	pmksa_cache_put(pmksa);
+}
+
 static void station_handshake_event(struct handshake_state *hs,
 					enum handshake_event event,
 					void *user_data, ...)
@@ -982,6 +1309,17 @@ static void station_handshake_event(struct handshake_state *hs,
 		break;
 	}
 	case HANDSHAKE_EVENT_COMPLETE:
+		station_okc_result(station, hs->pmksa != NULL);
+		station_cache_pmksa(hs);
+		break;
+	case HANDSHAKE_EVENT_EAP_STARTED:
+		/*
+		 * The AP is running full EAP so a failure from here on is not
+		 * due to the PMKSA we offered
+		 */
+		station->pmksa_attempted = false;
+		station_okc_result(station, false);
+		break;
 	case HANDSHAKE_EVENT_SETTING_KEYS_FAILED:
 	case HANDSHAKE_EVENT_EAP_NOTIFY:
 	case HANDSHAKE_EVENT_P2P_IP_REQUEST:
@@ -1175,6 +1513,68 @@ not_supported:
 	return -ENOTSUP;
 }
 
+/*
+ * If a PMKSA is cached for this BSS offer its PMKID in the RSNE so the AP can
+ * skip EAP or SAE authentication and start the 4-Way Handshake right away.
+ * With OKC enabled for the network a PMKSA from another BSS of the same ESS
+ * can be used as well.
+ */
+static void station_handshake_setup_pmksa(struct station *station,
+					const struct network_info *info,
+					struct handshake_state *hs,
+					struct scan_bss *bss)
+{
+	const uint8_t *spa = hs->spa;
+	struct pmksa *pmksa;
+	struct ie_rsn_info rsn_info;
+	uint8_t rsne_buf[256];
+	bool okc = false;
+
+	station->okc_attempted = false;
+
+	if (!(hs->akm_suite & PMKSA_AKMS) || hs->wpa_ie || hs->osen_ie)
+		return;
+
+	/* Offloaded handshakes have no way of using the cached PMK */
+	if (wiphy_can_offload(station->wiphy))
+		return;
+
+	if (l_memeqzero(spa, 6))
+		spa = netdev_get_address(station->netdev);
+
+	pmksa = pmksa_cache_get(spa, bss->addr, hs->ssid, hs->ssid_len,
+					hs->akm_suite);
+	if (!pmksa && info && info->config.okc) {
+		pmksa = pmksa_cache_get_okc(spa, bss->addr, hs->ssid,
+						hs->ssid_len, hs->akm_suite);
+		okc = true;
+	}
+
+	if (!pmksa)
+		return;
+
+	if (ie_parse_rsne_from_data(hs->supplicant_ie,
+					hs->supplicant_ie[1] + 2,
+					&rsn_info) < 0)
+		goto drop;
+
+	rsn_info.num_pmkids = 1;
+	rsn_info.pmkids = pmksa->pmkid;
+
+	if (!ie_build_rsne(&rsn_info, rsne_buf) ||
+			!handshake_state_set_supplicant_ie(hs, rsne_buf))
+		goto drop;
+
+	l_debug("Using %s PMKSA for "MAC, okc ? "opportunistic" : "cached",
+			MAC_STR(bss->addr));
+	handshake_state_set_pmksa(hs, pmksa);
+	station->okc_attempted = okc;
+	return;
+
+drop:
+	pmksa_free(pmksa);
+}
+
 static struct handshake_state *station_handshake_setup(struct station *station,
 							struct network *network,
 							struct scan_bss *bss)
@@ -1198,6 +1598,8 @@ static struct handshake_state *station_handshake_setup(struct station *station,
 	if (network_handshake_setup(network, bss, hs) < 0)
 		goto not_supported;
 
+	station_handshake_setup_pmksa(station, info, hs, bss);
+
 	vendor_ies = network_info_get_extra_ies(info, bss, &iov_elems);
 	handshake_state_set_vendor_ies(hs, vendor_ies, iov_elems);
 
@@ -1467,6 +1869,7 @@ static void station_enter_state(struct station *station,
 		l_queue_remove(station->networks_sorted, station->connected_network);
 		l_queue_insert(station->networks_sorted, station->connected_network,
 					network_rank_compare, NULL);
+		station_ordered_networks_update(station);
 
 		l_dbus_property_changed(dbus, netdev_get_path(station->netdev),
 				IWD_STATION_INTERFACE, "ConnectedNetwork");
@@ -1504,6 +1907,8 @@ static void station_enter_state(struct station *station,
 		if (station->connected_bss->hs20_dgaf_disable)
 			station_set_drop_unicast_l2_multicast(station, true);
 
+		station_predict_start(station);
+		station_bg_scan_start(station);
 		break;
 	case STATION_STATE_DISCONNECTED:
 		periodic_scan_stop(station);
@@ -1578,6 +1983,20 @@ static void station_roam_state_clear(struct station *station)
 {
 	l_timeout_remove(station->roam_trigger_timeout);
 	station->roam_trigger_timeout = NULL;
+	l_timeout_remove(station->ft_ds_refresh);
+	station->ft_ds_refresh = NULL;
+	if (station->predict_watch) {
+		netdev_link_watch_remove(station->netdev,
+						station->predict_watch);
+		station->predict_watch = 0;
+	}
+
+	station->predict_last_sample = 0;
+	station->predict_last_emit = 0;
+	station->predictive_roam = false;
+	l_timeout_remove(station->bg_scan_timeout);
+	station->bg_scan_timeout = NULL;
+	station->bg_scan_pass_done = 0;
 	station->preparing_roam = false;
 	station->roam_scan_full = false;
 	station->signal_low = false;
@@ -1587,6 +2006,10 @@ static void station_roam_state_clear(struct station *station)
 		scan_cancel(netdev_get_wdev_id(station->netdev),
 						station->roam_scan_id);
 
+	if (station->bg_scan_id)
+		scan_cancel(netdev_get_wdev_id(station->netdev),
+						station->bg_scan_id);
+
 	if (station->roam_freqs) {
 		scan_freq_set_free(station->roam_freqs);
 		station->roam_freqs = NULL;
@@ -1614,6 +2037,7 @@ static void station_reset_connection_state(struct station *station)
 	l_queue_remove(station->networks_sorted, station->connected_network);
 	l_queue_insert(station->networks_sorted, station->connected_network,
 				network_rank_compare, NULL);
+	station_ordered_networks_update(station);
 
 	station->connected_bss = NULL;
 	station->connected_network = NULL;
@@ -1750,6 +2174,11 @@ static void parse_neighbor_report(struct station *station,
 			continue;
 		}
 
+		/* Neighbors belong to the same ESS, remember their channels */
+		network_add_known_frequency(station->connected_network, freq,
+					KNOWN_FREQUENCY_HIT_NEIGHBOR_REPORT,
+					false);
+
 		/* Add the frequency to one of the lists */
 		if (info.md && hs->mde) {
 			scan_freq_set_add(freq_set_md, freq);
@@ -1853,30 +2282,55 @@ static bool station_can_fast_transition(struct handshake_state *hs,
 	return true;
 }
 
-static void station_ft_ds_action_start(struct station *station)
+static void station_ft_ds_refresh_timeout(struct l_timeout *timeout,
+						void *user_data)
+{
+	struct station *station = user_data;
+
+	l_timeout_remove(station->ft_ds_refresh);
+	station->ft_ds_refresh = NULL;
+
+	station_ft_prepare(station);
+}
+
+/*
+ * Get the FT keys ready for the best few candidates in our mobility domain
+ * so a roam does not have to wait on them: the PMK-R1s are pre-derived and,
+ * for FT-over-DS, the Action frame exchange is done (and periodically
+ * redone, the targets do not hold on to these forever) in the background.
+ */
+static void station_ft_prepare(struct station *station)
 {
 	struct handshake_state *hs = netdev_get_handshake(station->netdev);
 	uint16_t mdid;
 	const struct l_queue_entry *entry;
 	struct scan_bss *bss;
 	struct ie_rsn_info rsn_info;
+	unsigned int count = 0;
+	bool over_ds;
 
-	if (!station_can_fast_transition(hs, station->connected_bss) ||
-						!(hs->mde[4] & 1))
+	if (!station->connected_bss || !hs)
+		return;
+
+	if (!station_can_fast_transition(hs, station->connected_bss))
 		return;
 
 	if (ie_parse_mobility_domain_from_data(hs->mde, hs->mde[1] + 2,
 						&mdid, NULL, NULL) < 0)
 		return;
 
+	over_ds = hs->mde[4] & 1;
+
+	/* The BSS list is sorted by rank */
 	for (entry = network_bss_list_get_entries(station->connected_network);
-						entry; entry = entry->next) {
+			entry && count < FT_PREPARE_CANDIDATES;
+			entry = entry->next) {
 		bss = entry->data;
 
 		if (bss == station->connected_bss)
 			continue;
 
-		if (mdid != l_get_le16(bss->mde))
+		if (!bss->mde_present || mdid != l_get_le16(bss->mde))
 			continue;
 
 		if (scan_bss_get_rsn_info(bss, &rsn_info) < 0)
@@ -1885,17 +2339,48 @@ static void station_ft_ds_action_start(struct station *station)
 		if (!IE_AKM_IS_FT(rsn_info.akm_suites))
 			continue;
 
+		count++;
+
+		/* Assume the common R1KH-ID == BSSID setup */
+		if (!handshake_state_prepare_pmk_r1(hs, bss->addr))
+			l_debug("Could not pre-derive PMK-R1 for "MAC,
+					MAC_STR(bss->addr));
+
+		if (!over_ds)
+			continue;
+
 		/*
 		* Fire and forget. Netdev will maintain a cache of responses and
 		* when the time comes these can be referenced for a roam
 		*/
 		netdev_fast_transition_over_ds_action(station->netdev, bss);
 	}
+
+	l_debug("Prepared FT for %u candidate(s)", count);
+
+	if (!over_ds || !count)
+		return;
+
+	if (station->ft_ds_refresh)
+		l_timeout_modify(station->ft_ds_refresh,
+					FT_DS_REFRESH_INTERVAL);
+	else
+		station->ft_ds_refresh = l_timeout_create(
+					FT_DS_REFRESH_INTERVAL,
+					station_ft_ds_refresh_timeout,
+					station, NULL);
 }
 
 static void station_roamed(struct station *station)
 {
 	station->roam_scan_full = false;
+	station->predictive_roam = false;
+	station->predict_last_sample = 0;
+	station->predict_last_emit = 0;
+
+	network_add_known_frequency(station->connected_network,
+					station->connected_bss->frequency,
+					KNOWN_FREQUENCY_HIT_ROAM, true);
 
 	/*
 	 * Schedule another roaming attempt in case the signal continues to
@@ -1904,10 +2389,15 @@ static void station_roamed(struct station *station)
 	if (station->signal_low)
 		station_roam_timeout_rearm(station, roam_retry_interval);
 
-	if (station->netconfig)
+	if (station->netconfig) {
 		netconfig_reconfigure(station->netconfig,
 					!supports_arp_evict_nocarrier);
 
+		/* Remember the new AP as part of the lease's ESS */
+		network_save_dhcp_lease(station->connected_network,
+						station->netconfig);
+	}
+
 	if (station->roam_freqs) {
 		scan_freq_set_free(station->roam_freqs);
 		station->roam_freqs = NULL;
@@ -1919,7 +2409,7 @@ static void station_roamed(struct station *station)
 			l_warn("Could not request neighbor report");
 	}
 
-	station_ft_ds_action_start(station);
+	station_ft_prepare(station);
 
 	station_enter_state(station, STATION_STATE_CONNECTED);
 }
@@ -1934,6 +2424,7 @@ static void station_roam_retry(struct station *station)
 	station->preparing_roam = false;
 	station->roam_scan_full = false;
 	station->ap_directed_roaming = false;
+	station->predictive_roam = false;
 
 	if (station->signal_low)
 		station_roam_timeout_rearm(station, roam_retry_interval);
@@ -1989,6 +2480,12 @@ static void station_netconfig_event_handler(enum netconfig_event event,
 	case NETCONFIG_EVENT_CONNECTED:
 		station_enter_state(station, STATION_STATE_CONNECTED);
 
+		break;
+	case NETCONFIG_EVENT_LEASE_UPDATED:
+		if (station->connected_network)
+			network_save_dhcp_lease(station->connected_network,
+							station->netconfig);
+
 		break;
 	default:
 		l_error("station: Unsupported netconfig event: %d.", event);
@@ -2010,8 +2507,10 @@ static void station_reassociate_cb(struct netdev *netdev,
 
 	if (result == NETDEV_RESULT_OK)
 		station_roamed(station);
-	else
+	else {
+		station_okc_result(station, false);
 		station_roam_failed(station);
+	}
 }
 
 static void station_fast_transition_cb(struct netdev *netdev,
@@ -2096,6 +2595,7 @@ static void station_preauthenticate_cb(struct netdev *netdev,
 		struct ie_rsn_info rsn_info;
 
 		handshake_state_set_pmk(new_hs, pmk, 32);
+		station->okc_attempted = false;
 		handshake_state_set_authenticator_address(new_hs,
 					station->preauth_bssid);
 		handshake_state_set_supplicant_address(new_hs,
@@ -2343,6 +2843,16 @@ next:
 		goto fail_free_bss;
 	}
 
+	/*
+	 * The current link is still above the roam threshold, only move if
+	 * the candidate is expected to be noticeably faster.
+	 */
+	if (station->predictive_roam && best_bss->data_rate * 100 <=
+			station->link_rate * (100 + ROAM_PREDICT_MARGIN)) {
+		station_debug_event(station, "predictive-roam-skipped");
+		goto fail_free_bss;
+	}
+
 	bss = network_bss_find_by_addr(network, best_bss->addr);
 	if (bss) {
 		scan_bss_free(best_bss);
@@ -2417,6 +2927,45 @@ static int station_roam_scan_known_freqs(struct station *station)
 	return r;
 }
 
+static int station_roam_scan_bg_candidates(struct station *station)
+{
+	const struct l_queue_entry *entry;
+	struct scan_freq_set *freqs;
+	unsigned int count = 0;
+	int r;
+
+	if (!station->bg_scan_pass_done ||
+			l_time_after(l_time_now(),
+				l_time_offset(station->bg_scan_pass_done,
+					BG_SCAN_FRESH_TIME * L_USEC_PER_SEC)))
+		return -ENODATA;
+
+	freqs = scan_freq_set_new();
+
+	/* The BSS list is sorted by rank */
+	for (entry = network_bss_list_get_entries(station->connected_network);
+			entry && count < BG_SCAN_CONFIRM_CANDIDATES;
+			entry = entry->next) {
+		struct scan_bss *bss = entry->data;
+
+		if (bss == station->connected_bss ||
+				blacklist_contains_bss(bss->addr))
+			continue;
+
+		scan_freq_set_add(freqs, bss->frequency);
+		count++;
+	}
+
+	if (!count) {
+		scan_freq_set_free(freqs);
+		return -ENODATA;
+	}
+
+	r = station_roam_scan(station, freqs);
+	scan_freq_set_free(freqs);
+	return r;
+}
+
 static void station_neighbor_report_cb(struct netdev *netdev, int err,
 					const uint8_t *reports,
 					size_t reports_len, void *user_data)
@@ -2482,7 +3031,15 @@ static void station_roam_trigger_cb(struct l_timeout *timeout, void *user_data)
 	 * full scan.  10.11.10.1: "A neighbor report may not be exhaustive
 	 * either by choice, or due to the fact that there may be neighbor
 	 * APs not known to the AP."
+	 *
+	 * Background scanning, when enabled, already provides a fresh list
+	 * of candidates so only their channels need to be confirmed.
 	 */
+	if (station_roam_scan_bg_candidates(station) == 0) {
+		l_debug("Confirming background scan candidates for roam");
+		return;
+	}
+
 	if (station->roam_freqs) {
 		if (station_roam_scan(station, station->roam_freqs) == 0) {
 			l_debug("Using cached neighbor report for roam");
@@ -2643,6 +3200,11 @@ static void station_low_rssi(struct station *station)
 		return;
 
 	station->signal_low = true;
+	station->predictive_roam = false;
+
+	/* A predictive roam is already scanning */
+	if (station->preparing_roam)
+		return;
 
 	if (station_cannot_roam(station))
 		return;
@@ -2660,6 +3222,322 @@ static void station_ok_rssi(struct station *station)
 	station->roam_min_time.tv_sec = 0;
 }
 
+/*
+ * The predictor is updated on every link sample, signal its properties at
+ * most once per ROAM_PREDICT_EMIT_INTERVAL to keep D-Bus traffic down.
+ */
+static void station_predict_emit(struct station *station, uint64_t now)
+{
+	const char *path = netdev_get_path(station->netdev);
+
+	if (!iwd_is_developer_mode())
+		return;
+
+	if (station->predict_last_emit &&
+			l_time_diff(station->predict_last_emit, now) <
+			ROAM_PREDICT_EMIT_INTERVAL * L_USEC_PER_SEC)
+		return;
+
+	station->predict_last_emit = now;
+
+	l_dbus_property_changed(dbus_get_bus(), path,
+				IWD_STATION_DEBUG_INTERFACE, "AverageRSSI");
+	l_dbus_property_changed(dbus_get_bus(), path,
+				IWD_STATION_DEBUG_INTERFACE, "RSSITrend");
+	l_dbus_property_changed(dbus_get_bus(), path,
+				IWD_STATION_DEBUG_INTERFACE, "EstimatedRate");
+}
+
+static void station_predict_sample(struct netdev *netdev,
+				const struct diagnostic_station_info *info,
+				void *user_data)
+{
+	struct station *station = user_data;
+	uint64_t now = l_time_now();
+	int32_t threshold;
+	int32_t rssi;
+	int64_t dt;
+	int64_t predicted;
+
+	if (!info || station->state != STATION_STATE_CONNECTED)
+		return;
+
+	if (info->have_cur_rssi)
+		rssi = info->cur_rssi * 100;
+	else if (info->have_avg_rssi)
+		rssi = info->avg_rssi * 100;
+	else
+		return;
+
+	/*
+	 * The tx bitrate is a PHY rate, the same measure that
+	 * band_estimate_*_rate() produces for the roam candidates.
+	 */
+	if (info->have_tx_bitrate)
+		station->link_rate = (uint64_t) info->tx_bitrate * 100000;
+	else
+		station->link_rate = station->connected_bss->data_rate;
+
+	if (!station->predict_last_sample) {
+		station->rssi_ewma = rssi;
+		station->rssi_slope = 0;
+		station->predict_last_sample = now;
+		station_predict_emit(station, now);
+		return;
+	}
+
+	/* Elapsed time in ms */
+	dt = l_time_diff(station->predict_last_sample, now) / 1000;
+	if (dt <= 0)
+		return;
+
+	station->predict_last_sample = now;
+
+	/* Exponentially weighted averages, alpha = 1/4 */
+	station->rssi_slope += ((int64_t) (rssi - station->rssi_ewma) *
+					1000 / dt - station->rssi_slope) / 4;
+	station->rssi_ewma += (rssi - station->rssi_ewma) / 4;
+
+	station_predict_emit(station, now);
+
+	if (!predictive_roaming || station->signal_low ||
+			station->preparing_roam ||
+			station->roam_trigger_timeout ||
+			station->rssi_slope >= 0)
+		return;
+
+	if (station->predict_holdoff &&
+			l_time_before(now, station->predict_holdoff))
+		return;
+
+	threshold = netdev_get_low_signal_threshold(
+				station->connected_bss->frequency) * 100;
+	predicted = station->rssi_ewma +
+			(int64_t) station->rssi_slope * ROAM_PREDICT_HORIZON;
+
+	if (predicted >= threshold)
+		return;
+
+	l_debug("RSSI %d trending %d (1/100 dBm/s), starting predictive roam",
+			station->rssi_ewma, station->rssi_slope);
+
+	station->predictive_roam = true;
+	station->predict_holdoff = l_time_offset(now,
+					roam_retry_interval * L_USEC_PER_SEC);
+	station_debug_event(station, "predictive-roam");
+	station_roam_timeout_rearm(station, 1);
+}
+
+static void station_predict_start(struct station *station)
+{
+	if (station->predict_watch || station_cannot_roam(station))
+		return;
+
+	/*
+	 * The debug interface exposes the predictor state, so sample the
+	 * link in developer mode even if predictive roaming is disabled.
+	 */
+	if (!predictive_roaming && !iwd_is_developer_mode())
+		return;
+
+	station->predict_watch = netdev_link_watch_add(station->netdev,
+						station_predict_sample,
+						station);
+}
+
+static uint32_t station_bg_scan_time(struct station *station)
+{
+	uint64_t now = l_time_now();
+	uint32_t total = 0;
+	unsigned int i;
+
+	for (i = 0; i < BG_SCAN_LOG_SIZE; i++) {
+		uint64_t end = station->bg_scan_log[i].end;
+
+		if (end && l_time_diff(end, now) < 60 * L_USEC_PER_SEC)
+			total += station->bg_scan_log[i].ms;
+	}
+
+	return total;
+}
+
+struct bg_scan_group {
+	struct scan_freq_set *freqs;
+	unsigned int offset;
+	unsigned int seen;
+};
+
+static void bg_scan_group_add(uint32_t freq, void *user_data)
+{
+	struct bg_scan_group *group = user_data;
+	unsigned int idx = group->seen++;
+
+	if (idx >= group->offset && idx < group->offset + BG_SCAN_GROUP_SIZE)
+		scan_freq_set_add(group->freqs, freq);
+}
+
+/*
+ * Returns the next few channels of the current subset and advances the
+ * position, wrapping around to the first subset after the last one.
+ */
+static struct scan_freq_set *station_bg_scan_next_group(
+						struct station *station)
+{
+	struct bg_scan_group group;
+	unsigned int i;
+
+	group.freqs = scan_freq_set_new();
+
+	for (i = 0; i <= L_ARRAY_SIZE(station->scan_freqs_order); i++) {
+		unsigned int idx = station->bg_scan_subset_idx;
+
+		group.offset = station->bg_scan_offset;
+		group.seen = 0;
+		scan_freq_set_foreach(station->scan_freqs_order[idx],
+					bg_scan_group_add, &group);
+
+		station->bg_scan_offset += BG_SCAN_GROUP_SIZE;
+
+		if (station->bg_scan_offset >= group.seen) {
+			station->bg_scan_offset = 0;
+			idx++;
+
+			if (idx >= L_ARRAY_SIZE(station->scan_freqs_order) ||
+					!station->scan_freqs_order[idx])
+				idx = 0;
+
+			station->bg_scan_subset_idx = idx;
+		}
+
+		if (!scan_freq_set_isempty(group.freqs))
+			return group.freqs;
+	}
+
+	scan_freq_set_free(group.freqs);
+	return NULL;
+}
+
+static void station_bg_scan_rearm(struct station *station, uint32_t ms)
+{
+	uint64_t interval = BG_SCAN_MIN_INTERVAL;
+
+	/* Stay idle long enough for the scan to fit in the duty cycle */
+	if (ms)
+		interval = L_MAX(interval, (uint64_t) ms *
+				(100 - bg_scan_duty_cycle) /
+				bg_scan_duty_cycle);
+
+	l_timeout_modify_ms(station->bg_scan_timeout, interval);
+}
+
+static void station_bg_scan_triggered(int err, void *user_data)
+{
+	struct station *station = user_data;
+
+	if (err < 0) {
+		l_debug("Background scan trigger failed: %s", strerror(-err));
+		return;
+	}
+
+	station->bg_scan_start = l_time_now();
+}
+
+static bool station_bg_scan_notify(int err, struct l_queue *bss_list,
+					const struct scan_freq_set *freqs,
+					void *userdata)
+{
+	struct station *station = userdata;
+	uint64_t now = l_time_now();
+	uint32_t ms = 0;
+
+	if (station->bg_scan_start) {
+		ms = l_time_diff(station->bg_scan_start, now) / L_USEC_PER_MSEC;
+
+		station->bg_scan_log[station->bg_scan_log_idx].end = now;
+		station->bg_scan_log[station->bg_scan_log_idx].ms = ms;
+		station->bg_scan_log_idx = (station->bg_scan_log_idx + 1) %
+							BG_SCAN_LOG_SIZE;
+		station->bg_scan_start = 0;
+	}
+
+	if (err || station->state != STATION_STATE_CONNECTED)
+		return false;
+
+	station_set_scan_results(station, bss_list, freqs, false);
+
+	/* The position wraps once the final group of a pass is scanned */
+	if (!station->bg_scan_subset_idx && !station->bg_scan_offset) {
+		station->bg_scan_pass_done = now;
+		station_ft_prepare(station);
+	}
+
+	l_debug("Background scan took %ums, %ums off-channel in the last "
+			"minute", ms, station_bg_scan_time(station));
+
+	return true;
+}
+
+static void station_bg_scan_destroy(void *userdata)
+{
+	struct station *station = userdata;
+
+	station->bg_scan_id = 0;
+	station->bg_scan_start = 0;
+
+	/* Rearm based on the last logged scan, or retry after a failure */
+	if (station->bg_scan_timeout) {
+		unsigned int last = station->bg_scan_log_idx ?
+			station->bg_scan_log_idx - 1 : BG_SCAN_LOG_SIZE - 1;
+
+		station_bg_scan_rearm(station,
+					station->bg_scan_log[last].ms);
+	}
+}
+
+static void station_bg_scan_timeout(struct l_timeout *timeout,
+							void *user_data)
+{
+	struct station *station = user_data;
+	struct scan_parameters params = {
+		.flush = true,
+		.duration = BG_SCAN_DWELL,
+		.low_priority = true,
+	};
+
+	/* Don't compete with roaming or user requested scans */
+	if (station->state != STATION_STATE_CONNECTED ||
+			station->preparing_roam || station->dbus_scan_id) {
+		station_bg_scan_rearm(station, 0);
+		return;
+	}
+
+	params.freqs = station_bg_scan_next_group(station);
+	if (!params.freqs) {
+		station_bg_scan_rearm(station, 0);
+		return;
+	}
+
+	station->bg_scan_id = scan_active_full(
+					netdev_get_wdev_id(station->netdev),
+					&params, station_bg_scan_triggered,
+					station_bg_scan_notify, station,
+					station_bg_scan_destroy);
+	scan_freq_set_free(params.freqs);
+
+	if (!station->bg_scan_id)
+		station_bg_scan_rearm(station, 0);
+}
+
+static void station_bg_scan_start(struct station *station)
+{
+	if (!bg_scan_duty_cycle || station->bg_scan_timeout)
+		return;
+
+	station->bg_scan_timeout = l_timeout_create_ms(BG_SCAN_MIN_INTERVAL,
+						station_bg_scan_timeout,
+						station, NULL);
+}
+
 static void station_event_roamed(struct station *station, struct scan_bss *new)
 {
 	struct scan_bss *stale;
@@ -2783,7 +3661,7 @@ static void station_connect_ok(struct station *station)
 			l_warn("Could not request neighbor report");
 	}
 
-	station_ft_ds_action_start(station);
+	station_ft_prepare(station);
 
 	network_connected(station->connected_network);
 
@@ -2828,6 +3706,25 @@ static void station_connect_ok(struct station *station)
 		station_enter_state(station, STATION_STATE_CONNECTED);
 }
 
+/*
+ * The AP may refuse the PMKID we offered, either outright or by failing the
+ * handshake.  The PMKSA has been dropped at this point so retry the same BSS
+ * once with full authentication before treating it as a real failure.
+ */
+static bool station_pmksa_fallback(struct station *station)
+{
+	if (!station->pmksa_attempted)
+		return false;
+
+	station_okc_result(station, false);
+
+	l_debug("PMKSA rejected by "MAC", retrying full authentication",
+			MAC_STR(station->connected_bss->addr));
+
+	return __station_connect_network(station, station->connected_network,
+						station->connected_bss) == 0;
+}
+
 static void station_connect_cb(struct netdev *netdev, enum netdev_result result,
 					void *event_data, void *user_data)
 {
@@ -2842,6 +3739,9 @@ static void station_connect_cb(struct netdev *netdev, enum netdev_result result,
 		station_connect_ok(station);
 		return;
 	case NETDEV_RESULT_HANDSHAKE_FAILED:
+		if (station_pmksa_fallback(station))
+			return;
+
 		/* reason code in this case */
 		if (station_retry_with_reason(station, l_get_u16(event_data)))
 			return;
@@ -2849,6 +3749,9 @@ static void station_connect_cb(struct netdev *netdev, enum netdev_result result,
 		break;
 	case NETDEV_RESULT_AUTHENTICATION_FAILED:
 	case NETDEV_RESULT_ASSOCIATION_FAILED:
+		if (station_pmksa_fallback(station))
+			return;
+
 		/* status code in this case */
 		if (station_retry_with_status(station, l_get_u16(event_data)))
 			return;
@@ -2964,6 +3867,7 @@ int __station_connect_network(struct station *station, struct network *network,
 				struct scan_bss *bss)
 {
 	struct handshake_state *hs;
+	bool pmksa;
 	int r;
 
 	if (station->netconfig && !netconfig_load_settings(
@@ -2975,6 +3879,8 @@ int __station_connect_network(struct station *station, struct network *network,
 	if (!hs)
 		return -ENOTSUP;
 
+	pmksa = hs->pmksa != NULL;
+
 	r = netdev_connect(station->netdev, bss, hs, NULL, 0,
 				station_netdev_event,
 				station_connect_cb, station);
@@ -2987,6 +3893,7 @@ int __station_connect_network(struct station *station, struct network *network,
 
 	station->connected_bss = bss;
 	station->connected_network = network;
+	station->pmksa_attempted = pmksa;
 
 	return 0;
 }
@@ -3237,6 +4144,10 @@ static struct l_dbus_message *station_dbus_connect_hidden_network(
 			l_queue_get_entries(station->hidden_bss_list_sorted);
 		struct scan_bss *target = network_bss_select(network, true);
 
+		/* Stale network kept after dropping out of the scan results */
+		if (!target)
+			return dbus_error_not_available(message);
+
 		/* Treat OWE transition networks special */
 		if (target->owe_trans)
 			goto not_hidden;
@@ -3421,6 +4332,36 @@ static struct l_dbus_message *station_dbus_get_networks(struct l_dbus *dbus,
 	return reply;
 }
 
+static struct l_dbus_message *station_dbus_get_network_changes(
+						struct l_dbus *dbus,
+						struct l_dbus_message *message,
+						void *user_data)
+{
+	struct station *station = user_data;
+	struct l_dbus_message *reply;
+	struct l_dbus_message_builder *builder;
+	uint64_t generation = netorder_get_generation(station->ordered);
+	uint64_t since;
+	bool full;
+
+	if (!l_dbus_message_get_arguments(message, "t", &since))
+		return dbus_error_invalid_args(message);
+
+	full = netorder_is_full(station->ordered, since);
+
+	reply = l_dbus_message_new_method_return(message);
+	builder = l_dbus_message_builder_new(reply);
+
+	l_dbus_message_builder_append_basic(builder, 't', &generation);
+	l_dbus_message_builder_append_basic(builder, 'b', &full);
+	station_append_ordered_changes(station, builder, since, full);
+
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	return reply;
+}
+
 static struct l_dbus_message *station_dbus_get_hidden_access_points(
 						struct l_dbus *dbus,
 						struct l_dbus_message *message,
@@ -3870,6 +4811,7 @@ int station_hide_network(struct station *station, struct network *network)
 
 	l_queue_remove(station->networks_sorted, network);
 	l_hashmap_remove(station->networks, path);
+	station_ordered_networks_update(station);
 
 	while ((bss = network_bss_list_pop(network))) {
 		memset(bss->ssid, 0, bss->ssid_len);
@@ -3935,6 +4877,8 @@ static struct station *station_create(struct netdev *netdev)
 	l_hashmap_set_compare_function(station->networks,
 				(l_hashmap_compare_func_t) strcmp);
 	station->networks_sorted = l_queue_new();
+	station->ordered = netorder_new(ORDERED_NETWORKS_REMOVED_MAX,
+					ORDERED_NETWORKS_SIGNAL_DELTA);
 
 	station->wiphy = netdev_get_wiphy(netdev);
 	station->netdev = netdev;
@@ -4032,7 +4976,10 @@ static void station_free(struct station *station)
 
 	station_roam_state_clear(station);
 
+	l_timeout_remove(station->stale_timeout);
+
 	l_queue_destroy(station->networks_sorted, NULL);
+	netorder_free(station->ordered);
 	l_hashmap_destroy(station->networks, network_free);
 	l_queue_destroy(station->bss_list, bss_free);
 	l_queue_destroy(station->hidden_bss_list_sorted, NULL);
@@ -4061,10 +5008,17 @@ static void station_setup_interface(struct l_dbus_interface *interface)
 	l_dbus_interface_method(interface, "GetOrderedNetworks", 0,
 				station_dbus_get_networks, "a(on)", "",
 				"networks");
+	l_dbus_interface_method(interface, "GetOrderedNetworkChanges", 0,
+				station_dbus_get_network_changes,
+				"tba(ono)ao", "t", "generation", "full",
+				"changed", "removed", "since");
 	l_dbus_interface_method(interface, "GetHiddenAccessPoints", 0,
 				station_dbus_get_hidden_access_points,
 				"a(sns)", "",
 				"accesspoints");
+	l_dbus_interface_signal(interface, "OrderedNetworksChanged", 0,
+				"ta(ono)ao", "generation", "changed",
+				"removed");
 	l_dbus_interface_method(interface, "Scan", 0,
 				station_dbus_scan, "", "");
 	l_dbus_interface_method(interface, "RegisterSignalLevelAgent", 0,
@@ -4118,6 +5072,12 @@ static void station_get_diagnostic_cb(
 				diagnostic_akm_suite_to_security(hs->akm_suite,
 								hs->wpa_ie));
 
+	if (bg_scan_duty_cycle) {
+		uint32_t ms = station_bg_scan_time(station);
+
+		dbus_append_dict_basic(builder, "OffChannelTime", 'u', &ms);
+	}
+
 	diagnostic_info_to_dict(info, builder);
 
 	l_dbus_message_builder_leave_array(builder);
@@ -4144,11 +5104,19 @@ static struct l_dbus_message *station_get_diagnostics(struct l_dbus *dbus,
 						void *user_data)
 {
 	struct station *station = user_data;
+	const struct diagnostic_station_info *info;
 	int ret;
 
 	if (station->get_station_pending)
 		return dbus_error_busy(message);
 
+	info = netdev_get_link_info(station->netdev, DIAGNOSTICS_MAX_AGE);
+	if (info) {
+		station->get_station_pending = l_dbus_message_ref(message);
+		station_get_diagnostic_cb(info, station);
+		return NULL;
+	}
+
 	ret = netdev_get_current_station(station->netdev,
 				station_get_diagnostic_cb, station,
 				station_get_diagnostic_destroy);
@@ -4406,6 +5374,103 @@ static struct l_dbus_message *station_property_set_autoconnect(
 	return l_dbus_message_new_method_return(message);
 }
 
+static bool station_property_get_okc_hits(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct station *station = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'u', &station->okc_hits);
+
+	return true;
+}
+
+static bool station_property_get_okc_misses(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct station *station = user_data;
+
+	l_dbus_message_builder_append_basic(builder, 'u',
+						&station->okc_misses);
+
+	return true;
+}
+
+static bool station_property_get_anqp_cache_hits(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	uint32_t hits;
+
+	anqp_get_cache_stats(&hits, NULL);
+	l_dbus_message_builder_append_basic(builder, 'u', &hits);
+
+	return true;
+}
+
+static bool station_property_get_anqp_cache_misses(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	uint32_t misses;
+
+	anqp_get_cache_stats(NULL, &misses);
+	l_dbus_message_builder_append_basic(builder, 'u', &misses);
+
+	return true;
+}
+
+static bool station_property_get_rssi_average(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct station *station = user_data;
+
+	if (!station->predict_last_sample)
+		return false;
+
+	l_dbus_message_builder_append_basic(builder, 'i', &station->rssi_ewma);
+
+	return true;
+}
+
+static bool station_property_get_rssi_trend(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct station *station = user_data;
+
+	if (!station->predict_last_sample)
+		return false;
+
+	l_dbus_message_builder_append_basic(builder, 'i', &station->rssi_slope);
+
+	return true;
+}
+
+static bool station_property_get_estimated_rate(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					struct l_dbus_message_builder *builder,
+					void *user_data)
+{
+	struct station *station = user_data;
+	uint32_t kbps = station->link_rate / 1000;
+
+	if (!station->predict_last_sample)
+		return false;
+
+	l_dbus_message_builder_append_basic(builder, 'u', &kbps);
+
+	return true;
+}
+
 static void station_setup_debug_interface(
 					struct l_dbus_interface *interface)
 {
@@ -4424,6 +5489,24 @@ static void station_setup_debug_interface(
 	l_dbus_interface_property(interface, "AutoConnect", 0, "b",
 					station_property_get_autoconnect,
 					station_property_set_autoconnect);
+	l_dbus_interface_property(interface, "OKCHits", 0, "u",
+					station_property_get_okc_hits, NULL);
+	l_dbus_interface_property(interface, "OKCMisses", 0, "u",
+					station_property_get_okc_misses, NULL);
+	l_dbus_interface_property(interface, "ANQPCacheHits", 0, "u",
+					station_property_get_anqp_cache_hits,
+					NULL);
+	l_dbus_interface_property(interface, "ANQPCacheMisses", 0, "u",
+					station_property_get_anqp_cache_misses,
+					NULL);
+	l_dbus_interface_property(interface, "AverageRSSI", 0, "i",
+					station_property_get_rssi_average,
+					NULL);
+	l_dbus_interface_property(interface, "RSSITrend", 0, "i",
+					station_property_get_rssi_trend, NULL);
+	l_dbus_interface_property(interface, "EstimatedRate", 0, "u",
+					station_property_get_estimated_rate,
+					NULL);
 }
 
 static void ap_roam_frame_event(const struct mmpdu_header *hdr,
@@ -4523,6 +5606,32 @@ static int station_init(void)
 	if (roam_retry_interval > INT_MAX)
 		roam_retry_interval = INT_MAX;
 
+	if (!l_settings_get_bool(iwd_get_config(), "General",
+					"PredictiveRoaming",
+					&predictive_roaming))
+		predictive_roaming = false;
+
+	if (!l_settings_get_uint(iwd_get_config(), "Scan",
+					"BackgroundScanDutyCycle",
+					&bg_scan_duty_cycle))
+		bg_scan_duty_cycle = 0;
+
+	if (bg_scan_duty_cycle > 50) {
+		l_warn("Invalid [Scan].BackgroundScanDutyCycle value: %u,"
+				" using 50", bg_scan_duty_cycle);
+		bg_scan_duty_cycle = 50;
+	}
+
+	if (!l_settings_get_uint(iwd_get_config(), "Scan",
+					"StaleNetworkScans",
+					&stale_network_scans))
+		stale_network_scans = 3;
+
+	if (!l_settings_get_uint(iwd_get_config(), "Scan",
+					"StaleNetworkTimeout",
+					&stale_network_timeout))
+		stale_network_timeout = 120;
+
 	if (!l_settings_get_bool(iwd_get_config(), "General", "DisableANQP",
 				&anqp_disabled))
 		anqp_disabled = true;
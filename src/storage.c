@@ -49,6 +49,9 @@
 #define STORAGE_FILE_MODE (S_IRUSR | S_IWUSR)
 
 #define KNOWN_FREQ_FILENAME ".known_network.freq"
+#define ERP_CACHE_FILENAME ".erp_cache"
+#define ANQP_CACHE_FILENAME ".anqp_cache"
+#define ERP_CACHE_CREDENTIAL "iwd-erp-cache"
 
 static char *storage_path = NULL;
 static char *storage_hotspot_path = NULL;
@@ -448,6 +451,84 @@ void storage_known_frequencies_sync(struct l_settings *known_freqs)
 	l_free(known_freq_file_path);
 }
 
+struct l_settings *storage_anqp_cache_load(void)
+{
+	struct l_settings *settings = l_settings_new();
+	char *path = storage_get_path("/%s", ANQP_CACHE_FILENAME);
+
+	if (!l_settings_load_from_file(settings, path)) {
+		l_settings_free(settings);
+		settings = NULL;
+	}
+
+	l_free(path);
+
+	return settings;
+}
+
+void storage_anqp_cache_sync(struct l_settings *settings)
+{
+	char *path = storage_get_path("/%s", ANQP_CACHE_FILENAME);
+	char *data;
+	size_t len;
+
+	if (!settings) {
+		unlink(path);
+		l_free(path);
+		return;
+	}
+
+	data = l_settings_to_data(settings, &len);
+	write_file(data, len, false, "%s", path);
+	l_free(data);
+
+	l_free(path);
+}
+
+void *storage_erp_cache_load(size_t *out_len)
+{
+	char *path = storage_get_path("/%s", ERP_CACHE_FILENAME);
+	void *data;
+
+	data = l_file_get_contents(path, out_len);
+	l_free(path);
+
+	return data;
+}
+
+void storage_erp_cache_sync(const void *data, size_t len)
+{
+	char *path = storage_get_path("/%s", ERP_CACHE_FILENAME);
+
+	if (data && len)
+		write_file(data, len, false, "%s", path);
+	else
+		unlink(path);
+
+	l_free(path);
+}
+
+/*
+ * The ERP cache is encrypted if a secret has been passed in as a systemd
+ * credential (LoadCredential=iwd-erp-cache:...).  Returns the secret, the
+ * key itself is derived by the caller.
+ */
+void *storage_erp_cache_secret(size_t *out_len)
+{
+	const char *dir = getenv("CREDENTIALS_DIRECTORY");
+	char *path;
+	void *secret;
+
+	if (!dir)
+		return NULL;
+
+	path = l_strdup_printf("%s/%s", dir, ERP_CACHE_CREDENTIAL);
+	secret = l_file_get_contents(path, out_len);
+	l_free(path);
+
+	return secret;
+}
+
 bool storage_is_file(const char *filename)
 {
 	char *path;
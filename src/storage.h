@@ -50,3 +50,10 @@ int storage_network_remove(enum security type, const char *ssid);
 
 struct l_settings *storage_known_frequencies_load(void);
 void storage_known_frequencies_sync(struct l_settings *known_freqs);
+
+struct l_settings *storage_anqp_cache_load(void);
+void storage_anqp_cache_sync(struct l_settings *settings);
+
+void *storage_erp_cache_load(size_t *out_len);
+void storage_erp_cache_sync(const void *data, size_t len);
+void *storage_erp_cache_secret(size_t *out_len);
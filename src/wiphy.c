@@ -100,6 +100,7 @@ struct wiphy {
 	uint8_t ext_features[(NUM_NL80211_EXT_FEATURES + 7) / 8];
 	uint8_t max_num_ssids_per_scan;
 	uint32_t max_roc_duration;
+	uint32_t probe_resp_offload;
 	uint16_t max_scan_ie_len;
 	uint16_t supported_iftypes;
 	uint16_t supported_ciphers;
@@ -523,6 +524,12 @@ uint32_t wiphy_get_max_roc_duration(struct wiphy *wiphy)
 	return wiphy->max_roc_duration;
 }
 
+/* Returns the NL80211_PROBE_RESP_OFFLOAD_SUPPORT_* flags or 0 */
+uint32_t wiphy_get_probe_resp_offload(struct wiphy *wiphy)
+{
+	return wiphy->probe_resp_offload;
+}
+
 bool wiphy_supports_adhoc_rsn(struct wiphy *wiphy)
 {
 	return wiphy->support_adhoc_rsn;
@@ -1378,6 +1385,13 @@ static void wiphy_parse_attributes(struct wiphy *wiphy,
 			else
 				wiphy->max_scan_ie_len = *((uint16_t *) data);
 			break;
+		case NL80211_ATTR_PROBE_RESP_OFFLOAD:
+			if (len != sizeof(uint32_t))
+				l_warn("Invalid PROBE_RESP_OFFLOAD attribute");
+			else
+				wiphy->probe_resp_offload =
+							*((uint32_t *) data);
+			break;
 		case NL80211_ATTR_SUPPORT_IBSS_RSN:
 			wiphy->support_adhoc_rsn = true;
 			break;
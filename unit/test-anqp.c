@@ -0,0 +1,476 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <ell/ell.h>
+
+#include "src/ie.h"
+#include "src/mpdu.h"
+#include "src/scan.h"
+#include "src/frame-xchg.h"
+#include "src/storage.h"
+#include "src/anqp.h"
+
+#define CACHE_LIFETIME	3600
+#define CACHE_SIZE	64
+
+static const uint8_t own_addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t anqp_query[] = { 0x00, 0x01, 0x04, 0x00, 0x07, 0x01 };
+static const uint8_t anqp_response[] = { 0x07, 0x01, 0x02, 0x00, 0xaa, 0xbb };
+
+static uint64_t test_now = 1000000;
+
+/* Frame exchanges started by anqp, completed or cancelled by the tests */
+struct test_xchg {
+	uint32_t id;
+	uint8_t token;
+	frame_xchg_cb_t cb;
+	void *user_data;
+	frame_xchg_destroy_func_t destroy;
+	frame_xchg_resp_cb_t resp_cb;
+};
+
+static struct test_xchg xchgs[4];
+static uint32_t next_xchg_id;
+static unsigned int xchgs_started;
+static bool xchg_fail_early;
+
+uint32_t frame_xchg_start(uint64_t wdev_id, struct iovec *frame, uint32_t freq,
+			unsigned int retry_interval, unsigned int resp_timeout,
+			unsigned int retries_on_ack, uint32_t group_id,
+			frame_xchg_cb_t cb, void *user_data,
+			frame_xchg_destroy_func_t destroy, ...)
+{
+	const uint8_t *mpdu = frame[0].iov_base;
+	struct test_xchg *xchg = NULL;
+	unsigned int i;
+	va_list args;
+
+	for (i = 0; i < L_ARRAY_SIZE(xchgs); i++)
+		if (!xchgs[i].id) {
+			xchg = &xchgs[i];
+			break;
+		}
+
+	assert(xchg);
+
+	/* Category, action and dialog token follow the 24 byte header */
+	assert(frame[0].iov_len > 26);
+	assert(mpdu[24] == 0x04 && mpdu[25] == 0x0a);
+
+	xchg->id = ++next_xchg_id;
+	xchg->token = mpdu[26];
+	xchg->cb = cb;
+	xchg->user_data = user_data;
+	xchg->destroy = destroy;
+
+	va_start(args, destroy);
+	assert(va_arg(args, struct frame_xchg_prefix *));
+	xchg->resp_cb = va_arg(args, void *);
+	va_end(args);
+
+	xchgs_started++;
+
+	/*
+	 * The radio work can fail and be destroyed before frame_xchg_start
+	 * returns, in which case the id is still returned.
+	 */
+	if (xchg_fail_early) {
+		uint32_t id = xchg->id;
+
+		memset(xchg, 0, sizeof(*xchg));
+		cb(-EIO, user_data);
+		destroy(user_data);
+
+		return id;
+	}
+
+	return xchg->id;
+}
+
+static void xchg_done(struct test_xchg *xchg)
+{
+	frame_xchg_destroy_func_t destroy = xchg->destroy;
+	void *user_data = xchg->user_data;
+
+	memset(xchg, 0, sizeof(*xchg));
+
+	if (destroy)
+		destroy(user_data);
+}
+
+void frame_xchg_cancel(uint32_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(xchgs); i++)
+		if (xchgs[i].id == id)
+			xchg_done(&xchgs[i]);
+}
+
+struct l_settings *storage_anqp_cache_load(void)
+{
+	return NULL;
+}
+
+void storage_anqp_cache_sync(struct l_settings *settings)
+{
+}
+
+static uint64_t test_get_time(void)
+{
+	return test_now;
+}
+
+static unsigned int xchgs_pending(void)
+{
+	unsigned int i;
+	unsigned int n = 0;
+
+	for (i = 0; i < L_ARRAY_SIZE(xchgs); i++)
+		if (xchgs[i].id)
+			n++;
+
+	return n;
+}
+
+static struct test_xchg *xchg_first(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(xchgs); i++)
+		if (xchgs[i].id)
+			return &xchgs[i];
+
+	return NULL;
+}
+
+/* Answers an exchange with a GAS Initial Response carrying anqp_response */
+static void xchg_respond(struct test_xchg *xchg)
+{
+	struct mmpdu_header hdr;
+	uint8_t body[64];
+	uint8_t *ptr = body;
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	*ptr++ = 0x04;			/* Category: Public */
+	*ptr++ = 0x0b;			/* Action: GAS initial Response */
+	*ptr++ = xchg->token;
+	l_put_le16(0, ptr);		/* Status */
+	ptr += 2;
+	l_put_le16(0, ptr);		/* Comeback delay */
+	ptr += 2;
+	*ptr++ = IE_TYPE_ADVERTISEMENT_PROTOCOL;
+	*ptr++ = 2;
+	*ptr++ = 0x7f;
+	*ptr++ = IE_ADVERTISEMENT_ANQP;
+	l_put_le16(sizeof(anqp_response), ptr);
+	ptr += 2;
+	memcpy(ptr, anqp_response, sizeof(anqp_response));
+	ptr += sizeof(anqp_response);
+
+	assert(xchg->resp_cb(&hdr, body, ptr - body, 0, xchg->user_data));
+	xchg_done(xchg);
+}
+
+static void run_idle(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < 8; i++)
+		l_main_iterate(0);
+}
+
+struct test_request {
+	uint32_t id;
+	unsigned int calls;
+	enum anqp_result result;
+};
+
+static void test_response_cb(enum anqp_result result, const void *anqp,
+				size_t len, void *user_data)
+{
+	struct test_request *request = user_data;
+
+	request->calls++;
+	request->result = result;
+
+	if (result != ANQP_SUCCESS)
+		return;
+
+	assert(len == sizeof(anqp_response));
+	assert(!memcmp(anqp, anqp_response, len));
+}
+
+static void bss_init(struct scan_bss *bss, uint8_t addr_id, uint8_t hessid_id)
+{
+	memset(bss, 0, sizeof(*bss));
+
+	bss->addr[0] = 0x02;
+	bss->addr[5] = addr_id;
+	bss->frequency = 2412;
+
+	if (hessid_id) {
+		bss->hessid[0] = 0x02;
+		bss->hessid[5] = hessid_id;
+	}
+}
+
+static void request(struct scan_bss *bss, struct test_request *request)
+{
+	memset(request, 0, sizeof(*request));
+
+	request->id = anqp_request(1, own_addr, bss, anqp_query,
+					sizeof(anqp_query), test_response_cb,
+					request, NULL);
+	assert(request->id);
+}
+
+/* Fetches and caches the response for bss */
+static void cache_fill(struct scan_bss *bss)
+{
+	struct test_request req;
+
+	request(bss, &req);
+	run_idle();
+
+	assert(xchgs_pending() == 1);
+	xchg_respond(xchg_first());
+
+	assert(req.calls == 1);
+	assert(req.result == ANQP_SUCCESS);
+}
+
+/* Returns true if bss is answered from the cache */
+static bool cache_check(struct scan_bss *bss)
+{
+	struct test_request req;
+	unsigned int started = xchgs_started;
+
+	request(bss, &req);
+	run_idle();
+
+	if (xchgs_started == started) {
+		assert(req.calls == 1);
+		assert(req.result == ANQP_SUCCESS);
+		return true;
+	}
+
+	anqp_cancel(req.id);
+	assert(!xchgs_pending());
+
+	return false;
+}
+
+static void test_setup(void)
+{
+	__anqp_set_get_time_func(test_get_time);
+	assert(!anqp_init());
+}
+
+static void test_teardown(void)
+{
+	anqp_exit();
+	assert(!xchgs_pending());
+}
+
+static void test_shared_query(const void *data)
+{
+	struct scan_bss bss1;
+	struct scan_bss bss2;
+	struct scan_bss bss3;
+	struct test_request req1;
+	struct test_request req2;
+	struct test_request req3;
+	uint32_t hits;
+	uint32_t misses;
+	uint32_t old_hits;
+	uint32_t old_misses;
+
+	test_setup();
+	anqp_get_cache_stats(&old_hits, &old_misses);
+
+	/* Two BSSes of one ESS share a single exchange */
+	bss_init(&bss1, 1, 0x10);
+	bss_init(&bss2, 2, 0x10);
+	bss_init(&bss3, 3, 0);
+
+	request(&bss1, &req1);
+	request(&bss2, &req2);
+	request(&bss3, &req3);
+	assert(!xchgs_pending());
+
+	/* Requests complete from the main loop, never from anqp_request */
+	run_idle();
+	assert(xchgs_pending() == 2);
+	assert(!req1.calls && !req2.calls && !req3.calls);
+
+	anqp_get_cache_stats(&hits, &misses);
+	assert(hits - old_hits == 1);
+	assert(misses - old_misses == 2);
+
+	xchg_respond(xchg_first());
+	assert(req1.calls == 1 && req1.result == ANQP_SUCCESS);
+	assert(req2.calls == 1 && req2.result == ANQP_SUCCESS);
+	assert(!req3.calls);
+
+	/* Cancelling the last waiting request cancels the exchange */
+	anqp_cancel(req3.id);
+	assert(!xchgs_pending());
+	assert(!req3.calls);
+
+	test_teardown();
+}
+
+static void test_fail_early(const void *data)
+{
+	struct scan_bss bss1;
+	struct scan_bss bss2;
+	struct test_request req1;
+	struct test_request req2;
+
+	test_setup();
+
+	bss_init(&bss1, 1, 0);
+	bss_init(&bss2, 2, 0);
+
+	request(&bss1, &req1);
+	request(&bss2, &req2);
+
+	xchg_fail_early = true;
+	run_idle();
+	xchg_fail_early = false;
+
+	assert(req1.calls == 1 && req1.result == ANQP_FAILED);
+	assert(req2.calls == 1 && req2.result == ANQP_FAILED);
+	assert(!xchgs_pending());
+
+	/* Nothing is left counted as in flight */
+	cache_fill(&bss1);
+	cache_fill(&bss2);
+
+	test_teardown();
+}
+
+static void test_hessid_key(const void *data)
+{
+	struct scan_bss ess1;
+	struct scan_bss ess2;
+	struct scan_bss other_ess;
+	struct scan_bss bss;
+	struct scan_bss same_bss;
+	struct scan_bss hessid_is_bssid;
+
+	test_setup();
+
+	/* Responses cached by HESSID are used for every BSS of the ESS */
+	bss_init(&ess1, 1, 0x10);
+	bss_init(&ess2, 2, 0x10);
+	bss_init(&other_ess, 1, 0x11);
+
+	cache_fill(&ess1);
+	assert(cache_check(&ess2));
+	assert(!cache_check(&other_ess));
+
+	/* Without a HESSID only the same BSSID matches */
+	bss_init(&bss, 0x20, 0);
+	bss_init(&same_bss, 0x20, 0);
+	bss_init(&hessid_is_bssid, 0x21, 0x20);
+
+	cache_fill(&bss);
+	assert(cache_check(&same_bss));
+	assert(!cache_check(&hessid_is_bssid));
+
+	test_teardown();
+}
+
+static void test_expiry(const void *data)
+{
+	struct scan_bss bss;
+
+	test_setup();
+
+	bss_init(&bss, 1, 0);
+	cache_fill(&bss);
+
+	test_now += CACHE_LIFETIME - 1;
+	assert(cache_check(&bss));
+
+	test_now += 1;
+	assert(!cache_check(&bss));
+
+	test_teardown();
+}
+
+static void test_cache_size(const void *data)
+{
+	struct scan_bss bss;
+	unsigned int i;
+
+	test_setup();
+
+	/* The oldest response is evicted once the cache is full */
+	for (i = 0; i <= CACHE_SIZE; i++) {
+		bss_init(&bss, i + 1, 0);
+		cache_fill(&bss);
+	}
+
+	bss_init(&bss, CACHE_SIZE + 1, 0);
+	assert(cache_check(&bss));
+
+	bss_init(&bss, 2, 0);
+	assert(cache_check(&bss));
+
+	bss_init(&bss, 1, 0);
+	assert(!cache_check(&bss));
+
+	test_teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	int ret;
+
+	l_test_init(&argc, &argv);
+
+	l_test_add("/anqp/Shared query", test_shared_query, NULL);
+	l_test_add("/anqp/Early failure", test_fail_early, NULL);
+	l_test_add("/anqp/HESSID and BSSID keys", test_hessid_key, NULL);
+	l_test_add("/anqp/Expiry", test_expiry, NULL);
+	l_test_add("/anqp/Cache size", test_cache_size, NULL);
+
+	l_main_init();
+	ret = l_test_run();
+	l_main_exit();
+
+	return ret;
+}
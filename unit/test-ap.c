@@ -0,0 +1,396 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <sys/uio.h>
+#include <ell/ell.h>
+
+#include "src/ie.h"
+#include "src/mpdu.h"
+#include "src/aputil.h"
+
+static const uint8_t ap_bssid[6] = { 0x02, 0x00, 0x00, 0x00, 0x01, 0x00 };
+static const char *ap_ssid = "TestAP";
+static const uint8_t ap_channel = 6;
+
+struct probe_req_test {
+	bool directed;
+	const uint8_t *ies;
+	size_t ies_len;
+	bool match;
+};
+
+static const uint8_t wildcard_ies[] = {
+	IE_TYPE_SSID, 0,
+	IE_TYPE_DSSS_PARAMETER_SET, 1, 6,
+};
+
+static const uint8_t ssid_ies[] = {
+	IE_TYPE_SSID, 6, 'T', 'e', 's', 't', 'A', 'P',
+};
+
+static const uint8_t other_ssid_ies[] = {
+	IE_TYPE_SSID, 6, 'O', 't', 'h', 'e', 'r', 'X',
+};
+
+static const uint8_t ssid_list_ies[] = {
+	IE_TYPE_SSID, 6, 'O', 't', 'h', 'e', 'r', 'X',
+	IE_TYPE_SSID_LIST, 16,
+	IE_TYPE_SSID, 6, 'O', 't', 'h', 'e', 'r', 'Y',
+	IE_TYPE_SSID, 6, 'T', 'e', 's', 't', 'A', 'P',
+};
+
+static const uint8_t wrong_channel_ies[] = {
+	IE_TYPE_SSID, 0,
+	IE_TYPE_DSSS_PARAMETER_SET, 1, 11,
+};
+
+static const struct probe_req_test probe_req_wildcard = {
+	.ies = wildcard_ies,
+	.ies_len = sizeof(wildcard_ies),
+	.match = true,
+};
+
+static const struct probe_req_test probe_req_ssid = {
+	.directed = true,
+	.ies = ssid_ies,
+	.ies_len = sizeof(ssid_ies),
+	.match = true,
+};
+
+static const struct probe_req_test probe_req_other_ssid = {
+	.ies = other_ssid_ies,
+	.ies_len = sizeof(other_ssid_ies),
+	.match = false,
+};
+
+static const struct probe_req_test probe_req_ssid_list = {
+	.ies = ssid_list_ies,
+	.ies_len = sizeof(ssid_list_ies),
+	.match = true,
+};
+
+static const struct probe_req_test probe_req_wrong_channel = {
+	.ies = wrong_channel_ies,
+	.ies_len = sizeof(wrong_channel_ies),
+	.match = false,
+};
+
+static size_t build_probe_req(uint8_t *buf, const uint8_t *da,
+				const uint8_t *ies, size_t ies_len)
+{
+	struct mmpdu_header *hdr = (struct mmpdu_header *) buf;
+	static const uint8_t sa[6] = { 0x02, 0x00, 0x00, 0x00, 0x02, 0x00 };
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->fc.type = MPDU_TYPE_MANAGEMENT;
+	hdr->fc.subtype = MPDU_MANAGEMENT_SUBTYPE_PROBE_REQUEST;
+	memcpy(hdr->address_1, da, 6);
+	memcpy(hdr->address_2, sa, 6);
+	memcpy(hdr->address_3, da, 6);
+	memcpy(buf + sizeof(*hdr), ies, ies_len);
+
+	return sizeof(*hdr) + ies_len;
+}
+
+static bool probe_req_match(const uint8_t *buf, size_t len)
+{
+	const struct mmpdu_header *hdr = (const struct mmpdu_header *) buf;
+
+	return ap_probe_req_match(hdr, buf + sizeof(*hdr), len - sizeof(*hdr),
+					ap_bssid, ap_ssid, strlen(ap_ssid),
+					ap_channel);
+}
+
+static void test_probe_req_match(const void *data)
+{
+	const struct probe_req_test *test = data;
+	static const uint8_t bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	uint8_t buf[256];
+	size_t len;
+
+	len = build_probe_req(buf, test->directed ? ap_bssid : bcast,
+				test->ies, test->ies_len);
+	assert(probe_req_match(buf, len) == test->match);
+}
+
+static void test_probe_req_other_bssid(const void *data)
+{
+	static const uint8_t bssid[6] = { 0x02, 0x00, 0x00, 0x00, 0x03, 0x00 };
+	uint8_t buf[256];
+	size_t len;
+
+	len = build_probe_req(buf, bssid, ssid_ies, sizeof(ssid_ies));
+	assert(!probe_req_match(buf, len));
+}
+
+/*
+ * Probe Response up to and including the RSNE, built from scratch the way
+ * ap.c does for a given DA
+ */
+static size_t build_probe_resp_head(uint8_t *buf, const uint8_t *da,
+					const char *ssid)
+{
+	struct mmpdu_header *hdr = (struct mmpdu_header *) buf;
+	static const uint8_t rsne[] = {
+		IE_TYPE_RSN, 20, 0x01, 0x00,
+		0x00, 0x0f, 0xac, 0x04,
+		0x01, 0x00, 0x00, 0x0f, 0xac, 0x04,
+		0x01, 0x00, 0x00, 0x0f, 0xac, 0x02,
+		0x00, 0x00,
+	};
+	size_t len = sizeof(*hdr);
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->fc.type = MPDU_TYPE_MANAGEMENT;
+	hdr->fc.subtype = MPDU_MANAGEMENT_SUBTYPE_PROBE_RESPONSE;
+	memcpy(hdr->address_1, da, 6);
+	memcpy(hdr->address_2, ap_bssid, 6);
+	memcpy(hdr->address_3, ap_bssid, 6);
+
+	/* Timestamp, Beacon Interval and Capability Information */
+	memset(buf + len, 0, 8);
+	l_put_le16(100, buf + len + 8);
+	l_put_le16(0x0011, buf + len + 10);
+	len += 12;
+
+	buf[len++] = IE_TYPE_SSID;
+	buf[len++] = strlen(ssid);
+	memcpy(buf + len, ssid, strlen(ssid));
+	len += strlen(ssid);
+
+	buf[len++] = IE_TYPE_DSSS_PARAMETER_SET;
+	buf[len++] = 1;
+	buf[len++] = ap_channel;
+
+	memcpy(buf + len, rsne, sizeof(rsne));
+	return len + sizeof(rsne);
+}
+
+static size_t flatten_iov(const struct iovec *iov, uint8_t *buf)
+{
+	size_t len = 0;
+
+	for (; iov->iov_base; iov++) {
+		memcpy(buf + len, iov->iov_base, iov->iov_len);
+		len += iov->iov_len;
+	}
+
+	return len;
+}
+
+/* Assemble a response from the cache and compare it to a fresh frame */
+static void check_probe_resp(struct ap_probe_resp_cache *cache,
+				const uint8_t *da, const char *ssid,
+				const uint8_t *extra_ies, size_t extra_len)
+{
+	uint8_t expected[512];
+	uint8_t frame[512];
+	struct iovec iov[3];
+	size_t expected_len;
+	uint8_t *buf;
+
+	expected_len = build_probe_resp_head(expected, da, ssid);
+	memcpy(expected + expected_len, extra_ies, extra_len);
+	expected_len += extra_len;
+
+	buf = ap_probe_resp_cache_get_extra_ies(cache, extra_len);
+	if (extra_len) {
+		assert(buf);
+		memcpy(buf, extra_ies, extra_len);
+	}
+
+	ap_probe_resp_cache_assemble(cache, da, extra_len, iov);
+
+	assert(flatten_iov(iov, frame) == expected_len);
+	assert(!memcmp(frame, expected, expected_len));
+}
+
+static const uint8_t sta1_addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x02, 0x00 };
+static const uint8_t sta2_addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x03, 0x00 };
+static const uint8_t bcast_addr[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+
+static const uint8_t wsc_ies[] = {
+	IE_TYPE_VENDOR_SPECIFIC, 10, 0x00, 0x50, 0xf2, 0x04,
+	0x10, 0x4a, 0x00, 0x01, 0x10, 0x00,
+};
+
+static const uint8_t p2p_ies[] = {
+	IE_TYPE_VENDOR_SPECIFIC, 24, 0x50, 0x6f, 0x9a, 0x09,
+	0x02, 0x02, 0x00, 0x25, 0x00,
+	0x0d, 0x0e, 0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x02, 0x00,
+	0x01, 0x00, 0x50, 0xf2, 0x04,
+};
+
+static void test_probe_resp_cache_assemble(const void *data)
+{
+	struct ap_probe_resp_cache cache = {};
+	uint8_t head[512];
+	size_t len;
+	uint8_t *template;
+
+	assert(!ap_probe_resp_cache_is_valid(&cache));
+
+	len = build_probe_resp_head(head, bcast_addr, ap_ssid);
+	ap_probe_resp_cache_set(&cache, head, len);
+	assert(ap_probe_resp_cache_is_valid(&cache));
+	template = cache.template;
+
+	/* The DA of one response must not leak into the next */
+	check_probe_resp(&cache, sta1_addr, ap_ssid, wsc_ies, sizeof(wsc_ies));
+	check_probe_resp(&cache, sta2_addr, ap_ssid, NULL, 0);
+	check_probe_resp(&cache, sta1_addr, ap_ssid, p2p_ies, sizeof(p2p_ies));
+
+	/* Answering requests doesn't rebuild the template */
+	assert(cache.template == template);
+
+	ap_probe_resp_cache_clear(&cache);
+}
+
+static void test_probe_resp_cache_extra_ies(const void *data)
+{
+	struct ap_probe_resp_cache cache = {};
+	uint8_t *buf;
+
+	buf = ap_probe_resp_cache_get_extra_ies(&cache, sizeof(p2p_ies));
+	assert(buf);
+	assert(cache.extra_ies_size == sizeof(p2p_ies));
+
+	/* Smaller requests reuse the buffer */
+	assert(ap_probe_resp_cache_get_extra_ies(&cache,
+						sizeof(wsc_ies)) == buf);
+	assert(ap_probe_resp_cache_get_extra_ies(&cache, 0) == buf);
+	assert(cache.extra_ies_size == sizeof(p2p_ies));
+
+	/* Larger ones grow it */
+	assert(ap_probe_resp_cache_get_extra_ies(&cache, 64));
+	assert(cache.extra_ies_size == 64);
+
+	ap_probe_resp_cache_clear(&cache);
+	assert(!cache.extra_ies && !cache.extra_ies_size);
+}
+
+/* ap_update_beacon invalidates the cache, ap_reset clears it */
+static void test_probe_resp_cache_invalidate(const void *data)
+{
+	struct ap_probe_resp_cache cache = {};
+	uint8_t head[512];
+	size_t len;
+	uint8_t *extra_ies;
+
+	len = build_probe_resp_head(head, bcast_addr, ap_ssid);
+	ap_probe_resp_cache_set(&cache, head, len);
+	check_probe_resp(&cache, sta1_addr, ap_ssid, wsc_ies, sizeof(wsc_ies));
+	extra_ies = cache.extra_ies;
+
+	ap_probe_resp_cache_invalidate(&cache);
+	assert(!ap_probe_resp_cache_is_valid(&cache));
+	assert(cache.extra_ies == extra_ies);
+
+	/* The next response is built from the new beacon contents */
+	len = build_probe_resp_head(head, bcast_addr, "OtherAP");
+	ap_probe_resp_cache_set(&cache, head, len);
+	check_probe_resp(&cache, sta2_addr, "OtherAP", wsc_ies,
+							sizeof(wsc_ies));
+	assert(cache.extra_ies == extra_ies);
+
+	ap_probe_resp_cache_clear(&cache);
+	assert(!ap_probe_resp_cache_is_valid(&cache));
+	assert(!cache.extra_ies);
+}
+
+#define PROBE_FLOOD_COUNT 100000
+
+/*
+ * Drive the Probe Request match path with a mix of requests we answer
+ * and requests we drop, as seen during a probe flood.
+ */
+static void test_probe_req_flood(const void *data)
+{
+	static const struct probe_req_test *mix[] = {
+		&probe_req_wildcard,
+		&probe_req_ssid,
+		&probe_req_other_ssid,
+		&probe_req_ssid_list,
+		&probe_req_wrong_channel,
+	};
+	static const uint8_t bcast[6] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
+	uint8_t bufs[L_ARRAY_SIZE(mix)][256];
+	size_t lens[L_ARRAY_SIZE(mix)];
+	unsigned int i, matched = 0;
+	uint64_t start, elapsed;
+
+	for (i = 0; i < L_ARRAY_SIZE(mix); i++)
+		lens[i] = build_probe_req(bufs[i],
+					mix[i]->directed ? ap_bssid : bcast,
+					mix[i]->ies, mix[i]->ies_len);
+
+	start = l_time_now();
+
+	for (i = 0; i < PROBE_FLOOD_COUNT; i++) {
+		unsigned int n = i % L_ARRAY_SIZE(mix);
+
+		if (probe_req_match(bufs[n], lens[n]))
+			matched++;
+	}
+
+	elapsed = l_time_diff(start, l_time_now());
+	printf("%u Probe Requests (%u matched) in %" PRIu64 " us\n",
+		PROBE_FLOOD_COUNT, matched, elapsed);
+
+	assert(matched == PROBE_FLOOD_COUNT / L_ARRAY_SIZE(mix) * 3);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/AP/Probe Request/Wildcard", test_probe_req_match,
+			&probe_req_wildcard);
+	l_test_add("/AP/Probe Request/SSID", test_probe_req_match,
+			&probe_req_ssid);
+	l_test_add("/AP/Probe Request/Other SSID", test_probe_req_match,
+			&probe_req_other_ssid);
+	l_test_add("/AP/Probe Request/SSID List", test_probe_req_match,
+			&probe_req_ssid_list);
+	l_test_add("/AP/Probe Request/Wrong channel", test_probe_req_match,
+			&probe_req_wrong_channel);
+	l_test_add("/AP/Probe Request/Other BSSID", test_probe_req_other_bssid,
+			NULL);
+	l_test_add("/AP/Probe Response cache/Assemble",
+			test_probe_resp_cache_assemble, NULL);
+	l_test_add("/AP/Probe Response cache/Extra IE buffer",
+			test_probe_resp_cache_extra_ies, NULL);
+	l_test_add("/AP/Probe Response cache/Invalidate",
+			test_probe_resp_cache_invalidate, NULL);
+	l_test_add("/AP/Probe Request/Flood benchmark", test_probe_req_flood,
+			NULL);
+
+	return l_test_run();
+}
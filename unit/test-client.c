@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <inttypes.h>
 #include <ell/ell.h>
 #include <readline/readline.h>
 
@@ -69,12 +70,106 @@ static void command_line_find_tokens_test(const void *data)
 	}
 }
 
+#define PROXY_TEST_OBJECTS	4096
+
+static const struct proxy_interface_type proxy_test_types[] = {
+	{ .interface = IWD_NETWORK_INTERFACE },
+	{ .interface = IWD_DEVICE_INTERFACE },
+	{ .interface = IWD_STATION_INTERFACE },
+};
+
+static void proxy_registry_benchmark_test(const void *data)
+{
+	static struct proxy_interface *proxies[PROXY_TEST_OBJECTS];
+	char path[64];
+	struct l_queue *all;
+	uint64_t start;
+	uint64_t elapsed;
+	unsigned int i;
+	unsigned int round;
+
+	__proxy_registry_init();
+
+	for (i = 0; i < L_ARRAY_SIZE(proxy_test_types); i++)
+		proxy_interface_type_register(&proxy_test_types[i]);
+
+	/* Mostly networks, as seen by a station in a dense RF environment */
+	for (i = 0; i < PROXY_TEST_OBJECTS; i++) {
+		const char *interface = proxy_test_types[i % 8 ? 0 :
+						1 + i / 8 % 2].interface;
+
+		sprintf(path, "/net/connman/iwd/0/%u/%08x_psk", i / 8, i);
+		proxies[i] = __proxy_interface_add(interface, path);
+		assert(proxies[i]);
+	}
+
+	assert(!__proxy_interface_add(IWD_NETWORK_INTERFACE,
+				proxy_interface_get_path(proxies[1])));
+	assert(!__proxy_interface_add("net.connman.iwd.Unknown", "/foo"));
+
+	start = l_time_now();
+
+	for (round = 0; round < 16; round++) {
+		for (i = 0; i < PROXY_TEST_OBJECTS; i++) {
+			const char *interface =
+				proxy_interface_get_interface(proxies[i]);
+			const char *path =
+				proxy_interface_get_path(proxies[i]);
+
+			assert(proxy_interface_find(interface, path) ==
+								proxies[i]);
+		}
+	}
+
+	elapsed = l_time_diff(start, l_time_now());
+	printf("%u proxy lookups in %" PRIu64 " us\n",
+					16 * PROXY_TEST_OBJECTS, elapsed);
+
+	assert(!proxy_interface_find(IWD_STATION_INTERFACE,
+				proxy_interface_get_path(proxies[1])));
+
+	all = proxy_interface_find_all(IWD_NETWORK_INTERFACE, NULL, NULL);
+	assert(l_queue_length(all) == PROXY_TEST_OBJECTS / 8 * 7);
+	l_queue_destroy(all, NULL);
+
+	all = proxy_interface_find_all(IWD_DEVICE_INTERFACE, NULL, NULL);
+	assert(l_queue_length(all) == PROXY_TEST_OBJECTS / 16);
+	l_queue_destroy(all, NULL);
+
+	for (i = 0; i < PROXY_TEST_OBJECTS; i += 2) {
+		const char *interface =
+				proxy_interface_get_interface(proxies[i]);
+
+		l_strlcpy(path, proxy_interface_get_path(proxies[i]),
+								sizeof(path));
+		__proxy_interface_remove(proxies[i]);
+		assert(!proxy_interface_find(interface, path));
+	}
+
+	for (i = 1; i < PROXY_TEST_OBJECTS; i += 2)
+		assert(proxy_interface_find(
+				proxy_interface_get_interface(proxies[i]),
+				proxy_interface_get_path(proxies[i])) ==
+								proxies[i]);
+
+	all = proxy_interface_find_all(IWD_DEVICE_INTERFACE, NULL, NULL);
+	assert(!all);
+
+	all = proxy_interface_find_all(IWD_NETWORK_INTERFACE, NULL, NULL);
+	assert(l_queue_length(all) == PROXY_TEST_OBJECTS / 2);
+	l_queue_destroy(all, NULL);
+
+	__proxy_registry_exit();
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
 
 	l_test_add("/Command/Find tokens", command_line_find_tokens_test,
 							&command_line_data_1);
+	l_test_add("/Proxy/Registry benchmark", proxy_registry_benchmark_test,
+							NULL);
 
 	return l_test_run();
 }
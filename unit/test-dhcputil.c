@@ -0,0 +1,251 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "src/dhcputil.h"
+
+static const uint8_t client_addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x02, 0x00 };
+static const uint8_t other_addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x03, 0x00 };
+static const uint8_t bssid[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t other_bssid[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x03 };
+
+static const char *lease_settings =
+	"[IPv4Lease]\n"
+	"Address=192.168.1.10\n"
+	"PrefixLength=24\n"
+	"Server=192.168.1.1\n"
+	"Gateway=192.168.1.254\n"
+	"DNS=192.168.1.1 8.8.8.8\n"
+	"ClientAddress=02:00:00:00:02:00\n"
+	"BSSIDs=02:00:00:00:00:01 02:00:00:00:00:02\n"
+	"Expires=1000000\n";
+
+static struct l_settings *settings_from(const char *data)
+{
+	struct l_settings *settings = l_settings_new();
+
+	assert(l_settings_load_from_data(settings, data, strlen(data)));
+	return settings;
+}
+
+static void test_load(const void *data)
+{
+	struct l_settings *settings = settings_from(lease_settings);
+	struct dhcp_saved_lease *lease = dhcp_saved_lease_load(settings);
+
+	assert(lease);
+	assert(!strcmp(lease->address, "192.168.1.10"));
+	assert(lease->prefix_len == 24);
+	assert(!strcmp(lease->server, "192.168.1.1"));
+	assert(!strcmp(lease->gateway, "192.168.1.254"));
+	assert(lease->dns && l_strv_length(lease->dns) == 2);
+	assert(!strcmp(lease->dns[0], "192.168.1.1"));
+	assert(!strcmp(lease->dns[1], "8.8.8.8"));
+	assert(!memcmp(lease->client_addr, client_addr, 6));
+	assert(lease->n_bssids == 2);
+	assert(!memcmp(lease->bssids[0], bssid, 6));
+	assert(lease->expires == 1000000);
+
+	dhcp_saved_lease_free(lease);
+	l_settings_free(settings);
+}
+
+static void test_save(const void *data)
+{
+	struct l_settings *settings = l_settings_new();
+	struct dhcp_saved_lease lease = {
+		.address = "10.0.0.2",
+		.prefix_len = 16,
+		.server = "10.0.0.1",
+		.expires = 1234567,
+	};
+	struct dhcp_saved_lease *loaded;
+
+	memcpy(lease.client_addr, client_addr, 6);
+	dhcp_saved_lease_add_bssid(&lease, other_bssid);
+
+	/* A previous lease must be replaced as a whole */
+	assert(l_settings_load_from_data(settings, lease_settings,
+						strlen(lease_settings)));
+	l_settings_set_string(settings, "IPv4", "SendHostname", "true");
+
+	dhcp_saved_lease_save(settings, &lease);
+	loaded = dhcp_saved_lease_load(settings);
+
+	assert(loaded);
+	assert(!strcmp(loaded->address, "10.0.0.2"));
+	assert(loaded->prefix_len == 16);
+	assert(!strcmp(loaded->server, "10.0.0.1"));
+	assert(!loaded->gateway[0]);
+	assert(!loaded->dns);
+	assert(loaded->n_bssids == 1);
+	assert(!memcmp(loaded->bssids[0], other_bssid, 6));
+	assert(loaded->expires == 1234567);
+	assert(l_settings_has_key(settings, "IPv4", "SendHostname"));
+
+	dhcp_saved_lease_free(loaded);
+
+	dhcp_saved_lease_remove(settings);
+	assert(!dhcp_saved_lease_load(settings));
+	assert(l_settings_has_key(settings, "IPv4", "SendHostname"));
+
+	l_settings_free(settings);
+}
+
+static const char *invalid_settings[] = {
+	"[IPv4Lease]\nAddress=192.168.1.10\nPrefixLength=24\n"
+	"ClientAddress=02:00:00:00:02:00\nExpires=1000000\n",
+	"[IPv4Lease]\nAddress=192.168.1\nPrefixLength=24\nServer=192.168.1.1\n"
+	"ClientAddress=02:00:00:00:02:00\nExpires=1000000\n",
+	"[IPv4Lease]\nAddress=192.168.1.10\nPrefixLength=33\n"
+	"Server=192.168.1.1\nClientAddress=02:00:00:00:02:00\n"
+	"Expires=1000000\n",
+	"[IPv4Lease]\nAddress=192.168.1.10\nPrefixLength=24\n"
+	"Server=192.168.1.1\nClientAddress=02:00:00:00:02:00\n",
+	"[IPv4Lease]\nAddress=192.168.1.10\nPrefixLength=24\n"
+	"Server=192.168.1.1\nClientAddress=02:00:00:00\nExpires=1000000\n",
+	"[IPv4Lease]\nAddress=192.168.1.10\nPrefixLength=24\n"
+	"Server=192.168.1.1\nGateway=gateway\n"
+	"ClientAddress=02:00:00:00:02:00\nExpires=1000000\n",
+	"[IPv4Lease]\nAddress=192.168.1.10\nPrefixLength=24\n"
+	"Server=192.168.1.1\nDNS=192.168.1.1 ::1\n"
+	"ClientAddress=02:00:00:00:02:00\nExpires=1000000\n",
+	"[IPv4Lease]\nAddress=192.168.1.10\nPrefixLength=24\n"
+	"Server=192.168.1.1\nClientAddress=02:00:00:00:02:00\n"
+	"Expires=1000000\n",
+	"[IPv4Lease]\nAddress=192.168.1.10\nPrefixLength=24\n"
+	"Server=192.168.1.1\nClientAddress=02:00:00:00:02:00\n"
+	"BSSIDs=02:00:00:00:00\nExpires=1000000\n",
+	"[IPv4]\nAddress=192.168.1.10\n",
+};
+
+static void test_load_invalid(const void *data)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(invalid_settings); i++) {
+		struct l_settings *settings =
+				settings_from(invalid_settings[i]);
+
+		assert(!dhcp_saved_lease_load(settings));
+		l_settings_free(settings);
+	}
+}
+
+static void test_usable(const void *data)
+{
+	struct l_settings *settings = settings_from(lease_settings);
+	struct dhcp_saved_lease *lease = dhcp_saved_lease_load(settings);
+
+	assert(lease);
+
+	assert(dhcp_saved_lease_usable(lease, client_addr, bssid, 900000));
+	assert(!dhcp_saved_lease_usable(lease, other_addr, bssid, 900000));
+
+	/* Same SSID through an AP the lease was never used through */
+	assert(!dhcp_saved_lease_usable(lease, client_addr, other_bssid,
+						900000));
+	assert(!dhcp_saved_lease_usable(lease, client_addr, NULL, 900000));
+
+	/* Expired or about to expire */
+	assert(!dhcp_saved_lease_usable(lease, client_addr, bssid, 1000000));
+	assert(!dhcp_saved_lease_usable(lease, client_addr, bssid, 999990));
+	assert(!dhcp_saved_lease_usable(lease, client_addr, bssid, 2000000));
+
+	dhcp_saved_lease_free(lease);
+	l_settings_free(settings);
+}
+
+static void test_bssids(const void *data)
+{
+	struct dhcp_saved_lease lease = {};
+	uint8_t addr[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 };
+	unsigned int i;
+
+	for (i = 0; i < DHCP_SAVED_LEASE_MAX_BSSIDS; i++) {
+		addr[5] = i;
+		dhcp_saved_lease_add_bssid(&lease, addr);
+		dhcp_saved_lease_add_bssid(&lease, addr);
+	}
+
+	assert(lease.n_bssids == DHCP_SAVED_LEASE_MAX_BSSIDS);
+
+	/* The oldest BSSID makes room for a new one */
+	addr[5] = 0xff;
+	dhcp_saved_lease_add_bssid(&lease, addr);
+
+	assert(lease.n_bssids == DHCP_SAVED_LEASE_MAX_BSSIDS);
+	assert(lease.bssids[0][5] == 1);
+	assert(!memcmp(lease.bssids[DHCP_SAVED_LEASE_MAX_BSSIDS - 1],
+				addr, 6));
+}
+
+static void test_equal(const void *data)
+{
+	struct l_settings *settings = settings_from(lease_settings);
+	struct dhcp_saved_lease *a = dhcp_saved_lease_load(settings);
+	struct dhcp_saved_lease *b = dhcp_saved_lease_load(settings);
+
+	assert(a && b);
+	assert(dhcp_saved_lease_equal(a, b));
+
+	/* A renewal only moves the expiry time */
+	b->expires += 3600;
+	assert(dhcp_saved_lease_equal(a, b));
+
+	dhcp_saved_lease_add_bssid(b, other_bssid);
+	assert(!dhcp_saved_lease_equal(a, b));
+	b->n_bssids--;
+	assert(dhcp_saved_lease_equal(a, b));
+
+	strcpy(b->gateway, "192.168.1.253");
+	assert(!dhcp_saved_lease_equal(a, b));
+	strcpy(b->gateway, a->gateway);
+
+	l_strv_free(l_steal_ptr(b->dns));
+	assert(!dhcp_saved_lease_equal(a, b));
+
+	dhcp_saved_lease_free(a);
+	dhcp_saved_lease_free(b);
+	l_settings_free(settings);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/DHCP Saved Lease/Load", test_load, NULL);
+	l_test_add("/DHCP Saved Lease/Save", test_save, NULL);
+	l_test_add("/DHCP Saved Lease/Load invalid", test_load_invalid, NULL);
+	l_test_add("/DHCP Saved Lease/Usable", test_usable, NULL);
+	l_test_add("/DHCP Saved Lease/BSSIDs", test_bssids, NULL);
+	l_test_add("/DHCP Saved Lease/Equal", test_equal, NULL);
+
+	return l_test_run();
+}
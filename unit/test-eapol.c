@@ -25,8 +25,11 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <inttypes.h>
 #include <linux/if_ether.h>
 #include <ell/ell.h>
 
@@ -36,6 +39,7 @@
 #include "src/ie.h"
 #include "src/eap.h"
 #include "src/eap-private.h"
+#include "src/eap-tls-common.h"
 #include "src/handshake.h"
 
 /* Our nonce to use + its size */
@@ -3169,6 +3173,93 @@ static void eapol_sm_test_eap_tls(const void *data)
 	l_settings_free(config);
 }
 
+static void write_file(const char *path, const char *src)
+{
+	size_t len;
+	void *data = l_file_get_contents(src, &len);
+	FILE *f;
+
+	assert(data);
+
+	f = fopen(path, "w");
+	assert(f);
+	assert(fwrite(data, 1, len, f) == len);
+	fclose(f);
+
+	l_free(data);
+}
+
+static bool cert_lists_equal(struct l_queue *a, struct l_queue *b)
+{
+	const struct l_queue_entry *ea = l_queue_get_entries(a);
+	const struct l_queue_entry *eb = l_queue_get_entries(b);
+
+	for (; ea && eb; ea = ea->next, eb = eb->next) {
+		const uint8_t *der_a, *der_b;
+		size_t len_a, len_b;
+
+		der_a = l_cert_get_der_data(ea->data, &len_a);
+		der_b = l_cert_get_der_data(eb->data, &len_b);
+
+		if (len_a != len_b || memcmp(der_a, der_b, len_a))
+			return false;
+	}
+
+	return !ea && !eb;
+}
+
+static void eapol_sm_test_eap_tls_ca_cache(const void *data)
+{
+	char path[] = "/tmp/iwd-test-cacert-XXXXXX";
+	struct l_queue *first;
+	struct l_queue *second;
+	struct l_queue *changed;
+	uint64_t start;
+	uint64_t uncached_us;
+	uint64_t cached_us;
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	write_file(path, CERTDIR "cert-ca.pem");
+
+	eap_init();
+
+	start = l_time_now();
+	first = eap_tls_load_ca_cert(NULL, path);
+	uncached_us = l_time_diff(start, l_time_now());
+	assert(first);
+
+	start = l_time_now();
+	second = eap_tls_load_ca_cert(NULL, path);
+	cached_us = l_time_diff(start, l_time_now());
+	assert(second);
+
+	printf("CA certificates loaded in %" PRIu64 " us, "
+		"from cache in %" PRIu64 " us\n", uncached_us, cached_us);
+
+	/* Each caller gets its own copy as l_tls takes ownership */
+	assert(l_queue_peek_head(first) != l_queue_peek_head(second));
+	assert(cert_lists_equal(first, second));
+
+	/* A modified file must not be served from the cache */
+	write_file(path, CERTDIR "cert-server.pem");
+	changed = eap_tls_load_ca_cert(NULL, path);
+	assert(changed);
+	assert(!cert_lists_equal(first, changed));
+
+	l_queue_destroy(first, (l_queue_destroy_func_t) l_cert_free);
+	l_queue_destroy(second, (l_queue_destroy_func_t) l_cert_free);
+	l_queue_destroy(changed, (l_queue_destroy_func_t) l_cert_free);
+
+	unlink(path);
+	assert(!eap_tls_load_ca_cert(NULL, path));
+
+	eap_exit();
+}
+
 static void eapol_sm_test_eap_tls_embedded(const void *data)
 {
 	struct eapol_8021x_tls_test_state s = {};
@@ -3514,6 +3605,110 @@ static void eapol_ft_handshake_test(const void *data)
 	eapol_exit();
 }
 
+static void eapol_ft_prepare_pmk_r1_test(const void *data)
+{
+	const unsigned char psk[] = {
+		0xbc, 0xcd, 0x17, 0x98, 0xef, 0x6c, 0xb8, 0x7f,
+		0x2b, 0x54, 0x75, 0xfb, 0x98, 0x06, 0x57, 0xd2,
+		0xea, 0x02, 0x6c, 0xe3, 0x68, 0xef, 0x3f, 0xca,
+		0xda, 0x31, 0x48, 0x54, 0x3f, 0xee, 0x94, 0xf0 };
+	const unsigned char own_rsne[] = {
+		0x30, 0x12, 0x01, 0x00, 0x00, 0x0f, 0xac, 0x04,
+		0x01, 0x00, 0x00, 0x0f, 0xac, 0x04, 0x01, 0x00,
+		0x00, 0x0f, 0xac, 0x04 };
+	const uint8_t mde[] = { 0x36, 0x03, 0x12, 0x34, 0x01 };
+	const uint8_t fte[] = { 0x37, 0x00 };
+	const uint8_t r0khid[] = "dummy0";
+	const uint8_t r1khid[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 };
+	const uint8_t target[] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+	const uint8_t sta_address[] = { 0x02, 0x00, 0x00, 0x00, 0x02, 0x00 };
+	const char *ssid = "TestFT";
+	uint8_t pmk_r0[48];
+	uint8_t pmk_r0_name[16];
+	uint8_t pmk_r1[48];
+	uint8_t pmk_r1_name[16];
+	uint8_t cached_pmk_r1[48];
+	uint8_t cached_pmk_r1_name[16];
+	struct handshake_state *hs;
+
+	hs = test_handshake_state_new(1);
+
+	handshake_state_set_pmk(hs, psk, sizeof(psk));
+	handshake_state_set_authenticator_address(hs, target);
+	handshake_state_set_supplicant_address(hs, sta_address);
+	handshake_state_set_ssid(hs, (void *) ssid, strlen(ssid));
+	handshake_state_set_supplicant_ie(hs, own_rsne);
+	handshake_state_set_mde(hs, mde);
+	handshake_state_set_fte(hs, fte);
+	handshake_state_set_kh_ids(hs, r0khid, strlen((void *) r0khid), r1khid);
+	handshake_state_new_snonce(hs);
+	handshake_state_set_anonce(hs, eapol_key_test_26.key_nonce);
+
+	assert(handshake_state_prepare_pmk_r1(hs, target));
+	assert(handshake_state_prepare_pmk_r1(hs, target));
+	assert(hs->pmk_r1_cache_len == 1);
+
+	assert(crypto_derive_pmk_r0(psk, 32, (void *) ssid, strlen(ssid),
+					0x3412, r0khid,
+					strlen((void *) r0khid), sta_address,
+					false, pmk_r0, pmk_r0_name));
+	assert(crypto_derive_pmk_r1(pmk_r0, target, sta_address,
+					pmk_r0_name, false,
+					pmk_r1, pmk_r1_name));
+
+	/* The FTE from the target names the R1KH we prepared for */
+	handshake_state_set_kh_ids(hs, r0khid, strlen((void *) r0khid),
+					target);
+	assert(handshake_state_derive_ptk(hs));
+	assert(!memcmp(hs->pmk_r0_name, pmk_r0_name, 16));
+	assert(!memcmp(hs->pmk_r1, pmk_r1, 32));
+	assert(!memcmp(hs->pmk_r1_name, pmk_r1_name, 16));
+
+	/*
+	 * The cached PMK-R1 is used as is rather than derived again, replace
+	 * it with one derivation would never give to tell the two apart.
+	 */
+	memset(cached_pmk_r1, 0xaa, sizeof(cached_pmk_r1));
+	memset(cached_pmk_r1_name, 0xbb, sizeof(cached_pmk_r1_name));
+	memcpy(hs->pmk_r1_cache[0].pmk_r1, cached_pmk_r1,
+						sizeof(cached_pmk_r1));
+	memcpy(hs->pmk_r1_cache[0].pmk_r1_name, cached_pmk_r1_name,
+						sizeof(cached_pmk_r1_name));
+
+	assert(handshake_state_derive_ptk(hs));
+	assert(!memcmp(hs->pmk_r1, cached_pmk_r1, 32));
+	assert(!memcmp(hs->pmk_r1_name, cached_pmk_r1_name, 16));
+
+	/* Setting the same SSID again, e.g. on reassociation, keeps it */
+	handshake_state_set_ssid(hs, (void *) ssid, strlen(ssid));
+	assert(hs->have_pmk_r0);
+	assert(hs->pmk_r1_cache_len == 1);
+
+	assert(handshake_state_derive_ptk(hs));
+	assert(!memcmp(hs->pmk_r1, cached_pmk_r1, 32));
+
+	/* A different SSID invalidates the whole hierarchy */
+	handshake_state_set_ssid(hs, (void *) "OtherFT", 7);
+	assert(hs->pmk_r1_cache_len == 0);
+	assert(!hs->have_pmk_r0);
+
+	/* ... so the PMK-R1 is derived again */
+	handshake_state_set_ssid(hs, (void *) ssid, strlen(ssid));
+	assert(handshake_state_derive_ptk(hs));
+	assert(!memcmp(hs->pmk_r1, pmk_r1, 32));
+	assert(!memcmp(hs->pmk_r1_name, pmk_r1_name, 16));
+
+	assert(handshake_state_prepare_pmk_r1(hs, target));
+	assert(hs->pmk_r1_cache_len == 1);
+
+	/* A new PMK invalidates the whole hierarchy */
+	handshake_state_set_pmk(hs, psk, sizeof(psk));
+	assert(hs->pmk_r1_cache_len == 0);
+	assert(!hs->have_pmk_r0);
+
+	handshake_state_free(hs);
+}
+
 struct test_ap_sta_data {
 	struct handshake_state *ap_hs;
 	struct handshake_state *sta_hs;
@@ -4033,10 +4228,14 @@ int main(int argc, char *argv[])
 				&eapol_sm_test_eap_tls_subject_bad, NULL);
 		l_test_add("EAPoL/8021x EAP-TLS embedded certs",
 				&eapol_sm_test_eap_tls_embedded, NULL);
+		l_test_add("EAPoL/8021x EAP-TLS CA certificate cache",
+				&eapol_sm_test_eap_tls_ca_cache, NULL);
 	}
 
 	l_test_add("EAPoL/FT-Using-PSK 4-Way Handshake",
 			&eapol_ft_handshake_test, NULL);
+	l_test_add("EAPoL/FT pre-derived PMK-R1",
+			&eapol_ft_prepare_pmk_r1_test, NULL);
 
 	l_test_add("EAPoL/Supplicant+Authenticator 4-Way Handshake",
 			&eapol_ap_sta_handshake_test, NULL);
@@ -0,0 +1,622 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <ell/ell.h>
+
+#include "src/util.h"
+#include "src/ie.h"
+#include "src/handshake.h"
+#include "src/mpdu.h"
+#include "src/erp.h"
+#include "src/fils.h"
+#include "src/auth-proto.h"
+#include "src/crypto.h"
+
+#define RRK_LIFETIME	3600
+
+struct test_handshake_state {
+	struct handshake_state super;
+};
+
+struct authenticate_frame {
+	struct mmpdu_header hdr;
+	struct mmpdu_authentication auth;
+} __attribute__ ((packed));
+
+struct associate_frame {
+	struct mmpdu_header hdr;
+	struct mmpdu_association_response assoc;
+} __attribute__ ((packed));
+
+struct test_data {
+	uint8_t snonce[16];
+	uint8_t anonce[16];
+	uint8_t session[8];
+	uint8_t nai[254];
+	size_t nai_len;
+	uint8_t r_rk[64];
+	uint8_t r_ik[64];
+	uint8_t ick[32];
+	uint8_t kek[32];
+	uint8_t tk[16];
+	uint8_t pmk[32];
+	bool tx_auth_called;
+	bool tx_assoc_called;
+	bool tk_installed;
+	bool gtk_installed;
+};
+
+static const uint8_t spa[] = { 2, 0, 0, 0, 0, 0 };
+static const uint8_t aa[] = { 2, 0, 0, 0, 0, 1 };
+static const char *identity = "user@example.com";
+static const char *ssid = "TestFILS";
+static const uint8_t session_id[65] = { 0x0d, 0x11, 0x22, 0x33, 0x44 };
+static const uint8_t emsk[64] = {
+	0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+	0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,
+	0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38,
+	0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+	0x51, 0x52, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+	0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+};
+static const uint8_t gtk[16] = {
+	0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+};
+static const uint8_t cache_key[32] = { 0x42, 0x43, 0x44 };
+static struct test_data *current;
+
+static void test_handshake_state_free(struct handshake_state *hs)
+{
+	struct test_handshake_state *ths =
+			l_container_of(hs, struct test_handshake_state, super);
+
+	l_free(ths);
+}
+
+static struct handshake_state *test_handshake_state_new(uint32_t ifindex)
+{
+	struct test_handshake_state *ths;
+
+	ths = l_new(struct test_handshake_state, 1);
+
+	ths->super.ifindex = ifindex;
+	ths->super.free = test_handshake_state_free;
+
+	return &ths->super;
+}
+
+static void *export_cache(const uint8_t *key, size_t key_len, size_t *len)
+{
+	void *data;
+
+	erp_cache_add(identity, session_id, sizeof(session_id),
+			emsk, sizeof(emsk), ssid);
+
+	data = erp_cache_export(key, key_len, len);
+	assert(data);
+
+	/* Simulate a daemon restart */
+	erp_exit();
+	erp_init();
+	assert(!erp_cache_get(ssid));
+
+	return data;
+}
+
+static void test_reload_plain(const void *arg)
+{
+	struct erp_cache_entry *cache;
+	void *data;
+	size_t len;
+
+	erp_init();
+
+	data = export_cache(NULL, 0, &len);
+	assert(erp_cache_import(data, len, NULL, 0));
+	l_free(data);
+
+	cache = erp_cache_get(ssid);
+	assert(cache);
+	assert(!strcmp(erp_cache_entry_get_identity(cache), identity));
+	erp_cache_put(cache);
+
+	erp_cache_remove(identity);
+	assert(!erp_cache_get(ssid));
+
+	erp_exit();
+}
+
+static void test_reload_encrypted(const void *arg)
+{
+	uint8_t wrong_key[32] = { 0x42, 0x43, 0x45 };
+	struct erp_cache_entry *cache;
+	uint8_t *data;
+	size_t len;
+
+	erp_init();
+
+	data = export_cache(cache_key, sizeof(cache_key), &len);
+
+	/* SIV followed by the ciphertext, nothing readable */
+	assert(len > 16 && memcmp(data + 16, "[ERP-0]", 7));
+
+	assert(!erp_cache_import(data, len, wrong_key, sizeof(wrong_key)));
+
+	data[len - 1] ^= 0x01;
+	assert(!erp_cache_import(data, len, cache_key, sizeof(cache_key)));
+	data[len - 1] ^= 0x01;
+
+	assert(erp_cache_import(data, len, cache_key, sizeof(cache_key)));
+	l_free(data);
+
+	cache = erp_cache_get(ssid);
+	assert(cache);
+	assert(!strcmp(erp_cache_entry_get_identity(cache), identity));
+	erp_cache_put(cache);
+
+	erp_exit();
+}
+
+static void test_derive_key(const void *arg)
+{
+	static const char secret[] = "erp cache secret";
+	static const char other[] = "other secret";
+	uint8_t key[32];
+	uint8_t again[32];
+	uint8_t other_key[32];
+
+	assert(erp_cache_derive_key(secret, strlen(secret),
+						key, sizeof(key)));
+	assert(erp_cache_derive_key(secret, strlen(secret),
+						again, sizeof(again)));
+	assert(!memcmp(key, again, sizeof(key)));
+
+	assert(erp_cache_derive_key(other, strlen(other),
+					other_key, sizeof(other_key)));
+	assert(memcmp(key, other_key, sizeof(key)));
+}
+
+static void test_reload_expired(const void *arg)
+{
+	struct l_settings *settings = l_settings_new();
+	char *text;
+	size_t len;
+
+	erp_init();
+
+	l_settings_set_string(settings, "ERP-0", "Identity", identity);
+	l_settings_set_string(settings, "ERP-0", "SSID", ssid);
+	l_settings_set_uint64(settings, "ERP-0", "Expires", time(NULL) - 1);
+	l_settings_set_value(settings, "ERP-0", "SessionId", "0d11");
+	l_settings_set_value(settings, "ERP-0", "EMSK", "0102030405060708");
+
+	text = l_settings_to_data(settings, &len);
+	l_settings_free(settings);
+
+	assert(erp_cache_import(text, len, NULL, 0));
+	assert(!erp_cache_get(ssid));
+	l_free(text);
+
+	erp_exit();
+}
+
+static unsigned int cache_changes;
+
+static void test_cache_changed(void)
+{
+	cache_changes++;
+}
+
+static void test_cache_changed_func(const void *arg)
+{
+	void *data;
+	size_t len;
+
+	erp_init();
+	erp_cache_set_changed_func(test_cache_changed);
+	cache_changes = 0;
+
+	erp_cache_add(identity, session_id, sizeof(session_id),
+			emsk, sizeof(emsk), ssid);
+	assert(cache_changes == 1);
+
+	data = erp_cache_export(NULL, 0, &len);
+	assert(data);
+
+	erp_cache_remove(identity);
+	assert(cache_changes == 2);
+
+	/* Nothing to remove */
+	erp_cache_remove(identity);
+	assert(cache_changes == 2);
+
+	/* Loading the cache back isn't a change */
+	assert(erp_cache_import(data, len, NULL, 0));
+	assert(cache_changes == 2);
+	l_free(data);
+
+	erp_cache_set_changed_func(NULL);
+	erp_exit();
+}
+
+static void test_tx_auth(const uint8_t *data, size_t len, void *user_data)
+{
+	struct test_data *td = user_data;
+	struct ie_tlv_iter iter;
+	const uint8_t *eap = NULL;
+	size_t eap_len = 0;
+	uint8_t tag[16];
+	uint16_t key_len = L_CPU_TO_BE16(sizeof(emsk));
+	uint8_t cryptosuite = 2;
+
+	td->tx_auth_called = true;
+
+	assert(l_get_le16(data) == 1);
+	assert(l_get_le16(data + 2) == 0);
+
+	ie_tlv_iter_init(&iter, data + 4, len - 4);
+
+	while (ie_tlv_iter_next(&iter)) {
+		switch (iter.tag) {
+		case IE_TYPE_FILS_NONCE:
+			assert(iter.len == sizeof(td->snonce));
+			memcpy(td->snonce, iter.data, iter.len);
+			break;
+		case IE_TYPE_FILS_SESSION:
+			assert(iter.len == sizeof(td->session));
+			memcpy(td->session, iter.data, iter.len);
+			break;
+		case IE_TYPE_FILS_WRAPPED_DATA:
+			eap = iter.data;
+			eap_len = iter.len;
+			break;
+		}
+	}
+
+	/* EAP-Initiate/Re-auth carrying the keyName-NAI */
+	assert(eap && eap_len > 27);
+	assert(eap[0] == 5);
+	assert(l_get_be16(eap + 2) == eap_len);
+	assert(eap[4] == 2);
+	assert(eap[8] == 1);
+
+	td->nai_len = eap[9];
+	memcpy(td->nai, eap + 10, td->nai_len);
+
+	/* The server side derives the same rRK / rIK from its EMSK copy */
+	assert(prf_plus(L_CHECKSUM_SHA256, emsk, sizeof(emsk),
+			"EAP Re-authentication Root Key@ietf.org",
+			td->r_rk, sizeof(emsk), 1, &key_len, sizeof(key_len)));
+	assert(prf_plus(L_CHECKSUM_SHA256, td->r_rk, sizeof(emsk),
+			"Re-authentication Integrity Key@ietf.org",
+			td->r_ik, sizeof(emsk), 2, &cryptosuite, 1,
+			&key_len, sizeof(key_len)));
+
+	hmac_sha256(td->r_ik, sizeof(emsk), eap, eap_len - 16, tag, 16);
+	assert(!memcmp(tag, eap + eap_len - 16, 16));
+}
+
+static size_t build_eap_finish(struct test_data *td, uint8_t *buf)
+{
+	uint8_t *ptr = buf;
+
+	*ptr++ = 6;
+	*ptr++ = 0;
+	ptr += 2;
+	*ptr++ = 2;
+	*ptr++ = 0x40;	/* L bit */
+	l_put_be16(0, ptr);
+	ptr += 2;
+
+	*ptr++ = 1;
+	*ptr++ = td->nai_len;
+	memcpy(ptr, td->nai, td->nai_len);
+	ptr += td->nai_len;
+
+	*ptr++ = 2;
+	l_put_be32(RRK_LIFETIME, ptr);
+	ptr += 4;
+
+	*ptr++ = 2;
+	l_put_be16(ptr - buf + 16, buf + 2);
+
+	hmac_sha256(td->r_ik, sizeof(emsk), buf, ptr - buf, ptr, 16);
+	ptr += 16;
+
+	return ptr - buf;
+}
+
+static void derive_ap_keys(struct test_data *td)
+{
+	uint16_t seq = L_CPU_TO_BE16(0);
+	uint16_t rmsk_len = L_CPU_TO_BE16(64);
+	uint8_t rmsk[64];
+	uint8_t nonces[32];
+	uint8_t data[44];
+	uint8_t key_data[32 + 32 + 16];
+
+	assert(prf_plus(L_CHECKSUM_SHA256, td->r_rk, sizeof(emsk),
+			"Re-authentication Master Session Key@ietf.org",
+			rmsk, sizeof(rmsk), 2, &seq, sizeof(seq),
+			&rmsk_len, sizeof(rmsk_len)));
+
+	memcpy(nonces, td->snonce, 16);
+	memcpy(nonces + 16, td->anonce, 16);
+	hmac_sha256(nonces, sizeof(nonces), rmsk, sizeof(rmsk),
+			td->pmk, sizeof(td->pmk));
+
+	memcpy(data, spa, 6);
+	memcpy(data + 6, aa, 6);
+	memcpy(data + 12, td->snonce, 16);
+	memcpy(data + 28, td->anonce, 16);
+
+	assert(kdf_sha256(td->pmk, sizeof(td->pmk), "FILS PTK Derivation",
+				strlen("FILS PTK Derivation"), data,
+				sizeof(data), key_data, sizeof(key_data)));
+
+	memcpy(td->ick, key_data, 32);
+	memcpy(td->kek, key_data + 32, 32);
+	memcpy(td->tk, key_data + 64, 16);
+}
+
+static void key_auth(struct test_data *td, bool sta, uint8_t *out)
+{
+	uint8_t data[44];
+
+	memcpy(data, sta ? td->snonce : td->anonce, 16);
+	memcpy(data + 16, sta ? td->anonce : td->snonce, 16);
+	memcpy(data + 32, sta ? spa : aa, 6);
+	memcpy(data + 38, sta ? aa : spa, 6);
+
+	hmac_sha256(td->ick, sizeof(td->ick), data, sizeof(data), out, 32);
+}
+
+static void test_tx_assoc(struct iovec *iov, size_t iov_len,
+				const uint8_t *kek, size_t kek_len,
+				const uint8_t *nonces, size_t nonces_len,
+				void *user_data)
+{
+	struct test_data *td = user_data;
+	struct ie_tlv_iter iter;
+	uint8_t expected[32];
+	bool found = false;
+
+	td->tx_assoc_called = true;
+
+	derive_ap_keys(td);
+
+	assert(kek_len == sizeof(td->kek));
+	assert(!memcmp(kek, td->kek, kek_len));
+	assert(nonces_len == 32);
+	assert(!memcmp(nonces, td->snonce, 16));
+	assert(!memcmp(nonces + 16, td->anonce, 16));
+
+	key_auth(td, true, expected);
+
+	ie_tlv_iter_init(&iter, iov[0].iov_base, iov[0].iov_len);
+
+	while (ie_tlv_iter_next(&iter)) {
+		if (iter.tag != IE_TYPE_FILS_KEY_CONFIRMATION)
+			continue;
+
+		assert(iter.len == 32);
+		assert(!memcmp(iter.data, expected, 32));
+		found = true;
+	}
+
+	assert(found);
+}
+
+static int test_get_oci(void *user_data)
+{
+	return 0;
+}
+
+static void test_install_tk(struct handshake_state *hs, uint8_t key_index,
+				const uint8_t *tk, uint32_t cipher)
+{
+	assert(!memcmp(tk, current->tk, sizeof(current->tk)));
+	current->tk_installed = true;
+}
+
+static void test_install_gtk(struct handshake_state *hs, uint16_t key_index,
+				const uint8_t *key, uint8_t key_len,
+				const uint8_t *rsc, uint8_t rsc_len,
+				uint32_t cipher)
+{
+	assert(key_index == 1);
+	assert(key_len == sizeof(gtk));
+	assert(!memcmp(key, gtk, sizeof(gtk)));
+	current->gtk_installed = true;
+}
+
+static void test_fils_from_reloaded_cache(const void *arg)
+{
+	struct test_data *td = l_new(struct test_data, 1);
+	struct handshake_state *hs = test_handshake_state_new(1);
+	struct authenticate_frame *auth = alloca(sizeof(*auth) + 512);
+	struct associate_frame *assoc = alloca(sizeof(*assoc) + 256);
+	struct ie_tlv_builder builder;
+	struct ie_rsn_info info;
+	struct auth_proto *ap;
+	uint8_t rsne[256];
+	uint8_t eap[300];
+	size_t eap_len;
+	uint8_t kd[8 + 24];
+	uint8_t ap_key_auth[32];
+	void *data;
+	size_t len;
+	char *text;
+	struct l_settings *settings;
+	uint64_t expires;
+
+	current = td;
+	erp_init();
+
+	data = export_cache(cache_key, sizeof(cache_key), &len);
+	assert(erp_cache_import(data, len, cache_key, sizeof(cache_key)));
+	l_free(data);
+
+	__handshake_set_install_tk_func(test_install_tk);
+	__handshake_set_install_gtk_func(test_install_gtk);
+
+	memset(&info, 0, sizeof(info));
+	info.akm_suites = IE_RSN_AKM_SUITE_FILS_SHA256;
+	info.pairwise_ciphers = IE_RSN_CIPHER_SUITE_CCMP;
+	info.group_cipher = IE_RSN_CIPHER_SUITE_CCMP;
+	ie_build_rsne(&info, rsne);
+
+	handshake_state_set_supplicant_address(hs, spa);
+	handshake_state_set_authenticator_address(hs, aa);
+	assert(handshake_state_set_supplicant_ie(hs, rsne));
+	assert(handshake_state_set_authenticator_ie(hs, rsne));
+
+	hs->erp_cache = erp_cache_get(ssid);
+	assert(hs->erp_cache);
+
+	ap = fils_sm_new(hs, test_tx_auth, test_tx_assoc, test_get_oci, td);
+	assert(ap);
+
+	assert(auth_proto_start(ap));
+	assert(td->tx_auth_called);
+
+	/* Authentication response with EAP-Finish/Re-auth */
+	l_getrandom(td->anonce, sizeof(td->anonce));
+	eap_len = build_eap_finish(td, eap);
+
+	memset(auth, 0, sizeof(*auth));
+	memcpy(auth->hdr.address_2, aa, 6);
+	auth->hdr.fc.type = MPDU_TYPE_MANAGEMENT;
+	auth->hdr.fc.subtype = MPDU_MANAGEMENT_SUBTYPE_AUTHENTICATION;
+	auth->hdr.fc.order = 1;
+	l_put_le16(MMPDU_AUTH_ALGO_FILS_SK, &auth->auth.algorithm);
+	l_put_le16(2, &auth->auth.transaction_sequence);
+
+	ie_tlv_builder_init(&builder, auth->auth.ies, 512);
+	ie_tlv_builder_next(&builder, IE_TYPE_RSN);
+	ie_tlv_builder_set_data(&builder, rsne + 2, rsne[1]);
+	ie_tlv_builder_next(&builder, IE_TYPE_FILS_NONCE);
+	ie_tlv_builder_set_data(&builder, td->anonce, sizeof(td->anonce));
+	ie_tlv_builder_next(&builder, IE_TYPE_FILS_SESSION);
+	ie_tlv_builder_set_data(&builder, td->session, sizeof(td->session));
+	ie_tlv_builder_next(&builder, IE_TYPE_FILS_WRAPPED_DATA);
+	ie_tlv_builder_set_data(&builder, eap, eap_len);
+	ie_tlv_builder_finalize(&builder, &len);
+
+	assert(auth_proto_rx_authenticate(ap, (const uint8_t *) auth,
+					sizeof(*auth) + len) == 0);
+	assert(auth_proto_rx_oci(ap) == 0);
+	assert(td->tx_assoc_called);
+
+	/* Association response with the GTK and the AP's Key-Auth */
+	memset(kd, 0, sizeof(kd));
+	kd[8] = IE_TYPE_VENDOR_SPECIFIC;
+	kd[9] = 22;
+	l_put_be32(0x000fac01, kd + 10);
+	kd[14] = 1;
+	memcpy(kd + 16, gtk, sizeof(gtk));
+
+	key_auth(td, false, ap_key_auth);
+
+	memset(assoc, 0, sizeof(*assoc));
+	assoc->hdr.fc.type = MPDU_TYPE_MANAGEMENT;
+	assoc->hdr.fc.subtype = MPDU_MANAGEMENT_SUBTYPE_ASSOCIATION_RESPONSE;
+	assoc->hdr.fc.order = 1;
+
+	ie_tlv_builder_init(&builder, assoc->assoc.ies, 256);
+	ie_tlv_builder_next(&builder, IE_TYPE_KEY_DELIVERY);
+	ie_tlv_builder_set_data(&builder, kd, sizeof(kd));
+	ie_tlv_builder_next(&builder, IE_TYPE_FILS_KEY_CONFIRMATION);
+	ie_tlv_builder_set_data(&builder, ap_key_auth, sizeof(ap_key_auth));
+	ie_tlv_builder_finalize(&builder, &len);
+
+	assert(auth_proto_rx_associate(ap, (const uint8_t *) assoc,
+					sizeof(*assoc) + len) == 0);
+	assert(td->tk_installed);
+	assert(td->gtk_installed);
+	assert(hs->pmk_len == sizeof(td->pmk));
+	assert(!memcmp(hs->pmk, td->pmk, sizeof(td->pmk)));
+
+	auth_proto_free(ap);
+	handshake_state_free(hs);
+
+	/* The rRK lifetime from EAP-Finish bounds the cached entry */
+	text = erp_cache_export(NULL, 0, &len);
+	settings = l_settings_new();
+	assert(l_settings_load_from_data(settings, text, len));
+	assert(l_settings_get_uint64(settings, "ERP-0", "Expires", &expires));
+	assert(expires <= (uint64_t) time(NULL) + RRK_LIFETIME);
+	l_settings_free(settings);
+	l_free(text);
+
+	__handshake_set_install_tk_func(NULL);
+	__handshake_set_install_gtk_func(NULL);
+
+	erp_exit();
+	current = NULL;
+	l_free(td);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	if (!l_getrandom_is_supported()) {
+		l_info("l_getrandom not supported, skipping...");
+		goto done;
+	}
+
+	if (!l_checksum_is_supported(L_CHECKSUM_SHA256, true)) {
+		l_info("SHA256/HMAC_SHA256 not supported, skipping...");
+		goto done;
+	}
+
+	l_test_add("ERP cache reload", test_reload_plain, NULL);
+
+	l_test_add("ERP cache expired entries", test_reload_expired, NULL);
+	l_test_add("ERP cache key derivation", test_derive_key, NULL);
+	l_test_add("ERP cache change notification",
+					test_cache_changed_func, NULL);
+
+	if (!l_cipher_is_supported(L_CIPHER_AES_CTR) ||
+			!l_checksum_cmac_aes_supported()) {
+		l_info("AES-CTR/CMAC not supported, skipping...");
+		goto done;
+	}
+
+	l_test_add("ERP cache encrypted reload", test_reload_encrypted, NULL);
+	l_test_add("FILS with reloaded ERP cache",
+					test_fils_from_reloaded_cache, NULL);
+
+done:
+	return l_test_run();
+}
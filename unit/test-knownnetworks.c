@@ -0,0 +1,131 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "src/common.h"
+#include "src/knownnetworks.h"
+
+#define DAY	(24 * 3600)
+#define NOW	(1000 * DAY + 12 * 3600)
+
+struct score_test {
+	uint32_t hits;
+	uint64_t age;
+	uint32_t score;
+};
+
+/* A single sighting is kept for the full month despite halving weekly */
+static const struct score_test score_single_8_days = {
+	.hits = 1,
+	.age = 8 * DAY,
+	.score = 1,
+};
+
+static const struct score_test score_single_29_days = {
+	.hits = 1,
+	.age = 29 * DAY,
+	.score = 1,
+};
+
+static const struct score_test score_single_30_days = {
+	.hits = 1,
+	.age = 30 * DAY,
+	.score = 0,
+};
+
+static const struct score_test score_decay = {
+	.hits = 64,
+	.age = 15 * DAY,
+	.score = 16,
+};
+
+static void test_score(const void *data)
+{
+	const struct score_test *test = data;
+	struct known_frequency kf = {
+		.frequency = 2412,
+		.hits = test->hits,
+		.last_seen = NOW - test->age,
+	};
+
+	assert(known_frequency_score(&kf, NOW) == test->score);
+}
+
+static void test_scan_hits(const void *data)
+{
+	struct known_frequency kf = { .frequency = 5180 };
+	unsigned int i;
+
+	/* Repeated scans only count once a day */
+	for (i = 0; i < 600; i++)
+		known_frequency_add_hit(&kf, KNOWN_FREQUENCY_HIT_SCAN,
+						NOW + i * 60);
+
+	assert(kf.hits == KNOWN_FREQUENCY_HIT_SCAN);
+	assert(kf.last_seen == NOW + 599 * 60);
+
+	known_frequency_add_hit(&kf, KNOWN_FREQUENCY_HIT_SCAN, NOW + DAY);
+	assert(kf.hits == 2 * KNOWN_FREQUENCY_HIT_SCAN);
+}
+
+static void test_weighted_hits(const void *data)
+{
+	struct known_frequency scanned = { .frequency = 5180 };
+	struct known_frequency roamed = { .frequency = 5500 };
+	unsigned int i;
+
+	/* A day of scans on one channel and two roams to another */
+	for (i = 0; i < 24 * 60; i++)
+		known_frequency_add_hit(&scanned, KNOWN_FREQUENCY_HIT_SCAN,
+						NOW + i * 60);
+
+	known_frequency_add_hit(&roamed, KNOWN_FREQUENCY_HIT_NEIGHBOR_REPORT,
+					NOW);
+	known_frequency_add_hit(&roamed, KNOWN_FREQUENCY_HIT_ROAM, NOW + 60);
+	known_frequency_add_hit(&roamed, KNOWN_FREQUENCY_HIT_ROAM, NOW + 120);
+
+	assert(known_frequency_score(&roamed, NOW + DAY) >
+			known_frequency_score(&scanned, NOW + DAY));
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/knownnetworks/score/single hit 8 days", test_score,
+						&score_single_8_days);
+	l_test_add("/knownnetworks/score/single hit 29 days", test_score,
+						&score_single_29_days);
+	l_test_add("/knownnetworks/score/single hit 30 days", test_score,
+						&score_single_30_days);
+	l_test_add("/knownnetworks/score/decay", test_score, &score_decay);
+	l_test_add("/knownnetworks/hits/scan", test_scan_hits, NULL);
+	l_test_add("/knownnetworks/hits/weighted", test_weighted_hits, NULL);
+
+	return l_test_run();
+}
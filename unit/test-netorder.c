@@ -0,0 +1,288 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <ell/ell.h>
+
+#include "src/netorder.h"
+
+#define REMOVED_MAX	128
+#define SIGNAL_DELTA	500
+
+static void collect_changed(const char *path, int16_t signal,
+					const char *after, void *user_data)
+{
+	struct l_hashmap *changed = user_data;
+
+	assert(l_hashmap_insert(changed, path, l_strdup(after)));
+}
+
+static struct l_hashmap *get_changed(struct netorder *order, uint64_t since)
+{
+	struct l_hashmap *changed = l_hashmap_string_new();
+
+	netorder_foreach_changed(order, since, collect_changed, changed);
+
+	return changed;
+}
+
+static void check_changed(struct l_hashmap *changed, const char *path,
+							const char *after)
+{
+	const char *value = l_hashmap_lookup(changed, path);
+
+	assert(value);
+	assert(!strcmp(value, after));
+}
+
+static void collect_removed(const char *path, void *user_data)
+{
+	struct l_queue *removed = user_data;
+
+	l_queue_push_tail(removed, l_strdup(path));
+}
+
+static struct l_queue *get_removed(struct netorder *order, uint64_t since)
+{
+	struct l_queue *removed = l_queue_new();
+
+	netorder_foreach_removed(order, since, collect_removed, removed);
+
+	return removed;
+}
+
+static bool match_path(const void *a, const void *b)
+{
+	return !strcmp(a, b);
+}
+
+static void update(struct netorder *order, const char **paths,
+				const int16_t *signals, unsigned int n)
+{
+	unsigned int i;
+
+	netorder_begin(order);
+
+	for (i = 0; i < n; i++)
+		netorder_add(order, paths[i], signals[i]);
+}
+
+static void test_add(const void *data)
+{
+	struct netorder *order = netorder_new(REMOVED_MAX, SIGNAL_DELTA);
+	const char *paths[] = { "/a", "/b" };
+	const int16_t signals[] = { -5000, -6000 };
+	struct l_hashmap *changed;
+	struct l_queue *removed;
+
+	assert(netorder_get_generation(order) == 0);
+	assert(netorder_is_full(order, 0));
+
+	changed = get_changed(order, 0);
+	assert(l_hashmap_isempty(changed));
+	l_hashmap_destroy(changed, l_free);
+
+	update(order, paths, signals, 2);
+	assert(netorder_commit(order));
+	assert(netorder_get_generation(order) == 1);
+
+	changed = get_changed(order, 0);
+	assert(l_hashmap_size(changed) == 2);
+	check_changed(changed, "/a", "/");
+	check_changed(changed, "/b", "/a");
+	l_hashmap_destroy(changed, l_free);
+
+	removed = get_removed(order, 0);
+	assert(l_queue_isempty(removed));
+	l_queue_destroy(removed, l_free);
+
+	/* The same list again doesn't start a new generation */
+	update(order, paths, signals, 2);
+	assert(!netorder_commit(order));
+	assert(netorder_get_generation(order) == 1);
+	assert(!netorder_is_full(order, 1));
+
+	changed = get_changed(order, 1);
+	assert(l_hashmap_isempty(changed));
+	l_hashmap_destroy(changed, l_free);
+
+	netorder_free(order);
+}
+
+static void test_reorder(const void *data)
+{
+	struct netorder *order = netorder_new(REMOVED_MAX, SIGNAL_DELTA);
+	const char *paths[] = { "/a", "/b", "/c" };
+	const char *moved[] = { "/a", "/c", "/b" };
+	int16_t signals[] = { -5000, -6000, -7000 };
+	struct l_hashmap *changed;
+
+	update(order, paths, signals, 3);
+	assert(netorder_commit(order));
+
+	/* Only the moved network and its new follower are reported */
+	update(order, moved, signals, 3);
+	assert(netorder_commit(order));
+	assert(netorder_get_generation(order) == 2);
+
+	changed = get_changed(order, 1);
+	assert(l_hashmap_size(changed) == 2);
+	check_changed(changed, "/c", "/a");
+	check_changed(changed, "/b", "/c");
+	l_hashmap_destroy(changed, l_free);
+
+	/* Signal changes below the delta are ignored */
+	signals[1] += SIGNAL_DELTA - 1;
+	update(order, moved, signals, 3);
+	assert(!netorder_commit(order));
+
+	signals[1] += 1;
+	update(order, moved, signals, 3);
+	assert(netorder_commit(order));
+	assert(netorder_get_generation(order) == 3);
+
+	changed = get_changed(order, 2);
+	assert(l_hashmap_size(changed) == 1);
+	check_changed(changed, "/c", "/a");
+	l_hashmap_destroy(changed, l_free);
+
+	/* Catching up from an older generation merges the changes */
+	changed = get_changed(order, 1);
+	assert(l_hashmap_size(changed) == 2);
+	l_hashmap_destroy(changed, l_free);
+
+	netorder_free(order);
+}
+
+static void test_remove(const void *data)
+{
+	struct netorder *order = netorder_new(REMOVED_MAX, SIGNAL_DELTA);
+	const char *paths[] = { "/a", "/b" };
+	const int16_t signals[] = { -5000, -6000 };
+	struct l_hashmap *changed;
+	struct l_queue *removed;
+
+	update(order, paths, signals, 2);
+	assert(netorder_commit(order));
+
+	update(order, paths, signals, 1);
+	assert(netorder_commit(order));
+	assert(netorder_get_generation(order) == 2);
+
+	changed = get_changed(order, 1);
+	assert(l_hashmap_isempty(changed));
+	l_hashmap_destroy(changed, l_free);
+
+	removed = get_removed(order, 1);
+	assert(l_queue_length(removed) == 1);
+	assert(l_queue_find(removed, match_path, "/b"));
+	l_queue_destroy(removed, l_free);
+
+	removed = get_removed(order, 2);
+	assert(l_queue_isempty(removed));
+	l_queue_destroy(removed, l_free);
+
+	/* A snapshot only holds the networks still in the list */
+	assert(netorder_is_full(order, 0));
+
+	changed = get_changed(order, 0);
+	assert(l_hashmap_size(changed) == 1);
+	check_changed(changed, "/a", "/");
+	l_hashmap_destroy(changed, l_free);
+
+	/* Added back, the network is both removed and changed since 1 */
+	update(order, paths, signals, 2);
+	assert(netorder_commit(order));
+
+	changed = get_changed(order, 2);
+	assert(l_hashmap_size(changed) == 1);
+	check_changed(changed, "/b", "/a");
+	l_hashmap_destroy(changed, l_free);
+
+	removed = get_removed(order, 1);
+	assert(l_queue_length(removed) == 1);
+	l_queue_destroy(removed, l_free);
+
+	netorder_free(order);
+}
+
+static void test_removed_overflow(const void *data)
+{
+	struct netorder *order = netorder_new(REMOVED_MAX, SIGNAL_DELTA);
+	char *paths[REMOVED_MAX + 2];
+	int16_t signals[REMOVED_MAX + 2];
+	struct l_queue *removed;
+	unsigned int n = L_ARRAY_SIZE(paths);
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		paths[i] = l_strdup_printf("/net%u", i);
+		signals[i] = -5000;
+	}
+
+	update(order, (const char **) paths, signals, n);
+	assert(netorder_commit(order));
+
+	/* Remove one network per generation, the last one stays */
+	for (i = 1; i < n; i++) {
+		update(order, (const char **) paths, signals, n - i);
+		assert(netorder_commit(order));
+		assert(netorder_get_generation(order) == i + 1);
+	}
+
+	/* The first removal was forgotten, generation 1 needs a snapshot */
+	assert(netorder_is_full(order, 1));
+	assert(!netorder_is_full(order, 2));
+
+	removed = get_removed(order, 2);
+	assert(l_queue_length(removed) == REMOVED_MAX);
+	assert(!l_queue_find(removed, match_path, paths[n - 1]));
+	assert(l_queue_find(removed, match_path, paths[n - 2]));
+	assert(l_queue_find(removed, match_path, paths[1]));
+	l_queue_destroy(removed, l_free);
+
+	/* Generations not handed out yet also need a snapshot */
+	assert(netorder_is_full(order, n + 1));
+
+	for (i = 0; i < n; i++)
+		l_free(paths[i]);
+
+	netorder_free(order);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/netorder/Add", test_add, NULL);
+	l_test_add("/netorder/Reorder", test_reorder, NULL);
+	l_test_add("/netorder/Remove", test_remove, NULL);
+	l_test_add("/netorder/Removed overflow", test_removed_overflow, NULL);
+
+	return l_test_run();
+}
@@ -0,0 +1,286 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include <linux/if_packet.h>
+#include <ell/ell.h>
+
+#include "linux/nl80211.h"
+#include "monitor/nlmon.h"
+#include "monitor/pcap.h"
+
+#ifndef ARPHRD_NETLINK
+#define ARPHRD_NETLINK	824
+#endif
+
+#define NL80211_TEST_ID		0x1c
+#define NL80211_TEST_SEQ	7
+#define NL80211_TEST_PID	1000
+#define NL80211_TEST_IFINDEX	3
+
+struct test_msg {
+	uint8_t buf[256];
+	uint32_t len;
+};
+
+static void msg_init(struct test_msg *msg, uint16_t type, uint16_t flags,
+						uint32_t seq, uint32_t pid)
+{
+	struct nlmsghdr *nlmsg = (struct nlmsghdr *) msg->buf;
+
+	memset(msg, 0, sizeof(*msg));
+
+	nlmsg->nlmsg_type = type;
+	nlmsg->nlmsg_flags = flags;
+	nlmsg->nlmsg_seq = seq;
+	nlmsg->nlmsg_pid = pid;
+	msg->len = NLMSG_HDRLEN;
+}
+
+static void msg_append(struct test_msg *msg, const void *data, uint32_t len)
+{
+	assert(msg->len + NLMSG_ALIGN(len) <= sizeof(msg->buf));
+
+	memcpy(msg->buf + msg->len, data, len);
+	msg->len += NLMSG_ALIGN(len);
+	((struct nlmsghdr *) msg->buf)->nlmsg_len = msg->len;
+}
+
+static void msg_append_genl(struct test_msg *msg, uint8_t cmd)
+{
+	struct genlmsghdr genlmsg = { .cmd = cmd };
+
+	msg_append(msg, &genlmsg, GENL_HDRLEN);
+}
+
+static void msg_append_attr(struct test_msg *msg, uint16_t type,
+					const void *data, uint16_t len)
+{
+	struct nlattr nla = {
+		.nla_len = NLA_HDRLEN + len,
+		.nla_type = type,
+	};
+	uint8_t buf[64];
+
+	assert(NLA_HDRLEN + len <= sizeof(buf));
+
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, &nla, NLA_HDRLEN);
+	memcpy(buf + NLA_HDRLEN, data, len);
+	msg_append(msg, buf, NLA_HDRLEN + len);
+}
+
+static void write_genl(struct pcap *pcap, unsigned int sec,
+					const struct test_msg *msg)
+{
+	struct timeval tv = { .tv_sec = sec };
+	uint8_t sll_hdr[16];
+
+	memset(sll_hdr, 0, sizeof(sll_hdr));
+	l_put_be16(PACKET_HOST, sll_hdr);
+	l_put_be16(ARPHRD_NETLINK, sll_hdr + 2);
+	l_put_be16(NETLINK_GENERIC, sll_hdr + 14);
+
+	assert(pcap_write(pcap, &tv, sll_hdr, sizeof(sll_hdr),
+							msg->buf, msg->len));
+}
+
+/*
+ * Trace with the nl80211 family announcement followed by a scan
+ * request and its acknowledgement.
+ */
+static char *create_trace(void)
+{
+	char *pathname = l_strdup_printf("/tmp/iwmon-test-%d.pcap",
+								getpid());
+	struct pcap *pcap = pcap_create(pathname);
+	struct test_msg msg;
+	struct nlmsgerr err;
+	uint16_t id = NL80211_TEST_ID;
+	uint32_t ifindex = NL80211_TEST_IFINDEX;
+
+	assert(pcap);
+
+	msg_init(&msg, GENL_ID_CTRL, 0, 0, 0);
+	msg_append_genl(&msg, CTRL_CMD_NEWFAMILY);
+	msg_append_attr(&msg, CTRL_ATTR_FAMILY_ID, &id, sizeof(id));
+	msg_append_attr(&msg, CTRL_ATTR_FAMILY_NAME, NL80211_GENL_NAME,
+					strlen(NL80211_GENL_NAME) + 1);
+	write_genl(pcap, 100, &msg);
+
+	msg_init(&msg, NL80211_TEST_ID, NLM_F_REQUEST | NLM_F_ACK,
+					NL80211_TEST_SEQ, NL80211_TEST_PID);
+	msg_append_genl(&msg, NL80211_CMD_TRIGGER_SCAN);
+	msg_append_attr(&msg, NL80211_ATTR_IFINDEX, &ifindex,
+							sizeof(ifindex));
+	write_genl(pcap, 110, &msg);
+
+	msg_init(&msg, NLMSG_ERROR, 0, NL80211_TEST_SEQ, NL80211_TEST_PID);
+	memset(&err, 0, sizeof(err));
+	msg_append(&msg, &err, sizeof(err));
+	write_genl(pcap, 111, &msg);
+
+	pcap_close(pcap);
+
+	return pathname;
+}
+
+static void check_index(struct pcap_index *index)
+{
+	const struct pcap_index_entry *entry;
+
+	assert(pcap_index_get_count(index) == 3);
+
+	entry = pcap_index_get(index, 0);
+	assert(entry->flags & PCAP_INDEX_FLAG_GENL_CTRL);
+	assert(!(entry->flags & PCAP_INDEX_FLAG_NL80211));
+
+	entry = pcap_index_get(index, 1);
+	assert(entry->flags & PCAP_INDEX_FLAG_NL80211);
+	assert(entry->cmd == NL80211_CMD_TRIGGER_SCAN);
+	assert(entry->ifindex == NL80211_TEST_IFINDEX);
+
+	/* The acknowledgement is indexed under its request */
+	entry = pcap_index_get(index, 2);
+	assert(entry->flags & PCAP_INDEX_FLAG_NL80211);
+	assert(entry->cmd == NL80211_CMD_TRIGGER_SCAN);
+	assert(entry->ifindex == NL80211_TEST_IFINDEX);
+}
+
+static void test_build_index(const void *data)
+{
+	char *pathname = create_trace();
+	char *index_path = l_strdup_printf("%s.idx", pathname);
+	struct pcap *pcap = pcap_open(pathname);
+	struct pcap_index *index;
+	struct timespec times[2] = {
+		{ .tv_sec = 1000, .tv_nsec = 0 },
+		{ .tv_sec = 1000, .tv_nsec = 0 },
+	};
+
+	assert(pcap);
+	assert(pcap_map(pcap, NULL));
+
+	/* The nl80211 family id is learned from the trace itself */
+	index = nlmon_build_index(pcap, 0);
+	assert(index);
+	check_index(index);
+
+	assert(pcap_index_save(index, pcap, index_path));
+	pcap_index_free(index);
+
+	index = pcap_index_load(pcap, index_path);
+	assert(index);
+	check_index(index);
+	pcap_index_free(index);
+
+	pcap_close(pcap);
+
+	/* A file of the same size rewritten in place needs a new index */
+	assert(!utimensat(AT_FDCWD, pathname, times, 0));
+
+	pcap = pcap_open(pathname);
+	assert(pcap);
+	assert(pcap_map(pcap, NULL));
+	assert(!pcap_index_load(pcap, index_path));
+	pcap_close(pcap);
+
+	unlink(index_path);
+	unlink(pathname);
+	l_free(index_path);
+	l_free(pathname);
+}
+
+/*
+ * Reading an indexed trace with --cmd and --since skips the family
+ * announcement, which has to be replayed for the decoder to recognize
+ * the selected nl80211 records.
+ */
+static void test_replay_genl_ctrl(const void *data)
+{
+	char *pathname = create_trace();
+	struct pcap *pcap = pcap_open(pathname);
+	struct pcap_index *index;
+	const struct pcap_index_entry *entry;
+	struct pcap_index_entry selected;
+	struct nlmon *nlmon;
+	struct timeval tv;
+	const uint8_t *record;
+	uint32_t len;
+	size_t offset;
+
+	assert(pcap);
+	assert(pcap_map(pcap, NULL));
+
+	index = nlmon_build_index(pcap, 0);
+	assert(index);
+
+	entry = pcap_index_get(index, 1);
+	offset = entry->offset;
+	assert(pcap_read_at(pcap, &offset, &tv, (const void **) &record,
+								&len, NULL));
+	assert(len >= 16);
+
+	/* Without the announcement the record is not nl80211 */
+	nlmon = nlmon_create(0);
+	memset(&selected, 0, sizeof(selected));
+	nlmon_index_genl(nlmon, &tv, record + 16, len - 16, &selected);
+	assert(!(selected.flags & PCAP_INDEX_FLAG_NL80211));
+	nlmon_destroy(nlmon);
+
+	/* Replay the announcements preceding the selected record */
+	nlmon = nlmon_create(0);
+	nlmon_replay_genl_ctrl(nlmon, pcap, index, 1);
+
+	memset(&selected, 0, sizeof(selected));
+	nlmon_index_genl(nlmon, &tv, record + 16, len - 16, &selected);
+	assert(selected.flags & PCAP_INDEX_FLAG_NL80211);
+	assert(selected.cmd == NL80211_CMD_TRIGGER_SCAN);
+	nlmon_destroy(nlmon);
+
+	pcap_index_free(index);
+	pcap_close(pcap);
+	unlink(pathname);
+	l_free(pathname);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/nlmon/Build index", test_build_index, NULL);
+	l_test_add("/nlmon/Replay family announcements",
+					test_replay_genl_ctrl, NULL);
+
+	return l_test_run();
+}
@@ -0,0 +1,309 @@
+/*
+ *
+ *  Wireless daemon for Linux
+ *
+ *  Copyright (C) 2021  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <ell/ell.h>
+
+#include "src/ie.h"
+#include "src/pmksa.h"
+
+static const uint8_t spa[6] = { 0x02, 0x00, 0x00, 0x00, 0x01, 0x00 };
+static const uint8_t other_spa[6] = { 0x02, 0x00, 0x00, 0x00, 0x01, 0x01 };
+static const uint8_t aa1[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t aa2[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+static const char *ssid = "TestSSID";
+static const char *other_ssid = "OtherSSID";
+
+/* HMAC-SHA1-128(PMK, "PMK Name" || aa2 || spa) */
+static const uint8_t okc_pmkid_sha1[16] = {
+	0xe5, 0x0a, 0x59, 0x24, 0xee, 0xc1, 0x2f, 0x96,
+	0xff, 0x8e, 0x50, 0xd9, 0x17, 0xb3, 0x75, 0x40,
+};
+
+/* HMAC-SHA256-128(PMK, "PMK Name" || aa2 || spa) */
+static const uint8_t okc_pmkid_sha256[16] = {
+	0x91, 0x0a, 0xd5, 0x2a, 0xae, 0x3b, 0x39, 0x15,
+	0xf9, 0xb0, 0x39, 0x9b, 0x8a, 0x56, 0x78, 0x17,
+};
+
+static struct pmksa *test_pmksa_new(const uint8_t *aa, const char *ssid,
+					uint32_t akm, uint64_t expiration)
+{
+	struct pmksa *pmksa = l_new(struct pmksa, 1);
+	unsigned int i;
+
+	pmksa->expiration = expiration;
+	memcpy(pmksa->spa, spa, 6);
+	memcpy(pmksa->aa, aa, 6);
+	memcpy(pmksa->ssid, ssid, strlen(ssid));
+	pmksa->ssid_len = strlen(ssid);
+	pmksa->akm = akm;
+	memset(pmksa->pmkid, aa[5], 16);
+
+	for (i = 0; i < 32; i++)
+		pmksa->pmk[i] = i;
+
+	pmksa->pmk_len = 32;
+
+	return pmksa;
+}
+
+static struct pmksa *test_get(const uint8_t *spa, const uint8_t *aa,
+				const char *ssid, uint32_t akm)
+{
+	return pmksa_cache_get(spa, aa, (const uint8_t *) ssid, strlen(ssid),
+				akm);
+}
+
+static void test_insert_lookup(const void *data)
+{
+	uint64_t expiration = l_time_now() + pmksa_lifetime();
+	struct pmksa *pmksa;
+
+	pmksa_init();
+
+	assert(!pmksa_cache_put(test_pmksa_new(aa1, ssid,
+						IE_RSN_AKM_SUITE_8021X,
+						expiration)));
+
+	/* Each of the SPA, AA, SSID and AKM has to match */
+	assert(!test_get(other_spa, aa1, ssid, IE_RSN_AKM_SUITE_8021X));
+	assert(!test_get(spa, aa2, ssid, IE_RSN_AKM_SUITE_8021X));
+	assert(!test_get(spa, aa1, other_ssid, IE_RSN_AKM_SUITE_8021X));
+	assert(!test_get(spa, aa1, ssid, IE_RSN_AKM_SUITE_SAE_SHA256));
+
+	pmksa = test_get(spa, aa1, ssid, IE_RSN_AKM_SUITE_8021X |
+					IE_RSN_AKM_SUITE_8021X_SHA256);
+	assert(pmksa);
+	assert(!memcmp(pmksa->aa, aa1, 6));
+	assert(pmksa->pmkid[0] == aa1[5]);
+
+	/* The entry is handed over to the caller */
+	assert(!test_get(spa, aa1, ssid, IE_RSN_AKM_SUITE_8021X));
+
+	/* ... and given back once used */
+	assert(!pmksa_cache_put(pmksa));
+	pmksa = test_get(spa, aa1, ssid, IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	pmksa_free(pmksa);
+
+	pmksa_exit();
+}
+
+static void test_replace(const void *data)
+{
+	uint64_t expiration = l_time_now() + pmksa_lifetime();
+	struct pmksa *pmksa;
+
+	pmksa_init();
+
+	pmksa = test_pmksa_new(aa1, ssid, IE_RSN_AKM_SUITE_8021X, expiration);
+	assert(!pmksa_cache_put(pmksa));
+
+	pmksa = test_pmksa_new(aa1, ssid, IE_RSN_AKM_SUITE_8021X,
+							expiration + 1);
+	pmksa->pmkid[0] = 0xff;
+	assert(!pmksa_cache_put(pmksa));
+
+	pmksa = test_get(spa, aa1, ssid, IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	assert(pmksa->pmkid[0] == 0xff);
+	pmksa_free(pmksa);
+
+	assert(!test_get(spa, aa1, ssid, IE_RSN_AKM_SUITE_8021X));
+
+	pmksa_exit();
+}
+
+static void test_expiry(const void *data)
+{
+	uint64_t now = l_time_now();
+	struct pmksa *pmksa;
+
+	pmksa_init();
+
+	assert(!pmksa_cache_put(test_pmksa_new(aa1, ssid,
+						IE_RSN_AKM_SUITE_8021X,
+						now - 1)));
+
+	assert(!test_get(spa, aa1, ssid, IE_RSN_AKM_SUITE_8021X));
+
+	/* Expired entries aren't used for OKC either */
+	assert(!pmksa_cache_get_okc(spa, aa2, (const uint8_t *) ssid,
+					strlen(ssid), IE_RSN_AKM_SUITE_8021X));
+
+	assert(!pmksa_cache_put(test_pmksa_new(aa2, ssid,
+						IE_RSN_AKM_SUITE_8021X,
+						now + pmksa_lifetime())));
+
+	pmksa = test_get(spa, aa2, ssid, IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	pmksa_free(pmksa);
+
+	pmksa_exit();
+}
+
+static void test_cache_size(const void *data)
+{
+	uint64_t expiration = l_time_now() + pmksa_lifetime();
+	uint8_t aa[6] = { 0x02, 0x00, 0x00, 0x00, 0x10, 0x00 };
+	struct pmksa *pmksa;
+	unsigned int i;
+
+	pmksa_init();
+
+	/* One more than the default size, the earliest to expire goes */
+	for (i = 0; i <= 64; i++) {
+		aa[5] = i;
+		assert(!pmksa_cache_put(test_pmksa_new(aa, ssid,
+						IE_RSN_AKM_SUITE_8021X,
+						expiration + i)));
+	}
+
+	aa[5] = 0;
+	assert(!test_get(spa, aa, ssid, IE_RSN_AKM_SUITE_8021X));
+
+	aa[5] = 1;
+	pmksa = test_get(spa, aa, ssid, IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	pmksa_free(pmksa);
+
+	aa[5] = 64;
+	pmksa = test_get(spa, aa, ssid, IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	pmksa_free(pmksa);
+
+	pmksa_exit();
+}
+
+struct okc_test {
+	uint32_t akm;
+	const uint8_t *pmkid;
+};
+
+static const struct okc_test okc_sha1 = {
+	.akm = IE_RSN_AKM_SUITE_8021X,
+	.pmkid = okc_pmkid_sha1,
+};
+
+static const struct okc_test okc_sha256 = {
+	.akm = IE_RSN_AKM_SUITE_8021X_SHA256,
+	.pmkid = okc_pmkid_sha256,
+};
+
+static void test_okc(const void *data)
+{
+	const struct okc_test *test = data;
+	uint64_t expiration = l_time_now() + pmksa_lifetime();
+	struct pmksa *pmksa;
+
+	pmksa_init();
+
+	assert(!pmksa_cache_put(test_pmksa_new(aa1, ssid, test->akm,
+						expiration)));
+
+	assert(!pmksa_cache_get_okc(spa, aa2, (const uint8_t *) other_ssid,
+					strlen(other_ssid), test->akm));
+	assert(!pmksa_cache_get_okc(other_spa, aa2, (const uint8_t *) ssid,
+					strlen(ssid), test->akm));
+
+	/* A PMKSA with one AP of the ESS gives the PMKID for another */
+	pmksa = pmksa_cache_get_okc(spa, aa2, (const uint8_t *) ssid,
+					strlen(ssid), test->akm);
+	assert(pmksa);
+	assert(!memcmp(pmksa->aa, aa2, 6));
+	assert(!memcmp(pmksa->spa, spa, 6));
+	assert(pmksa->akm == test->akm);
+	assert(pmksa->pmk_len == 32 && pmksa->pmk[31] == 31);
+	assert(!memcmp(pmksa->pmkid, test->pmkid, 16));
+	pmksa_free(pmksa);
+
+	/* The cache keeps the original entry */
+	pmksa = test_get(spa, aa1, ssid, test->akm);
+	assert(pmksa);
+	pmksa_free(pmksa);
+
+	pmksa_exit();
+}
+
+static void test_okc_sae(const void *data)
+{
+	uint64_t expiration = l_time_now() + pmksa_lifetime();
+
+	pmksa_init();
+
+	/* SAE PMKs are specific to each AP */
+	assert(!pmksa_cache_put(test_pmksa_new(aa1, ssid,
+						IE_RSN_AKM_SUITE_SAE_SHA256,
+						expiration)));
+	assert(!pmksa_cache_get_okc(spa, aa2, (const uint8_t *) ssid,
+					strlen(ssid),
+					IE_RSN_AKM_SUITE_SAE_SHA256));
+
+	pmksa_exit();
+}
+
+static void test_flush_ssid(const void *data)
+{
+	uint64_t expiration = l_time_now() + pmksa_lifetime();
+	struct pmksa *pmksa;
+
+	pmksa_init();
+
+	assert(!pmksa_cache_put(test_pmksa_new(aa1, ssid,
+						IE_RSN_AKM_SUITE_8021X,
+						expiration)));
+	assert(!pmksa_cache_put(test_pmksa_new(aa2, other_ssid,
+						IE_RSN_AKM_SUITE_8021X,
+						expiration)));
+
+	pmksa_cache_flush_ssid((const uint8_t *) ssid, strlen(ssid));
+
+	assert(!test_get(spa, aa1, ssid, IE_RSN_AKM_SUITE_8021X));
+
+	pmksa = test_get(spa, aa2, other_ssid, IE_RSN_AKM_SUITE_8021X);
+	assert(pmksa);
+	pmksa_free(pmksa);
+
+	pmksa_exit();
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("/PMKSA/Insert and lookup", test_insert_lookup, NULL);
+	l_test_add("/PMKSA/Replace", test_replace, NULL);
+	l_test_add("/PMKSA/Expiry", test_expiry, NULL);
+	l_test_add("/PMKSA/Cache size", test_cache_size, NULL);
+	l_test_add("/PMKSA/OKC SHA1", test_okc, &okc_sha1);
+	l_test_add("/PMKSA/OKC SHA256", test_okc, &okc_sha256);
+	l_test_add("/PMKSA/OKC SAE", test_okc_sae, NULL);
+	l_test_add("/PMKSA/Flush SSID", test_flush_ssid, NULL);
+
+	return l_test_run();
+}